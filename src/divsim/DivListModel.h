@@ -7,13 +7,15 @@
 #include <vector>
 
 /** Helper class for DivListModel. */
-template<bool UseLinkedList, bool UseDivMask>
+template<bool UseLinkedList, bool UseDivMask, bool UseHashIndex = false,
+  bool UseDegreeBuckets = false, bool UseMaskArray = false>
 class DivListModelConfiguration;
 
-template<bool ULL, bool UDM>
+template<bool ULL, bool UDM, bool UHI, bool UDB, bool UMA>
 class DivListModelConfiguration {
 public:
   typedef int Exponent;
+  typedef int Score;
   typedef ::Monomial Monomial;
   typedef Monomial Entry;
 
@@ -31,6 +33,9 @@ public:
 
   static const bool UseLinkedList = ULL;
   static const bool UseDivMask = UDM;
+  static const bool UseHashIndex = UHI;
+  static const bool UseDegreeBuckets = UDB;
+  static const bool UseMaskArray = UMA;
 
   bool getDoAutomaticRebuilds() const {return _useAutomaticRebuild;}
   double getRebuildRatio() const {return _rebuildRatio;}
@@ -53,6 +58,22 @@ public:
     return true;
   }
 
+  /** The score is the total degree. */
+  Score getScore(const Monomial& monomial) const {
+    Score degree = 0;
+    for (size_t var = 0; var < getVarCount(); ++var)
+      degree += monomial[var];
+    return degree;
+  }
+
+  /** Combines the exponents, so equal monomials get equal hashes. */
+  size_t getHash(const Monomial& monomial) const {
+    size_t hash = 0;
+    for (size_t var = 0; var < getVarCount(); ++var)
+      hash = hash * 31 + monomial[var];
+    return hash;
+  }
+
   bool isLessThan(const Monomial& a, const Monomial& b) const {
     for (size_t var = 0; var < getVarCount(); ++var) {
       if (getExponent(a, var) < getExponent(b, var))
@@ -74,14 +95,15 @@ public:
   mutable unsigned long long _expQueryCount;
 };
 
-template<bool UseLinkedList, bool UseDivMask>
+template<bool UseLinkedList, bool UseDivMask, bool UseHashIndex = false,
+  bool UseDegreeBuckets = false, bool UseMaskArray = false>
 class DivListModel;
 
 /** An instantiation of the capabilities of DivList. */
-template<bool ULL, bool UDM>
+template<bool ULL, bool UDM, bool UHI, bool UDB, bool UMA>
 class DivListModel {
  private:
-  typedef DivListModelConfiguration<ULL, UDM> C;
+  typedef DivListModelConfiguration<ULL, UDM, UHI, UDB, UMA> C;
   typedef mathic::DivList<C> Finder;
  public:
   typedef typename Finder::iterator iterator;
@@ -114,7 +136,20 @@ class DivListModel {
     return it == end() ? 0 : &*it;
   }
   const Entry* findDivisor(const Monomial& monomial) const {
-    return const_cast<DivListModel<ULL, UDM>&>(*this).findDivisor(monomial);
+    return const_cast<DivListModel<ULL, UDM, UHI, UDB, UMA>&>(*this).findDivisor(monomial);
+  }
+  Entry* findBestDivisor(const Monomial& monomial) {
+    return _finder.findBestDivisor(monomial);
+  }
+  bool contains(const Monomial& monomial) const {
+    return _finder.contains(monomial);
+  }
+  bool removeElement(const Monomial& monomial) {
+    return _finder.removeElement(monomial);
+  }
+  template<class MO>
+  bool removeMultiples(const Monomial& monomial, MO& out) {
+    return _finder.removeMultiples(monomial, out);
   }
 
   template<class DO>
@@ -152,8 +187,8 @@ class DivListModel {
   const bool _moveDivisorToFront;
 };
 
-template<bool ULL, bool UDM>
-inline void DivListModel<ULL, UDM>::insert(const Entry& entry) {
+template<bool ULL, bool UDM, bool UHI, bool UDB, bool UMA>
+inline void DivListModel<ULL, UDM, UHI, UDB, UMA>::insert(const Entry& entry) {
   if (!_minimizeOnInsert) {
     _finder.insert(entry);
     return;
@@ -168,9 +203,9 @@ inline void DivListModel<ULL, UDM>::insert(const Entry& entry) {
   }
 }
 
-template<bool ULL, bool UDM>
+template<bool ULL, bool UDM, bool UHI, bool UDB, bool UMA>
 template<class MO>
-inline void DivListModel<ULL, UDM>::insert(const Entry& entry, MO& out) {
+inline void DivListModel<ULL, UDM, UHI, UDB, UMA>::insert(const Entry& entry, MO& out) {
   if (!_minimizeOnInsert) {
     _finder.insert(entry);
     return;
@@ -185,8 +220,8 @@ inline void DivListModel<ULL, UDM>::insert(const Entry& entry, MO& out) {
   }
 }
 
-template<bool ULL, bool UDM>
-inline std::string DivListModel<ULL, UDM>::getName() const {
+template<bool ULL, bool UDM, bool UHI, bool UDB, bool UMA>
+inline std::string DivListModel<ULL, UDM, UHI, UDB, UMA>::getName() const {
   return _finder.getName() +
     (_minimizeOnInsert ? " remin" : " nomin") +
     (_moveDivisorToFront ? " toFront" : "");
@@ -0,0 +1,284 @@
+#include "stdinc.h"
+#include "IdealGenerators.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <set>
+
+namespace {
+  typedef std::vector<int> Exponents;
+  typedef std::vector<Exponents> Generators;
+
+  bool divides(const Exponents& a, const Exponents& b) {
+    for (size_t var = 0; var < a.size(); ++var)
+      if (a[var] > b[var])
+        return false;
+    return true;
+  }
+
+  /** Appends monomial to generators if no generator divides it and it
+      does not divide any generator, so that generators stays minimal.
+      Returns true if monomial was appended. */
+  bool addIfMinimal(const Exponents& monomial, Generators& generators) {
+    for (size_t i = 0; i < generators.size(); ++i)
+      if (divides(generators[i], monomial) ||
+        divides(monomial, generators[i]))
+        return false;
+    generators.push_back(monomial);
+    return true;
+  }
+
+  /** Returns the number of monomials of total degree degree in varCount
+      variables, or limit if that is less. */
+  size_t countOfDegree(size_t varCount, size_t degree, size_t limit) {
+    // the count is (varCount - 1 + degree) choose degree.
+    double count = 1;
+    for (size_t i = 1; i <= degree; ++i) {
+      count = count * (varCount - 1 + i) / i;
+      if (count >= limit)
+        return limit;
+    }
+    return static_cast<size_t>(count + 0.5);
+  }
+
+  /** Returns the least degree with at least count monomials. There is
+      only one monomial of each degree in one variable, so then this
+      returns 1. */
+  size_t degreeWithCount(size_t varCount, size_t count) {
+    if (varCount < 2)
+      return 1;
+    size_t degree = 1;
+    while (countOfDegree(varCount, degree, count) < count)
+      ++degree;
+    return degree;
+  }
+
+  /** Appends the monomials of total degree degree in the variables var,
+      var + 1, ... to out in descending lex order, until out has limit
+      elements. prefix holds the exponents of the variables before var. */
+  void makeLexSegment(size_t var, size_t degree, Exponents& prefix,
+    size_t limit, Generators& out) {
+    if (var + 1 == prefix.size()) {
+      prefix[var] = static_cast<int>(degree);
+      out.push_back(prefix);
+      return;
+    }
+    for (size_t e = degree + 1; e > 0 && out.size() < limit; --e) {
+      prefix[var] = static_cast<int>(e - 1);
+      makeLexSegment(var + 1, degree - (e - 1), prefix, limit, out);
+    }
+    prefix[var] = 0;
+  }
+
+  void makeRandomOfDegree(size_t degree, Exponents& monomial) {
+    std::fill(monomial.begin(), monomial.end(), 0);
+    for (size_t i = 0; i < degree; ++i)
+      ++monomial[rand() % monomial.size()];
+  }
+
+  void makeGeneric(size_t varCount, size_t size, Generators& generators) {
+    // each variable gets a random order of the exponents 1 to
+    // candidateCount, and half the exponents are zero. Many candidates
+    // are multiples of others, so there are more candidates than size.
+    const size_t candidateCount = 10 * size;
+    std::vector<Exponents> exponents(varCount);
+    for (size_t var = 0; var < varCount; ++var) {
+      for (size_t e = 1; e <= candidateCount; ++e)
+        exponents[var].push_back(static_cast<int>(e));
+      std::random_shuffle(exponents[var].begin(), exponents[var].end());
+    }
+    Exponents monomial(varCount);
+    for (size_t i = 0; i < candidateCount && generators.size() < size; ++i) {
+      bool isOne = true;
+      for (size_t var = 0; var < varCount; ++var) {
+        monomial[var] = rand() % 2 == 0 ? 0 : exponents[var][i];
+        isOne = isOne && monomial[var] == 0;
+      }
+      if (!isOne)
+        addIfMinimal(monomial, generators);
+    }
+  }
+
+  /** Returns true if every monomial that a Borel move of one unit from
+      a variable to the variable before it takes monomial to is in set. */
+  bool hasBorelPredecessors
+  (const Exponents& monomial, const std::set<Exponents>& set) {
+    Exponents predecessor(monomial);
+    for (size_t var = 1; var < monomial.size(); ++var) {
+      if (monomial[var] == 0)
+        continue;
+      --predecessor[var];
+      ++predecessor[var - 1];
+      if (set.find(predecessor) == set.end())
+        return false;
+      ++predecessor[var];
+      --predecessor[var - 1];
+    }
+    return true;
+  }
+
+  void makeBorel(size_t varCount, size_t size, Generators& generators) {
+    // Borel moves from x_j to x_i for i < j are made of moves from one
+    // variable to the one before it. So a set of monomials of one degree
+    // is strongly stable if it is built up from x_0^degree by adding
+    // monomials whose predecessors under such moves are in the set. That
+    // makes a random strongly stable set of exactly size monomials. There
+    // are a few times more monomials of the degree than size, so that
+    // the set is not all of them.
+    const size_t degree = degreeWithCount(varCount, 4 * size);
+    std::set<Exponents> borel;
+    std::vector<Exponents> candidates(1, Exponents(varCount));
+    candidates.back()[0] = static_cast<int>(degree);
+    while (borel.size() < size && !candidates.empty()) {
+      const size_t index = rand() % candidates.size();
+      Exponents monomial = candidates[index];
+      candidates[index] = candidates.back();
+      candidates.pop_back();
+      borel.insert(monomial);
+      for (size_t var = 1; var < varCount; ++var) {
+        if (monomial[var - 1] == 0)
+          continue;
+        --monomial[var - 1];
+        ++monomial[var];
+        // each monomial becomes a candidate when its last predecessor is
+        // added, which only happens once.
+        if (hasBorelPredecessors(monomial, borel))
+          candidates.push_back(monomial);
+        ++monomial[var - 1];
+        --monomial[var];
+      }
+    }
+    generators.assign(borel.begin(), borel.end());
+  }
+
+  void makeLex(size_t varCount, size_t size, Generators& generators) {
+    const size_t degree = degreeWithCount(varCount, size);
+    Exponents prefix(varCount);
+    makeLexSegment(0, degree, prefix, size, generators);
+  }
+
+  void makeSquarefree(size_t varCount, size_t size, Generators& generators) {
+    const size_t maxDegree = std::min<size_t>(4, varCount);
+    Exponents monomial(varCount);
+    for (size_t tries = 0; generators.size() < size && tries < 100 * size;
+      ++tries) {
+      const size_t degree =
+        maxDegree < 2 ? 1 : 2 + rand() % (maxDegree - 1);
+      std::fill(monomial.begin(), monomial.end(), 0);
+      for (size_t i = 0; i < degree; ++i)
+        monomial[rand() % varCount] = 1;
+      addIfMinimal(monomial, generators);
+    }
+  }
+
+  /** Sets monomial to a random monomial in the variables
+      [varsBegin, varsEnd) whose degree is degree when each variable var
+      has degree weights[var]. Returns false if this did not find one. */
+  bool makeRandomOfWeightedDegree(const std::vector<int>& weights,
+    const size_t* varsBegin, const size_t* varsEnd, int degree,
+    Exponents& monomial) {
+    std::fill(monomial.begin(), monomial.end(), 0);
+    const size_t varCount = varsEnd - varsBegin;
+    for (size_t step = 0; degree > 0 && step < 100; ++step) {
+      const size_t var = varsBegin[rand() % varCount];
+      if (weights[var] <= degree) {
+        ++monomial[var];
+        degree -= weights[var];
+      }
+    }
+    return degree == 0;
+  }
+
+  void makeToric(size_t varCount, size_t size, Generators& generators) {
+    const int minWeightedDegree = 12;
+    std::vector<int> weights(varCount);
+    for (size_t var = 0; var < varCount; ++var)
+      weights[var] = 1 + rand() % 4;
+    std::vector<size_t> vars(varCount);
+    for (size_t var = 0; var < varCount; ++var)
+      vars[var] = var;
+
+    // u and v are on disjoint halves of the variables, so there must be
+    // at least one variable in each half.
+    if (varCount < 2)
+      return;
+    const size_t* const begin = &vars.front();
+    const size_t* const middle = begin + varCount / 2;
+    const size_t* const end = begin + varCount;
+    Exponents u(varCount);
+    Exponents v(varCount);
+    for (size_t tries = 0; generators.size() < size && tries < 100 * size;
+      ++tries) {
+      std::random_shuffle(vars.begin(), vars.end());
+      const int degree = minWeightedDegree + rand() % minWeightedDegree;
+      if (!makeRandomOfWeightedDegree(weights, begin, middle, degree, u) ||
+        !makeRandomOfWeightedDegree(weights, middle, end, degree, v))
+        continue;
+      // std::vector compares lexicographically, which is lex order.
+      addIfMinimal(u > v ? u : v, generators);
+    }
+  }
+
+  void makeSparse(size_t varCount, size_t size, Generators& generators) {
+    const size_t maxSupport = std::min<size_t>(3, varCount);
+    Exponents monomial(varCount);
+    for (size_t tries = 0; generators.size() < size && tries < 100 * size;
+      ++tries) {
+      std::fill(monomial.begin(), monomial.end(), 0);
+      const size_t support = 1 + rand() % maxSupport;
+      for (size_t i = 0; i < support; ++i)
+        monomial[rand() % varCount] = 1 + rand() % 10000;
+      addIfMinimal(monomial, generators);
+    }
+  }
+
+  struct KindName {
+    IdealKind kind;
+    const char* name;
+  };
+
+  const KindName kindNames[] = {
+    {GenericIdeal, "generic"},
+    {BorelIdeal, "borel"},
+    {LexIdeal, "lex"},
+    {SquarefreeIdeal, "squarefree"},
+    {ToricIdeal, "toric"},
+    {SparseIdeal, "sparse"}
+  };
+  const size_t kindCount = sizeof(kindNames) / sizeof(kindNames[0]);
+}
+
+bool getIdealKind(const std::string& name, IdealKind& kind) {
+  for (size_t i = 0; i < kindCount; ++i) {
+    if (name == kindNames[i].name) {
+      kind = kindNames[i].kind;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* getIdealKindName(IdealKind kind) {
+  for (size_t i = 0; i < kindCount; ++i)
+    if (kind == kindNames[i].kind)
+      return kindNames[i].name;
+  ASSERT(false);
+  return "";
+}
+
+void makeIdeal(IdealKind kind, size_t varCount, size_t size,
+  std::vector<std::vector<int> >& generators) {
+  ASSERT(varCount > 0);
+  generators.clear();
+  if (size == 0)
+    return;
+  switch (kind) {
+  case GenericIdeal: makeGeneric(varCount, size, generators); break;
+  case BorelIdeal: makeBorel(varCount, size, generators); break;
+  case LexIdeal: makeLex(varCount, size, generators); break;
+  case SquarefreeIdeal: makeSquarefree(varCount, size, generators); break;
+  case ToricIdeal: makeToric(varCount, size, generators); break;
+  case SparseIdeal: makeSparse(varCount, size, generators); break;
+  }
+  std::random_shuffle(generators.begin(), generators.end());
+}
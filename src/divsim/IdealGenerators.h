@@ -0,0 +1,50 @@
+#ifndef IDEAL_GENERATORS_GUARD
+#define IDEAL_GENERATORS_GUARD
+
+#include <vector>
+#include <string>
+
+/** Families of monomial ideals with structure that random exponents do
+    not have, so that the divisor finders can be compared on the kinds of
+    input that they see in practice. */
+enum IdealKind {
+  /** Generic ideals: no two generators have the same non-zero exponent
+      of any variable. */
+  GenericIdeal,
+  /** Strongly stable ideals, also called Borel-fixed in characteristic
+      zero: if x_j m is a generator then so is x_i m for every i < j.
+      Generic initial ideals have this form. The generators here all
+      have the same degree. */
+  BorelIdeal,
+  /** Lex-segment ideals: the largest monomials of one degree in lex
+      order. */
+  LexIdeal,
+  /** Squarefree ideals, which are the Stanley-Reisner ideals of the
+      simplicial complex of the faces that are not generators. */
+  SquarefreeIdeal,
+  /** Toric-style ideals: the lex lead terms of random binomials
+      x^u - x^v in a toric ideal. u and v have disjoint supports and the
+      same degree for a random positive grading of the variables. The
+      generators are lead terms of elements of the ideal, not of a
+      Groebner basis of it. */
+  ToricIdeal,
+  /** High-degree sparse ideals: each generator has exponents up to
+      10,000 in at most 3 variables. */
+  SparseIdeal
+};
+
+/** Sets kind to the kind called name, which is generic, borel, lex,
+    squarefree, toric or sparse. Returns false if there is no such kind. */
+bool getIdealKind(const std::string& name, IdealKind& kind);
+
+/** Returns the name of kind that getIdealKind understands. */
+const char* getIdealKindName(IdealKind kind);
+
+/** Sets generators to the minimal generators of an ideal of the given
+    kind in varCount variables. There are about size generators, though
+    there can be fewer if the kind has fewer monomials than that in
+    varCount variables. The generators are in random order. */
+void makeIdeal(IdealKind kind, size_t varCount, size_t size,
+  std::vector<std::vector<int> >& generators);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include "Monomial.h"
 #include "mathic/KDTree.h"
+#include "mathic/ShardedDivFinder.h"
 #include <string>
 #include <vector>
 
@@ -11,14 +12,24 @@ template<
   bool UseTreeDivMask,
   bool PackedTree,
   size_t LeafSize,
-  bool AllowRemovals>
+  bool AllowRemovals,
+  bool UsePartialRebuilds = false,
+  bool UseScoreBounds = false,
+  size_t CompactExponentBits = 0,
+  bool UseHashIndex = false,
+  size_t ShardCount = 1,
+  bool ShardByHash = false,
+  bool UseTombstones = false,
+  bool UseAutoTuning = false>
 class KDTreeModelConfiguration;
 
 /** Helper class for KDTreeModel. */
-template<bool UDM, bool UTDM, bool PT, size_t LS, bool AR>
+template<bool UDM, bool UTDM, bool PT, size_t LS, bool AR, bool UPR, bool USB,
+  size_t CEB, bool UHI, size_t SC, bool SBH, bool UT, bool UAT>
 class KDTreeModelConfiguration {
  public:
   typedef int Exponent;
+  typedef int Score;
   typedef ::Monomial Monomial;
   typedef Monomial Entry;
 
@@ -64,7 +75,24 @@ class KDTreeModelConfiguration {
     return false;
   }
 
+  /** The score is the total degree. */
+  Score getScore(const Monomial& monomial) const {
+    Score degree = 0;
+    for (size_t var = 0; var < getVarCount(); ++var)
+      degree += monomial[var];
+    return degree;
+  }
+
+  /** Combines the exponents, so equal monomials get equal hashes. */
+  size_t getHash(const Monomial& monomial) const {
+    size_t hash = 0;
+    for (size_t var = 0; var < getVarCount(); ++var)
+      hash = hash * 31 + monomial[var];
+    return hash;
+  }
+
   size_t getLeafSize() const {return LeafSize;}
+  size_t getShardCount() const {return SC;}
   bool getUseDivisorCache() const {return _useDivisorCache;}
   bool getDoAutomaticRebuilds() const {return _useAutomaticRebuild;}
   double getRebuildRatio() const {return _rebuildRatio;}
@@ -75,6 +103,14 @@ class KDTreeModelConfiguration {
   static const bool PackedTree = PT;
   static const size_t LeafSize = LS;
   static const bool AllowRemovals = AR;
+  static const bool UsePartialRebuilds = UPR;
+  static const bool UseScoreBounds = USB;
+  static const size_t CompactExponentBits = CEB;
+  static const size_t CompactVarCount = 16;
+  static const bool UseHashIndex = UHI;
+  static const bool ShardByHash = SBH;
+  static const bool UseTombstones = UT;
+  static const bool UseAutoTuning = UAT;
 
   unsigned long long getExpQueryCount() const {return _expQueryCount;}
 
@@ -88,19 +124,41 @@ class KDTreeModelConfiguration {
   mutable unsigned long long _expQueryCount;
 };
 
-/** An instantiation of the capabilities of KDTree. */
+/** Helper class for KDTreeModel. Selects ShardedDivFinder if there is
+    more than one shard. */
+template<class C, bool Sharded>
+struct KDTreeModelFinder {
+  typedef mathic::KDTree<C> Finder;
+};
+template<class C>
+struct KDTreeModelFinder<C, true> {
+  typedef mathic::ShardedDivFinder<C> Finder;
+};
+
+/** An instantiation of the capabilities of KDTree, or of
+    ShardedDivFinder if ShardCount is greater than 1. */
 template<
   bool UseDivMask,
   bool UseTreeDivMask,
   bool PackedTree,
   size_t LeafSize,
-  bool AllowRemovals
+  bool AllowRemovals,
+  bool UsePartialRebuilds = false,
+  bool UseScoreBounds = false,
+  size_t CompactExponentBits = 0,
+  bool UseHashIndex = false,
+  size_t ShardCount = 1,
+  bool ShardByHash = false,
+  bool UseTombstones = false,
+  bool UseAutoTuning = false
 >
 class KDTreeModel {
  private:
-  typedef KDTreeModelConfiguration
-    <UseDivMask, UseTreeDivMask, PackedTree, LeafSize, AllowRemovals> C;
-  typedef mathic::KDTree<C> Finder;
+  typedef KDTreeModelConfiguration<UseDivMask, UseTreeDivMask,
+    PackedTree, LeafSize, AllowRemovals, UsePartialRebuilds, UseScoreBounds,
+    CompactExponentBits, UseHashIndex, ShardCount, ShardByHash,
+    UseTombstones, UseAutoTuning> C;
+  typedef typename KDTreeModelFinder<C, (ShardCount > 1)>::Finder Finder;
  public:
   typedef typename Finder::Monomial Monomial;
   typedef typename Finder::Entry Entry;
@@ -127,6 +185,19 @@ class KDTreeModel {
   const Entry* findDivisor(const Monomial& monomial) const {
     return _finder.findDivisor(monomial);
   }
+  Entry* findBestDivisor(const Monomial& monomial) {
+    return _finder.findBestDivisor(monomial);
+  }
+  bool contains(const Monomial& monomial) const {
+    return _finder.contains(monomial);
+  }
+  bool removeElement(const Monomial& monomial) {
+    return _finder.removeElement(monomial);
+  }
+  template<class MO>
+  bool removeMultiples(const Monomial& monomial, MO& out) {
+    return _finder.removeMultiples(monomial, out);
+  }
   std::string getName() const;
 
   template<class DO>
@@ -158,8 +229,10 @@ class KDTreeModel {
   bool _minimizeOnInsert;
 };
 
-template<bool UDM, bool UTDM, bool PT, size_t LS, bool AR>
-inline void KDTreeModel<UDM, UTDM, PT, LS, AR>::insert(const Entry& entry) {
+template<bool UDM, bool UTDM, bool PT, size_t LS, bool AR, bool UPR, bool USB,
+  size_t CEB, bool UHI, size_t SC, bool SBH, bool UT, bool UAT>
+inline void KDTreeModel<UDM, UTDM, PT, LS, AR, UPR, USB, CEB, UHI, SC, SBH, UT, UAT>::
+insert(const Entry& entry) {
   if (!_minimizeOnInsert) {
     _finder.insert(entry);
     return;
@@ -170,9 +243,10 @@ inline void KDTreeModel<UDM, UTDM, PT, LS, AR>::insert(const Entry& entry) {
   _finder.insert(entry);
 }
 
-template<bool UDM, bool UTDM, bool PT, size_t LS, bool AR>
+template<bool UDM, bool UTDM, bool PT, size_t LS, bool AR, bool UPR, bool USB,
+  size_t CEB, bool UHI, size_t SC, bool SBH, bool UT, bool UAT>
 template<class MultipleOutput>
-inline void KDTreeModel<UDM, UTDM, PT, LS, AR>::
+inline void KDTreeModel<UDM, UTDM, PT, LS, AR, UPR, USB, CEB, UHI, SC, SBH, UT, UAT>::
 insert(const Entry& entry, MultipleOutput& removed) {
   if (!_minimizeOnInsert) {
     _finder.insert(entry);
@@ -184,8 +258,10 @@ insert(const Entry& entry, MultipleOutput& removed) {
   _finder.insert(entry);
 }
 
-template<bool UDM, bool UTDM, bool PT, size_t LS, bool AR>
-inline std::string KDTreeModel<UDM, UTDM, PT, LS, AR>::getName() const {
+template<bool UDM, bool UTDM, bool PT, size_t LS, bool AR, bool UPR, bool USB,
+  size_t CEB, bool UHI, size_t SC, bool SBH, bool UT, bool UAT>
+inline std::string KDTreeModel<UDM, UTDM, PT, LS, AR, UPR, USB, CEB, UHI, SC, SBH, UT, UAT>::
+getName() const {
   return _finder.getName() +
     (_minimizeOnInsert ? " remin" : " nomin");
 }
@@ -0,0 +1,114 @@
+#include "stdinc.h"
+#include "MinimizeSimulation.h"
+
+#include "mathic/ColumnPrinter.h"
+#include <algorithm>
+
+namespace {
+  // Appends all the monomials of total degree degree in the variables
+  // var, var + 1, ... to out. prefix holds the exponents of the
+  // variables before var.
+  void makeAllOfDegree(
+    size_t var,
+    size_t degree,
+    std::vector<int>& prefix,
+    std::vector<std::vector<int> >& out
+  ) {
+    if (var + 1 == prefix.size()) {
+      prefix[var] = static_cast<int>(degree);
+      out.push_back(prefix);
+      return;
+    }
+    for (size_t e = 0; e <= degree; ++e) {
+      prefix[var] = static_cast<int>(e);
+      makeAllOfDegree(var + 1, degree - e, prefix, out);
+    }
+  }
+}
+
+void MinimizeSimulation::makeRandom
+  (size_t varCount, size_t generatorCount, int maxExponent) {
+  srand(0);
+  _varCount = varCount;
+  _minimalCount = 0;
+  _generators.resize(generatorCount);
+  for (size_t i = 0; i < generatorCount; ++i) {
+    _generators[i].resize(varCount);
+    for (size_t var = 0; var < varCount; ++var)
+      _generators[i][var] = rand() % maxExponent;
+  }
+}
+
+void MinimizeSimulation::makeStructured
+  (size_t varCount, size_t degree, size_t multipleCount) {
+  ASSERT(varCount > 0);
+  srand(0);
+  _varCount = varCount;
+  _minimalCount = 0;
+  _generators.clear();
+  std::vector<int> prefix(varCount);
+  makeAllOfDegree(0, degree, prefix, _generators);
+
+  const size_t minimalCount = _generators.size();
+  for (size_t i = 0; i < multipleCount; ++i) {
+    std::vector<int> multiple(_generators[rand() % minimalCount]);
+    for (size_t var = 0; var < varCount; ++var)
+      multiple[var] += rand() % 3;
+    multiple[rand() % varCount] += 1;
+    _generators.push_back(multiple);
+  }
+  std::random_shuffle(_generators.begin(), _generators.end());
+}
+
+void MinimizeSimulation::printData(std::ostream& out) const {
+  std::vector<SimData> sorted(_data);
+  std::sort(sorted.begin(), sorted.end());
+  out << "*** Minimization of " << _generators.size() << " generators in "
+      << _varCount << " variables with " << _minimalCount
+      << " minimal generators, " << _repeats << " repeats ***" << std::endl;
+  mic::ColumnPrinter pr;
+  pr.addColumn(true);
+  pr.addColumn(false, " ", "ms");
+  for (std::vector<SimData>::const_iterator it = sorted.begin();
+    it != sorted.end(); ++it) {
+    pr[0] << it->_name << '\n';
+    pr[1] << mic::ColumnPrinter::commafy(it->_mseconds) << '\n';
+  }
+  pr.print(out);
+}
+
+void MinimizeSimulation::makeEntries(std::vector<Monomial>& entries) {
+  entries.clear();
+  for (size_t i = 0; i < _generators.size(); ++i)
+    entries.push_back(Monomial(_generators[i]));
+}
+
+void MinimizeSimulation::checkMinimalCount
+  (size_t count, const std::string& name) {
+  if (_minimalCount == 0)
+    _minimalCount = count;
+  else if (_minimalCount != count) {
+    std::cerr << "Minimization \"" << name <<
+      "\" found incorrect number of minimal generators." << std::endl;
+    std::exit(1);
+  }
+}
+
+void MinimizeSimulation::addData
+  (const std::string& name, const mic::Timer& timer) {
+  SimData data;
+  data._mseconds = (unsigned long)timer.getMilliseconds();
+  data._name = name;
+  _data.push_back(data);
+  if (_printPartialData)
+    data.print(std::cerr);
+}
+
+void MinimizeSimulation::SimData::print(std::ostream& out) {
+  out << _name
+    << " " << mic::ColumnPrinter::commafy(_mseconds) << " ms" << '\n';
+}
+
+bool MinimizeSimulation::SimData::operator<(const SimData& sd) const {
+  return _mseconds < sd._mseconds;
+}
@@ -0,0 +1,113 @@
+#ifndef MINIMIZE_SIMULATION_GUARD
+#define MINIMIZE_SIMULATION_GUARD
+
+#include "Monomial.h"
+#include "mathic/Minimize.h"
+#include "mathic/Timer.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iostream>
+#include <cstdlib>
+
+/** Times computing the minimal generators of a monomial ideal, both
+    through mathic::minimize and through inserting the generators one at
+    a time into a divisor finder that removes multiples as it goes. */
+class MinimizeSimulation {
+ public:
+  MinimizeSimulation(size_t repeats, bool printPartialData):
+    _repeats(repeats),
+    _printPartialData(printPartialData),
+    _varCount(0),
+    _minimalCount(0) {}
+
+  /** Uses generatorCount generators with each exponent chosen uniformly
+      at random from [0, maxExponent). */
+  void makeRandom(size_t varCount, size_t generatorCount, int maxExponent);
+
+  /** Uses all the monomials of total degree degree in varCount variables
+      along with multipleCount random multiples of those, so that the
+      minimal generators are exactly the monomials of degree degree. */
+  void makeStructured(size_t varCount, size_t degree, size_t multipleCount);
+
+  /** Times mathic::minimize using Finder with chunkCount chunks. */
+  template<class Finder>
+  void runBulk(const typename Finder::Configuration& conf, size_t chunkCount);
+
+  /** Times minimizing by calling findDivisor, removeMultiples and insert
+      on Finder for each generator. Finder must allow removals. */
+  template<class Finder>
+  void runIncremental(const typename Finder::Configuration& conf);
+
+  size_t getVarCount() const {return _varCount;}
+
+  void printData(std::ostream& out) const;
+
+ private:
+  struct SimData {
+    bool operator<(const SimData& sd) const;
+    void print(std::ostream& out);
+
+    std::string _name;
+    unsigned long _mseconds;
+  };
+
+  void makeEntries(std::vector<Monomial>& entries);
+  void checkMinimalCount(size_t count, const std::string& name);
+  void addData(const std::string& name, const mic::Timer& timer);
+
+  std::vector<std::vector<int> > _generators;
+  std::vector<SimData> _data;
+  size_t _repeats;
+  bool _printPartialData;
+  size_t _varCount;
+  size_t _minimalCount; // 0 if not yet known
+};
+
+template<class Finder>
+void MinimizeSimulation::runBulk(
+  const typename Finder::Configuration& conf,
+  size_t chunkCount
+) {
+  std::vector<Monomial> entries;
+  size_t minimalCount = 0;
+  mic::Timer timer;
+  for (size_t step = 0; step < _repeats; ++step) {
+    makeEntries(entries);
+    std::vector<Monomial>::iterator newEnd =
+      mathic::minimize<Finder>(entries.begin(), entries.end(), conf, chunkCount);
+    minimalCount = std::distance(entries.begin(), newEnd);
+  }
+
+  std::ostringstream name;
+  name << Finder(conf).getName() << " bulk chunks=" << chunkCount;
+  addData(name.str(), timer);
+  checkMinimalCount(minimalCount, name.str());
+}
+
+template<class Finder>
+void MinimizeSimulation::runIncremental(
+  const typename Finder::Configuration& conf
+) {
+  std::vector<Monomial> entries;
+  size_t minimalCount = 0;
+  std::string name;
+  mic::Timer timer;
+  for (size_t step = 0; step < _repeats; ++step) {
+    makeEntries(entries);
+    Finder finder(conf);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      if (finder.findDivisor(entries[i]) != 0)
+        continue;
+      finder.removeMultiples(entries[i]);
+      finder.insert(entries[i]);
+    }
+    minimalCount = finder.size();
+    name = finder.getName() + " incremental";
+  }
+
+  addData(name, timer);
+  checkMinimalCount(minimalCount, name);
+}
+
+#endif
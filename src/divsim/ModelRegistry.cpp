@@ -0,0 +1,131 @@
+#include "stdinc.h"
+#include "ModelRegistry.h"
+
+#include "DivListModel.h"
+#include "KDTreeModel.h"
+#include "Simulation.h"
+
+namespace {
+  /** Runs Model with the given constructor parameters. The second and
+      third parameters are sortOnInsert and useDivisorCache for
+      KDTreeModel and moveDivisorToFront and sortOnInsert for
+      DivListModel. A double cannot be a template parameter, so the
+      rebuild ratio is given in percent. */
+  template<class Model, bool MinimizeOnInsert, bool Param2, bool Param3,
+    unsigned int RebuildPercent, size_t MinRebuild>
+  class Runner : public ModelRunner {
+  public:
+    virtual void run(Simulation& sim) {
+      sim.run<Model>(MinimizeOnInsert, Param2, Param3,
+        RebuildPercent / 100.0, MinRebuild);
+    }
+
+    virtual void runThreads
+      (Simulation& sim, const mathic::ThreadScalingOptions& options) {
+      sim.runThreads<Model>(options, MinimizeOnInsert, Param2, Param3,
+        RebuildPercent / 100.0, MinRebuild);
+    }
+  };
+
+  /** The parameters of most runs of a KDTreeModel. */
+  template<class Model>
+  class KDRunner : public Runner<Model, 0, 0, 0, 100, 1000> {};
+
+  /** The parameters of most runs of a DivListModel. */
+  template<class Model>
+  class ListRunner : public Runner<Model, 0, 0, 0, 50, 500> {};
+
+  template<class Runner>
+  void add(ModelRegistry& registry, const char* name) {
+    mathic::nameFactoryRegister<Runner>(registry, name);
+  }
+}
+
+void registerModels(ModelRegistry& registry) {
+  // packed trees with div masks, leaves of 8 and removals unless noted.
+  add<KDRunner<KDTreeModel<1,1,1,8,1> > >(registry, "kdtree");
+  add<KDRunner<KDTreeModel<1,1,0,8,1> > >(registry, "kdtree-binary");
+  add<KDRunner<KDTreeModel<1,0,1,8,1> > >(registry, "kdtree-notreemask");
+  add<Runner<KDTreeModel<0,0,1,8,1>,0,0,0,0,0> >(registry, "kdtree-nomask");
+  add<KDRunner<KDTreeModel<1,1,1,1,1> > >(registry, "kdtree-leaf1");
+  add<KDRunner<KDTreeModel<1,1,1,1,0> > >(registry, "kdtree-leaf1-noremove");
+  add<KDRunner<KDTreeModel<1,1,1,1,1,1> > >
+    (registry, "kdtree-leaf1-partial");
+  add<KDRunner<KDTreeModel<1,1,1,8,1,1> > >(registry, "kdtree-partial");
+  add<KDRunner<KDTreeModel<1,1,1,8,1,0,0,16> > >
+    (registry, "kdtree-compact16");
+  add<KDRunner<KDTreeModel<1,1,1,8,1,0,0,8> > >(registry, "kdtree-compact8");
+  add<KDRunner<KDTreeModel<1,1,1,8,1,0,0,0,1> > >
+    (registry, "kdtree-hashindex");
+  add<KDRunner<KDTreeModel<1,1,1,8,1,0,0,0,0,1,0,1> > >
+    (registry, "kdtree-tombstones");
+  add<KDRunner<KDTreeModel<1,1,1,8,1,0,0,0,0,4> > >
+    (registry, "kdtree-shards4");
+  add<KDRunner<KDTreeModel<1,1,1,8,1,0,0,0,0,4,1> > >
+    (registry, "kdtree-shards4-byhash");
+  add<KDRunner<KDTreeModel<1,1,1,8,1,0,0,0,0,1,0,0,1> > >
+    (registry, "kdtree-tuned");
+  add<Runner<KDTreeModel<0,0,1,2,1>,1,0,0,0,0> >
+    (registry, "kdtree-nomask-leaf2-min");
+  add<Runner<KDTreeModel<0,0,0,2,1>,1,0,0,0,0> >
+    (registry, "kdtree-nomask-binary-leaf2-min");
+
+  add<Runner<DivListModel<0,0>,0,0,0,0,0> >(registry, "divlist-nomask");
+  add<Runner<DivListModel<0,0>,1,1,0,50,500> >
+    (registry, "divlist-nomask-front-min");
+  add<ListRunner<DivListModel<0,1> > >(registry, "divlist");
+  add<ListRunner<DivListModel<1,1> > >(registry, "divlist-linked");
+  add<ListRunner<DivListModel<0,1,1> > >(registry, "divlist-hashindex");
+  add<ListRunner<DivListModel<0,1,0,1> > >(registry, "divlist-degree");
+  add<ListRunner<DivListModel<0,1,0,0,1> > >(registry, "divlist-maskarray");
+}
+
+namespace {
+  template<size_t Size>
+  void pushBack
+    (const char* const (&toAdd)[Size], std::vector<std::string>& names) {
+    names.insert(names.end(), toAdd, toAdd + Size);
+  }
+}
+
+void pushBackDefaultModels
+  (const ModelRegistry& registry, std::vector<std::string>& names) {
+#ifdef DEBUG
+  std::vector<std::string> all;
+  registry.namesWithPrefix("", all);
+  const std::string minSuffix = "-min";
+  for (size_t i = 0; i < all.size(); ++i) {
+    const std::string& name = all[i];
+    if (name.size() < minSuffix.size() ||
+      name.compare(name.size() - minSuffix.size(), minSuffix.size(),
+        minSuffix) != 0)
+      names.push_back(name);
+  }
+#else
+  const char* const defaults[] = {
+    "kdtree-leaf1", "kdtree-leaf1-noremove", "kdtree-leaf1-partial",
+    "kdtree-compact16", "kdtree-compact8", "kdtree", "kdtree-tombstones",
+    "kdtree-shards4", "kdtree-shards4-byhash", "kdtree-tuned"
+  };
+  pushBack(defaults, names);
+#endif
+}
+
+void pushBackDefaultTraceModels(std::vector<std::string>& names) {
+  const char* const defaults[] = {
+    "kdtree", "kdtree-binary", "kdtree-notreemask", "kdtree-nomask",
+    "kdtree-partial", "kdtree-compact16", "kdtree-hashindex",
+    "kdtree-tombstones", "kdtree-shards4", "kdtree-tuned", "divlist-nomask",
+    "divlist", "divlist-linked", "divlist-hashindex", "divlist-degree",
+    "divlist-maskarray"
+  };
+  pushBack(defaults, names);
+}
+
+void pushBackChosenModels(const ModelRegistry& registry,
+  const std::string& list, std::vector<std::string>& names) {
+  if (list == "all")
+    registry.namesWithPrefix("", names);
+  else
+    mathic::uniqueNamesWithPrefixes(registry, list, names);
+}
@@ -0,0 +1,52 @@
+#ifndef DIV_MODEL_REGISTRY_GUARD
+#define DIV_MODEL_REGISTRY_GUARD
+
+#include "mathic/NameFactory.h"
+#include <string>
+#include <vector>
+
+class Simulation;
+namespace mathic {
+  struct ThreadScalingOptions;
+}
+
+/** Runs one of the divisor finder models that divsim is compiled with,
+    along with the run time parameters of that model. Models are
+    template instantiations, so a ModelRegistry has a runner for each of
+    them so that they can be chosen by name on the command line. */
+class ModelRunner {
+public:
+  virtual ~ModelRunner() {}
+  virtual void run(Simulation& sim) = 0;
+  virtual void runThreads
+    (Simulation& sim, const mathic::ThreadScalingOptions& options) = 0;
+};
+
+typedef mathic::NameFactory<ModelRunner> ModelRegistry;
+
+/** Registers every model under a short name such as kdtree-tombstones.
+    Models whose name ends in -min minimize on insert. A debug build
+    checks the states of every model against those of the first model
+    of a simulation, so models that minimize and models that do not
+    cannot be run together in a debug build. */
+void registerModels(ModelRegistry& registry);
+
+/** Appends the names of the models that divsim runs on a generated
+    workload if none are chosen. A debug build runs every model that does
+    not minimize on insert. */
+void pushBackDefaultModels
+  (const ModelRegistry& registry, std::vector<std::string>& names);
+
+/** Appends the names of the models that divsim runs on a trace if none
+    are chosen. These all allow removals and none minimize on insert, as
+    is required to replay a trace. */
+void pushBackDefaultTraceModels(std::vector<std::string>& names);
+
+/** Appends the names of the models chosen by the comma separated list
+    of name prefixes, or every model if the list is "all". Throws
+    mathic::UnknownNameException or mathic::AmbiguousNameException if a
+    prefix does not choose exactly one model. */
+void pushBackChosenModels(const ModelRegistry& registry,
+  const std::string& list, std::vector<std::string>& names);
+
+#endif
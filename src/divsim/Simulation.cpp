@@ -2,8 +2,10 @@
 #include "Simulation.h"
 
 #include "mathic/ColumnPrinter.h"
+#include "mathic/DivTrace.h"
 #include <cstdlib>
 #include <algorithm>
+#include <sstream>
 
 namespace {
   void makeRandom(std::vector<int>& monomial) {
@@ -16,6 +18,10 @@ void Simulation::makeStandard
   (size_t varCount, size_t inserts, size_t queries, bool findAll) {
   srand(0);
 
+  std::ostringstream type;
+  type << "standard " << varCount << ' ' << inserts << ' ' << queries
+    << (findAll ? " all" : " one");
+  _simType = type.str();
   _findAll = findAll;
   _varCount = varCount;
   _events.clear();
@@ -27,12 +33,106 @@ void Simulation::makeStandard
     Event event;
     event._monomial.resize(varCount);
     makeRandom(event._monomial);
+    event._removedCount = 0;
     event._type = (i <= inserts ? InsertUnknown : QueryUnknown);
     _events.push_back(event);
   }
 }
 
+void Simulation::makeStructured(IdealKind kind,
+  size_t varCount, size_t size, size_t queries, bool findAll) {
+  srand(0);
+
+  std::vector<std::vector<int> > generators;
+  makeIdeal(kind, varCount, size, generators);
+  std::ostringstream type;
+  type << getIdealKindName(kind) << ' ' << varCount << ' ' << size << ' '
+    << queries << (findAll ? " all" : " one");
+  _simType = type.str();
+  _findAll = findAll;
+  _varCount = varCount;
+  _events.clear();
+  if (generators.empty())
+    return;
+
+  Event event;
+  event._removedCount = 0;
+  event._type = InsertUnknown;
+  for (size_t i = 0; i < generators.size(); ++i) {
+    event._monomial = generators[i];
+    _events.push_back(event);
+  }
+
+  event._type = QueryUnknown;
+  for (size_t i = 0; i < queries; ++i) {
+    event._monomial = generators[rand() % generators.size()];
+    std::vector<int>& monomial = event._monomial;
+    if (rand() % 2 == 0) {
+      // lower the first positive exponent from a random variable on.
+      const size_t start = rand() % varCount;
+      for (size_t i = 0; i < varCount; ++i) {
+        const size_t var = (start + i) % varCount;
+        if (monomial[var] > 0) {
+          monomial[var] = rand() % monomial[var];
+          break;
+        }
+      }
+    }
+    for (size_t raise = 0; raise < 2; ++raise)
+      monomial[rand() % varCount] += rand() % 3;
+    _events.push_back(event);
+  }
+}
+
+void Simulation::makeFromTrace(const std::string& fileName) {
+  mathic::DivTraceReader reader(fileName);
+  _simType = "trace " + fileName;
+  _findAll = false;
+  _varCount = reader.getVarCount();
+  _events.clear();
+  mathic::DivTraceEvent traceEvent;
+  while (reader.next(traceEvent)) {
+    Event event;
+    event._monomial.assign
+      (traceEvent.exponents.begin(), traceEvent.exponents.end());
+    event._removedCount = traceEvent.removedCount;
+    switch (traceEvent.type) {
+    case mathic::DivTraceEvent::Insert: event._type = InsertUnknown; break;
+    case mathic::DivTraceEvent::QueryHasDivisor:
+      event._type = QueryHasDivisor; break;
+    case mathic::DivTraceEvent::QueryNoDivisor:
+      event._type = QueryNoDivisor; break;
+    case mathic::DivTraceEvent::RemoveMultiples:
+      event._type = RemoveMultiples; break;
+    case mathic::DivTraceEvent::RemoveElement:
+      event._type = RemoveElement; break;
+    }
+    _events.push_back(event);
+  }
+}
+
+const size_t Simulation::LatencySampleInterval;
+
+void Simulation::addToReport(mathic::BenchmarkReport& report) const {
+  for (std::vector<SimData>::const_iterator it = _data.begin();
+    it != _data.end(); ++it) {
+    mathic::BenchmarkResult result;
+    result.workload = _simType;
+    result.model = it->_name;
+    result.setRunNanos(it->_runNanos);
+    result.comparisons = it->_expQueryCount;
+    result.operations = it->_operationCount;
+    result.perf = it->_perf;
+    report.add(result);
+  }
+  _scaling.addToReport(report, _simType);
+}
+
 void Simulation::printData(std::ostream& out) const {
+  if (!_scaling.empty())
+    _scaling.print(out);
+  if (_data.empty())
+    return;
   std::vector<SimData> sorted(_data);
   std::sort(sorted.begin(), sorted.end());
   out << "*** Simulation outcome for "
@@ -41,11 +141,40 @@ void Simulation::printData(std::ostream& out) const {
   pr.addColumn(true);
   pr.addColumn(false, " ", "ms");
   pr.addColumn(false, " ", "eqs");
+  pr.addColumn(false, " ", "op/s");
+  pr.addColumn(false, " ", "eqs/op");
+  std::vector<size_t> counters; // the perf counters that have a column
+  for (size_t i = 0; i < mathic::PerfCounts::CounterCount; ++i) {
+    for (size_t sim = 0; sim < sorted.size(); ++sim) {
+      if (sorted[sim]._perf.available[i]) {
+        counters.push_back(i);
+        pr.addColumn(false, " ", std::string(mathic::PerfCounts::getName
+          (static_cast<mathic::PerfCounts::Counter>(i))) + "/op");
+        break;
+      }
+    }
+  }
+  pr.addColumn(true, " insert ");
+  pr.addColumn(true, " query ");
   for (std::vector<SimData>::const_iterator it = sorted.begin();
     it != sorted.end(); ++it) {
     pr[0] << it->_name << '\n';
     pr[1] << mic::ColumnPrinter::commafy(it->_mseconds) << '\n';
     pr[2] << mic::ColumnPrinter::commafy(it->_expQueryCount) << '\n';
+    pr[3] << mic::ColumnPrinter::commafy(it->getOperationsPerSecond()) << '\n';
+    pr[4] << mic::ColumnPrinter::ratio(it->_expQueryCount, it->_operationCount)
+      << '\n';
+    size_t column = 5;
+    for (size_t i = 0; i < counters.size(); ++i, ++column) {
+      if (it->_perf.available[counters[i]])
+        pr[column] << mic::ColumnPrinter::ratio
+          (it->_perf.values[counters[i]], it->_operationCount);
+      pr[column] << '\n';
+    }
+    it->_insertLatency.print(pr[column]);
+    pr[column] << '\n';
+    it->_queryLatency.print(pr[column + 1]);
+    pr[column + 1] << '\n';
   }
   pr.print(out);
 }
@@ -54,7 +183,37 @@ void Simulation::SimData::print(std::ostream& out) {
   out << _name
     << " " << mic::ColumnPrinter::commafy(_mseconds) << " ms"
     << " " << mic::ColumnPrinter::commafy(_expQueryCount) << " eqs"
-    << '\n';
+    << " " << mic::ColumnPrinter::commafy(getOperationsPerSecond()) << " op/s"
+    << "\n  insert ";
+  _insertLatency.print(out);
+  out << "\n  query ";
+  _queryLatency.print(out);
+  if (_perf.anyAvailable()) {
+    out << "\n  ";
+    _perf.print(out, _operationCount);
+  }
+  out << '\n';
+}
+
+unsigned long long Simulation::SimData::getOperationsPerSecond() const {
+  if (_nseconds == 0)
+    return 0;
+  return static_cast<unsigned long long>(_operationCount * 1e9 / _nseconds);
+}
+
+void Simulation::SimData::merge(const SimData& sd) {
+  ASSERT(_name == sd._name);
+  _nseconds += sd._nseconds;
+  _mseconds = static_cast<unsigned long>(_nseconds / 1000000);
+  _expQueryCount += sd._expQueryCount;
+  _operationCount += sd._operationCount;
+  _insertLatency.merge(sd._insertLatency);
+  _queryLatency.merge(sd._queryLatency);
+  for (size_t i = 0; i < mathic::PerfCounts::CounterCount; ++i) {
+    _perf.available[i] = _perf.available[i] && sd._perf.available[i];
+    _perf.values[i] += sd._perf.values[i];
+  }
+  _runNanos.insert(_runNanos.end(), sd._runNanos.begin(), sd._runNanos.end());
 }
 
 bool Simulation::SimData::operator<(const SimData& sd) const {
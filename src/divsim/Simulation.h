@@ -2,19 +2,45 @@
 #define SIMULATION_GUARD
 
 #include "Monomial.h"
+#include "IdealGenerators.h"
 #include "mathic/Timer.h"
+#include "mathic/LatencyHistogram.h"
+#include "mathic/PerfCounters.h"
+#include "mathic/BenchmarkReport.h"
+#include "mathic/ThreadScaling.h"
 #include <vector>
+#include <string>
 #include <iostream>
 #include <cstdlib>
 #include <algorithm>
+#include <memory>
 
 class Simulation {
  public:
-  Simulation(size_t repeats, bool printPartialData):
-   _repeats(repeats), _printPartialData(printPartialData), _simType("none") {}
+  /** Each model is run runs times, each time on a new object, and
+      each run goes through the events repeats times. The runs are the
+      timings that BenchmarkReport computes confidence intervals from. */
+  Simulation(size_t repeats, bool printPartialData, size_t runs = 1):
+   _repeats(repeats), _runs(runs), _printPartialData(printPartialData),
+   _simType("none") {}
 
   void makeStandard(size_t varCount, size_t inserts, size_t queries, bool findAll);
 
+  /** Inserts the minimal generators of an ideal of the given kind with
+      about size generators, see makeIdeal. Then does queries queries
+      close to the boundary of the ideal. Half of them are multiples of
+      a random generator. The other half lower an exponent of a random
+      generator and raise a few others, so they may or may not have a
+      divisor. */
+  void makeStructured(IdealKind kind, size_t varCount, size_t size,
+    size_t queries, bool findAll);
+
+  /** Reads the events of a trace written by mathic::DivTraceWriter. The
+      divisor queries and removals of every finder that is run are
+      checked against the answers recorded in the trace. Finders must
+      allow removals if the trace has any. */
+  void makeFromTrace(const std::string& fileName);
+
   template<class DivFinder>
   void run();
   template<class DivFinder, class Param1>
@@ -33,20 +59,52 @@ class Simulation {
   void run(const P1& p1, const P2& p2, const P3& param3, const P4& param4,
     const P5& p5, const P6& p6);
 
+  /** Runs the events on each number of threads in options at once to
+      see how DivFinder scales. Each thread runs all the events on its own
+      DivFinder that it constructs itself from the parameters, unless
+      options.shared is true. Then the threads split the events between
+      them and run them on a single DivFinder behind a mutex. The answers
+      are not checked, as a shared finder does not see the events in
+      order. */
+  template<class DivFinder, class P1, class P2, class P3, class P4, class P5>
+  void runThreads(const mathic::ThreadScalingOptions& options,
+    const P1& p1, const P2& p2, const P3& p3, const P4& p4, const P5& p5);
+
   void printData(std::ostream& out) const;
 
+  /** Adds the outcome of each model to report. */
+  void addToReport(mathic::BenchmarkReport& report) const;
+
+  /** The wall clock time of every LatencySampleInterval'th insert and
+      query is recorded in a latency histogram. Hardware performance
+      counters are recorded for each run where they are available. */
+  static const size_t LatencySampleInterval = 16;
+
  private:
   struct SimData {
+    SimData(): _operationCount(0) {}
+
+    unsigned long long getOperationsPerSecond() const;
+    /** Adds another run of the same model to this one. */
+    void merge(const SimData& sd);
     bool operator<(const SimData& sd) const;
     void print(std::ostream& out);
 
     std::string _name;
     unsigned long _mseconds;
+    unsigned long long _nseconds;
     unsigned long long _expQueryCount;
+    unsigned long long _operationCount; /// inserts, queries and removals
+    mathic::LatencyHistogram _insertLatency;
+    mathic::LatencyHistogram _queryLatency;
+    mathic::PerfCounts _perf;
+    std::vector<unsigned long long> _runNanos; /// the time of each run
   };
 
+  /** Runs the events on finder. runIndex is 0 for the first run of a
+      model and counts up from there for the following runs. */
   template<class DivFinder>
-  void run(DivFinder& finder);
+  void run(DivFinder& finder, size_t runIndex);
 
   enum EventType {
     InsertUnknown,
@@ -55,12 +113,15 @@ class Simulation {
     QueryHasDivisor,
     QueryUnknown,
     StateUnknown,
-    StateKnown
+    StateKnown,
+    RemoveMultiples,
+    RemoveElement
   };
   struct Event {
     EventType _type;
     std::vector<int> _monomial;
     std::vector<const Monomial::Exponent*> _state;
+    size_t _removedCount; /// for RemoveMultiples and RemoveElement
 #ifdef DEBUG
     std::vector<Monomial> _allMonomials;
 #else
@@ -69,52 +130,80 @@ class Simulation {
   };
   class MonomialStore;
 
+  template<class DivFinder, class P1, class P2, class P3, class P4, class P5>
+  class ScalingWork;
+
+  /** Runs the events of number thread out of threadCount on finder
+      _repeats times. If mutex is not null then finder is shared and each
+      event is run with mutex locked. Returns the number of operations. */
+  template<class DivFinder>
+  unsigned long long runThread(DivFinder& finder, mathic::Mutex* mutex,
+    size_t thread, size_t threadCount) const;
+
+  template<class DivFinder>
+  void runThreadEvent(DivFinder& finder, const Event& e) const;
+
   bool _findAll;
   std::vector<Event> _events;
   std::vector<SimData> _data;
   size_t _varCount;
   size_t _repeats;
+  size_t _runs;
   bool _printPartialData;
   std::string _simType;
+  mathic::PerfCounters _perf;
+  mathic::ThreadScaling _scaling;
 };
 
 template<class DivFinder>
 void Simulation::run() {
-  DivFinder finder(_varCount);
-  run(finder);
+  for (size_t i = 0; i < _runs; ++i) {
+    DivFinder finder(_varCount);
+    run(finder, i);
+  }
 }
 
 template<class DivFinder, class Param1>
 void Simulation::run(const Param1& param1) {
-  DivFinder finder(_varCount, param1);
-  run(finder);
+  for (size_t i = 0; i < _runs; ++i) {
+    DivFinder finder(_varCount, param1);
+    run(finder, i);
+  }
 }
 
 template<class DivFinder, class Param1, class Param2>
 void Simulation::run(const Param1& param1, const Param2& param2) {
-  DivFinder finder(_varCount, param1, param2);
-  run(finder);
+  for (size_t i = 0; i < _runs; ++i) {
+    DivFinder finder(_varCount, param1, param2);
+    run(finder, i);
+  }
 }
 
 template<class DivFinder, class Param1, class Param2, class Param3>
 void Simulation::run
 (const Param1& param1, const Param2& param2, const Param3& param3) {
-  DivFinder finder(_varCount, param1, param2, param3);
-  run(finder);
+  for (size_t i = 0; i < _runs; ++i) {
+    DivFinder finder(_varCount, param1, param2, param3);
+    run(finder, i);
+  }
 }
 
 template<class DivFinder, class P1, class P2, class P3, class P4>
 void Simulation::run
 (const P1& param1, const P2& param2, const P3& param3, const P4& param4) {
-  DivFinder finder(_varCount, param1, param2, param3, param4);
-  run(finder);
+  for (size_t i = 0; i < _runs; ++i) {
+    DivFinder finder(_varCount, param1, param2, param3, param4);
+    run(finder, i);
+  }
 }
 
 template<class DivFinder, class P1, class P2, class P3, class P4, class P5>
 void Simulation::run
 (const P1& p1, const P2& p2, const P3& p3, const P4& p4, const P5& p5) {
-  DivFinder finder(_varCount, p1, p2, p3, p4, p5);
-  run(finder);
+  for (size_t i = 0; i < _runs; ++i) {
+    DivFinder finder(_varCount, p1, p2, p3, p4, p5);
+    run(finder, i);
+  }
 }
 
 template<class DivFinder, class P1, class P2, class P3, class P4,
@@ -122,8 +211,10 @@ class P5, class P6>
 void Simulation::run
 (const P1& p1, const P2& p2, const P3& p3, const P4& p4, const P5& p5,
 const P6& p6) {
-  DivFinder finder(_varCount, p1, p2, p3, p4, p5, p6);
-  run(finder);
+  for (size_t i = 0; i < _runs; ++i) {
+    DivFinder finder(_varCount, p1, p2, p3, p4, p5, p6);
+    run(finder, i);
+  }
 }
 
 class Simulation::MonomialStore {
@@ -234,22 +325,52 @@ private:
   std::vector<const Monomial::Exponent*>& _entries;
 };
 
+struct DivisorCounter {
+public:
+  DivisorCounter(): _count(0) {}
+  bool proceed(const Monomial& m) {
+    ++_count;
+    return true;
+  }
+  size_t getCount() const {return _count;}
+
+private:
+  size_t _count;
+};
+
+struct RemovedCounter {
+public:
+  RemovedCounter(): _count(0) {}
+  void push_back(const Monomial& m) {++_count;}
+  size_t getCount() const {return _count;}
+
+private:
+  size_t _count;
+};
+
 template<class DivFinder>
-void Simulation::run(DivFinder& finder) {
-  mic::Timer timer;
+void Simulation::run(DivFinder& finder, size_t runIndex) {
+  SimData data;
+  mic::WallTimer timer;
   std::vector<Monomial> divisors;
   std::vector<const Monomial::Exponent*> tmp;
+  _perf.start();
   for (size_t step = 0; step < _repeats; ++step) {
     for (size_t i = 0; i < _events.size(); ++i) {
       Event& e = _events[i];
+      const bool sample = e._type != StateUnknown && e._type != StateKnown &&
+        ++data._operationCount % LatencySampleInterval == 0;
       if (e._type == InsertKnown || e._type == InsertUnknown) {
         divisors.clear();
         MonomialStore store;
-        if (0) {
-          // here to make sure it compiles, also easy to switch to checking this instead.
-          finder.insert(e._monomial);
-        } else
-          finder.insert(e._monomial, store);
+        {
+          mathic::LatencyHistogram::Timing timing(data._insertLatency, sample);
+          if (0) {
+            // here to make sure it compiles, also easy to switch to checking this instead.
+            finder.insert(e._monomial);
+          } else
+            finder.insert(e._monomial, store);
+        }
         store.checkInsert(e, finder);
       } else if (e._type == StateUnknown || e._type == StateKnown) {
         tmp.clear();
@@ -264,8 +385,26 @@ void Simulation::run(DivFinder& finder) {
             std::exit(1);
           }
         }
+      } else if (e._type == RemoveMultiples || e._type == RemoveElement) {
+        size_t removedCount;
+        if (e._type == RemoveMultiples) {
+          RemovedCounter counter;
+          finder.removeMultiples(e._monomial, counter);
+          removedCount = counter.getCount();
+        } else
+          removedCount = finder.removeElement(e._monomial) ? 1 : 0;
+        if (removedCount != e._removedCount) {
+          std::cerr << "Divisor finder \"" << finder.getName()
+                    << "\" removed " << removedCount << " entries instead of "
+                    << e._removedCount << '.' << std::endl;
+          std::exit(1);
+        }
       } else if (!_findAll) {
-        typename DivFinder::Entry* entry = finder.findDivisor(e._monomial);
+        typename DivFinder::Entry* entry;
+        {
+          mathic::LatencyHistogram::Timing timing(data._queryLatency, sample);
+          entry = finder.findDivisor(e._monomial);
+        }
         if (entry == 0) {
           if (e._type == QueryHasDivisor) {
             std::cerr << "Divisor finder \"" << finder.getName()
@@ -290,21 +429,125 @@ void Simulation::run(DivFinder& finder) {
         ASSERT(_findAll);
         divisors.clear();
         MonomialStore store;
-        const_cast<const DivFinder&>(finder) // to test const interface
-          .findAllDivisors(e._monomial, store);
+        {
+          mathic::LatencyHistogram::Timing timing(data._queryLatency, sample);
+          const_cast<const DivFinder&>(finder) // to test const interface
+            .findAllDivisors(e._monomial, store);
+        }
         store.checkQuery(e, finder);
       }
     }
   }
 
-  SimData data;
-  data._mseconds = (unsigned long)timer.getMilliseconds();
+  data._nseconds = timer.getNanoseconds();
+  data._runNanos.push_back(data._nseconds);
+  data._perf = _perf.stop();
+  data._mseconds = static_cast<unsigned long>(data._nseconds / 1000000);
   data._name = finder.getName();
   data._expQueryCount = finder.getExpQueryCount();
-  _data.push_back(data);
-  if (_printPartialData)
-    data.print(std::cerr);
+  if (runIndex == 0)
+    _data.push_back(data);
+  else
+    _data.back().merge(data);
+  if (_printPartialData && runIndex + 1 == _runs)
+    _data.back().print(std::cerr);
   std::cout << finder.size() << std::endl;
 }
 
+template<class DivFinder, class P1, class P2, class P3, class P4, class P5>
+class Simulation::ScalingWork : public mathic::ScalingWork {
+public:
+  ScalingWork(const Simulation& sim, bool shared,
+    const P1& p1, const P2& p2, const P3& p3, const P4& p4, const P5& p5):
+    _sim(sim), _shared(shared), _finder(0),
+    _p1(p1), _p2(p2), _p3(p3), _p4(p4), _p5(p5) {}
+  ~ScalingWork() {delete _finder;}
+
+  virtual std::string getName() const {
+    std::auto_ptr<DivFinder> finder(makeFinder());
+    return finder->getName() + (_shared ? " shared" : "");
+  }
+
+  virtual void prepare(size_t threadCount) {
+    if (_shared)
+      _finder = makeFinder();
+  }
+
+  virtual unsigned long long run(size_t thread, size_t threadCount) {
+    if (_shared)
+      return _sim.runThread(*_finder, &_mutex, thread, threadCount);
+    std::auto_ptr<DivFinder> finder(makeFinder());
+    return _sim.runThread(*finder, 0, 0, 1);
+  }
+
+  virtual void finish() {
+    delete _finder;
+    _finder = 0;
+  }
+
+private:
+  DivFinder* makeFinder() const {
+    return new DivFinder(_sim._varCount, _p1, _p2, _p3, _p4, _p5);
+  }
+
+  const Simulation& _sim;
+  const bool _shared;
+  DivFinder* _finder; /// the shared finder
+  mathic::Mutex _mutex;
+  const P1 _p1;
+  const P2 _p2;
+  const P3 _p3;
+  const P4 _p4;
+  const P5 _p5;
+};
+
+template<class DivFinder, class P1, class P2, class P3, class P4, class P5>
+void Simulation::runThreads(const mathic::ThreadScalingOptions& options,
+  const P1& p1, const P2& p2, const P3& p3, const P4& p4, const P5& p5) {
+  ScalingWork<DivFinder, P1, P2, P3, P4, P5>
+    work(*this, options.shared, p1, p2, p3, p4, p5);
+  _scaling.run(work, options.threadCounts);
+}
+
+template<class DivFinder>
+unsigned long long Simulation::runThread(DivFinder& finder,
+  mathic::Mutex* mutex, size_t thread, size_t threadCount) const {
+  unsigned long long operations = 0;
+  for (size_t step = 0; step < _repeats; ++step) {
+    for (size_t i = thread; i < _events.size(); i += threadCount) {
+      const Event& e = _events[i];
+      if (e._type == StateUnknown || e._type == StateKnown)
+        continue;
+      ++operations;
+      if (mutex == 0)
+        runThreadEvent(finder, e);
+      else {
+        mathic::Mutex::Lock lock(*mutex);
+        runThreadEvent(finder, e);
+      }
+    }
+  }
+  return operations;
+}
+
+template<class DivFinder>
+void Simulation::runThreadEvent(DivFinder& finder, const Event& e) const {
+  // the finders do not write to the exponents of the monomials, which
+  // all the threads share.
+  std::vector<int>& monomial = const_cast<std::vector<int>&>(e._monomial);
+  if (e._type == InsertKnown || e._type == InsertUnknown)
+    finder.insert(monomial);
+  else if (e._type == RemoveMultiples) {
+    RemovedCounter counter;
+    finder.removeMultiples(monomial, counter);
+  } else if (e._type == RemoveElement)
+    finder.removeElement(monomial);
+  else if (!_findAll)
+    finder.findDivisor(monomial);
+  else {
+    DivisorCounter counter;
+    finder.findAllDivisors(monomial, counter);
+  }
+}
+
 #endif
@@ -2,147 +2,245 @@
 
 #include "DivListModel.h"
 #include "KDTreeModel.h"
+#include "ModelRegistry.h"
 #include "Simulation.h"
+#include "MinimizeSimulation.h"
 #include "mathic/Timer.h"
+#include "mathic/BenchmarkReport.h"
+#include "mathic/Profiler.h"
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+  void runMinimize(MinimizeSimulation& sim) {
+    const size_t varCount = sim.getVarCount();
+    typedef KDTreeModelConfiguration<1,1,1,10,1> KDConf;
+    typedef mathic::KDTree<KDConf> KDFinder;
+    typedef KDTreeModelConfiguration<1,1,1,10,1,0,0,0,0,1,0,1> TombConf;
+    typedef mathic::KDTree<TombConf> TombFinder;
+    typedef DivListModelConfiguration<0,1> ListConf;
+    typedef mathic::DivList<ListConf> ListFinder;
+    typedef DivListModelConfiguration<0,1,0,1> DegreeConf;
+    typedef mathic::DivList<DegreeConf> DegreeFinder;
+    typedef DivListModelConfiguration<0,1,0,0,1> MaskArrayConf;
+    typedef mathic::DivList<MaskArrayConf> MaskArrayFinder;
+    const KDConf kdConf(varCount, false, false, 1.0, 1000);
+    const TombConf tombConf(varCount, false, false, 1.0, 1000);
+    const ListConf listConf(varCount, false, 0.0, 0);
+    const DegreeConf degreeConf(varCount, false, 0.0, 0);
+    const MaskArrayConf maskArrayConf(varCount, false, 0.0, 0);
+
+    sim.runIncremental<KDFinder>(kdConf);
+    sim.runIncremental<TombFinder>(tombConf);
+    sim.runBulk<KDFinder>(kdConf, 1);
+    sim.runBulk<KDFinder>(kdConf, 4);
+    sim.runBulk<KDFinder>(kdConf, 0);
+    sim.runBulk<ListFinder>(listConf, 1);
+    sim.runIncremental<ListFinder>(listConf);
+    sim.runIncremental<DegreeFinder>(degreeConf);
+    sim.runIncremental<MaskArrayFinder>(maskArrayConf);
+    sim.printData(std::cout);
+  }
 
-int main() {
-  const size_t repeats = IF_DEBUG(true ? 1 :) 1;
-  Simulation sim(repeats, true);
-  mic::Timer timer;
-  std::cout << "Generating simulation. ";
-
-    
+  void runMinimizeSimulations() {
+    {
+      MinimizeSimulation sim(1, true);
 #ifdef DEBUG
-  sim.makeStandard(10, 400, 1000, true);
+      sim.makeRandom(6, 500, 20);
 #else
-  sim.makeStandard(10, 5000, 2000000, true);
+      sim.makeRandom(6, 50000, 20);
 #endif
-  timer.print(std::cout);
-  std::cout << std::endl;
+      runMinimize(sim);
+    }
+    {
+      MinimizeSimulation sim(1, true);
+#ifdef DEBUG
+      sim.makeStructured(4, 6, 300);
+#else
+      sim.makeStructured(5, 20, 100000);
+#endif
+      runMinimize(sim);
+    }
+  }
 
-#ifndef DEBUG
-  sim.run<KDTreeModel<1,1,1,1,1> >(0, 0, 0, 1.0, 1000);
-  sim.run<KDTreeModel<1,1,1,1,0> >(0, 0, 0, 1.0, 1000);
-return 0;
+  /** The number of times to run each model if there is a benchmark
+      report, so that it has timings to compute confidence intervals
+      from. */
+  const size_t ReportRuns = 5;
+
+  /** Writes the outcome of sim as requested by options. Also prints the
+      profile if divsim is built with MATHIC_PROFILING defined. Returns
+      the exit code of divsim. */
+  int processReport(const Simulation& sim,
+    const mathic::BenchmarkReportOptions& options) {
+    if (mathic::Profiler::enabled()) {
+      mathic::Profiler::printFlat(std::cerr);
+      mathic::Profiler::printTree(std::cerr);
+    }
+    mathic::BenchmarkReport report;
+    sim.addToReport(report);
+    return options.process(report, std::cout) ? 0 : 1;
+  }
 
-  sim.run<KDTreeModel<0,0,1,2,1> >(1, 0, 0, 0.0, 0); // best tree, no mask
-  sim.run<KDTreeModel<0,0,0,2,1> >(1, 0, 0, 0.0, 0); // best tree, no mask
+  /** Runs the named models from registry on sim, on each number of
+      threads in threadOptions if there are any. */
+  void runModels(Simulation& sim, const ModelRegistry& registry,
+    const std::vector<std::string>& models,
+    const mathic::ThreadScalingOptions& threadOptions) {
+    for (size_t i = 0; i < models.size(); ++i) {
+      if (threadOptions.any())
+        registry.create(models[i])->runThreads(sim, threadOptions);
+      else
+        registry.create(models[i])->run(sim);
+    }
+    std::cout << "\n\n";
+    sim.printData(std::cout);
+  }
 
-  sim.run<KDTreeModel<0,0,1,2,1> >(1, 0, 0, 1.0, 1000); // best tree, mask
-  sim.run<KDTreeModel<0,0,0,2,1> >(1, 0, 0, 1.0, 1000); // best tree, mask
+  size_t toInt(const char* str) {
+    std::istringstream in(str);
+    size_t i;
+    in >> i;
+    return i;
+  }
 
-  sim.run<DivListModel<0, 0> >(1, 1, 0, 0.5, 500);
-  return 0;
-#endif
+  void printUsage(const ModelRegistry& registry) {
+    std::cerr << "usage: [report options] [thread options] [models LIST]\n"
+      "         [var-count inserts queries [all|one]]\n"
+      "       [report options] [thread options] [models LIST] "
+      "trace trace-file\n"
+      "       [report options] [thread options] [models LIST] "
+      "ideal KIND\n"
+      "         var-count size queries [all|one]\n"
+      "KIND is generic, borel, lex, squarefree, toric or sparse\n"
+      "report options: json FILE, csv FILE and compare BASELINE-CSV-FILE\n"
+      "thread options: threads COUNTS and shared-threads COUNTS where "
+      "COUNTS is like 1,2,4\n"
+      "LIST is all or a comma separated list of prefixes of these models:\n";
+    std::vector<std::string> names;
+    registry.namesWithPrefix("", names);
+    for (size_t i = 0; i < names.size(); ++i)
+      std::cerr << "  " << names[i] << '\n';
+  }
+}
 
+int main(int argc, const char** args) {
+  // "json file", "csv file" and "compare baseline-csv-file" write a
+  // benchmark report and compare it to a baseline.
+  mathic::BenchmarkReportOptions reportOptions;
+  reportOptions.parse(argc, args);
+  const size_t runs = reportOptions.any() ? ReportRuns : 1;
+
+  // "threads list" runs each model on each number of threads in the
+  // comma separated list at once, each with its own finder, to measure
+  // scaling. "shared-threads list" does the same on one shared finder.
+  mathic::ThreadScalingOptions threadOptions;
+  threadOptions.parse(argc, args);
+  if (threadOptions.any() && !mathic::ThreadScaling::threadsAvailable()) {
+    std::cerr << "Threads are not available on this platform.\n";
+    return 1;
+  }
 
-  /*
-  for (int minimizeOnInsert = 1; minimizeOnInsert <= 1; ++minimizeOnInsert) {
-    for (int order = 0; order <= 2; ++order) {
-      bool moveDivisorToFront = (order == 1);
-      bool sortOnInsert = (order == 2);
-      sim.run<DivListModel<1> >
-        (minimizeOnInsert, moveDivisorToFront, sortOnInsert);
-      sim.run<DivListModel<0> >
-        (minimizeOnInsert, moveDivisorToFront, sortOnInsert);
+  // "models list" chooses the models to run from a comma separated list
+  // of name prefixes.
+  ModelRegistry registry("model");
+  registerModels(registry);
+  std::vector<std::string> models;
+  if (argc >= 3 && std::string(args[1]) == "models") {
+    try {
+      pushBackChosenModels(registry, args[2], models);
+    } catch (const mathic::MathicException& e) {
+      std::cerr << e.what();
+      printUsage(registry);
+      return 1;
     }
+    args += 2;
+    argc -= 2;
   }
-  //*/
-
-  //sim.run<DivListModel<0, 0> >(1, 0, 1, 0.0, 0); // best array, no mask
-  /*
-  sim.run<DivListModel<0> >(1, 0, 0)
-  sim.run<DivListModel<0> >(1, 1, 0);
-  sim.run<DivListModel<0> >(1, 0, 1);
-  sim.run<DivListModel<1> >(1, 0, 0);
-  sim.run<DivListModel<1> >(1, 1, 0);
-  sim.run<DivListModel<1> >(1, 0, 1);
-  //*/
-
-  sim.run<KDTreeModel<0,0,1,1,0> >(0, 0, 0, 0.0, 0);
-  sim.run<DivListModel<0,0> >(0, 1, 0, 0.5, 500);
-  for (int mini = 0; mini <= 0; ++mini) {
-    for (int sortOnInsert = 0; sortOnInsert <= 1; ++sortOnInsert) {
-      for (int useDivCache = 0; useDivCache <= 1; ++useDivCache) {
-        sim.run<KDTreeModel<1,1,1,1,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-        sim.run<KDTreeModel<1,0,1,1,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-        sim.run<KDTreeModel<0,0,1,1,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-
-        sim.run<KDTreeModel<1,1,1,2,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-        sim.run<KDTreeModel<1,0,1,2,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-        sim.run<KDTreeModel<0,0,1,2,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-
-        sim.run<KDTreeModel<1,1,1,3,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-        sim.run<KDTreeModel<1,0,1,3,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-        sim.run<KDTreeModel<0,0,1,3,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-
-        sim.run<KDTreeModel<1,1,1,20,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-
-        sim.run<KDTreeModel<1,1,0,1,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-        sim.run<KDTreeModel<1,1,0,2,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-        sim.run<KDTreeModel<1,1,0,40,0> >(mini,sortOnInsert,useDivCache, 0.5, 10);
-
-		/*
-        for (size_t leafSize = 5; leafSize <= 15; leafSize += 5)
-          for (size_t start = 0; start <= 0; start += 200)
-            for (double ratio = 0; ratio < 0.1; ratio += 0.2)
-              sim.run<KDTreeModel<0,0> >(leafSize, mini,sortOnInsert,useDivisorCache, ratio, start);
-
-              //*/
-        /*sim.run<KDTreeModel<0> >(8, mini,sortOnInsert,useDivisorCache, 0, 0);
-        sim.run<KDTreeModel<1> >(8, mini,sortOnInsert,useDivisorCache, 0, 0);
-        sim.run<KDTreeModel<0> >(20, mini,sortOnInsert,useDivisorCache, 0, 0);
-        sim.run<KDTreeModel<1> >(20, mini,sortOnInsert,useDivisorCache, 0, 0);
-        sim.run<KDTreeModel<0> >(40, mini,sortOnInsert,useDivisorCache, 0, 0);
-        sim.run<KDTreeModel<1> >(40, mini,sortOnInsert,useDivisorCache, 0, 0);
-        sim.run<KDTreeModel<0> >(60, mini,sortOnInsert,useDivisorCache, 0, 0);
-        sim.run<KDTreeModel<1> >(60, mini,sortOnInsert,useDivisorCache, 0, 0);*/
-
-        /*
-        sim.run<KDTreeModel<1> >(10, mini,sortOnInsert,useDivisorCache, 0.001, 2000);
-        sim.run<KDTreeModel<1> >(10, mini,sortOnInsert,useDivisorCache, 0.001, 4000);
-
-        sim.run<KDTreeModel<0> >(10, mini,sortOnInsert,useDivisorCache, 0.001, 6000);
-        sim.run<KDTreeModel<1> >(10, mini,sortOnInsert,useDivisorCache, 0.001, 6000);
-
-        sim.run<KDTreeModel<1> >(10, mini,sortOnInsert,useDivisorCache, 0.001, 8000);
-        sim.run<KDTreeModel<1> >(10, mini,sortOnInsert,useDivisorCache, 0.001, 10000);*/
-        //sim.run<KDTreeModel>(10, mini,sortOnInsert,useDivisorCache, 4, 2000);
-        //sim.run<KDTreeModel>(20, mini,sortOnInsert,useDivisorCache, 0.75, 2000);
-        //sim.run<KDTreeModel>(8, mini,sortOnInsert,useDivisorCache, 0.75, 2000);
-      }
+
+  // "trace file" replays a trace written by mathic::DivTraceWriter.
+  if (argc >= 2 && std::string(args[1]) == "trace") {
+    if (argc != 3) {
+      printUsage(registry);
+      return 1;
     }
+    if (models.empty())
+      pushBackDefaultTraceModels(models);
+    Simulation sim(1, true, runs);
+    mic::Timer timer;
+    std::cout << "Reading trace. ";
+    sim.makeFromTrace(args[2]);
+    timer.print(std::cout);
+    std::cout << std::endl;
+    runModels(sim, registry, models, threadOptions);
+    return processReport(sim, reportOptions);
   }
-  //*/
-  /*
-  for (int mini = 1; mini <= 1; ++mini) {
-    for (int noneFrontSort = 0; noneFrontSort <= 2; ++noneFrontSort) {
-      bool tof = (noneFrontSort == 1);
-      bool sort = (noneFrontSort == 2);
-      
-      for (double ratio = 0.5; ratio < 0.51; ratio += 0.1)
-        for (size_t start = 500; start <= 500; start += 100)
-          sim.run<DivListModel<1, 1> >(mini, tof, sort, ratio, start);
+
+  // "ideal kind ..." inserts the generators of a structured ideal. See
+  // Simulation::makeStructured.
+  if (argc >= 2 && std::string(args[1]) == "ideal") {
+    IdealKind kind;
+    if ((argc != 6 && argc != 7) || !getIdealKind(args[2], kind) ||
+      toInt(args[3]) == 0) {
+      printUsage(registry);
+      return 1;
     }
+    if ((kind == BorelIdeal || kind == LexIdeal || kind == ToricIdeal) &&
+      toInt(args[3]) < 2) {
+      std::cerr << "ERROR: " << args[2]
+        << " ideals need at least 2 variables.\n";
+      return 1;
+    }
+    const bool findAll = argc != 7 || std::string(args[6]) != "one";
+    if (models.empty())
+      pushBackDefaultModels(registry, models);
+    Simulation sim(1, true, runs);
+    mic::Timer timer;
+    std::cout << "Generating " << args[2] << " ideal. ";
+    sim.makeStructured(kind, toInt(args[3]), toInt(args[4]), toInt(args[5]),
+      findAll);
+    timer.print(std::cout);
+    std::cout << std::endl;
+    runModels(sim, registry, models, threadOptions);
+    return processReport(sim, reportOptions);
+  }
+
+  if (argc != 1 && argc != 4 && argc != 5) {
+    printUsage(registry);
+    return 1;
   }
-  //*/
-
-  /* best for single query from best to worst
-  sim.run<KDTreeModel<1,1> >(40, 1, 0, 0, 1.0, 1000); // best tree, mask
-  sim.run<KDTreeModel<0,0> >(15, 1, 0, 0, 0.0, 0); // best tree, no mask
-  sim.run<DivListModel<0, 1> >(1, 1, 0, 0.5, 500); // best array, mask
-  sim.run<DivListModel<1, 1> >(1, 1, 0, 0.5, 500); // should be best linked, mask
-  sim.run<DivListModel<0, 0> >(1, 0, 1, 0.0, 0); // best array, no mask
-  sim.run<DivListModel<1, 0> >(1, 0, 1, 0.0, 0); // best linked, no mask
-  //*/
-
-  /* base div lists
-  sim.run<DivListModel<0, 0> >(1, 0, 0, 0.0, 0); // base array
-  sim.run<DivListModel<1, 0> >(1, 0, 0, 0.0, 0); // base linked
-  //*/
-
-  std::cout << "\n\n";
-  sim.printData(std::cout);
-  return 0;
+#ifdef DEBUG
+  size_t varCount = 10;
+  size_t inserts = 400;
+  size_t queries = 1000;
+#else
+  size_t varCount = 10;
+  size_t inserts = 5000;
+  size_t queries = 2000000;
+#endif
+  bool findAll = true;
+  if (argc >= 4) {
+    varCount = toInt(args[1]);
+    inserts = toInt(args[2]);
+    queries = toInt(args[3]);
+    if (argc == 5)
+      findAll = std::string(args[4]) != "one";
+  } else if (models.empty() && !reportOptions.any() && !threadOptions.any())
+    runMinimizeSimulations();
+
+  if (models.empty())
+    pushBackDefaultModels(registry, models);
+
+  const size_t repeats = IF_DEBUG(true ? 1 :) 1;
+  Simulation sim(repeats, true, runs);
+  mic::Timer timer;
+  std::cout << "Generating simulation. ";
+  sim.makeStandard(varCount, inserts, queries, findAll);
+  timer.print(std::cout);
+  std::cout << std::endl;
+
+  runModels(sim, registry, models, threadOptions);
+  return processReport(sim, reportOptions);
 }
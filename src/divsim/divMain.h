@@ -1,6 +1,6 @@
 #ifndef MATHIC_DIV_MAIN_GUARD
 #define MATHIC_DIV_MAIN_GUARD
 
-int main();
+int main(int argc, const char** args);
 
 #endif
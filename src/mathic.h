@@ -12,6 +12,9 @@
 // divisor query data structures
 #include "mathic/DivList.h"
 #include "mathic/KDTree.h"
+#include "mathic/Minimize.h"
+#include "mathic/ShardedDivFinder.h"
+#include "mathic/ComponentDivFinder.h"
 
 // priority queue data structures
 #include "mathic/TourTree.h"
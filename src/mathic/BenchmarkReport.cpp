@@ -0,0 +1,380 @@
+#include "BenchmarkReport.h"
+
+#include "ColumnPrinter.h"
+#include "error.h"
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace mathic {
+  namespace {
+    /** Returns the 97.5th percentile of Student's t distribution with
+        degreesOfFreedom degrees of freedom, which is the factor for a
+        two sided 95% confidence interval. Fractional degrees of freedom
+        are rounded down, which errs on the side of wider intervals. */
+    double getTCritical95(double degreesOfFreedom) {
+      static const double table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+        2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101,
+        2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052,
+        2.048, 2.045, 2.042
+      };
+      const size_t tableSize = sizeof(table) / sizeof(*table);
+      if (degreesOfFreedom < 1)
+        return table[0];
+      if (degreesOfFreedom < tableSize)
+        return table[static_cast<size_t>(degreesOfFreedom) - 1];
+      if (degreesOfFreedom < 60)
+        return 2.021; // the value at 40
+      if (degreesOfFreedom < 120)
+        return 2.000; // the value at 60
+      return 1.960;
+    }
+
+    std::string toString(double d) {
+      std::ostringstream out;
+      out.precision(15);
+      out << d;
+      return out.str();
+    }
+
+    std::string quoteJson(const std::string& str) {
+      std::string quoted = "\"";
+      for (size_t i = 0; i < str.size(); ++i) {
+        const char c = str[i];
+        if (c == '"' || c == '\\') {
+          quoted += '\\';
+          quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+          static const char hex[] = "0123456789abcdef";
+          quoted += "\\u00";
+          quoted += hex[(c >> 4) & 0xF];
+          quoted += hex[c & 0xF];
+        } else
+          quoted += c;
+      }
+      return quoted + '"';
+    }
+
+    std::string quoteCsv(const std::string& str) {
+      std::string quoted = "\"";
+      for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] == '"')
+          quoted += '"';
+        quoted += str[i];
+      }
+      return quoted + '"';
+    }
+
+    /** Splits a line of CSV into its fields. Returns false if the line
+        is malformed. */
+    bool splitCsv(const std::string& line, std::vector<std::string>& fields) {
+      fields.clear();
+      size_t pos = 0;
+      while (true) {
+        std::string field;
+        if (pos < line.size() && line[pos] == '"') {
+          for (++pos; ; ++pos) {
+            if (pos == line.size())
+              return false;
+            if (line[pos] == '"') {
+              if (pos + 1 < line.size() && line[pos + 1] == '"')
+                ++pos;
+              else {
+                ++pos;
+                break;
+              }
+            }
+            field += line[pos];
+          }
+        } else {
+          while (pos < line.size() && line[pos] != ',')
+            field += line[pos++];
+        }
+        fields.push_back(field);
+        if (pos == line.size())
+          return true;
+        if (line[pos] != ',')
+          return false;
+        ++pos;
+      }
+    }
+
+    bool parseNumber(const std::string& str, double& number) {
+      if (str.empty())
+        return false;
+      char* end;
+      number = std::strtod(str.c_str(), &end);
+      return *end == '\0';
+    }
+
+    const size_t CsvFixedFieldCount = 9;
+  }
+
+  BenchmarkResult::BenchmarkResult():
+    runs(0),
+    meanNanos(0),
+    stddevNanos(0),
+    comparisons(0),
+    memoryUse(0),
+    operations(0) {}
+
+  void BenchmarkResult::setRunNanos
+  (const std::vector<unsigned long long>& nanos) {
+    runNanos = nanos;
+    runs = nanos.size();
+    meanNanos = 0;
+    stddevNanos = 0;
+    if (runs == 0)
+      return;
+    for (size_t i = 0; i < runs; ++i)
+      meanNanos += nanos[i];
+    meanNanos /= runs;
+    if (runs < 2)
+      return;
+    double squares = 0;
+    for (size_t i = 0; i < runs; ++i) {
+      const double deviation = nanos[i] - meanNanos;
+      squares += deviation * deviation;
+    }
+    stddevNanos = std::sqrt(squares / (runs - 1));
+  }
+
+  double BenchmarkResult::getConfidence95() const {
+    if (runs < 2)
+      return 0;
+    return getTCritical95(static_cast<double>(runs - 1)) *
+      stddevNanos / std::sqrt(static_cast<double>(runs));
+  }
+
+  void BenchmarkReport::writeJson(std::ostream& out) const {
+    out << "[";
+    for (size_t i = 0; i < _results.size(); ++i) {
+      const BenchmarkResult& r = _results[i];
+      out << (i == 0 ? "\n" : ",\n")
+        << "  {\"workload\": " << quoteJson(r.workload)
+        << ", \"model\": " << quoteJson(r.model)
+        << ",\n   \"runs\": " << r.runs
+        << ", \"meanNanos\": " << toString(r.meanNanos)
+        << ", \"stddevNanos\": " << toString(r.stddevNanos)
+        << ", \"ci95Nanos\": " << toString(r.getConfidence95())
+        << ",\n   \"runNanos\": [";
+      for (size_t run = 0; run < r.runNanos.size(); ++run)
+        out << (run == 0 ? "" : ", ") << r.runNanos[run];
+      out << "],\n   \"comparisons\": " << r.comparisons
+        << ", \"memoryBytes\": " << r.memoryUse
+        << ", \"operations\": " << r.operations
+        << ",\n   \"counters\": {";
+      const char* separator = "";
+      for (size_t c = 0; c < PerfCounts::CounterCount; ++c) {
+        if (!r.perf.available[c])
+          continue;
+        const PerfCounts::Counter counter = static_cast<PerfCounts::Counter>(c);
+        out << separator << quoteJson(PerfCounts::getName(counter))
+          << ": " << r.perf.values[counter];
+        separator = ", ";
+      }
+      out << "}}";
+    }
+    out << "\n]\n";
+  }
+
+  void BenchmarkReport::writeCsv(std::ostream& out) const {
+    out << "workload,model,runs,mean_ns,stddev_ns,ci95_ns,"
+      "comparisons,memory_bytes,operations";
+    for (size_t c = 0; c < PerfCounts::CounterCount; ++c)
+      out << ',' << PerfCounts::getName(static_cast<PerfCounts::Counter>(c));
+    out << '\n';
+    for (size_t i = 0; i < _results.size(); ++i) {
+      const BenchmarkResult& r = _results[i];
+      out << quoteCsv(r.workload) << ',' << quoteCsv(r.model)
+        << ',' << r.runs
+        << ',' << toString(r.meanNanos)
+        << ',' << toString(r.stddevNanos)
+        << ',' << toString(r.getConfidence95())
+        << ',' << r.comparisons
+        << ',' << r.memoryUse
+        << ',' << r.operations;
+      for (size_t c = 0; c < PerfCounts::CounterCount; ++c) {
+        out << ',';
+        if (r.perf.available[c])
+          out << r.perf.values[c];
+      }
+      out << '\n';
+    }
+  }
+
+  void BenchmarkReport::readCsv(const std::string& fileName) {
+    std::ifstream in(fileName.c_str());
+    if (!in)
+      reportError("could not open benchmark report " + fileName + '.');
+    std::string line;
+    std::vector<std::string> fields;
+    const size_t fieldCount = CsvFixedFieldCount + PerfCounts::CounterCount;
+    if (!std::getline(in, line) || !splitCsv(line, fields) ||
+      fields.size() != fieldCount || fields[0] != "workload")
+      reportError(fileName + " is not a benchmark report in CSV format.");
+    for (size_t lineNumber = 2; std::getline(in, line); ++lineNumber) {
+      if (line.empty())
+        continue;
+      double numbers[fieldCount];
+      bool ok = splitCsv(line, fields) && fields.size() == fieldCount;
+      for (size_t i = 2; ok && i < fieldCount; ++i) {
+        const bool isCounter = i >= CsvFixedFieldCount;
+        if (!parseNumber(fields[i], numbers[i]) &&
+          !(isCounter && fields[i].empty()))
+          ok = false;
+      }
+      if (!ok) {
+        std::ostringstream msg;
+        msg << "line " << lineNumber << " of benchmark report "
+          << fileName << " is malformed.";
+        reportError(msg.str());
+      }
+
+      BenchmarkResult result;
+      result.workload = fields[0];
+      result.model = fields[1];
+      result.runs = static_cast<size_t>(numbers[2]);
+      result.meanNanos = numbers[3];
+      result.stddevNanos = numbers[4];
+      result.comparisons = static_cast<unsigned long long>(numbers[6]);
+      result.memoryUse = static_cast<unsigned long long>(numbers[7]);
+      result.operations = static_cast<unsigned long long>(numbers[8]);
+      for (size_t c = 0; c < PerfCounts::CounterCount; ++c) {
+        const size_t field = CsvFixedFieldCount + c;
+        result.perf.available[c] = !fields[field].empty();
+        if (result.perf.available[c])
+          result.perf.values[c] =
+            static_cast<unsigned long long>(numbers[field]);
+      }
+      add(result);
+    }
+  }
+
+  size_t BenchmarkReport::compare(const BenchmarkReport& baseline,
+    std::ostream& out, double minRelativeChange) const {
+    ColumnPrinter pr;
+    pr.addColumn(true);
+    pr.addColumn(false, " ", "ms");
+    pr.addColumn(false, "+-", "ms ->");
+    pr.addColumn(false, " ", "ms");
+    pr.addColumn(false, "+-", "ms");
+    pr.addColumn(false, " ");
+    pr.addColumn(true, " ");
+    size_t regressions = 0;
+    for (size_t i = 0; i < _results.size(); ++i) {
+      const BenchmarkResult& current = _results[i];
+      const BenchmarkResult* base = 0;
+      for (size_t j = 0; j < baseline._results.size(); ++j) {
+        const BenchmarkResult& candidate = baseline._results[j];
+        if (candidate.workload == current.workload &&
+          candidate.model == current.model)
+          base = &candidate;
+      }
+
+      pr[0] << current.model << '\n';
+      if (base == 0) {
+        pr[1] << '\n';
+        pr[2] << '\n';
+      } else {
+        pr[1] << ColumnPrinter::oneDecimal(base->meanNanos / 1e6) << '\n';
+        pr[2] << ColumnPrinter::oneDecimal(base->getConfidence95() / 1e6)
+          << '\n';
+      }
+      pr[3] << ColumnPrinter::oneDecimal(current.meanNanos / 1e6) << '\n';
+      pr[4] << ColumnPrinter::oneDecimal(current.getConfidence95() / 1e6)
+        << '\n';
+      if (base == 0) {
+        pr[5] << '\n';
+        pr[6] << "not in baseline\n";
+        continue;
+      }
+
+      const double change = base->meanNanos == 0 ? 0 :
+        (current.meanNanos - base->meanNanos) / base->meanNanos;
+      // percent does not handle negative numbers.
+      pr[5] << (change >= 0 ? '+' : '-')
+        << ColumnPrinter::percent(std::fabs(change)) << '\n';
+      if (current.runs < 2 || base->runs < 2) {
+        pr[6] << "too few runs to test\n";
+        continue;
+      }
+
+      // Welch's t-test, which does not assume equal variances.
+      const double currentVar =
+        current.stddevNanos * current.stddevNanos / current.runs;
+      const double baseVar = base->stddevNanos * base->stddevNanos / base->runs;
+      const double varSum = currentVar + baseVar;
+      const double diff = current.meanNanos - base->meanNanos;
+      bool significant;
+      if (varSum == 0)
+        significant = diff != 0;
+      else {
+        const double t = diff / std::sqrt(varSum);
+        const double degreesOfFreedom = varSum * varSum /
+          (currentVar * currentVar / (current.runs - 1) +
+           baseVar * baseVar / (base->runs - 1));
+        significant = std::fabs(t) > getTCritical95(degreesOfFreedom);
+      }
+      if (!significant || std::fabs(change) < minRelativeChange)
+        pr[6] << '\n';
+      else if (diff > 0) {
+        pr[6] << "REGRESSION\n";
+        ++regressions;
+      } else
+        pr[6] << "faster\n";
+    }
+    out << "*** Comparison to baseline (95% confidence) ***\n";
+    pr.print(out);
+    return regressions;
+  }
+
+  void BenchmarkReportOptions::parse(int& argc, const char**& args) {
+    while (argc >= 3) {
+      const std::string option = args[1];
+      std::string* file;
+      if (option == "json")
+        file = &jsonFile;
+      else if (option == "csv")
+        file = &csvFile;
+      else if (option == "compare")
+        file = &baselineFile;
+      else
+        return;
+      *file = args[2];
+      argc -= 2;
+      // args[0] stays in front.
+      args[2] = args[0];
+      args += 2;
+    }
+  }
+
+  bool BenchmarkReportOptions::any() const {
+    return !jsonFile.empty() || !csvFile.empty() || !baselineFile.empty();
+  }
+
+  bool BenchmarkReportOptions::process
+  (const BenchmarkReport& report, std::ostream& out) const {
+    if (!jsonFile.empty()) {
+      std::ofstream json(jsonFile.c_str());
+      report.writeJson(json);
+      if (!json)
+        reportError("could not write benchmark report to " + jsonFile + '.');
+    }
+    if (!csvFile.empty()) {
+      std::ofstream csv(csvFile.c_str());
+      report.writeCsv(csv);
+      if (!csv)
+        reportError("could not write benchmark report to " + csvFile + '.');
+    }
+    if (baselineFile.empty())
+      return true;
+    BenchmarkReport baseline;
+    baseline.readCsv(baselineFile);
+    const size_t regressions = report.compare(baseline, out);
+    out << regressions << " regressions." << std::endl;
+    return regressions == 0;
+  }
+}
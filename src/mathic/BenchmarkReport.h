@@ -0,0 +1,97 @@
+#ifndef MATHIC_BENCHMARK_REPORT_GUARD
+#define MATHIC_BENCHMARK_REPORT_GUARD
+
+#include "stdinc.h"
+#include "PerfCounters.h"
+#include <vector>
+#include <string>
+#include <ostream>
+#include <istream>
+
+namespace mathic {
+  /** The outcome of running one model on one workload a number of times,
+      as recorded by pqsim and divsim. */
+  struct BenchmarkResult {
+    BenchmarkResult();
+
+    std::string workload; /// what was simulated
+    std::string model; /// the data structure and its configuration
+
+    size_t runs; /// number of timed runs
+    double meanNanos; /// mean wall clock time of a run
+    double stddevNanos; /// sample standard deviation of the time of a run
+    /// the times of the runs if known. A result read from a CSV file has
+    /// only the mean and standard deviation.
+    std::vector<unsigned long long> runNanos;
+
+    /// comparisons, or whatever unit of work the model counts, such as
+    /// exponent queries for divisor finders.
+    unsigned long long comparisons;
+    unsigned long long memoryUse; /// bytes
+    unsigned long long operations; /// operations in all runs
+    PerfCounts perf;
+
+    /** Sets runNanos to nanos and computes runs, meanNanos and
+        stddevNanos from it. */
+    void setRunNanos(const std::vector<unsigned long long>& nanos);
+
+    /** Returns the half width of the 95% confidence interval of the mean
+        time of a run, based on Student's t distribution. Returns 0 if
+        there are fewer than 2 runs. */
+    double getConfidence95() const;
+  };
+
+  /** A collection of benchmark results that can be written as JSON or
+      CSV and compared to a baseline. Baselines are read from CSV. */
+  class BenchmarkReport {
+  public:
+    void add(const BenchmarkResult& result) {_results.push_back(result);}
+    const std::vector<BenchmarkResult>& getResults() const {return _results;}
+
+    /** Writes an array with an object for each result. */
+    void writeJson(std::ostream& out) const;
+
+    /** Writes a header line and then a line for each result. A counter
+        that was not available is an empty field. */
+    void writeCsv(std::ostream& out) const;
+
+    /** Adds the results in a file written by writeCsv. Reports an error
+        if the file cannot be read or is not in that format. */
+    void readCsv(const std::string& fileName);
+
+    /** Prints each result next to the result in baseline with the same
+        workload and model. A result is a regression if Welch's t-test
+        says that it is slower than the baseline at the 95% confidence
+        level and if it is slower by at least minRelativeChange, so that
+        tiny but consistent differences are not flagged. Both results
+        need at least 2 runs for the test. Returns the number of
+        regressions. */
+    size_t compare(const BenchmarkReport& baseline, std::ostream& out,
+      double minRelativeChange = 0.02) const;
+
+  private:
+    std::vector<BenchmarkResult> _results;
+  };
+
+  /** The command line options of pqsim and divsim for writing a report
+      and comparing it to a baseline. */
+  struct BenchmarkReportOptions {
+    std::string jsonFile; /// write the report here as JSON if not empty
+    std::string csvFile; /// write the report here as CSV if not empty
+    std::string baselineFile; /// compare to this CSV file if not empty
+
+    /** Removes the options "json FILE", "csv FILE" and "compare FILE"
+        from the front of the arguments after args[0]. */
+    void parse(int& argc, const char**& args);
+
+    /** Returns true if there is anything to do with a report. */
+    bool any() const;
+
+    /** Writes report to the requested files and compares it to the
+        baseline, printing the comparison to out. Returns false if there
+        are regressions. */
+    bool process(const BenchmarkReport& report, std::ostream& out) const;
+  };
+}
+
+#endif
@@ -2,8 +2,12 @@
 #define MATHIC_BINARY_K_D_TREE_GUARD
 
 #include "stdinc.h"
+#include "ConfigFlags.h"
 #include "DivMask.h"
+#include "CompactExponents.h"
 #include "KDEntryArray.h"
+#include "KDTreeAnalysis.h"
+#include "ScoreBound.h"
 #include <memtailor.h>
 #include <ostream>
 
@@ -14,9 +18,12 @@ namespace mathic {
     typedef typename C::Monomial Monomial;
     typedef typename C::Entry Entry;
     typedef typename C::Exponent Exponent;
-    typedef typename DivMask::Extender<Entry, C::UseDivMask> ExtEntry;
-    typedef typename DivMask::Extender<const Monomial&,C::UseDivMask> ExtMonoRef;
+    typedef typename WithCompactExponents
+      <C, DivMask::Extender<Entry, C::UseDivMask> >::Type ExtEntry;
+    typedef typename WithCompactExponents
+      <C, DivMask::Extender<const Monomial&, C::UseDivMask> >::Type ExtMonoRef;
     typedef typename DivMask::Calculator<C> DivMaskCalculator;
+    typedef HasScoreBound<C> ScoreBound;
 
     struct ExpOrder {
     ExpOrder(size_t var, const C& conf): _var(var), _conf(conf) {}
@@ -63,7 +70,7 @@ namespace mathic {
       bool isInterior() const {return !isLeaf();}
       const Interior& asInterior() const {
         MATHIC_ASSERT(isInterior());
-        return static_cast<Interior&>(*this);
+        return static_cast<const Interior&>(*this);
       }
       Interior& asInterior() {
         MATHIC_ASSERT(isInterior());
@@ -82,7 +89,8 @@ namespace mathic {
     };
 
     class KDTreeInterior : public KDTreeNode,
-      public mathic::DivMask::HasDivMask<C::UseTreeDivMask> {
+      public mathic::DivMask::HasDivMask<C::UseTreeDivMask>,
+      public ScoreBound {
     public:
       typedef typename C::Exponent Exponent;
       typedef KDTreeInterior Interior;
@@ -141,6 +149,14 @@ namespace mathic {
             updateToLowerBound(node.asInterior());
       }
 
+      void updateScoreBoundFrom(Node& node, const C& conf) {
+        if (node.isLeaf())
+          this->updateScoreBound(node.asLeaf().entries().begin(),
+            node.asLeaf().entries().end(), conf);
+        else
+          this->updateScoreBound(node.asInterior());
+      }
+
     private:
       Node* _equalOrLess;
       Node* _strictlyGreater;
@@ -198,13 +214,24 @@ namespace mathic {
 
     bool removeElement(const Monomial& monomial);
 
-    void insert(const ExtEntry& entry);
+    /** calc must be the calculator used for the div masks of the entries
+        already in the tree. It is used if a partial rebuild occurs. */
+    void insert(const ExtEntry& entry, const DivMaskCalculator& calc);
 
     template<class Iter>
     void reset(Iter begin, Iter end, const DivMaskCalculator& calc);
 
     inline Entry* findDivisor(const ExtMonoRef& monomial);
 
+    /** As findDivisor, but records the work done in stats. */
+    Entry* findDivisor(const ExtMonoRef& monomial, KDTreeQueryStats& stats);
+
+    inline Entry* findBestDivisor(const ExtMonoRef& monomial);
+
+    template<class S>
+    inline Entry* findDivisorWithScoreBelow
+      (const ExtMonoRef& monomial, const S& bound);
+
     template<class DivisorOutput>
     inline void findAllDivisors
       (const ExtMonoRef& monomial, DivisorOutput& out);
@@ -216,10 +243,35 @@ namespace mathic {
     template<class EntryOutput>
     void forAll(EntryOutput& out);
 
+    /** A resumable traversal of the entries that divide a monomial if
+        Divisors is true or of the entries that the monomial divides if
+        Divisors is false. See KDTree::divisorRange. */
+    template<bool Divisors>
+    class Range;
+
     void clear();
 
+    /** Returns the number of removed entries that are still taking up
+        space. Always 0 unless UseTombstones is true. */
+    size_t getDeadCount() const {return _deadCount;}
+
+    /** Returns the maximal number of entries in a leaf. It starts out as
+        C::LeafSize. */
+    size_t getLeafSize() const {return _leafSize;}
+
+    /** Sets the maximal number of entries in a leaf for splits and
+        rebuilds from now on. Leaves that are already larger stay so
+        until the next rebuild. leafSize must be in [1, C::LeafSize]. */
+    void setLeafSize(size_t leafSize) {
+      MATHIC_ASSERT(0 < leafSize && leafSize <= C::LeafSize);
+      _leafSize = leafSize;
+    }
+
     size_t getMemoryUse() const;
 
+    /** Adds the shape of the tree to analysis. */
+    void analyze(KDTreeAnalysis& analysis) const;
+
     C& getConfiguration() {return _conf;}
 
     void print(std::ostream& out) const;
@@ -239,15 +291,53 @@ namespace mathic {
       Interior* parent;
     };
 
+    /** Builds a balanced subtree containing the entries in [begin, end)
+        and returns its root. var is the split variable of the parent or
+        -1 for the root of the tree. */
+    template<class Iter>
+    Node* build(Iter begin, Iter end, const DivMaskCalculator& calc,
+      size_t var);
+
+    /** Rebuilds the deepest subtree along _path that is too deep for
+        the number of entries in it. Call after an insertion of extEntry
+        has made the height of the tree exceed
+        maxBalancedDepth(_entryCount). */
+    void partialRebuild(const ExtEntry& extEntry, const DivMaskCalculator& calc);
+
+    /** Returns how deep a tree with entryCount entries may get before
+        a partial rebuild is triggered. */
+    size_t maxBalancedDepth(size_t entryCount) const;
+
+    /** Returns the number of entries in the subtree rooted at node. */
+    size_t subtreeSize(Node* node) const;
+
+    /** Return memory for a node, reusing the memory of nodes discarded
+        by a partial rebuild if possible. */
+    Leaf* allocLeaf();
+    Interior* allocInterior();
+
     memt::Arena _arena; // Everything permanent allocated from here.
     C _conf; // User supplied configuration.
     mutable std::vector<Node*> _tmp; // For navigating the tree.
     Node* _root; // Root of the tree. Can be null!
+    size_t _entryCount; // Only kept up to date if UsePartialRebuilds.
+    size_t _deadCount; // Only non-zero if UseTombstones.
+    size_t _leafSize; // At most C::LeafSize.
+    size_t _partialRebuildCount; // Number of calls to partialRebuild.
+
+    // The interior nodes passed by the most recent insertion. _path[i] is
+    // at depth i. Only used if UsePartialRebuilds.
+    std::vector<Interior*> _path;
+
+    // Nodes discarded by partial rebuilds.
+    std::vector<Leaf*> _freeLeaves;
+    std::vector<Interior*> _freeInteriors;
   };
 
   template<class C>
   BinaryKDTree<C>::BinaryKDTree(const C& configuration):
-  _conf(configuration), _root(0) {
+  _conf(configuration), _root(0), _entryCount(0), _deadCount(0),
+  _leafSize(C::LeafSize), _partialRebuildCount(0) {
     MATHIC_ASSERT(C::LeafSize > 0);
     MATHIC_ASSERT(debugIsValid());
   }
@@ -282,6 +372,10 @@ namespace mathic {
     }
     MATHIC_ASSERT(_tmp.empty());
     MATHIC_ASSERT(debugIsValid());
+    if (ConfigFlags<C>::UsePartialRebuilds)
+      _entryCount -= removedCount;
+    if (ConfigFlags<C>::UseTombstones)
+      _deadCount += removedCount;
     return removedCount;
   }
 
@@ -292,34 +386,65 @@ namespace mathic {
       return 0;
     Node* node = _root;
 
-    while (node->isInterior())
-      node = node->asInterior().getChildFor(monomial, _conf);
-    const bool value = node->asLeaf().removeElement(monomial);
+    while (node->isInterior()) {
+      Interior& interior = node->asInterior();
+      if (interior.getExponent() <
+          _conf.getExponent(monomial, interior.getVar()))
+        node = &interior.getStrictlyGreater();
+      else
+        node = &interior.getEqualOrLess();
+    }
+    const bool value = node->asLeaf().entries().removeElement(monomial, _conf);
     MATHIC_ASSERT(debugIsValid());
+    if (ConfigFlags<C>::UsePartialRebuilds && value)
+      --_entryCount;
+    if (ConfigFlags<C>::UseTombstones && value)
+      ++_deadCount;
     return value;
   }
 
   template<class C>
-  void BinaryKDTree<C>::insert(const ExtEntry& extEntry) {
+  void BinaryKDTree<C>::insert(
+    const ExtEntry& extEntry,
+    const DivMaskCalculator& calc
+  ) {
     Interior* parent = 0;
     if (_root == 0)
       _root = new (_arena.allocObjectNoCon<Leaf>()) Leaf(_arena, _conf);
+    if (ConfigFlags<C>::UsePartialRebuilds) {
+      _path.clear();
+      ++_entryCount;
+    }
+    const typename ScoreBound::Score score =
+      ScoreBound::getScore(extEntry.get(), _conf);
     Node* node = _root;
     while (node->isInterior()) {
       parent = &node->asInterior();
+      if (ConfigFlags<C>::UsePartialRebuilds)
+        _path.push_back(parent);
       if (C::UseTreeDivMask)
         parent->updateToLowerBound(extEntry);
+      parent->updateScoreBound(score);
       node = &parent->getChildFor(extEntry, _conf);
     }
     Leaf* leaf = &node->asLeaf();
+    if (ConfigFlags<C>::UseTombstones)
+      _deadCount -= leaf->entries().compact();
 
     MATHIC_ASSERT(leaf->entries().size() <= C::LeafSize);
-    if (leaf->entries().size() == C::LeafSize) {
+    if (leaf->entries().size() >= _leafSize) {
       Interior& interior = leaf->splitInsert(extEntry, parent, _arena, _conf);
       if (parent == 0) {
         MATHIC_ASSERT(leaf == _root);
         _root = &interior;
       }
+      if (ConfigFlags<C>::UsePartialRebuilds) {
+        // only a split can make the tree deeper
+        _path.push_back(&interior);
+        if (_path.size() > maxBalancedDepth(_entryCount))
+          partialRebuild(extEntry, calc);
+      }
+      MATHIC_ASSERT(debugIsValid());
     } else {
       MATHIC_ASSERT(leaf->entries().size() < C::LeafSize);
       leaf->entries().insert(extEntry, _conf);
@@ -333,29 +458,41 @@ namespace mathic {
     clear();
     if (insertBegin == insertEnd)
       return;
+    _entryCount = std::distance(insertBegin, insertEnd);
+    _root = build(insertBegin, insertEnd, calc, static_cast<size_t>(-1));
+    MATHIC_ASSERT(debugIsValid());
+  }
 
+  template<class C>
+  template<class Iter>
+  typename BinaryKDTree<C>::Node* BinaryKDTree<C>::build(
+    Iter insertBegin,
+    Iter insertEnd,
+    const DivMaskCalculator& calc,
+    size_t initialVar
+  ) {
+    MATHIC_ASSERT(insertBegin != insertEnd);
     typedef InsertTodo<Iter> Task;
     typedef std::vector<Task> TaskCont;
     TaskCont todo;
 
+    Node* top = 0;
     Interior* parent = 0;
     bool isEqualOrLessChild = false;
     while (true) {
       Node* node = 0;
       const size_t insertCount = std::distance(insertBegin, insertEnd);
-      const bool isLeaf = (insertCount <= C::LeafSize);
+      const bool isLeaf = (insertCount <= _leafSize);
       if (isLeaf)
-        node = new (_arena.allocObjectNoCon<Leaf>())
+        node = new (allocLeaf())
           Leaf(insertBegin, insertEnd, _arena, calc, _conf);
       else {
-        size_t var =
-          (parent == 0 ? static_cast<size_t>(-1) : parent->getVar());
+        size_t var = (parent == 0 ? initialVar : parent->getVar());
 
         Exponent exp;
         Iter middle = KDEntryArray<C, ExtEntry>::
           split(insertBegin, insertEnd, var, exp, _conf);
-        Interior* interior = new (_arena.allocObjectNoCon<Interior>())
-          Interior(var, exp);
+        Interior* interior = new (allocInterior()) Interior(var, exp);
 
         MATHIC_ASSERT(middle != insertBegin && middle != insertEnd);
         // push strictly-greater on todo
@@ -370,8 +507,8 @@ namespace mathic {
       }
 
       if (parent == 0) {
-        MATHIC_ASSERT(_root == 0);
-        _root = node;
+        MATHIC_ASSERT(top == 0);
+        top = node;
       } else if (isEqualOrLessChild)
         parent->setEqualOrLess(node);
       else
@@ -394,14 +531,14 @@ namespace mathic {
         // continue with equal-or-less as next item      
       }
     }
-    MATHIC_ASSERT(_root != 0);
+    MATHIC_ASSERT(top != 0);
 
-    if (C::UseTreeDivMask) {
+    if (C::UseTreeDivMask || ConfigFlags<C>::UseScoreBounds) {
       // record nodes in tree using breadth first search
       typedef std::vector<Interior*> NodeCont;
       NodeCont nodes;
-      if (_root->isInterior())
-        nodes.push_back(&_root->asInterior());
+      if (top->isInterior())
+        nodes.push_back(&top->asInterior());
       for (size_t i = 0; i < nodes.size(); ++i) {
         Interior* node = nodes[i];
         if (node->getEqualOrLess().isInterior())
@@ -416,9 +553,125 @@ namespace mathic {
         Interior* node = *it;
         node->updateToLowerBound(node->getEqualOrLess());
         node->updateToLowerBound(node->getStrictlyGreater());
+        node->updateScoreBoundFrom(node->getEqualOrLess(), _conf);
+        node->updateScoreBoundFrom(node->getStrictlyGreater(), _conf);
       }
     }
-    MATHIC_ASSERT(debugIsValid());
+    return top;
+  }
+
+  template<class C>
+  void BinaryKDTree<C>::partialRebuild(
+    const ExtEntry& extEntry,
+    const DivMaskCalculator& calc
+  ) {
+    MATHIC_ASSERT(ConfigFlags<C>::UsePartialRebuilds);
+    ++_partialRebuildCount;
+    MATHIC_ASSERT(_tmp.empty());
+    MATHIC_ASSERT(!_path.empty());
+    // Walk up the insertion path, accumulating the size of the subtree
+    // below each node, until finding a node whose subtree is too deep
+    // for its size. The root always qualifies as the whole tree is too
+    // deep. The work done here is proportional to the size of the subtree
+    // that gets rebuilt, which makes the cost amortized logarithmic.
+    const size_t height = _path.size();
+    size_t depth = height;
+    size_t size = subtreeSize(&_path.back()->getChildFor(extEntry, _conf));
+    while (depth > 0 && height - depth <= maxBalancedDepth(size)) {
+      --depth;
+      Interior& interior = *_path[depth];
+      Node& onPath = interior.getChildFor(extEntry, _conf);
+      size += subtreeSize(&onPath == &interior.getEqualOrLess() ?
+        &interior.getStrictlyGreater() : &interior.getEqualOrLess());
+    }
+
+    // Move the entries out of the subtree and recycle its nodes.
+    Interior* parent = depth == 0 ? 0 : _path[depth - 1];
+    Node* top = parent == 0 ? _root : &parent->getChildFor(extEntry, _conf);
+    const bool isEqualOrLessChild =
+      parent != 0 && top == &parent->getEqualOrLess();
+    std::vector<Entry> entries;
+    entries.reserve(size);
+    _tmp.push_back(top);
+    while (!_tmp.empty()) {
+      Node* node = _tmp.back();
+      _tmp.pop_back();
+      if (node->isInterior()) {
+        Interior& interior = node->asInterior();
+        _tmp.push_back(&interior.getStrictlyGreater());
+        _tmp.push_back(&interior.getEqualOrLess());
+        _freeInteriors.push_back(&interior);
+      } else {
+        Leaf& leaf = node->asLeaf();
+        for (LeafIt it = leaf.entries().begin();
+          it != leaf.entries().end(); ++it)
+          if (!leaf.entries().isDead(it))
+            entries.push_back(it->get());
+        _deadCount -= leaf.entries().deadCount();
+        leaf.entries().clear(); // calls destructors
+        _freeLeaves.push_back(&leaf);
+      }
+    }
+    MATHIC_ASSERT(entries.size() == size);
+
+    // The div masks of the entries are unchanged as calc is the calculator
+    // that they were computed with. The tree div mask on parent stays
+    // valid as the set of entries below it is the same.
+    const size_t var =
+      parent == 0 ? static_cast<size_t>(-1) : parent->getVar();
+    top = build(entries.begin(), entries.end(), calc, var);
+    if (parent == 0)
+      _root = top;
+    else if (isEqualOrLessChild)
+      parent->setEqualOrLess(top);
+    else
+      parent->setStrictlyGreater(top);
+    _path.clear();
+  }
+
+  template<class C>
+  size_t BinaryKDTree<C>::maxBalancedDepth(size_t entryCount) const {
+    // Allow twice the depth of a perfectly balanced tree plus some slack
+    // for small trees.
+    size_t depth = 2;
+    for (size_t leaves = entryCount / _leafSize; leaves > 0; leaves /= 2)
+      depth += 2;
+    return depth;
+  }
+
+  template<class C>
+  size_t BinaryKDTree<C>::subtreeSize(Node* node) const {
+    MATHIC_ASSERT(_tmp.empty());
+    size_t size = 0;
+    _tmp.push_back(node);
+    while (!_tmp.empty()) {
+      node = _tmp.back();
+      _tmp.pop_back();
+      while (node->isInterior()) {
+        _tmp.push_back(&node->asInterior().getStrictlyGreater());
+        node = &node->asInterior().getEqualOrLess();
+      }
+      size += node->asLeaf().entries().liveSize();
+    }
+    return size;
+  }
+
+  template<class C>
+  typename BinaryKDTree<C>::Leaf* BinaryKDTree<C>::allocLeaf() {
+    if (_freeLeaves.empty())
+      return _arena.allocObjectNoCon<Leaf>();
+    Leaf* leaf = _freeLeaves.back();
+    _freeLeaves.pop_back();
+    return leaf;
+  }
+
+  template<class C>
+  typename BinaryKDTree<C>::Interior* BinaryKDTree<C>::allocInterior() {
+    if (_freeInteriors.empty())
+      return _arena.allocObjectNoCon<Interior>();
+    Interior* interior = _freeInteriors.back();
+    _freeInteriors.pop_back();
+    return interior;
   }
 
   template<class C>
@@ -463,6 +716,85 @@ namespace mathic {
     return 0;
   }
 
+  template<class C>
+  typename BinaryKDTree<C>::Entry* BinaryKDTree<C>::findBestDivisor
+    (const ExtMonoRef& extMonomial) {
+    MATHIC_ASSERT(_tmp.empty());
+    if (_root == 0)
+      return 0;
+    Entry* best = 0;
+    typename C::Score bestScore = typename C::Score();
+    Node* node = _root;
+    while (true) {
+      while (node->isInterior()) {
+        Interior& interior = node->asInterior();
+        if (C::UseTreeDivMask &&
+            !interior.getDivMask().canDivide(extMonomial.getDivMask()))
+          goto next;
+        if (best != 0 && !interior.canBeat(bestScore))
+          goto next; // nothing in this sub tree scores better than best
+
+        if (interior.getExponent() <
+            _conf.getExponent(extMonomial.get(), interior.getVar()))
+          _tmp.push_back(&interior.getStrictlyGreater());
+        node = &interior.getEqualOrLess();
+      }
+      MATHIC_ASSERT(node->isLeaf());
+      node->asLeaf().entries().
+        findBestDivisor(extMonomial, best, bestScore, _conf);
+    next:
+      if (_tmp.empty())
+        break;
+      node = _tmp.back();
+      _tmp.pop_back();
+    }
+    MATHIC_ASSERT(_tmp.empty());
+    MATHIC_ASSERT(best == 0 || _conf.divides(*best, extMonomial.get()));
+    return best;
+  }
+
+  template<class C>
+  template<class S>
+  typename BinaryKDTree<C>::Entry* BinaryKDTree<C>::findDivisorWithScoreBelow
+    (const ExtMonoRef& extMonomial, const S& bound) {
+    MATHIC_ASSERT(_tmp.empty());
+    if (_root == 0)
+      return 0;
+    Node* node = _root;
+    while (true) {
+      while (node->isInterior()) {
+        Interior& interior = node->asInterior();
+        if (C::UseTreeDivMask &&
+            !interior.getDivMask().canDivide(extMonomial.getDivMask()))
+          goto next;
+        if (!interior.canBeat(bound))
+          goto next; // no score in this sub tree is below bound
+        if (interior.getExponent() <
+            _conf.getExponent(extMonomial.get(), interior.getVar()))
+          _tmp.push_back(&interior.getStrictlyGreater());
+        node = &interior.getEqualOrLess();
+      }
+      MATHIC_ASSERT(node->isLeaf());
+      {
+        KDEntryArray<C, ExtEntry>& entries = node->asLeaf().entries();
+        typename KDEntryArray<C, ExtEntry>::iterator it =
+          entries.findDivisorWithScoreBelow(extMonomial, bound, _conf);
+        if (it != entries.end()) {
+          MATHIC_ASSERT(_conf.divides(it->get(), extMonomial.get()));
+          _tmp.clear();
+          return &it->get();
+        }
+      }
+    next:
+      if (_tmp.empty())
+        break;
+      node = _tmp.back();
+      _tmp.pop_back();
+    }
+    MATHIC_ASSERT(_tmp.empty());
+    return 0;
+  }
+
   template<class C>
   template<class DO>
   void BinaryKDTree<C>::findAllDivisors(const ExtMonoRef& extMonomial, DO& output) {
@@ -530,6 +862,89 @@ next:
     MATHIC_ASSERT(_tmp.empty());
   }
 
+  template<class C>
+  template<bool Divisors>
+  class BinaryKDTree<C>::Range {
+  public:
+    Range(BinaryKDTree<C>& tree, const ExtMonoRef& extMonomial):
+      _conf(tree._conf), _monomial(extMonomial), _leaf(0), _entry(0) {
+      if (tree._root != 0)
+        _todo.push_back(tree._root);
+      settle();
+    }
+
+    bool empty() const {return _leaf == 0;}
+
+    Entry& front() const {
+      MATHIC_ASSERT(!empty());
+      return _entry->get();
+    }
+
+    void popFront() {
+      MATHIC_ASSERT(!empty());
+      ++_entry;
+      settle();
+    }
+
+  private:
+    typedef typename KDEntryArray<C, ExtEntry>::iterator EntryIter;
+
+    /** Walks down from node to a leaf, pushing the other branches that
+        can contain a match. Returns null if the div masks rule out the
+        rest of the walk. */
+    Leaf* enter(Node* node) {
+      while (node->isInterior()) {
+        Interior& interior = node->asInterior();
+        const bool greater = interior.getExponent() <
+          _conf.getExponent(_monomial.get(), interior.getVar());
+        if (Divisors) {
+          if (C::UseTreeDivMask &&
+            !interior.getDivMask().canDivide(_monomial.getDivMask()))
+            return 0;
+          if (greater)
+            _todo.push_back(&interior.getStrictlyGreater());
+          node = &interior.getEqualOrLess();
+        } else {
+          if (!greater)
+            _todo.push_back(&interior.getEqualOrLess());
+          node = &interior.getStrictlyGreater();
+        }
+      }
+      return &node->asLeaf();
+    }
+
+    /** Moves _entry forward to the next match, or sets _leaf to null if
+        there are no more matches. */
+    void settle() {
+      while (true) {
+        if (_leaf != 0) {
+          KDEntryArray<C, ExtEntry>& entries = _leaf->entries();
+          _entry = Divisors ?
+            entries.findNextDivisor(_monomial, _entry, _conf) :
+            entries.findNextMultiple(_monomial, _entry, _conf);
+          if (_entry != entries.end())
+            return;
+        }
+        do {
+          if (_todo.empty()) {
+            _leaf = 0;
+            return;
+          }
+          Node* node = _todo.back();
+          _todo.pop_back();
+          _leaf = enter(node);
+        } while (_leaf == 0);
+        _entry = _leaf->entries().begin();
+      }
+    }
+
+    const C& _conf;
+    ExtMonoRef _monomial;
+    std::vector<Node*> _todo; // sub trees not yet entered
+    Leaf* _leaf; // the leaf whose entries are being scanned
+    EntryIter _entry; // the current match in _leaf
+  };
+
   template<class C>
   template<class EO>
   void BinaryKDTree<C>::forAll(EO& output) {
@@ -575,15 +990,87 @@ next:
     }
     _arena.freeAllAllocs();
     _root = 0;
+    _entryCount = 0;
+    _deadCount = 0;
+    _freeLeaves.clear();
+    _freeInteriors.clear();
   }
 
   template<class C>
   size_t BinaryKDTree<C>::getMemoryUse() const {
 	size_t sum = _arena.getMemoryUse();
 	sum += _tmp.capacity() * sizeof(_tmp.front());
+	sum += _path.capacity() * sizeof(_path.front());
 	return sum;
   }
 
+  template<class C>
+  typename BinaryKDTree<C>::Entry* BinaryKDTree<C>::findDivisor
+    (const ExtMonoRef& extMonomial, KDTreeQueryStats& stats) {
+    // keep this in sync with the findDivisor that does no counting.
+    MATHIC_ASSERT(_tmp.empty());
+    ++stats.queries;
+    if (_root == 0)
+      return 0;
+    Node* node = _root;
+    while (true) {
+      ++stats.nodesVisited;
+      while (node->isInterior()) {
+        Interior& interior = node->asInterior();
+        if (C::UseTreeDivMask &&
+            !interior.getDivMask().canDivide(extMonomial.getDivMask())) {
+          ++stats.maskRejections;
+          goto next;
+        }
+        if (interior.getExponent() <
+            _conf.getExponent(extMonomial.get(), interior.getVar()))
+          _tmp.push_back(&interior.getStrictlyGreater());
+        node = &interior.getEqualOrLess();
+        ++stats.nodesVisited;
+      }
+
+      {
+        Leaf& leaf = node->asLeaf();
+        LeafIt leafIt = leaf.entries().findDivisor(extMonomial, _conf, stats);
+        if (leafIt != leaf.entries().end()) {
+          _tmp.clear();
+          return &leafIt->get();
+        }
+      }
+    next:
+      if (_tmp.empty())
+        break;
+      node = _tmp.back();
+      _tmp.pop_back();
+    }
+    MATHIC_ASSERT(_tmp.empty());
+    return 0;
+  }
+
+  template<class C>
+  void BinaryKDTree<C>::analyze(KDTreeAnalysis& analysis) const {
+    analysis.deadCount += _deadCount;
+    analysis.partialRebuilds += _partialRebuildCount;
+    if (_root == 0)
+      return;
+    std::vector<std::pair<const Node*, size_t> > todo;
+    todo.push_back(std::make_pair(_root, 0));
+    while (!todo.empty()) {
+      const Node* node = todo.back().first;
+      const size_t depth = todo.back().second;
+      todo.pop_back();
+      ++analysis.nodeCount;
+      if (node->isLeaf()) {
+        analysis.addLeaf(depth, node->asLeaf().entries().size());
+        continue;
+      }
+      const Interior& interior = node->asInterior();
+      analysis.addSplit(interior.getVar());
+      todo.push_back(std::make_pair(&interior.getEqualOrLess(), depth + 1));
+      todo.push_back(std::make_pair(&interior.getStrictlyGreater(), depth + 1));
+    }
+  }
+
   template<class C>
   void BinaryKDTree<C>::print(std::ostream& out) const {
     out << "<<<<<<<< BinaryKDTree >>>>>>>>\n";
@@ -671,6 +1158,8 @@ next:
           _tmp.push_back(&node->asInterior().getEqualOrLess());
         } else {
           MATHIC_ASSERT(node->asLeaf().entries().allLessThanOrEqualTo(var, exp, _conf));
+          MATHIC_ASSERT(interior.isScoreBoundOf(node->asLeaf().entries().begin(),
+            node->asLeaf().entries().end(), _conf));
         }
       }
 
@@ -690,6 +1179,8 @@ next:
           _tmp.push_back(&node->asInterior().getEqualOrLess());
         } else {
           MATHIC_ASSERT(node->asLeaf().entries().allStrictlyGreaterThan(var, exp, _conf));
+          MATHIC_ASSERT(interior.isScoreBoundOf(node->asLeaf().entries().begin(),
+            node->asLeaf().entries().end(), _conf));
         }
       }
     }
@@ -772,6 +1263,10 @@ next:
     Leaf* insertLeaf = &interior.getChildFor(extEntry, conf).asLeaf();
     MATHIC_ASSERT(insertLeaf->entries().size() < C::LeafSize);
     insertLeaf->entries().insert(extEntry, conf);
+    if (ConfigFlags<C>::UseScoreBounds) {
+      interior.updateScoreBoundFrom(*this, conf);
+      interior.updateScoreBoundFrom(other, conf);
+    }
 
     return interior;
   }
@@ -171,6 +171,22 @@ namespace mathic {
     return out.str();
   }
 
+  std::string ColumnPrinter::nanosInUnit(unsigned long long nanos) {
+	std::ostringstream out;
+	if (nanos < 1000) {
+	  out << nanos << "ns";
+    } else {
+	  const char* units[] = {"us", "ms", "s"};
+	  const size_t unitCount = sizeof(units) / sizeof(*units);
+	  double amount = static_cast<double>(nanos) / 1000.0;
+	  size_t i = 0;
+	  for (i = 0; i + 1 < unitCount && amount >= 1000; ++i)
+        amount /= 1000.0;
+	  out << oneDecimal(amount) << units[i];
+    }
+    return out.str();
+  }
+
 
   std::ostream& operator<<(std::ostream& out, const ColumnPrinter& printer) {
 	printer.print(out);
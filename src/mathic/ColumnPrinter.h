@@ -46,6 +46,9 @@ namespace mathic {
 	/** Prints as X bytes, X kilobytes, X megabytes etc. */
     static std::string bytesInUnit(unsigned long long bytes);
 
+	/** Prints as X ns, X us, X ms or X s. */
+    static std::string nanosInUnit(unsigned long long nanos);
+
   private:
 	struct Col {
 	  std::string prefix;
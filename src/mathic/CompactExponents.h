@@ -0,0 +1,123 @@
+#ifndef MATHIC_COMPACT_EXPONENTS_GUARD
+#define MATHIC_COMPACT_EXPONENTS_GUARD
+
+#include "stdinc.h"
+#include "ConfigFlags.h"
+#include "DivMask.h"
+
+namespace mathic {
+  /** The unsigned type of the given number of bits used to store
+      compact exponents. Only 8 and 16 bits are supported. */
+  template<size_t Bits>
+  struct CompactExponentWord;
+  template<>
+  struct CompactExponentWord<8> {typedef unsigned char Type;};
+  template<>
+  struct CompactExponentWord<16> {typedef unsigned short Type;};
+
+  template<class C, class Ext, size_t Bits>
+  class CompactExtender;
+
+  /** Type is Ext extended with a compact copy of the exponents if
+      Bits is not zero. Type is just Ext if Bits is zero, so there is no
+      overhead when compact exponents are turned off. */
+  template<class C, class Ext,
+    size_t Bits = ConfigFlags<C>::CompactExponentBits>
+  struct WithCompactExponents {
+    typedef CompactExtender<C, Ext, Bits> Type;
+  };
+  template<class C, class Ext>
+  struct WithCompactExponents<C, Ext, 0> {
+    typedef Ext Type;
+  };
+
+  /** Extends a DivMask::Extender with a copy of the exponents of its
+      entry packed into Bits bits per exponent, stored inside the object
+      itself. Divisibility checks between two such objects then only
+      touch the objects and not the memory of the entries. That works
+      for up to ConfigFlags<C>::CompactVarCount variables.
+
+      Exponents that do not fit are stored as the largest value that
+      does fit. Such a saturated copy can still serve as the dividend of
+      a divisibility check since the divisor cannot exceed the saturated
+      value without also exceeding the actual value. A saturated copy
+      cannot serve as a divisor, so such checks, and checks with too many
+      variables or with negative exponents, fall back to
+      Configuration::divides. */
+  template<class C, class Ext, size_t Bits>
+  class CompactExtender : public Ext {
+  public:
+    typedef typename CompactExponentWord<Bits>::Type Word;
+    typedef typename C::Exponent Exponent;
+    static const size_t VarCapacity = ConfigFlags<C>::CompactVarCount;
+
+    CompactExtender(): Ext(), _state(NotCompact) {}
+
+    template<class T>
+    CompactExtender(
+      const T& t,
+      const DivMask::Calculator<C>& calc,
+      const C& conf
+    ):
+      Ext(t, calc, conf) {
+      setCompactExponents(conf);
+    }
+
+    template<class S>
+    bool divides(const CompactExtender<C, S, Bits>& t, const C& conf) const {
+      if (!this->canDivide(t))
+        return false;
+      if (_state != Exact || t._state == NotCompact)
+        return conf.divides(this->get(), t.get());
+      // unused slots are zero in both, so checking all of them is
+      // correct and lets the compiler unroll the loop.
+      unsigned int notDivides = 0;
+      for (size_t var = 0; var < VarCapacity; ++var)
+        notDivides |= t._exponents[var] < _exponents[var];
+      MATHIC_ASSERT((notDivides == 0) == conf.divides(this->get(), t.get()));
+      return notDivides == 0;
+    }
+
+    /** Returns true if the compact exponents are equal to the exponents
+        of the entry. */
+    bool hasExactCompactExponents() const {return _state == Exact;}
+
+  private:
+    template<class C2, class Ext2, size_t Bits2>
+    friend class CompactExtender;
+
+    void setCompactExponents(const C& conf) {
+      const size_t varCount = conf.getVarCount();
+      _state = NotCompact;
+      if (varCount > VarCapacity)
+        return;
+      const Word maxWord = static_cast<Word>(~static_cast<Word>(0));
+      const Exponent maxExponent = static_cast<Exponent>(maxWord);
+      State state = Exact;
+      for (size_t var = 0; var < varCount; ++var) {
+        const Exponent e = conf.getExponent(this->get(), var);
+        if (e < static_cast<Exponent>(0))
+          return;
+        if (maxExponent < e) {
+          _exponents[var] = maxWord;
+          state = Saturated;
+        } else
+          _exponents[var] = static_cast<Word>(e);
+      }
+      for (size_t var = varCount; var < VarCapacity; ++var)
+        _exponents[var] = 0;
+      _state = state;
+    }
+
+    enum State {
+      Exact, /// the compact exponents are the exponents of the entry
+      Saturated, /// some exponents did not fit and were saturated
+      NotCompact /// there are no compact exponents
+    };
+
+    Word _exponents[VarCapacity];
+    unsigned char _state; // a State, stored compactly
+  };
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef MATHIC_COMPONENT_DIV_FINDER_GUARD
+#define MATHIC_COMPONENT_DIV_FINDER_GUARD
+
+#include "stdinc.h"
+#include "KDTree.h"
+#include "DivFinderHelper.h"
+#include <vector>
+#include <string>
+
+namespace mathic {
+  /** An object that supports queries for divisors of a module monomial.
+      A module monomial is a monomial together with a component, which is
+      a non-negative integer. One module monomial divides another if they
+      have the same component and the monomial of the first divides the
+      monomial of the second. It has the same interface as KDTree, so it
+      can be used in its place. See DivFinder.h and KDTree.h for more
+      documentation.
+
+      The entries of each component are kept in a separate KDTree, so no
+      query ever looks at entries of a different component. The component
+      is not a variable, so the trees never split on it and the div masks
+      use all their bits on the actual variables. The tree of a component
+      is created the first time an entry of that component is inserted.
+      Components are used as indices, so they should be small.
+
+      Extra fields for Configuration in addition to those for KDTree:
+
+      * size_t getComponent(const Monomial& monomial) const
+      Return the component of monomial. There must also be an overload
+      that takes an Entry.
+
+      getVarCount, getExponent and the other fields of KDTree must refer
+      only to the variables and not to the component. The configuration
+      is copied into each tree, so changes made through
+      getConfiguration() do not affect the trees that already exist. */
+  template<class Configuration>
+  class ComponentDivFinder;
+
+  template<class C>
+  class ComponentDivFinder {
+  public:
+    typedef C Configuration;
+    typedef KDTree<C> Tree;
+    typedef typename C::Monomial Monomial;
+    typedef typename C::Entry Entry;
+    typedef typename C::Exponent Exponent;
+
+    ComponentDivFinder(const C& configuration):
+      _conf(configuration), _size(0) {}
+    ~ComponentDivFinder();
+
+    /** Returns whether there are any entries. */
+    bool empty() const {return size() == 0;}
+
+    /** Returns the number of entries. */
+    size_t size() const {return _size;}
+
+    /** Returns a string that describes the data structure. */
+    std::string getName() const;
+
+    /** Returns a reference to this object's configuration object. */
+    C& getConfiguration() {return _conf;}
+
+    /** Returns a reference to this object's configuration object. */
+    const C& getConfiguration() const {return _conf;}
+
+    /** Returns one more than the largest component that has had an
+        entry inserted into it. */
+    size_t getComponentCount() const {return _trees.size();}
+
+    /** Returns the tree for component. Returns null if no entry of that
+        component has ever been inserted. */
+    const Tree* getTree(size_t component) const {
+      return component < _trees.size() ? _trees[component] : 0;
+    }
+
+    /** Removes all multiples of monomial. A duplicate counts
+        as a multiple. Returns true if any multiples were removed. */
+    bool removeMultiples(const Monomial& monomial) {
+      Tree* tree = findTree(monomial);
+      if (tree == 0)
+        return false;
+      const size_t before = tree->size();
+      if (!tree->removeMultiples(monomial))
+        return false;
+      _size -= before - tree->size();
+      return true;
+    }
+
+    /** Removes all multiples of monomial. A duplicate counts
+        as a multiple. Returns true if any multiples were removed.
+        Calls out.push_back(entry) for each entry that is removed. */
+    template<class MultipleOutput>
+    bool removeMultiples(const Monomial& monomial, MultipleOutput& out) {
+      Tree* tree = findTree(monomial);
+      if (tree == 0)
+        return false;
+      const size_t before = tree->size();
+      if (!tree->removeMultiples(monomial, out))
+        return false;
+      _size -= before - tree->size();
+      return true;
+    }
+
+    /** Calls out.proceed(entry) for each entry that monomial divides.
+        The method returns if proceed returns false, otherwise the
+        search for divisors proceeds. */
+    template<class Output>
+    void findAllMultiples(const Monomial& monomial, Output& out) {
+      Tree* tree = findTree(monomial);
+      if (tree != 0)
+        tree->findAllMultiples(monomial, out);
+    }
+
+    /** Calls out.proceed(entry) for each entry that monomial divides.
+        The method returns if proceed returns false, otherwise the
+        search for divisors proceeds. */
+    template<class Output>
+    void findAllMultiples(const Monomial& monomial, Output& out) const {
+      const Tree* tree = findTree(monomial);
+      if (tree != 0)
+        tree->findAllMultiples(monomial, out);
+    }
+
+    /** Inserts entry into the data structure. Does NOT remove multiples
+        of entry and entry is inserted even if it is a multiple of another
+        entry. */
+    void insert(const Entry& entry) {
+      makeTree(_conf.getComponent(entry)).insert(entry);
+      ++_size;
+    }
+
+    /** Inserts the entries in the range [begin, end) into the data
+        structure. Does NOT remove multiples of entry and entry is inserted
+        even if it is a multiple of another entry.
+
+        The elements in the range [begin, end) may be rearranged by this
+        function, so the range must be mutable. If that is not acceptable,
+        call the one element insert method for each element. */
+    template<class Iter>
+    void insert(Iter begin, Iter end);
+
+    /** Removes an element whose exponents and component are equal to
+        monomial's. Returns false if there are no such monomials in the
+        data structure. */
+    bool removeElement(const Monomial& monomial) {
+      Tree* tree = findTree(monomial);
+      if (tree == 0 || !tree->removeElement(monomial))
+        return false;
+      --_size;
+      return true;
+    }
+
+    /** Returns true if there is an entry whose exponents and component
+        are equal to monomial's. */
+    bool contains(const Monomial& monomial) const {
+      const Tree* tree = findTree(monomial);
+      return tree != 0 && tree->contains(monomial);
+    }
+
+    /** Returns a pointer to an entry that divides monomial. Returns null
+        if no entries divide monomial. */
+    Entry* findDivisor(const Monomial& monomial) {
+      Tree* tree = findTree(monomial);
+      return tree == 0 ? 0 : tree->findDivisor(monomial);
+    }
+
+    /** Returns the position of a divisor of monomial. Returns null if no
+        entries divide monomial. */
+    const Entry* findDivisor(const Monomial& monomial) const {
+      return const_cast<ComponentDivFinder<C>&>(*this).findDivisor(monomial);
+    }
+
+    /** Returns a pointer to an entry that divides monomial and that has
+        the lowest score among those entries. Returns null if no entries
+        divide monomial. */
+    Entry* findBestDivisor(const Monomial& monomial) {
+      Tree* tree = findTree(monomial);
+      return tree == 0 ? 0 : tree->findBestDivisor(monomial);
+    }
+
+    /** Returns a pointer to an entry that divides monomial and that has
+        the lowest score among those entries. Returns null if no entries
+        divide monomial. */
+    const Entry* findBestDivisor(const Monomial& monomial) const {
+      return const_cast<ComponentDivFinder<C>&>(*this).
+        findBestDivisor(monomial);
+    }
+
+    /** Returns a pointer to an entry that divides monomial and that has
+        a score lower than bound. Returns null if there is no such entry. */
+    template<class Score>
+    Entry* findDivisorWithScoreBelow
+      (const Monomial& monomial, const Score& bound) {
+      Tree* tree = findTree(monomial);
+      return tree == 0 ? 0 : tree->findDivisorWithScoreBelow(monomial, bound);
+    }
+
+    /** Returns a pointer to an entry that divides monomial and that has
+        a score lower than bound. Returns null if there is no such entry. */
+    template<class Score>
+    const Entry* findDivisorWithScoreBelow
+      (const Monomial& monomial, const Score& bound) const {
+      return const_cast<ComponentDivFinder<C>&>(*this).
+        findDivisorWithScoreBelow(monomial, bound);
+    }
+
+    /** Calls out.proceed(entry) for each entry that divides monomial.
+        The method returns if proceed returns false, otherwise the
+        search for divisors proceeds. */
+    template<class DivisorOutput>
+    void findAllDivisors(const Monomial& monomial, DivisorOutput& out) {
+      Tree* tree = findTree(monomial);
+      if (tree != 0)
+        tree->findAllDivisors(monomial, out);
+    }
+
+    /** Calls output.proceed(entry) for each entry that divides monomial.
+        The method returns if proceed returns false, otherwise the
+        search for divisors proceeds. */
+    template<class DivisorOutput>
+    void findAllDivisors(const Monomial& monomial, DivisorOutput& out) const {
+      const Tree* tree = findTree(monomial);
+      if (tree != 0)
+        tree->findAllDivisors(monomial, out);
+    }
+
+    /** Calls output.proceed(entry) for each entry, going through the
+        components in increasing order. The method returns if proceed
+        returns false, otherwise the search for divisors proceeds. */
+    template<class EntryOutput>
+    void forAll(EntryOutput& out) {
+      DivFinderHelper::StopRecorder<Entry, EntryOutput> recorder(out);
+      for (size_t i = 0; i < _trees.size(); ++i) {
+        if (_trees[i] == 0)
+          continue;
+        _trees[i]->forAll(recorder);
+        if (recorder.stopped())
+          return;
+      }
+    }
+
+    /** Calls out.proceed(entry) for each entry, going through the
+        components in increasing order. The method returns if proceed
+        returns false, otherwise the search for divisors proceeds. */
+    template<class EntryOutput>
+    void forAll(EntryOutput& out) const {
+      DivFinderHelper::StopRecorder<Entry, EntryOutput> recorder(out);
+      for (size_t i = 0; i < _trees.size(); ++i) {
+        if (_trees[i] == 0)
+          continue;
+        const Tree& tree = *_trees[i];
+        tree.forAll(recorder);
+        if (recorder.stopped())
+          return;
+      }
+    }
+
+    /** Removes all entries. Does not reset the configuration object. */
+    void clear() {
+      for (size_t i = 0; i < _trees.size(); ++i)
+        if (_trees[i] != 0)
+          _trees[i]->clear();
+      _size = 0;
+    }
+
+    /** Rebuilds the tree of each component. */
+    void rebuild() {
+      for (size_t i = 0; i < _trees.size(); ++i)
+        if (_trees[i] != 0)
+          _trees[i]->rebuild();
+    }
+
+	/** Returns the number of bytes allocated by this object. Does not
+		include sizeof(*this), does not include any additional memory
+		that the configuration may have allocated and does not include
+		any memory that an Entry may point to. Does include
+		sizeof(Entry) as well as unused memory that is being kept to
+		avoid frequent allocations. */
+    size_t getMemoryUse() const {
+      size_t sum = _trees.capacity() * sizeof(Tree*);
+      for (size_t i = 0; i < _trees.size(); ++i)
+        if (_trees[i] != 0)
+          sum += sizeof(Tree) + _trees[i]->getMemoryUse();
+      return sum;
+    }
+
+  private:
+    ComponentDivFinder(const ComponentDivFinder<C>&); // unavailable
+    void operator=(const ComponentDivFinder<C>&); // unavailable
+
+    /** Returns the tree for the component of monomial, or null if there
+        is no such tree. */
+    Tree* findTree(const Monomial& monomial) {
+      const size_t component = _conf.getComponent(monomial);
+      return component < _trees.size() ? _trees[component] : 0;
+    }
+
+    const Tree* findTree(const Monomial& monomial) const {
+      return const_cast<ComponentDivFinder<C>&>(*this).findTree(monomial);
+    }
+
+    /** Returns the tree for component, creating it if necessary. */
+    Tree& makeTree(size_t component) {
+      if (component >= _trees.size())
+        _trees.resize(component + 1);
+      if (_trees[component] == 0)
+        _trees[component] = new Tree(_conf);
+      return *_trees[component];
+    }
+
+    C _conf;
+    std::vector<Tree*> _trees; /// _trees[c] is null or the tree for c.
+    size_t _size;
+  };
+
+  template<class C>
+  ComponentDivFinder<C>::~ComponentDivFinder() {
+    for (size_t i = 0; i < _trees.size(); ++i)
+      delete _trees[i];
+  }
+
+  template<class C>
+  std::string ComponentDivFinder<C>::getName() const {
+    return "Component " + Tree(_conf).getName();
+  }
+
+  template<class C>
+  template<class Iter>
+  void ComponentDivFinder<C>::insert(Iter begin, Iter end) {
+    // Partition by component so that each tree is built in one go, which
+    // makes for balanced trees.
+    std::vector<std::vector<Entry> > parts;
+    for (; begin != end; ++begin) {
+      const size_t component = _conf.getComponent(*begin);
+      if (component >= parts.size())
+        parts.resize(component + 1);
+      parts[component].push_back(*begin);
+    }
+    for (size_t component = 0; component < parts.size(); ++component) {
+      if (parts[component].empty())
+        continue;
+      makeTree(component).insert
+        (parts[component].begin(), parts[component].end());
+      _size += parts[component].size();
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef MATHIC_CONFIG_FLAGS_GUARD
+#define MATHIC_CONFIG_FLAGS_GUARD
+
+#include "stdinc.h"
+#include <cstddef>
+
+namespace mathic {
+  namespace ConfigFlagsHelper {
+    typedef char Yes;
+    struct No {char no[2];};
+
+    /** Only a valid type if the flag it is given exists, so that the
+        overload that takes it is removed when the flag does not exist. */
+    template<size_t Flag>
+    struct Probe {};
+  }
+
+  /** Defines ConfigFlagsHelper::Get##NAME<C>::value as C::NAME if the
+      Configuration C has a static integral constant called NAME and
+      otherwise as 0, which is false for a bool. */
+#define MATHIC_CONFIG_FLAG(TYPE, NAME)                                    \
+  namespace ConfigFlagsHelper {                                           \
+    template<class C>                                                     \
+    struct Has##NAME {                                                    \
+      template<class T>                                                   \
+      static Yes test(Probe<T::NAME>*);                                   \
+      template<class T>                                                   \
+      static No test(...);                                                \
+      static const bool value = sizeof(test<C>(0)) == sizeof(Yes);        \
+    };                                                                    \
+    template<class C, bool Has = Has##NAME<C>::value>                     \
+    struct Get##NAME {                                                    \
+      static const TYPE value = 0;                                        \
+    };                                                                    \
+    template<class C>                                                     \
+    struct Get##NAME<C, true> {                                           \
+      static const TYPE value = C::NAME;                                  \
+    };                                                                    \
+  }
+
+  MATHIC_CONFIG_FLAG(bool, UsePartialRebuilds)
+  MATHIC_CONFIG_FLAG(bool, UseScoreBounds)
+  MATHIC_CONFIG_FLAG(size_t, CompactExponentBits)
+  MATHIC_CONFIG_FLAG(size_t, CompactVarCount)
+  MATHIC_CONFIG_FLAG(bool, UseHashIndex)
+  MATHIC_CONFIG_FLAG(bool, UseTombstones)
+  MATHIC_CONFIG_FLAG(bool, UseAutoTuning)
+  MATHIC_CONFIG_FLAG(bool, UseDegreeBuckets)
+  MATHIC_CONFIG_FLAG(bool, UseMaskArray)
+
+#undef MATHIC_CONFIG_FLAG
+
+  /** The optional flags of a Configuration C. A flag that C does not
+      define is false, or 0 for the sizes, which turns off the feature
+      that it is for. So a Configuration that was written before a flag
+      was added keeps compiling and keeps doing what it did. Always read
+      these flags through this class rather than directly from C. */
+  template<class C>
+  struct ConfigFlags {
+    static const bool UsePartialRebuilds =
+      ConfigFlagsHelper::GetUsePartialRebuilds<C>::value;
+    static const bool UseScoreBounds =
+      ConfigFlagsHelper::GetUseScoreBounds<C>::value;
+    static const size_t CompactExponentBits =
+      ConfigFlagsHelper::GetCompactExponentBits<C>::value;
+    static const size_t CompactVarCount =
+      ConfigFlagsHelper::GetCompactVarCount<C>::value;
+    static const bool UseHashIndex =
+      ConfigFlagsHelper::GetUseHashIndex<C>::value;
+    static const bool UseTombstones =
+      ConfigFlagsHelper::GetUseTombstones<C>::value;
+    static const bool UseAutoTuning =
+      ConfigFlagsHelper::GetUseAutoTuning<C>::value;
+    static const bool UseDegreeBuckets =
+      ConfigFlagsHelper::GetUseDegreeBuckets<C>::value;
+    static const bool UseMaskArray =
+      ConfigFlagsHelper::GetUseMaskArray<C>::value;
+  };
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef MATHIC_DIV_FINDER_HELPER_GUARD
+#define MATHIC_DIV_FINDER_HELPER_GUARD
+
+#include "stdinc.h"
+
+namespace mathic {
+  /** Pieces shared by the div finders that are built from several
+      other div finders, such as ShardedDivFinder and
+      ComponentDivFinder. */
+  namespace DivFinderHelper {
+    /** Passes entries on to out and records if out asked to stop, so
+        that a query over several finders can stop after the finder
+        where out stopped. */
+    template<class Entry, class Output>
+    class StopRecorder {
+    public:
+      StopRecorder(Output& out): _out(out), _stopped(false) {}
+      bool proceed(Entry& entry) {return record(_out.proceed(entry));}
+      bool proceed(const Entry& entry) {return record(_out.proceed(entry));}
+      bool stopped() const {return _stopped;}
+    private:
+      bool record(bool proceed) {
+        _stopped = !proceed;
+        return proceed;
+      }
+      Output& _out;
+      bool _stopped;
+    };
+  }
+}
+
+#endif
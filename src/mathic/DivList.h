@@ -2,8 +2,13 @@
 #define MATHIC_DIV_ARRAY_GUARD
 
 #include "stdinc.h"
+#include "ConfigFlags.h"
+#include "Profiler.h"
 #include "DivMask.h"
 #include "Comparer.h"
+#include "HashIndex.h"
+#include "DivMaskArray.h"
+#include "error.h"
 #include <memtailor.h>
 #include <vector>
 #include <string>
@@ -15,7 +20,9 @@ namespace mathic {
   /** An object that supports queries for divisors of a monomial using
       an array of monomials. See DivFinder for more documentation.
 
-      Extra fields for Configuration:
+      Extra fields for Configuration. The static flags from
+      UseDegreeBuckets on are optional and are false if left out. See
+      ConfigFlags.h.
 
       * static const bool UseLinkedList
       Use a linked list if true, otherwise use an array.
@@ -25,6 +32,38 @@ namespace mathic {
 
       * bool getSortOnInsert() const
       Keep the monomials sorted to speed up queries.
+
+      * static const bool UseDegreeBuckets
+      If true, the entries are kept ordered by total degree, which is
+      cached in each entry, so each degree forms a contiguous bucket. A
+      divisor cannot have higher degree than the monomial it divides, so
+      divisor queries stop at the first bucket of too high degree and
+      findAllMultiples starts at the first bucket of high enough degree.
+      moveToFront then moves an entry to the front of its bucket. Cannot
+      be combined with getSortOnInsert(), and the constructor reports an
+      error if both are on.
+
+      * static const bool UseMaskArray
+      If true, the div masks of the entries are also kept in a dense
+      array separate from the entries, and divisor queries scan that
+      array to find the candidates before looking at any entries. See
+      DivMaskArray.h. Ignored unless UseDivMask is true and
+      UseLinkedList is false. Changes other than appending an entry
+      recompute the array, which takes time proportional to the size
+      of the list, as does the change itself.
+
+      * static const bool UseHashIndex
+      If true, a hash table of the entries is kept alongside the list so
+      that contains takes expected constant time, as does removeElement
+      when there is no matching entry. See HashIndex.h.
+
+      * A function size_t getHash(Monomial m) const
+      Only needed if UseHashIndex is true. It must also accept an Entry,
+      and monomials with the same exponents must have the same hash.
+
+      * A type Score and a function Score getScore(Entry e) const
+      Only needed if calling findBestDivisor or findDivisorWithScoreBelow.
+      Score must have an operator< and a lower score is better.
   */
   template<class Configuration>
     class DivList;
@@ -43,6 +82,160 @@ namespace mathic {
       struct ListImpl<true, Entry> {
       typedef std::list<Entry> Impl;
     };
+
+    /** Extends Ext with the total degree of its entry. */
+    template<class C, class Ext>
+    class DegreeExtender : public Ext {
+    public:
+      typedef typename C::Exponent Degree;
+
+      DegreeExtender(): Ext(), _degree() {}
+
+      template<class T>
+      DegreeExtender(
+        const T& t,
+        const DivMask::Calculator<C>& calc,
+        const C& conf
+      ):
+        Ext(t, calc, conf), _degree() {
+        const size_t varCount = conf.getVarCount();
+        for (size_t var = 0; var < varCount; ++var)
+          _degree = _degree + conf.getExponent(t, var);
+      }
+
+      const Degree& getDegree() const {return _degree;}
+
+    private:
+      Degree _degree;
+    };
+
+    /** Type is Ext extended with its degree if UseDegreeBuckets is true
+        and otherwise it is just Ext. */
+    template<class C, class Ext,
+      bool UseDegreeBuckets = ConfigFlags<C>::UseDegreeBuckets>
+    struct WithDegree {
+      typedef DegreeExtender<C, Ext> Type;
+    };
+    template<class C, class Ext>
+    struct WithDegree<C, Ext, false> {
+      typedef Ext Type;
+    };
+
+    /** Keeps a list ordered by degree if UseDegreeBuckets is true. The
+        versions for false keep no order and never prune anything. */
+    template<bool UseDegreeBuckets>
+    struct Buckets;
+
+    template<>
+    struct Buckets<true> {
+      struct DegreeLess {
+        template<class A, class B>
+        bool operator()(const A& a, const B& b) const {
+          return a.getDegree() < b.getDegree();
+        }
+      };
+
+      /** Returns true if a has too high degree to divide b. Since the
+          list is ordered by degree, then so do all entries after a. */
+      template<class A, class B>
+      static bool tooHighToDivide(const A& a, const B& b) {
+        return b.getDegree() < a.getDegree();
+      }
+
+      /** Inserts entry at the end of its bucket. Returns where. */
+      template<class E>
+      static typename std::vector<E>::iterator
+      insert(std::vector<E>& list, const E& entry) {
+        return list.insert
+          (std::upper_bound(list.begin(), list.end(), entry, DegreeLess()),
+          entry);
+      }
+
+      template<class E>
+      static typename std::list<E>::iterator
+      insert(std::list<E>& list, const E& entry) {
+        // new entries tend to have high degree, so search from the back.
+        typename std::list<E>::iterator it = list.end();
+        while (it != list.begin()) {
+          typename std::list<E>::iterator prev = it;
+          --prev;
+          if (!(entry.getDegree() < prev->getDegree()))
+            break;
+          it = prev;
+        }
+        return list.insert(it, entry);
+      }
+
+      template<class E>
+      static void sortAll(std::vector<E>& list) {
+        std::stable_sort(list.begin(), list.end(), DegreeLess());
+      }
+
+      template<class E>
+      static void sortAll(std::list<E>& list) {
+        list.sort(DegreeLess());
+      }
+
+      /** Returns the first entry that has high enough degree to be a
+          multiple of monomial. */
+      template<class E, class M>
+      static typename std::vector<E>::iterator
+      firstMultipleCandidate(std::vector<E>& list, const M& monomial) {
+        return std::lower_bound
+          (list.begin(), list.end(), monomial, DegreeLess());
+      }
+
+      template<class E, class M>
+      static typename std::list<E>::iterator
+      firstMultipleCandidate(std::list<E>& list, const M& monomial) {
+        typename std::list<E>::iterator it = list.begin();
+        while (it != list.end() && it->getDegree() < monomial.getDegree())
+          ++it;
+        return it;
+      }
+
+      /** Moves pos to the front of its bucket. Returns where it is now. */
+      template<class E, class It>
+      static It moveToFront(std::vector<E>& list, It pos) {
+        It bucketBegin =
+          std::lower_bound(list.begin(), pos, *pos, DegreeLess());
+        std::rotate(bucketBegin, pos, pos + 1);
+        return bucketBegin;
+      }
+
+      template<class E, class It>
+      static It moveToFront(std::list<E>& list, It pos) {
+        It bucketBegin = pos;
+        while (bucketBegin != list.begin()) {
+          It prev = bucketBegin;
+          --prev;
+          if (prev->getDegree() < pos->getDegree())
+            break;
+          bucketBegin = prev;
+        }
+        list.splice(bucketBegin, list, pos);
+        return pos;
+      }
+    };
+
+    template<>
+    struct Buckets<false> {
+      template<class A, class B>
+      static bool tooHighToDivide(const A& a, const B& b) {return false;}
+      template<class L, class E>
+      static typename L::iterator insert(L& list, const E& entry) {
+        list.push_back(entry);
+        typename L::iterator last = list.end();
+        return --last;
+      }
+      template<class L>
+      static void sortAll(L& list) {}
+      template<class L, class M>
+      static typename L::iterator firstMultipleCandidate
+        (L& list, const M& monomial) {return list.begin();}
+      template<class L, class It>
+      static It moveToFront(L& list, It pos);
+    };
   }
 
   template<class C>
@@ -55,11 +248,16 @@ namespace mathic {
 
     static const bool UseLinkedList = C::UseLinkedList;
     static const bool UseDivMask = C::UseDivMask;
+    static const bool UseMaskArray =
+      ConfigFlags<C>::UseMaskArray && C::UseDivMask && !C::UseLinkedList;
 
   private:
-    typedef typename DivMask::Extender<Entry, C::UseDivMask> ExtEntry;
-    typedef typename DivMask::Extender<const Monomial&,C::UseDivMask> ExtMonoRef;
+    typedef typename DivListHelper::WithDegree
+      <C, DivMask::Extender<Entry, C::UseDivMask> >::Type ExtEntry;
+    typedef typename DivListHelper::WithDegree
+      <C, DivMask::Extender<const Monomial&, C::UseDivMask> >::Type ExtMonoRef;
     typedef typename DivMask::Calculator<C> DivMaskCalculator;
+    typedef DivListHelper::Buckets<ConfigFlags<C>::UseDegreeBuckets> Buckets;
 
     typedef typename DivListHelper::ListImpl<C::UseLinkedList, ExtEntry>::Impl
       List;
@@ -83,11 +281,29 @@ namespace mathic {
 
     bool removeElement(const Monomial& monomial);
 
+    /** Returns true if there is an entry whose exponents are equal to
+        monomial's. */
+    bool contains(const Monomial& monomial) const;
+
     iterator findDivisorIterator(const Monomial& monomial);
 
     Entry* findDivisor(const Monomial& monomial);
     const Entry* findDivisor(const Monomial& monomial) const;
 
+    /** Returns a divisor of monomial with the lowest score. Returns null
+        if no entries divide monomial. */
+    Entry* findBestDivisor(const Monomial& monomial);
+    const Entry* findBestDivisor(const Monomial& monomial) const;
+
+    /** Returns a divisor of monomial with a score lower than bound.
+        Returns null if there is no such divisor. */
+    template<class Score>
+    Entry* findDivisorWithScoreBelow
+      (const Monomial& monomial, const Score& bound);
+    template<class Score>
+    const Entry* findDivisorWithScoreBelow
+      (const Monomial& monomial, const Score& bound) const;
+
     template<class DO>
     void findAllDivisors(const Monomial& monomial, DO& out);
     template<class DO>
@@ -107,6 +323,29 @@ namespace mathic {
     template<class EntryOutput>
     void forAll(EntryOutput& output) const;
 
+    /** A range of the entries that divide a monomial if Divisors is
+        true or of the entries that the monomial divides if Divisors is
+        false. The range offers empty(), front() and popFront() and finds
+        each entry only when it is asked for. It is invalidated by any
+        change to the DivList and it keeps a reference to the monomial,
+        which must stay alive while the range is in use. */
+    template<bool Divisors>
+    class Range;
+    typedef Range<true> DivisorRange;
+    typedef Range<false> MultipleRange;
+
+    /** Returns a range of the entries that divide monomial. */
+    DivisorRange divisorRange(const Monomial& monomial) {
+      return DivisorRange
+        (*this, ExtMonoRef(monomial, _divMaskCalculator, _conf));
+    }
+
+    /** Returns a range of the entries that monomial divides. */
+    MultipleRange multipleRange(const Monomial& monomial) {
+      return MultipleRange
+        (*this, ExtMonoRef(monomial, _divMaskCalculator, _conf));
+    }
+
     iterator begin() {return iterator(_list.begin());}
     const_iterator begin() const {return const_iterator(_list.begin());}
     iterator end() {return iterator(_list.end());}
@@ -120,6 +359,8 @@ namespace mathic {
     C& getConfiguration() {return _conf;}
     const C& getConfiguration() const {return _conf;}
 
+    /** Moves pos to the front, or to the front of its bucket if
+        UseDegreeBuckets is true. */
     void moveToFront(iterator pos);
 
     void rebuild();
@@ -132,6 +373,11 @@ namespace mathic {
 		avoid frequent allocations. */
     size_t getMemoryUse() const;
 
+#ifdef MATHIC_DEBUG
+    /** Returns true if the mask array matches the entries. */
+    bool debugIsValid() const;
+#endif
+
   private:
     DivList(const DivList<C>&); // unavailable
     void operator=(const DivList<C>&); // unavailable
@@ -139,6 +385,24 @@ namespace mathic {
     void resetNumberOfChangesTillRebuild();
     void reportChanges(size_t changesMadeCount);
 
+    /** Recomputes _masks from scratch if UseMaskArray is true. Changes
+        of single entries update _masks in place instead. */
+    void resetMaskArray() {
+      if (UseMaskArray)
+        _masks.reset(_list.begin(), _list.end());
+    }
+
+    /** Returns _masks if UseMaskArray is true and otherwise null. */
+    DivMaskArray* maskArray() {return UseMaskArray ? &_masks : 0;}
+
+    /** Returns an iterator to the entry at index. Takes constant time
+        if UseLinkedList is false. */
+    ListIter listAt(size_t index) {
+      ListIter it = _list.begin();
+      std::advance(it, index);
+      return it;
+    }
+
     template<class DO>
     class ConstEntryOutput {
     public:
@@ -153,9 +417,68 @@ namespace mathic {
     };
 
     List _list;
+    DivMaskArray _masks; /// only used if UseMaskArray is true
+    HashIndex<C> _index;
     C _conf;
     DivMaskCalculator _divMaskCalculator;
     size_t _changesTillRebuild; /// Update using reportChanges().
+
+    /// For temporary copies of the entries. This is not the process wide
+    /// arena of memtailor, so that lists on different threads do not
+    /// share any memory.
+    memt::Arena _scratchArena;
+  };
+
+  template<class C>
+  template<bool Divisors>
+  class DivList<C>::Range {
+  public:
+    bool empty() const {return _it == _end;}
+
+    Entry& front() const {
+      MATHIC_ASSERT(!empty());
+      return _it->get();
+    }
+
+    void popFront() {
+      MATHIC_ASSERT(!empty());
+      ++_it;
+      settle();
+    }
+
+  private:
+    friend class DivList<C>;
+
+    Range(DivList<C>& list, const ExtMonoRef& extMonomial):
+      _conf(list._conf),
+      _monomial(extMonomial),
+      _it(Divisors ? list._list.begin() :
+        Buckets::firstMultipleCandidate(list._list, extMonomial)),
+      _end(list._list.end()) {
+      settle();
+    }
+
+    /** Moves _it forward to the next match or to _end. */
+    void settle() {
+      for (; _it != _end; ++_it) {
+        if (Divisors) {
+          if (Buckets::tooHighToDivide(*_it, _monomial) ||
+            (_conf.getSortOnInsert() &&
+              _conf.isLessThan(_monomial.get(), _it->get()))) {
+            _it = _end; // no later entry can divide
+            return;
+          }
+          if (_it->divides(_monomial, _conf))
+            return;
+        } else if (_monomial.divides(*_it, _conf))
+          return;
+      }
+    }
+
+    const C& _conf;
+    ExtMonoRef _monomial;
+    ListIter _it;
+    ListIter _end;
   };
 
   template<class C>
@@ -221,9 +544,11 @@ namespace mathic {
   };
 
   namespace DivListHelper {
+    /** Removes the multiples of monomial from list and from masks in the
+        same pass, unless masks is null. */
     template<class C, class E, class M, class MO>
-      size_t removeMultiples
-      (C& conf, std::vector<E>& list, const M& monomial, MO& out) {
+      size_t removeMultiples(C& conf, std::vector<E>& list,
+        const M& monomial, MO& out, DivMaskArray* masks) {
       typedef typename std::vector<E>::iterator iterator;
       iterator it = list.begin();
       iterator oldEnd = list.end();
@@ -239,6 +564,8 @@ namespace mathic {
       for (++it; it != oldEnd; ++it) {
         if (!monomial.divides(*it, conf)) {
           *newEnd = *it;
+          if (masks != 0)
+            masks->copy(it - list.begin(), newEnd - list.begin());
           ++newEnd;
         } else
           out.push_back(it->get());
@@ -247,14 +574,19 @@ namespace mathic {
       const size_t newSize = std::distance(list.begin(), newEnd);
       MATHIC_ASSERT(newSize < list.size());
       list.resize(newSize);
+      if (masks != 0)
+        masks->resize(newSize);
       return origSize - newSize;
     }
 
+    /** A list has no mask array, so masks must be null. */
     template<class C, class E, class M, class MO>
     size_t removeMultiples(C& conf,
                            std::list<E>& list,
                            const M& monomial,
-                           MO& out) {
+                           MO& out,
+                           DivMaskArray* masks) {
+      MATHIC_ASSERT(masks == 0);
 #ifdef MATHIC_DEBUG
       const size_t origSize = list.size();
 #endif
@@ -291,6 +623,12 @@ namespace mathic {
       list.splice(list.begin(), list, pos);
     }
 
+    template<class L, class It>
+    It Buckets<false>::moveToFront(L& list, It pos) {
+      DivListHelper::moveToFront(list, pos);
+      return list.begin();
+    }
+
     template<class C, class E>
       typename std::list<E>::iterator
       insertSort(C& conf, std::list<E>& list, const E& entry) {
@@ -393,6 +731,9 @@ namespace mathic {
     DivList<C>::DivList(const C& configuration):
   _conf(configuration),
     _divMaskCalculator(configuration) {
+      if (ConfigFlags<C>::UseDegreeBuckets && _conf.getSortOnInsert())
+        reportError("DivList cannot keep degree buckets and also sort "
+          "on insert.");
       resetNumberOfChangesTillRebuild();
     }
 
@@ -400,10 +741,13 @@ namespace mathic {
     void DivList<C>::insert(const Entry& entry) {
     ExtEntry extEntry(entry, _divMaskCalculator, _conf);
 
-    if (!_conf.getSortOnInsert())
-      _list.push_back(extEntry);
-    else
+    const ListIter it = !_conf.getSortOnInsert() ?
+      Buckets::insert(_list, extEntry) :
       DivListHelper::insertSort(_conf, _list, extEntry);
+    if (UseMaskArray)
+      _masks.insert(std::distance(_list.begin(), it), extEntry.getDivMask());
+    MATHIC_ASSERT(debugIsValid());
+    _index.insert(entry, _conf);
     reportChanges(1);
   }
 
@@ -419,10 +763,14 @@ namespace mathic {
       return;
 
     _divMaskCalculator.rebuild(rangeBegin, rangeEnd, _conf);
-    for (; rangeBegin != rangeEnd; ++rangeBegin)
+    for (; rangeBegin != rangeEnd; ++rangeBegin) {
       _list.push_back(ExtEntry(*rangeBegin, _divMaskCalculator, _conf));
+      _index.insert(*rangeBegin, _conf);
+    }
     if (_conf.getSortOnInsert())
       DivListHelper::sortAll(_conf, _list);
+    Buckets::sortAll(_list);
+    resetMaskArray();
     resetNumberOfChangesTillRebuild();
   }
 
@@ -433,9 +781,17 @@ namespace mathic {
 #ifdef MATHIC_DEBUG
     const size_t origSize = size();
 #endif
-    const size_t removedCount =
-      DivListHelper::removeMultiples(_conf, _list, extMonomial, out);
+    size_t removedCount;
+    if (ConfigFlags<C>::UseHashIndex) {
+      HashIndexHelper::RemoveFromIndex<HashIndex<C>, MO, C>
+        indexOut(_index, out, _conf);
+      removedCount = DivListHelper::removeMultiples
+        (_conf, _list, extMonomial, indexOut, maskArray());
+    } else
+      removedCount = DivListHelper::removeMultiples
+        (_conf, _list, extMonomial, out, maskArray());
     MATHIC_ASSERT(size() + removedCount == origSize);
+    MATHIC_ASSERT(debugIsValid());
     reportChanges(removedCount);
     return removedCount > 0;
   }
@@ -448,6 +804,8 @@ namespace mathic {
 
   template<class C>
   bool DivList<C>::removeElement(const Monomial& monomial) {
+    if (ConfigFlags<C>::UseHashIndex && !_index.remove(monomial, _conf))
+      return false;
     const size_t varCount = _conf.getVarCount();
     for (ListIter it = _list.begin(); it != _list.end(); ++it) {
       for (size_t var = 0; var < varCount; ++var) {
@@ -456,21 +814,48 @@ namespace mathic {
           goto skip;
         }
       }
+      if (UseMaskArray)
+        _masks.erase(std::distance(_list.begin(), it));
       _list.erase(it);
+      MATHIC_ASSERT(debugIsValid());
       return true;
     skip:;
     }
+    MATHIC_ASSERT(!ConfigFlags<C>::UseHashIndex);
     return false;
   }
 
+  template<class C>
+  bool DivList<C>::contains(const Monomial& monomial) const {
+    if (ConfigFlags<C>::UseHashIndex)
+      return _index.contains(monomial, _conf);
+    HashIndexHelper::FindEqual<C, Monomial> findEqual(monomial, _conf);
+    findAllDivisors(monomial, findEqual);
+    return findEqual.found();
+  }
+
   template<class C>
   typename DivList<C>::iterator
   DivList<C>::findDivisorIterator(const Monomial& monomial) {
     ExtMonoRef extMonomial(monomial, _divMaskCalculator, _conf);
 
-    if (!_conf.getSortOnInsert()) {
+    if (UseMaskArray && !_conf.getSortOnInsert()) {
+      const DivMask mask = extMonomial.getDivMask();
+      const size_t count = _masks.size();
+      size_t i = _masks.findCanDivide(mask, 0);
+      for (; i < count; i = _masks.findCanDivide(mask, i + 1)) {
+        const ListIter it = listAt(i);
+        if (Buckets::tooHighToDivide(*it, extMonomial))
+          break;
+        if (_conf.divides(it->get(), extMonomial.get()))
+          return iterator(it);
+      }
+      return end();
+    } else if (!_conf.getSortOnInsert()) {
       ListIter listEnd = _list.end();
       for (ListIter it = _list.begin(); it != listEnd; ++it) {
+        if (Buckets::tooHighToDivide(*it, extMonomial))
+          break;
         if (it->divides(extMonomial, _conf))
           return iterator(it);
       }
@@ -482,11 +867,26 @@ namespace mathic {
   template<class C>
   typename DivList<C>::Entry*
   DivList<C>::findDivisor(const Monomial& monomial) {
+    MATHIC_PROFILE("DivList::findDivisor");
     ExtMonoRef extMonomial(monomial, _divMaskCalculator, _conf);
 
-    if (!_conf.getSortOnInsert()) {
+    if (UseMaskArray && !_conf.getSortOnInsert()) {
+      const DivMask mask = extMonomial.getDivMask();
+      const size_t count = _masks.size();
+      size_t i = _masks.findCanDivide(mask, 0);
+      for (; i < count; i = _masks.findCanDivide(mask, i + 1)) {
+        const ListIter it = listAt(i);
+        if (Buckets::tooHighToDivide(*it, extMonomial))
+          break;
+        if (_conf.divides(it->get(), extMonomial.get()))
+          return &it->get();
+      }
+      return 0;
+    } else if (!_conf.getSortOnInsert()) {
       const ListIter listEnd = _list.end();
       for (ListIter it = _list.begin(); it != listEnd; ++it) {
+        if (Buckets::tooHighToDivide(*it, extMonomial))
+          break;
         if (it->divides(extMonomial, _conf))
           return &it->get();
       }
@@ -503,16 +903,84 @@ namespace mathic {
     return const_cast<DivList<C>&>(*this).findDivisor(monomial);
   }
 
+  template<class C>
+  typename DivList<C>::Entry*
+  DivList<C>::findBestDivisor(const Monomial& monomial) {
+    ExtMonoRef extMonomial(monomial, _divMaskCalculator, _conf);
+    Entry* best = 0;
+    typename C::Score bestScore = typename C::Score();
+    const ListIter listEnd = _list.end();
+    for (ListIter it = _list.begin(); it != listEnd; ++it) {
+      if (Buckets::tooHighToDivide(*it, extMonomial))
+        break;
+      // check the score first as it is likely cheaper than divisibility
+      const typename C::Score score = _conf.getScore(it->get());
+      if (best != 0 && !(score < bestScore))
+        continue;
+      if (it->divides(extMonomial, _conf)) {
+        best = &it->get();
+        bestScore = score;
+      }
+    }
+    return best;
+  }
+
+  template<class C>
+  const typename DivList<C>::Entry*
+  DivList<C>::findBestDivisor(const Monomial& monomial) const {
+    return const_cast<DivList<C>&>(*this).findBestDivisor(monomial);
+  }
+
+  template<class C>
+  template<class Score>
+  typename DivList<C>::Entry* DivList<C>::findDivisorWithScoreBelow
+    (const Monomial& monomial, const Score& bound) {
+    ExtMonoRef extMonomial(monomial, _divMaskCalculator, _conf);
+    const ListIter listEnd = _list.end();
+    for (ListIter it = _list.begin(); it != listEnd; ++it) {
+      if (Buckets::tooHighToDivide(*it, extMonomial))
+        break;
+      // check the score first as it is likely cheaper than divisibility
+      if (_conf.getScore(it->get()) < bound &&
+        it->divides(extMonomial, _conf))
+        return &it->get();
+    }
+    return 0;
+  }
+
+  template<class C>
+  template<class Score>
+  const typename DivList<C>::Entry* DivList<C>::findDivisorWithScoreBelow
+    (const Monomial& monomial, const Score& bound) const {
+    return const_cast<DivList<C>&>(*this).
+      findDivisorWithScoreBelow(monomial, bound);
+  }
+
   template<class C>
   template<class DO>
   void DivList<C>::findAllDivisors(const Monomial& monomial, DO& out) {
     ExtMonoRef extMonomial(monomial, _divMaskCalculator, _conf);
-    if (!_conf.getSortOnInsert()) {
+    if (UseMaskArray && !_conf.getSortOnInsert()) {
+      const DivMask mask = extMonomial.getDivMask();
+      const size_t count = _masks.size();
+      size_t i = _masks.findCanDivide(mask, 0);
+      for (; i < count; i = _masks.findCanDivide(mask, i + 1)) {
+        const ListIter it = listAt(i);
+        if (Buckets::tooHighToDivide(*it, extMonomial))
+          break;
+        if (_conf.divides(it->get(), extMonomial.get()))
+          if (!out.proceed(it->get()))
+            break;
+      }
+    } else if (!_conf.getSortOnInsert()) {
       const ListIter listEnd = _list.end();
-      for (ListIter it = _list.begin(); it != listEnd; ++it)
+      for (ListIter it = _list.begin(); it != listEnd; ++it) {
+        if (Buckets::tooHighToDivide(*it, extMonomial))
+          break;
         if (it->divides(extMonomial, _conf))
           if (!out.proceed(it->get()))
             break;
+      }
     } else
       DivListHelper::findAllDivisorsSorted(_conf, _list, extMonomial, out);
   }
@@ -523,7 +991,8 @@ namespace mathic {
     // todo: consider doing sorted version
     ExtMonoRef extMonomial(monomial, _divMaskCalculator, _conf);
     const ListIter listEnd = _list.end();
-    for (ListIter it = _list.begin(); it != listEnd; ++it)
+    ListIter it = Buckets::firstMultipleCandidate(_list, extMonomial);
+    for (; it != listEnd; ++it)
       if (extMonomial.divides(*it, _conf))
         if (!out.proceed(it->get()))
           break;
@@ -563,25 +1032,52 @@ namespace mathic {
           << '/' << _conf.getRebuildMin();
     }
     out << (_conf.getSortOnInsert() ? " sort" : "")
-        << (UseDivMask ? " dmask" : "");
+        << (UseDivMask ? " dmask" : "")
+        << (UseMaskArray ? " mask-array" : "")
+        << (ConfigFlags<C>::UseDegreeBuckets ? " degree" : "")
+        << (ConfigFlags<C>::UseHashIndex ? " hash" : "");
     return out.str();
   }
 
   template<class C>
     void DivList<C>::moveToFront(iterator pos) {
-    DivListHelper::moveToFront(_list, pos.getInternal());
+    if (!UseMaskArray) {
+      Buckets::moveToFront(_list, pos.getInternal());
+      return;
+    }
+    const size_t index = std::distance(_list.begin(), pos.getInternal());
+    const ListIter front = Buckets::moveToFront(_list, pos.getInternal());
+    _masks.moveToFront(std::distance(_list.begin(), front), index);
+    MATHIC_ASSERT(debugIsValid());
+  }
+
+#ifdef MATHIC_DEBUG
+  template<class C>
+  bool DivList<C>::debugIsValid() const {
+    if (!UseMaskArray)
+      return true;
+    if (_masks.size() != _list.size())
+      return false;
+    size_t index = 0;
+    for (CListIter it = _list.begin(); it != _list.end(); ++it, ++index)
+      if (_masks.getMask(index) != it->getDivMask().getValue())
+        return false;
+    return true;
   }
+#endif
 
   template<class C>
     void DivList<C>::rebuild() {
+    MATHIC_PROFILE("DivList::rebuild");
     const size_t totalSize = size();
     typedef memt::ArenaVector<Entry, true> TmpContainer;
-    TmpContainer tmpCopy(memt::Arena::getArena(), totalSize);
+    TmpContainer tmpCopy(_scratchArena, totalSize);
     std::copy(begin(), end(), std::back_inserter<TmpContainer>(tmpCopy));
     _divMaskCalculator.rebuild(tmpCopy.begin(), tmpCopy.end(), _conf);
     ListIter listEnd = _list.end();
     for (ListIter it = _list.begin(); it != listEnd; ++it)
       it->recalculateDivMask(_divMaskCalculator, _conf);
+    resetMaskArray();
     resetNumberOfChangesTillRebuild();
   }
 
@@ -609,7 +1105,8 @@ namespace mathic {
 
   template<class C>
   size_t DivList<C>::getMemoryUse() const {
-	return _list.capacity() * sizeof(_list.front());
+	return _list.capacity() * sizeof(_list.front()) +
+      _masks.getMemoryUse() + _index.getMemoryUse();
   }
 }
 
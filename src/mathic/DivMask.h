@@ -31,6 +31,8 @@ namespace mathic {
       monomial. */
   class DivMask {
   public:
+    typedef unsigned int MaskType;
+
     /** Calculates div masks. Don't change NullCalculator
         from its default value. The actual code are in partial specializations
         selecting the right version based on NullCalculator. */
@@ -115,6 +117,9 @@ namespace mathic {
 
     void combineAnd(const DivMask& mask) {_mask &= mask._mask;}
 
+    /** Returns the bits of the mask. */
+    MaskType getValue() const {return _mask;}
+
     bool operator==(DivMask& mask) const {return _mask == mask._mask;}
     bool operator!=(DivMask& mask) const {return _mask != mask._mask;}
 
@@ -161,7 +166,6 @@ namespace mathic {
       }
     };
 
-    typedef unsigned int MaskType;
     DivMask(MaskType mask): _mask(mask) {}
 
   private:
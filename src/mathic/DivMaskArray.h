@@ -0,0 +1,114 @@
+#ifndef MATHIC_DIV_MASK_ARRAY_GUARD
+#define MATHIC_DIV_MASK_ARRAY_GUARD
+
+#include "stdinc.h"
+#include "DivMask.h"
+#include <vector>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace mathic {
+  /** A dense array of div masks kept separate from the entries they
+      belong to. Scanning it for the masks that can divide a given mask
+      touches only the masks, and with SSE2 available it checks 4 masks
+      per instruction. */
+  class DivMaskArray {
+  public:
+    typedef DivMask::MaskType MaskType;
+
+    bool empty() const {return _masks.empty();}
+    size_t size() const {return _masks.size();}
+    void clear() {_masks.clear();}
+
+    void push_back(const DivMask& mask) {_masks.push_back(mask.getValue());}
+
+    MaskType getMask(size_t index) const {
+      MATHIC_ASSERT(index < size());
+      return _masks[index];
+    }
+
+    /** Inserts mask at index, which moves the masks from index on up by
+        one. */
+    void insert(size_t index, const DivMask& mask) {
+      MATHIC_ASSERT(index <= size());
+      _masks.insert(_masks.begin() + index, mask.getValue());
+    }
+
+    /** Removes the mask at index, which moves the masks after it down by
+        one. */
+    void erase(size_t index) {
+      MATHIC_ASSERT(index < size());
+      _masks.erase(_masks.begin() + index);
+    }
+
+    /** Moves the mask at index to front and the masks in [front, index)
+        up by one. This takes time proportional to index - front. */
+    void moveToFront(size_t front, size_t index) {
+      MATHIC_ASSERT(front <= index);
+      MATHIC_ASSERT(index < size());
+      std::rotate(_masks.begin() + front, _masks.begin() + index,
+        _masks.begin() + index + 1);
+    }
+
+    /** Copies the mask at from to index to. Together with resize this
+        removes masks in the same single pass that removes the entries
+        they belong to. */
+    void copy(size_t from, size_t to) {
+      MATHIC_ASSERT(from < size());
+      MATHIC_ASSERT(to < size());
+      _masks[to] = _masks[from];
+    }
+
+    /** Removes the masks from index newSize on. */
+    void resize(size_t newSize) {
+      MATHIC_ASSERT(newSize <= size());
+      _masks.resize(newSize);
+    }
+
+    /** Replaces the masks by the masks of the extended entries in
+        [begin, end). */
+    template<class Iter>
+    void reset(Iter begin, Iter end) {
+      _masks.clear();
+      for (; begin != end; ++begin)
+        _masks.push_back(begin->getDivMask().getValue());
+    }
+
+    /** Returns the smallest index i >= from such that the mask at index
+        i can divide mask. Returns size() if there is no such index. */
+    size_t findCanDivide(const DivMask& mask, size_t from) const {
+      const MaskType notMask = ~mask.getValue();
+      const size_t size = _masks.size();
+      size_t i = from;
+#ifdef __SSE2__
+      if (sizeof(MaskType) == 4) {
+        const __m128i notMask4 = _mm_set1_epi32(static_cast<int>(notMask));
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 4 <= size; i += 4) {
+          const __m128i masks = _mm_loadu_si128
+            (reinterpret_cast<const __m128i*>(&_masks[i]));
+          const __m128i canDivide =
+            _mm_cmpeq_epi32(_mm_and_si128(masks, notMask4), zero);
+          const int bits = _mm_movemask_ps(_mm_castsi128_ps(canDivide));
+          if (bits != 0)
+            return i + ((bits & 1) ? 0 : (bits & 2) ? 1 : (bits & 4) ? 2 : 3);
+        }
+      }
+#endif
+      for (; i < size; ++i)
+        if ((_masks[i] & notMask) == 0)
+          return i;
+      return size;
+    }
+
+    size_t getMemoryUse() const {return _masks.capacity() * sizeof(MaskType);}
+
+  private:
+    std::vector<MaskType> _masks;
+  };
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "DivTrace.h"
+
+#include "error.h"
+
+namespace mathic {
+  namespace {
+    const char Magic[] = {'M', 'D', 'V', 'T', 1};
+
+    typedef TraceFileWriter::Number Number;
+    typedef DivTraceEvent::Exponent Exponent;
+
+    Number zigzag(Exponent difference) {
+      const Number bits = static_cast<Number>(difference);
+      return difference < 0 ? ~(bits << 1) : bits << 1;
+    }
+
+    Exponent unzigzag(Number number) {
+      const Number bits = (number & 1) != 0 ? ~(number >> 1) : number >> 1;
+      return static_cast<Exponent>(bits);
+    }
+  }
+
+  DivTraceWriter::DivTraceWriter
+  (const std::string& fileName, size_t varCount):
+    _file(fileName, Magic, sizeof(Magic)),
+    _previous(varCount) {
+    _file.writeNumber(varCount);
+  }
+
+  void DivTraceWriter::write(DivTraceEvent::Type type,
+    const std::vector<Exponent>& exponents,
+    size_t removedCount) {
+    MATHIC_ASSERT(exponents.size() == getVarCount());
+    MATHIC_ASSERT(type == DivTraceEvent::RemoveMultiples ||
+      type == DivTraceEvent::RemoveElement || removedCount == 0);
+    _file.writeNumber(type);
+    if (type == DivTraceEvent::RemoveMultiples ||
+      type == DivTraceEvent::RemoveElement)
+      _file.writeNumber(removedCount);
+    for (size_t var = 0; var < _previous.size(); ++var) {
+      _file.writeNumber(zigzag(exponents[var] - _previous[var]));
+      _previous[var] = exponents[var];
+    }
+    _file.eventWritten();
+  }
+
+  DivTraceReader::DivTraceReader(const std::string& fileName):
+    _file(fileName, Magic, sizeof(Magic), "divisor query trace") {
+    rewind();
+  }
+
+  bool DivTraceReader::next(DivTraceEvent& event) {
+    if (_file.atEnd())
+      return false;
+    const Number type = _file.readNumber();
+    if (type > DivTraceEvent::RemoveElement)
+      reportError("the trace in " + _file.getFileName() +
+        " has an unknown event.");
+    event.type = static_cast<DivTraceEvent::Type>(type);
+    event.removedCount = 0;
+    if (type == DivTraceEvent::RemoveMultiples ||
+      type == DivTraceEvent::RemoveElement)
+      event.removedCount = static_cast<size_t>(_file.readNumber());
+    event.exponents.resize(_previous.size());
+    for (size_t var = 0; var < _previous.size(); ++var) {
+      _previous[var] += unzigzag(_file.readNumber());
+      event.exponents[var] = _previous[var];
+    }
+    return true;
+  }
+
+  void DivTraceReader::rewind() {
+    _file.rewind();
+    _previous.assign(static_cast<size_t>(_file.readNumber()), 0);
+  }
+}
@@ -0,0 +1,206 @@
+#ifndef MATHIC_DIV_TRACE_GUARD
+#define MATHIC_DIV_TRACE_GUARD
+
+#include "stdinc.h"
+#include "TraceFile.h"
+#include <vector>
+#include <string>
+
+namespace mathic {
+  /** An event recorded in a divisor query trace. */
+  struct DivTraceEvent {
+    enum Type {
+      Insert = 0,
+      QueryHasDivisor = 1,
+      QueryNoDivisor = 2,
+      RemoveMultiples = 3,
+      RemoveElement = 4
+    };
+    typedef long long Exponent;
+
+    Type type;
+    std::vector<Exponent> exponents;
+    /// the number of entries removed, for RemoveMultiples and RemoveElement
+    size_t removedCount;
+  };
+
+  /** Writes a trace of the inserts, divisor queries and removals done on
+      a divisor finder such as KDTree or DivList, so that the same
+      traffic can be replayed later, for example by divsim. Each event
+      records the exponent vector of its monomial together with the
+      answer that the finder gave, so a replay can check the answers of
+      another finder.
+
+      The file starts with the 4 bytes "MDVT" and a version byte of 1.
+      The rest is numbers written as by TraceFileWriter. The first number
+      is the number of variables. Then follow the events. An event starts
+      with its DivTraceEvent::Type. For the two removal types, the number
+      of entries removed follows. Then come the exponents of the monomial
+      as the difference from the exponent of the same variable in the
+      monomial of the previous event, or from zero for the first event.
+      The differences are zigzag encoded so that small negative numbers
+      are small too. */
+  class DivTraceWriter {
+  public:
+    typedef DivTraceEvent::Exponent Exponent;
+
+    /** Creates the file fileName, replacing any file of that name.
+        Reports an error if the file cannot be created. */
+    DivTraceWriter(const std::string& fileName, size_t varCount);
+
+    /** Records an event on the monomial with the given exponents. */
+    void write(DivTraceEvent::Type type,
+      const std::vector<Exponent>& exponents,
+      size_t removedCount = 0);
+
+    /** Writes the buffered events to the file. Reports an error if that
+        fails. */
+    void flush() {_file.flush();}
+
+    size_t getVarCount() const {return _previous.size();}
+    unsigned long long getEventCount() const {return _file.getEventCount();}
+
+  private:
+    DivTraceWriter(const DivTraceWriter&); // unavailable
+    void operator=(const DivTraceWriter&); // unavailable
+
+    TraceFileWriter _file;
+    std::vector<Exponent> _previous; /// the exponents of the last event
+  };
+
+  /** Reads a trace written by DivTraceWriter one event at a time. */
+  class DivTraceReader {
+  public:
+    /** Opens the trace in fileName. Reports an error if the file cannot
+        be read or is not a trace. */
+    explicit DivTraceReader(const std::string& fileName);
+
+    /** Reads the next event into event. Returns false if there are no
+        more events. Reports an error if the trace is truncated or
+        malformed. */
+    bool next(DivTraceEvent& event);
+
+    /** Makes the next event read be the first event of the trace. */
+    void rewind();
+
+    size_t getVarCount() const {return _previous.size();}
+
+  private:
+    DivTraceReader(const DivTraceReader&); // unavailable
+    void operator=(const DivTraceReader&); // unavailable
+
+    TraceFileReader _file;
+    std::vector<DivTraceEvent::Exponent> _previous;
+  };
+
+  /** A divisor finder that passes everything on to a finder of type
+      Finder and records the inserts, divisor queries and removals in a
+      trace. Finder can be KDTree or DivList. Other queries are passed on
+      but not recorded. */
+  template<class Finder>
+  class TracingDivFinder {
+  public:
+    typedef typename Finder::Configuration Configuration;
+    typedef typename Finder::Monomial Monomial;
+    typedef typename Finder::Entry Entry;
+
+    /** Does not take ownership of trace, which must stay alive while
+        this object is in use. The variable count of trace must match
+        that of configuration. */
+    TracingDivFinder
+      (const Configuration& configuration, DivTraceWriter& trace):
+      _finder(configuration),
+      _trace(trace),
+      _exponents(configuration.getVarCount()) {
+      MATHIC_ASSERT(trace.getVarCount() == configuration.getVarCount());
+    }
+
+    Finder& getFinder() {return _finder;}
+    const Finder& getFinder() const {return _finder;}
+
+    Configuration& getConfiguration() {return _finder.getConfiguration();}
+    const Configuration& getConfiguration() const {
+      return _finder.getConfiguration();
+    }
+
+    std::string getName() const {return "Tracing " + _finder.getName();}
+
+    void insert(const Entry& entry) {
+      record(DivTraceEvent::Insert, entry);
+      _finder.insert(entry);
+    }
+
+    Entry* findDivisor(const Monomial& monomial) {
+      Entry* divisor = _finder.findDivisor(monomial);
+      record(divisor != 0 ?
+        DivTraceEvent::QueryHasDivisor : DivTraceEvent::QueryNoDivisor,
+        monomial);
+      return divisor;
+    }
+
+    bool removeMultiples(const Monomial& monomial) {
+      NoOutput out;
+      return removeMultiples(monomial, out);
+    }
+
+    /** Calls out.push_back(entry) for each entry that is removed, so
+        that entries that own memory can be freed. */
+    template<class MultipleOutput>
+    bool removeMultiples(const Monomial& monomial, MultipleOutput& out) {
+      RemovedCounter<MultipleOutput> counter(out);
+      _finder.removeMultiples(monomial, counter);
+      record(DivTraceEvent::RemoveMultiples, monomial, counter.count);
+      return counter.count > 0;
+    }
+
+    bool removeElement(const Monomial& monomial) {
+      const bool removed = _finder.removeElement(monomial);
+      record(DivTraceEvent::RemoveElement, monomial, removed ? 1 : 0);
+      return removed;
+    }
+
+    bool contains(const Monomial& monomial) const {
+      return _finder.contains(monomial);
+    }
+
+    template<class EntryOutput>
+    void forAll(EntryOutput& out) const {_finder.forAll(out);}
+
+    bool empty() const {return _finder.empty();}
+    size_t size() const {return _finder.size();}
+    size_t getMemoryUse() const {return _finder.getMemoryUse();}
+
+  private:
+    struct NoOutput {
+      void push_back(const Entry& entry) {}
+    };
+
+    /// Counts the removed entries for the trace and passes them on.
+    template<class MultipleOutput>
+    struct RemovedCounter {
+      RemovedCounter(MultipleOutput& out): count(0), _out(out) {}
+      void push_back(const Entry& entry) {
+        ++count;
+        _out.push_back(entry);
+      }
+      size_t count;
+    private:
+      MultipleOutput& _out;
+    };
+
+    template<class M>
+    void record(DivTraceEvent::Type type, const M& monomial,
+      size_t removedCount = 0) {
+      const Configuration& conf = getConfiguration();
+      for (size_t var = 0; var < _exponents.size(); ++var)
+        _exponents[var] = conf.getExponent(monomial, var);
+      _trace.write(type, _exponents, removedCount);
+    }
+
+    Finder _finder;
+    DivTraceWriter& _trace;
+    std::vector<DivTraceEvent::Exponent> _exponents;
+  };
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define MATHIC_GEOBUCKET_GUARD
 
 #include "stdinc.h"
+#include "Profiler.h"
 #include <string>
 #include <sstream>
 #include <vector>
@@ -343,6 +344,7 @@ namespace mathic {
 
   template<class C>
 	void Geobucket<C>::push(Entry entry) {
+	MATHIC_PROFILE("Geobucket::push");
 	++_entryCount;
 	Bucket& bucket = *_bucketBegin;
 	if (bucket.size() == bucket.capacity()) {
@@ -402,6 +404,7 @@ namespace mathic {
   template<class C>
 	template<class It>
 	void Geobucket<C>::push(It begin, It end) {
+	MATHIC_PROFILE("Geobucket::push range");
 #ifdef MATHIC_DEBUG
 	if (begin != end) {
 	  for (It it = begin; it + 1 != end; ++it) {
@@ -444,6 +447,7 @@ namespace mathic {
 
   template<class C>
   typename Geobucket<C>::Entry Geobucket<C>::pop() {
+	MATHIC_PROFILE("Geobucket::pop");
 	Bucket* maxBucket =
 	  const_cast<Bucket*>(_front.getMax(_bucketBegin, _bucketEnd));
 	Entry top = maxBucket->back();
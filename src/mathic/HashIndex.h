@@ -0,0 +1,233 @@
+#ifndef MATHIC_HASH_INDEX_GUARD
+#define MATHIC_HASH_INDEX_GUARD
+
+#include "stdinc.h"
+#include "ConfigFlags.h"
+#include <vector>
+
+namespace mathic {
+  /** An open addressing hash table of entries that supports exact
+      match queries in expected constant time. It is included into
+      divisor query data structures at compile time based on the
+      template parameter UseHashIndex. The class offers the same methods
+      either way, but they are replaced by do-nothing versions if
+      UseHashIndex is false.
+
+      Two monomials match if all their exponents are equal. The table
+      records how many entries match each distinct monomial, so it works
+      for data structures that allow duplicates. Hash values are given
+      by the method size_t getHash(Monomial) on the Configuration C,
+      which must also accept an Entry. Equal monomials must have equal
+      hash values.
+
+      The table uses linear probing. Removals shift later entries back
+      instead of leaving tombstones, so the table never needs cleaning
+      up and lookups do not degrade after many removals. */
+  template<class C, bool UseHashIndex = ConfigFlags<C>::UseHashIndex>
+  class HashIndex;
+
+  namespace HashIndexHelper {
+    template<class C, class A, class B>
+    bool isEqual(const A& a, const B& b, const C& conf) {
+      const size_t varCount = conf.getVarCount();
+      for (size_t var = 0; var < varCount; ++var)
+        if (conf.getExponent(a, var) != conf.getExponent(b, var))
+          return false;
+      return true;
+    }
+
+    /** An output for findAllDivisors that looks for an entry equal to
+        monomial. A divisor query is the way to check for an exact match
+        when there is no hash index. */
+    template<class C, class M>
+    class FindEqual {
+    public:
+      FindEqual(const M& monomial, const C& conf):
+        _monomial(monomial), _conf(conf), _found(false) {}
+
+      template<class E>
+      bool proceed(const E& entry) {
+        _found = isEqual(entry, _monomial, _conf);
+        return !_found;
+      }
+
+      bool found() const {return _found;}
+
+    private:
+      const M& _monomial;
+      const C& _conf;
+      bool _found;
+    };
+
+    /** A multiple output that removes each entry passed to it from index
+        and then passes the entry on to out. */
+    template<class Index, class MO, class C>
+    class RemoveFromIndex {
+    public:
+      RemoveFromIndex(Index& index, MO& out, const C& conf):
+        _index(index), _out(out), _conf(conf) {}
+
+      template<class E>
+      void push_back(E& entry) {
+        _index.remove(entry, _conf);
+        _out.push_back(entry);
+      }
+
+    private:
+      Index& _index;
+      MO& _out;
+      const C& _conf;
+    };
+  }
+
+  template<class C>
+  class HashIndex<C, true> {
+  public:
+    typedef typename C::Entry Entry;
+
+    HashIndex(): _size(0), _distinctCount(0) {}
+
+    bool empty() const {return _size == 0;}
+
+    /** Returns the number of entries, counting duplicates. */
+    size_t size() const {return _size;}
+
+    void insert(const Entry& entry, const C& conf) {
+      if (2 * (_distinctCount + 1) > _slots.size())
+        grow();
+      const size_t hash = conf.getHash(entry);
+      size_t slot = find(entry, hash, conf);
+      if (_slots[slot].count == 0) {
+        _slots[slot].entry = entry;
+        _slots[slot].hash = hash;
+        ++_distinctCount;
+      }
+      ++_slots[slot].count;
+      ++_size;
+    }
+
+    /** Returns true if an entry matches monomial. */
+    template<class M>
+    bool contains(const M& monomial, const C& conf) const {
+      if (empty())
+        return false;
+      return _slots[find(monomial, conf.getHash(monomial), conf)].count > 0;
+    }
+
+    /** Removes one entry that matches monomial. Returns false if there is
+        no such entry. */
+    template<class M>
+    bool remove(const M& monomial, const C& conf) {
+      if (empty())
+        return false;
+      size_t slot = find(monomial, conf.getHash(monomial), conf);
+      if (_slots[slot].count == 0)
+        return false;
+      --_size;
+      if (--_slots[slot].count == 0) {
+        --_distinctCount;
+        erase(slot);
+      }
+      return true;
+    }
+
+    void clear() {
+      _slots.clear();
+      _size = 0;
+      _distinctCount = 0;
+    }
+
+    size_t getMemoryUse() const {return _slots.capacity() * sizeof(Slot);}
+
+  private:
+    struct Slot {
+      Slot(): hash(0), count(0) {}
+      Entry entry;
+      size_t hash;
+      size_t count; /// 0 if the slot is empty
+    };
+
+    size_t mask() const {return _slots.size() - 1;}
+
+    static size_t home(size_t hash, size_t mask) {
+      // mix the bits as the hash may have structure in its low bits.
+      hash ^= hash >> 16;
+      hash *= 0x45d9f3b;
+      hash ^= hash >> 16;
+      return hash & mask;
+    }
+
+    /** Returns the slot of the entry matching monomial, or the empty slot
+        where it would go if there is no such entry. */
+    template<class M>
+    size_t find(const M& monomial, size_t hash, const C& conf) const {
+      MATHIC_ASSERT(!_slots.empty());
+      size_t slot = home(hash, mask());
+      while (true) {
+        const Slot& s = _slots[slot];
+        if (s.count == 0 ||
+          (s.hash == hash && HashIndexHelper::isEqual(s.entry, monomial, conf)))
+          return slot;
+        slot = (slot + 1) & mask();
+      }
+    }
+
+    /** Empties slot and moves back later entries of the same probe
+        sequence so that no lookup passes over an empty slot. */
+    void erase(size_t slot) {
+      size_t next = slot;
+      while (true) {
+        next = (next + 1) & mask();
+        if (_slots[next].count == 0)
+          break;
+        // the entry in next can move to slot only if its home is not
+        // cyclically in (slot, next].
+        const size_t nextHome = home(_slots[next].hash, mask());
+        if (((next - nextHome) & mask()) >= ((next - slot) & mask())) {
+          _slots[slot] = _slots[next];
+          slot = next;
+        }
+      }
+      _slots[slot] = Slot();
+    }
+
+    void grow() {
+      std::vector<Slot> old;
+      old.swap(_slots);
+      _slots.resize(old.empty() ? 16 : 2 * old.size());
+      for (size_t i = 0; i < old.size(); ++i) {
+        if (old[i].count == 0)
+          continue;
+        size_t slot = home(old[i].hash, mask());
+        while (_slots[slot].count != 0)
+          slot = (slot + 1) & mask();
+        _slots[slot] = old[i];
+      }
+    }
+
+    std::vector<Slot> _slots; /// size is zero or a power of two
+    size_t _size;
+    size_t _distinctCount;
+  };
+
+  template<class C>
+  class HashIndex<C, false> {
+  public:
+    typedef typename C::Entry Entry;
+
+    bool empty() const {return true;}
+    size_t size() const {return 0;}
+    void insert(const Entry& entry, const C& conf) {}
+    template<class M>
+    bool contains(const M& monomial, const C& conf) const {
+      MATHIC_ASSERT(false);
+      return false;
+    }
+    template<class M>
+    bool remove(const M& monomial, const C& conf) {return false;}
+    void clear() {}
+    size_t getMemoryUse() const {return 0;}
+  };
+}
+
+#endif
@@ -2,6 +2,7 @@
 #define MATHIC_HEAP_GUARD
 
 #include "stdinc.h"
+#include "Profiler.h"
 #include "ComTree.h"
 #include <vector>
 #include <ostream>
@@ -117,6 +118,7 @@ namespace mathic {
 
   template<class C>
   typename Heap<C>::Entry Heap<C>::pop() {
+	MATHIC_PROFILE("Heap::pop");
 	Entry top = _tree[Node()];
 	Entry movedValue = _tree[_tree.lastLeaf()];
 	_tree.popBack();
@@ -2,14 +2,68 @@
 #define MATHIC_K_D_ENTRY_ARRAY_GUARD
 
 #include "stdinc.h"
+#include "ConfigFlags.h"
 
 #include "DivMask.h"
 #include "Comparer.h"
+#include "KDTreeAnalysis.h"
 
 #include <stdexcept>
 #include <memtailor.h>
 
 namespace mathic {
+  /** One bit for each of Capacity entries that records if the entry has
+      been removed without being physically removed. If Use is false,
+      no entries are ever dead and there is no overhead. */
+  template<size_t Capacity, bool Use>
+  class KDTombstones {
+  public:
+    KDTombstones() {clear();}
+
+    bool isDead(size_t index) const {
+      MATHIC_ASSERT(index < Capacity);
+      return ((_bits[index / WordBits] >> (index % WordBits)) & 1) != 0;
+    }
+
+    void setDead(size_t index) {
+      MATHIC_ASSERT(!isDead(index));
+      _bits[index / WordBits] |= static_cast<Word>(1) << (index % WordBits);
+      ++_count;
+    }
+
+    /** Returns the number of dead entries. */
+    size_t count() const {return _count;}
+
+    void clear() {
+      for (size_t i = 0; i < WordCount; ++i)
+        _bits[i] = 0;
+      _count = 0;
+    }
+
+  private:
+    typedef unsigned int Word;
+    static const size_t WordBits = sizeof(Word) * BitsPerByte;
+    static const size_t WordCount = (Capacity + WordBits - 1) / WordBits;
+    Word _bits[WordCount];
+    Word _count;
+  };
+
+  template<size_t Capacity>
+  class KDTombstones<Capacity, false> {
+  public:
+    bool isDead(size_t index) const {return false;}
+    void setDead(size_t index) {MATHIC_ASSERT(false);}
+    size_t count() const {return 0;}
+    void clear() {}
+  };
+
+  /** The entries of a leaf in a KD tree. If C::UseTombstones is true,
+      removing an entry only marks it as dead. Queries skip dead
+      entries. The dead entries are physically removed by compact(),
+      which the KD trees call before changing the leaf in other ways,
+      and by clear(). Until then dead entries still count towards
+      size() and lie in the range [begin(), end()), so that range
+      is a superset of the live entries. */
   template<class C, class EE>
   class KDEntryArray : public DivMask::HasDivMask<C::UseTreeDivMask> {
   public:
@@ -46,6 +100,23 @@ namespace mathic {
 
     bool empty() const {return begin() == end();}
     size_t size() const {return std::distance(begin(), end());}
+
+    /** Returns true if the entry at it has been removed but is still
+        taking up space. */
+    bool isDead(const_iterator it) const {
+      return ConfigFlags<C>::UseTombstones &&
+        _dead.isDead(std::distance(begin(), it));
+    }
+
+    /** Returns the number of dead entries. */
+    size_t deadCount() const {return _dead.count();}
+
+    /** Returns the number of entries that are not dead. */
+    size_t liveSize() const {return size() - deadCount();}
+
+    /** Physically removes the dead entries, keeping the order of the
+        remaining entries. Returns how many were removed. */
+    size_t compact();
     EE& front() {MATHIC_ASSERT(!empty()); return *begin();}
     const EE& front() const {MATHIC_ASSERT(!empty()); return *begin();}
     EE& back() {MATHIC_ASSERT(!empty()); return *(_end - 1);}
@@ -66,13 +137,45 @@ namespace mathic {
     template<class EM>
     inline iterator findDivisor(const EM& extMonomial, const C& conf);
 
+    /** As findDivisor, but records the work done in stats. This is a
+        separate method so that findDivisor does no counting. */
+    template<class EM>
+    iterator findDivisor
+      (const EM& extMonomial, const C& conf, KDTreeQueryStats& stats);
+
     template<class EM, class DO>
     inline bool findAllDivisors(const EM& extMonomial, DO& out, const C& conf);
 
+    /** If there is a divisor of extMonomial with a score lower than
+        bestScore, then best is set to the lowest scoring such divisor and
+        bestScore is set to its score. bestScore is ignored if best is
+        null. */
+    template<class EM, class S>
+    inline void findBestDivisor
+      (const EM& extMonomial, Entry*& best, S& bestScore, const C& conf);
+
+    /** Returns an entry that divides extMonomial and that has a score
+        lower than bound. Returns end() if there is no such entry. */
+    template<class EM, class S>
+    inline iterator findDivisorWithScoreBelow
+      (const EM& extMonomial, const S& bound, const C& conf);
+
     template<class EM, class Output>
     inline bool findAllMultiples
       (const EM& extMonomial, Output& out, const C& conf);
 
+    /** Returns the first entry in [from, end()) that divides extMonomial
+        and is not dead. Returns end() if there is no such entry. */
+    template<class EM>
+    inline iterator findNextDivisor
+      (const EM& extMonomial, iterator from, const C& conf);
+
+    /** Returns the first entry in [from, end()) that extMonomial divides
+        and that is not dead. Returns end() if there is no such entry. */
+    template<class EM>
+    inline iterator findNextMultiple
+      (const EM& extMonomial, iterator from, const C& conf);
+
     template<class EO>
     bool forAll(EO& eo);
 
@@ -100,6 +203,7 @@ namespace mathic {
 
     using DivMask::HasDivMask<C::UseTreeDivMask>::resetDivMask;
     using DivMask::HasDivMask<C::UseTreeDivMask>::getDivMask;
+    using DivMask::HasDivMask<C::UseTreeDivMask>::updateToLowerBound;
 
   private:
     static Entry& getEntry(Entry& e) {return e;}
@@ -117,6 +221,7 @@ namespace mathic {
      to avoid constructing all the entries right away. */
     char _beginMemory[C::LeafSize * sizeof(ExtEntry)];
     iterator _end; // points into _beginMemory
+    KDTombstones<C::LeafSize, ConfigFlags<C>::UseTombstones> _dead;
 #ifdef MATHIC_DEBUG
     const bool _sortOnInsertDebug;
 #endif
@@ -277,6 +382,28 @@ namespace mathic {
     void KDEntryArray<C, EE>::clear() {
       while (!empty())
         pop_back();
+      _dead.clear();
+  }
+
+  template<class C, class EE>
+  size_t KDEntryArray<C, EE>::compact() {
+    const size_t removedCount = deadCount();
+    if (removedCount == 0)
+      return 0;
+    iterator newEnd = begin();
+    for (iterator it = begin(); it != end(); ++it) {
+      if (isDead(it))
+        continue;
+      if (newEnd != it)
+        *newEnd = *it;
+      ++newEnd;
+    }
+    _dead.clear();
+    const size_t newSize = std::distance(begin(), newEnd);
+    while (newSize < size())
+      pop_back();
+    recalculateTreeDivMask();
+    return removedCount;
   }
 
   template<class C, class EE>
@@ -284,6 +411,18 @@ namespace mathic {
   size_t KDEntryArray<C, EE>::removeMultiples
     (const EM& monomial, MO& out, const C& conf) {
     MATHIC_ASSERT(C::AllowRemovals);
+    if (ConfigFlags<C>::UseTombstones) {
+      size_t removedCount = 0;
+      const iterator stop = end();
+      for (iterator it = begin(); it != stop; ++it) {
+        if (monomial.divides(*it, conf) && !isDead(it)) {
+          out.push_back(it->get());
+          _dead.setDead(std::distance(begin(), it));
+          ++removedCount;
+        }
+      }
+      return removedCount;
+    }
     if (C::LeafSize == 1) { // special case for performance
       if (empty() || !monomial.divides(*begin(), conf))
         return 0;
@@ -328,9 +467,15 @@ namespace mathic {
     const size_t varCount = conf.getVarCount();
     const_iterator stop = end();
     for (iterator it = begin(); it != stop; ++it) {
+      if (isDead(it))
+        continue;
       for (size_t var = 0; var < varCount; ++var)
         if (conf.getExponent(monomial, var) != conf.getExponent(it->get(), var))
           goto skip;
+      if (ConfigFlags<C>::UseTombstones) {
+        _dead.setDead(std::distance(begin(), it));
+        return true;
+      }
       if (it != end()) {
         const_iterator next = it;
         for (++next; next != end(); ++it, ++next)
@@ -355,7 +500,7 @@ namespace mathic {
     if (C::LeafSize == 1) { // special case for performance
       MATHIC_ASSERT(C::AllowRemovals || !empty());
       if ((!C::AllowRemovals || !empty()) &&
-        begin()->divides(extMonomial, conf))
+        begin()->divides(extMonomial, conf) && !isDead(begin()))
         return begin();
       else
         return end();
@@ -363,7 +508,7 @@ namespace mathic {
     else if (!conf.getSortOnInsert()) {
       const iterator stop = end();
       for (iterator it = begin(); it != stop; ++it)
-        if (it->divides(extMonomial, conf))
+        if (it->divides(extMonomial, conf) && !isDead(it))
           return it;
       return stop;
     } else {
@@ -371,12 +516,40 @@ namespace mathic {
         std::upper_bound(begin(), end(), extMonomial, Comparer<C>(conf));
       iterator it = begin();
       for (; it != rangeEnd; ++it)
-        if (it->divides(extMonomial, conf))
+        if (it->divides(extMonomial, conf) && !isDead(it))
           return it;
       return end();
     }
   }
 
+  template<class C, class EE>
+  template<class EM>
+  typename KDEntryArray<C, EE>::iterator KDEntryArray<C, EE>::findDivisor
+    (const EM& extMonomial, const C& conf, KDTreeQueryStats& stats) {
+    ++stats.leavesScanned;
+    if (C::UseTreeDivMask &&
+      C::LeafSize > 1 &&
+      !getDivMask().canDivide(extMonomial.getDivMask())) {
+      ++stats.maskRejections;
+      return end();
+    }
+    iterator stop = end();
+    if (C::LeafSize > 1 && conf.getSortOnInsert())
+      stop = std::upper_bound(begin(), end(), extMonomial, Comparer<C>(conf));
+    for (iterator it = begin(); it != stop; ++it) {
+      if (isDead(it))
+        continue;
+      if (!it->canDivide(extMonomial)) {
+        ++stats.maskRejections;
+        continue;
+      }
+      ++stats.divisibilityTests;
+      if (it->divides(extMonomial, conf))
+        return it;
+    }
+    return end();
+  }
+
   template<class C, class EE>
   template<class EM, class DO>
   bool KDEntryArray<C, EE>::
@@ -389,12 +562,12 @@ namespace mathic {
     if (C::LeafSize == 1) { // special case for performance
       MATHIC_ASSERT(C::AllowRemovals || !empty());
       return (C::AllowRemovals && empty()) ||
-        !begin()->divides(extMonomial, conf) ||
+        !begin()->divides(extMonomial, conf) || isDead(begin()) ||
         out.proceed(begin()->get());
     } else  if (!conf.getSortOnInsert()) {
       const iterator stop = end();
       for (iterator it = begin(); it != stop; ++it)
-        if (it->divides(extMonomial, conf))
+        if (it->divides(extMonomial, conf) && !isDead(it))
           if (!out.proceed(it->get()))
             return false;
     } else {
@@ -402,13 +575,62 @@ namespace mathic {
         std::upper_bound(begin(), end(), extMonomial, Comparer<C>(conf));
       iterator it = begin();
       for (; it != rangeEnd; ++it)
-        if (it->divides(extMonomial, conf))
+        if (it->divides(extMonomial, conf) && !isDead(it))
           if (!out.proceed(it->get()))
             return false;
     }
     return true;
   }
 
+  template<class C, class EE>
+  template<class EM, class S>
+  void KDEntryArray<C, EE>::findBestDivisor(
+    const EM& extMonomial,
+    Entry*& best,
+    S& bestScore,
+    const C& conf
+  ) {
+    if (C::UseTreeDivMask &&
+      C::LeafSize > 1 && // no reason to do it for just 1 leaf
+      !getDivMask().canDivide(extMonomial.getDivMask()))
+      return;
+
+    iterator rangeEnd = end();
+    if (conf.getSortOnInsert())
+      rangeEnd = std::upper_bound(begin(), end(), extMonomial, Comparer<C>(conf));
+    for (iterator it = begin(); it != rangeEnd; ++it) {
+      // check the score first as it is likely cheaper than divisibility
+      const S score = conf.getScore(it->get());
+      if (best != 0 && !(score < bestScore))
+        continue;
+      if (it->divides(extMonomial, conf) && !isDead(it)) {
+        best = &it->get();
+        bestScore = score;
+      }
+    }
+  }
+
+  template<class C, class EE>
+  template<class EM, class S>
+  typename KDEntryArray<C, EE>::iterator KDEntryArray<C, EE>::
+  findDivisorWithScoreBelow(const EM& extMonomial, const S& bound, const C& conf) {
+    if (C::UseTreeDivMask &&
+      C::LeafSize > 1 && // no reason to do it for just 1 leaf
+      !getDivMask().canDivide(extMonomial.getDivMask()))
+      return end();
+
+    iterator rangeEnd = end();
+    if (conf.getSortOnInsert())
+      rangeEnd = std::upper_bound(begin(), end(), extMonomial, Comparer<C>(conf));
+    for (iterator it = begin(); it != rangeEnd; ++it) {
+      // check the score first as it is likely cheaper than divisibility
+      if (conf.getScore(it->get()) < bound &&
+        it->divides(extMonomial, conf) && !isDead(it))
+        return it;
+    }
+    return end();
+  }
+
   template<class C, class EE>
   template<class EM, class DO>
   bool KDEntryArray<C, EE>::
@@ -416,29 +638,56 @@ namespace mathic {
     if (C::LeafSize == 1) { // special case for performance
       MATHIC_ASSERT(C::AllowRemovals || !empty());
       return (C::AllowRemovals && empty()) ||
-        !extMonomial.divides(*begin(), conf) ||
+        !extMonomial.divides(*begin(), conf) || isDead(begin()) ||
         out.proceed(begin()->get());
     }
 
     // todo: consider making sorted version
     const iterator stop = end();
     for (iterator it = begin(); it != stop; ++it)
-      if (extMonomial.divides(*it, conf))
+      if (extMonomial.divides(*it, conf) && !isDead(it))
         if (!out.proceed(it->get()))
           return false;
     return true;
   }
 
+  template<class C, class EE>
+  template<class EM>
+  typename KDEntryArray<C, EE>::iterator KDEntryArray<C, EE>::
+  findNextDivisor(const EM& extMonomial, iterator from, const C& conf) {
+    if (C::UseTreeDivMask &&
+      C::LeafSize > 1 && // no reason to do it for just 1 leaf
+      !getDivMask().canDivide(extMonomial.getDivMask()))
+      return end();
+    const iterator stop = end();
+    for (; from != stop; ++from)
+      if (from->divides(extMonomial, conf) && !isDead(from))
+        break;
+    return from;
+  }
+
+  template<class C, class EE>
+  template<class EM>
+  typename KDEntryArray<C, EE>::iterator KDEntryArray<C, EE>::
+  findNextMultiple(const EM& extMonomial, iterator from, const C& conf) {
+    const iterator stop = end();
+    for (; from != stop; ++from)
+      if (extMonomial.divides(*from, conf) && !isDead(from))
+        break;
+    return from;
+  }
+
   template<class C, class EE>
   template<class EO>
   bool KDEntryArray<C, EE>::forAll(EO& output) {
     if (C::LeafSize == 1) { // special case for performance
       MATHIC_ASSERT(C::AllowRemovals || !empty());
-      return (C::AllowRemovals && empty()) || output.proceed(begin()->get());
+      return (C::AllowRemovals && empty()) || isDead(begin()) ||
+        output.proceed(begin()->get());
     }
     const iterator stop = end();
     for (iterator it = begin(); it != stop; ++it)
-      if (!output.proceed(it->get()))
+      if (!isDead(it) && !output.proceed(it->get()))
         return false;
     return true;
   }
@@ -480,6 +729,8 @@ namespace mathic {
   bool KDEntryArray<C, EE>::debugIsValid() const {
     MATHIC_ASSERT(C::AllowRemovals || !empty());
     MATHIC_ASSERT(static_cast<size_t>(end() - begin()) <= C::LeafSize);
+    MATHIC_ASSERT(deadCount() <= size());
+    MATHIC_ASSERT(ConfigFlags<C>::UseTombstones || deadCount() == 0);
     if (C::UseTreeDivMask && C::LeafSize > 1) {
       for (const_iterator it = begin(); it != end(); ++it) {
         MATHIC_ASSERT(getDivMask().canDivide(it->getDivMask()));
@@ -2,7 +2,12 @@
 #define MATHIC_K_D_TREE_GUARD
 
 #include "stdinc.h"
+#include "ConfigFlags.h"
+#include "Profiler.h"
 #include "DivMask.h"
+#include "HashIndex.h"
+#include "KDTreeTuner.h"
+#include "KDTreeAnalysis.h"
 #include "BinaryKDTree.h"
 #include "PackedKDTree.h"
 #include <memtailor.h>
@@ -17,18 +22,85 @@ namespace mathic {
   /** An object that supports queries for divisors of a monomial using
       a KD Tree (K Dimensional Tree). See DivFinder.h for more documentation.
 
-      Extra fields for Configuration:
+      Extra fields for Configuration. The static flags from
+      UsePartialRebuilds on are optional and are false, or 0, if left
+      out. See ConfigFlags.h.
 
       * bool getSortOnInsert() const
       Return true to keep the monomials in leaves sorted to speed up queries.
 
-      * size_t getLeafSize() const
-      Return the fixed maximal size of a leaf.
+      * static const size_t LeafSize
+      The maximal number of entries in a leaf. Space for this many
+      entries is reserved in each leaf.
 
       * static const bool AllowRemovals
       If false, it is an error to call methods that remove elements from
       the data structure. This can be a slight speed up in some cases.
       Clear and rebuild is still allowed even if this field is false.
+
+      * static const bool UsePartialRebuilds
+      If true, an insertion that makes the tree too deep for its size
+      rebuilds only the deepest subtree on the insertion path that is too
+      deep for its own size. This bounds the depth of the tree without
+      the latency spikes of rebuilding the whole tree. Insertions then no
+      longer count towards automatic rebuilds, only removals do. The div
+      mask calculator is only updated by full rebuilds.
+
+      * static const bool UseScoreBounds
+      If true, each sub tree keeps a lower bound on the scores of its
+      entries, so findBestDivisor can skip sub trees that cannot contain
+      a divisor with a better score than the best one found so far and
+      findDivisorWithScoreBelow can skip sub trees whose scores are all
+      too high. The bounds are lowered on insertion and recomputed on
+      rebuilds. Removals leave the bounds lower than they need to be
+      until the next rebuild, which is still correct.
+
+      * static const size_t CompactExponentBits
+      If 8 or 16, each entry in the tree stores a copy of its exponents
+      using that many bits per exponent, as does each monomial being
+      queried, so that divisibility checks in the leaves do not need to
+      access the memory of the entries. Entries with an exponent that
+      does not fit fall back to Configuration::divides. Set to 0 to
+      turn this off. See CompactExponents.h.
+
+      * static const size_t CompactVarCount
+      The maximal number of variables for which compact exponents are
+      used if CompactExponentBits is not 0. The space for this many
+      exponents is reserved for each entry, so this should not be much
+      larger than the actual number of variables.
+
+      * static const bool UseHashIndex
+      If true, a hash table of the entries is kept alongside the tree.
+      It makes contains and removeElement take expected constant time
+      when there is no matching entry, and contains take expected
+      constant time always. See HashIndex.h.
+
+      * static const bool UseTombstones
+      If true, removing an entry only marks it as dead in its leaf, so
+      removals do not move any entries. Queries skip dead entries. A leaf
+      is compacted when an entry is inserted into it, and the whole tree
+      is compacted by a rebuild once there are more dead entries than
+      live ones. Removals then no longer count towards automatic
+      rebuilds. See KDEntryArray.h.
+
+      * static const bool UseAutoTuning
+      If true, the tree times a sample of its operations and tries out
+      smaller leaf sizes and other rebuild ratios to find the fastest
+      setting for the actual workload. It rebuilds itself when that
+      changes the leaf size. The setting that is chosen and the timings
+      behind the choice are available from getTuner(). See KDTreeTuner.h.
+
+      * A function size_t getHash(Monomial m) const
+      Only needed if UseHashIndex is true. It must also accept an Entry,
+      and monomials with the same exponents must have the same hash.
+
+      * A type Score and a function Score getScore(Entry e) const
+      Only needed if calling findBestDivisor or findDivisorWithScoreBelow.
+      Score must have an operator< and a lower score is better. The score
+      can be any key on the entries, such as the ratio of signature to
+      leading term in a signature based algorithm. The score of an entry
+      must not change while the entry is in the tree if UseScoreBounds
+      is true.
   */
   template<class Configuration>
   class KDTree;
@@ -62,7 +134,11 @@ namespace mathic {
     KDTree(const C& configuration):
       _divMaskCalculator(configuration),
       _tree(configuration),
-      _size(0) {
+      _tuner(configuration),
+      _size(0),
+      _fullRebuildCount(0),
+      _sampleInterval(0),
+      _queriesTillSample(0) {
       resetNumberOfChangesTillRebuild();
       if (getConfiguration().getUseDivisorCache())
         _divisorCache = 0;
@@ -110,8 +186,15 @@ namespace mathic {
       MATHIC_ASSERT(C::AllowRemovals);
       if (!C::AllowRemovals)
         throw std::logic_error("Removal request while removals disabled.");
+      typename Tuner::Operation operation(_tuner, size());
       ExtMonoRef extMonomial(monomial, _divMaskCalculator, getConfiguration());
-      size_t removedCount = _tree.removeMultiples(extMonomial, out);
+      size_t removedCount;
+      if (ConfigFlags<C>::UseHashIndex) {
+        HashIndexHelper::RemoveFromIndex<Index, MultipleOutput, C>
+          indexOut(_index, out, getConfiguration());
+        removedCount = _tree.removeMultiples(extMonomial, indexOut);
+      } else
+        removedCount = _tree.removeMultiples(extMonomial, out);
       reportChanges(0, removedCount);
       return removedCount > 0;
     }
@@ -121,6 +204,7 @@ namespace mathic {
         search for divisors proceeds. */
     template<class Output>
     void findAllMultiples(const Monomial& monomial, Output& out) {
+      typename Tuner::Operation operation(_tuner, size());
       ExtMonoRef extMonomial(monomial, _divMaskCalculator, getConfiguration());
       _tree.findAllMultiples(extMonomial, out);
     }
@@ -138,8 +222,11 @@ namespace mathic {
         of entry and entry is inserted even if it is a multiple of another
         entry. */
     void insert(const Entry& entry) {
+      MATHIC_PROFILE("KDTree::insert");
+      typename Tuner::Operation operation(_tuner, size());
       ExtEntry extEntry(entry, _divMaskCalculator, getConfiguration());
-      _tree.insert(extEntry);
+      _tree.insert(extEntry, _divMaskCalculator);
+      _index.insert(entry, getConfiguration());
       reportChanges(1, 0);
     }
 
@@ -155,13 +242,21 @@ namespace mathic {
       if (begin == end)
         return;
       const size_t inserted = std::distance(begin, end); 
+      if (ConfigFlags<C>::UseHashIndex)
+        for (Iter it = begin; it != end; ++it)
+          _index.insert(*it, getConfiguration());
       if (!empty()) {
-        for (; begin != end; ++begin)
-          _tree.insert(*begin);
+        for (; begin != end; ++begin) {
+          ExtEntry extEntry(*begin, _divMaskCalculator, getConfiguration());
+          _tree.insert(extEntry, _divMaskCalculator);
+        }
       } else {
-        _tree.insert(begin, end);
         // insert into empty container is equivalent to rebuild
+        _divMaskCalculator.rebuild(begin, end, getConfiguration());
+        _tree.reset(begin, end, _divMaskCalculator);
+        _size = inserted;
         resetNumberOfChangesTillRebuild();
+        return;
       }
       reportChanges(inserted, 0);
     }
@@ -172,13 +267,36 @@ namespace mathic {
       MATHIC_ASSERT(C::AllowRemovals);
       if (!C::AllowRemovals)
         throw std::logic_error("Removal request while removals disabled.");
-      return _tree.removeElement(monomial);
+      typename Tuner::Operation operation(_tuner, size());
+      if (ConfigFlags<C>::UseHashIndex &&
+        !_index.contains(monomial, getConfiguration()))
+        return false;
+      const bool removed = _tree.removeElement(monomial);
+      if (removed) {
+        _index.remove(monomial, getConfiguration());
+        reportChanges(0, 1);
+      }
+      MATHIC_ASSERT(removed || !ConfigFlags<C>::UseHashIndex);
+      return removed;
+    }
+
+    /** Returns true if there is an entry whose exponents are equal to
+        monomial's. */
+    bool contains(const Monomial& monomial) const {
+      if (ConfigFlags<C>::UseHashIndex)
+        return _index.contains(monomial, getConfiguration());
+      HashIndexHelper::FindEqual<C, Monomial>
+        findEqual(monomial, getConfiguration());
+      findAllDivisors(monomial, findEqual);
+      return findEqual.found();
     }
 
     /** Returns a pointer to an entry that divides monomial. Returns null if no
         entries divide monomial. */
     inline Entry* findDivisor(const Monomial& monomial) {
+      MATHIC_PROFILE("KDTree::findDivisor");
       // todo: do this on extended monomials. requires cache to be extended.
+      typename Tuner::Operation operation(_tuner, size());
       const C& conf = getConfiguration();
       if (conf.getUseDivisorCache() &&
         _divisorCache != 0 &&
@@ -186,7 +304,12 @@ namespace mathic {
         return _divisorCache;
 
       ExtMonoRef extMonomial(monomial, _divMaskCalculator, getConfiguration());
-      Entry* divisor = _tree.findDivisor(extMonomial);
+      Entry* divisor;
+      if (_sampleInterval != 0 && --_queriesTillSample == 0) {
+        _queriesTillSample = _sampleInterval;
+        divisor = _tree.findDivisor(extMonomial, _queryStats);
+      } else
+        divisor = _tree.findDivisor(extMonomial);
       if (conf.getUseDivisorCache() && divisor != 0)
         _divisorCache = divisor;
       return divisor;
@@ -198,11 +321,49 @@ namespace mathic {
       return const_cast<KDTree<C>&>(*this).findDivisor(monomial);
     }
 
+    /** Returns a pointer to an entry that divides monomial and that has
+        the lowest score among those entries. Returns null if no entries
+        divide monomial. */
+    Entry* findBestDivisor(const Monomial& monomial) {
+      typename Tuner::Operation operation(_tuner, size());
+      ExtMonoRef extMonomial(monomial, _divMaskCalculator, getConfiguration());
+      return _tree.findBestDivisor(extMonomial);
+    }
+
+    /** Returns a pointer to an entry that divides monomial and that has
+        the lowest score among those entries. Returns null if no entries
+        divide monomial. */
+    const Entry* findBestDivisor(const Monomial& monomial) const {
+      return const_cast<KDTree<C>&>(*this).findBestDivisor(monomial);
+    }
+
+    /** Returns a pointer to an entry that divides monomial and that has
+        a score lower than bound. Returns null if there is no such entry.
+        If UseScoreBounds is true, sub trees whose entries all have a score
+        of at least bound are not searched. */
+    template<class Score>
+    Entry* findDivisorWithScoreBelow
+      (const Monomial& monomial, const Score& bound) {
+      typename Tuner::Operation operation(_tuner, size());
+      ExtMonoRef extMonomial(monomial, _divMaskCalculator, getConfiguration());
+      return _tree.findDivisorWithScoreBelow(extMonomial, bound);
+    }
+
+    /** Returns a pointer to an entry that divides monomial and that has
+        a score lower than bound. Returns null if there is no such entry. */
+    template<class Score>
+    const Entry* findDivisorWithScoreBelow
+      (const Monomial& monomial, const Score& bound) const {
+      return const_cast<KDTree<C>&>(*this).
+        findDivisorWithScoreBelow(monomial, bound);
+    }
+
     /** Calls out.proceed(entry) for each entry that divides monomial.
         The method returns if proceed returns false, otherwise the
         search for divisors proceeds. */
     template<class DivisorOutput>
     void findAllDivisors(const Monomial& monomial, DivisorOutput& out) {
+      typename Tuner::Operation operation(_tuner, size());
       ExtMonoRef extMonomial(monomial, _divMaskCalculator, getConfiguration());
       _tree.findAllDivisors(extMonomial, out);
     }
@@ -233,16 +394,73 @@ namespace mathic {
       const_cast<KDTree<C>&>(*this).forAll(constOutput);
     }
 
+    /** A range of the entries that divide a monomial. The range offers
+        empty(), front() and popFront(). It finds each entry only when it
+        is asked for, so stopping after a few entries costs only the work
+        of finding those. The range is invalidated by any change to the
+        KDTree and it keeps a reference to the monomial, which must stay
+        alive while the range is in use. */
+    typedef typename Tree::template Range<true> DivisorRange;
+
+    /** As DivisorRange, but for the entries that a monomial divides. */
+    typedef typename Tree::template Range<false> MultipleRange;
+
+    /** Returns a range of the entries that divide monomial in the order
+        that findAllDivisors would output them. */
+    DivisorRange divisorRange(const Monomial& monomial) {
+      return DivisorRange
+        (_tree, ExtMonoRef(monomial, _divMaskCalculator, getConfiguration()));
+    }
+
+    /** Returns a range of the entries that monomial divides in the order
+        that findAllMultiples would output them. */
+    MultipleRange multipleRange(const Monomial& monomial) {
+      return MultipleRange
+        (_tree, ExtMonoRef(monomial, _divMaskCalculator, getConfiguration()));
+    }
+
+    /** Returns a new KDTree with the same entries and configuration as
+        this one. The two trees share their nodes, so this takes constant
+        time apart from copying the hash index if UseHashIndex is true.
+        A tree copies a shared node before modifying it, along with its
+        shared ancestors, so later changes to either tree do not affect
+        the other. Only PackedTree is supported.
+
+        Once the snapshots are deleted, the next change to this tree
+        takes its nodes back in time proportional to the size of the
+        tree, after which changes no longer copy nodes.
+
+        The snapshot and this tree can be used and deleted on different
+        threads, for example to delete a snapshot on one thread while
+        this tree is modified on another. The reference counts that the
+        trees share are changed atomically. As for any tree, each of
+        them must only be used by one thread at a time, and snapshot()
+        changes this tree. The caller must delete the snapshot. */
+    KDTree<C>* snapshot() {
+      KDTree<C>* copy = new KDTree<C>(getConfiguration());
+      copy->_divMaskCalculator = _divMaskCalculator;
+      copy->_tree.share(_tree);
+      copy->_tuner = _tuner;
+      copy->_index = _index;
+      copy->_size = _size;
+      copy->_changesTillRebuild = _changesTillRebuild;
+      return copy;
+    }
+
     /** Removes all entries. Does not reset the configuration object. */
     void clear() {
       _tree.clear();
+      _index.clear();
+      _size = 0;
       resetNumberOfChangesTillRebuild();
-      _tree.calc().rebuildDefault(getConfiguration());
+      _divMaskCalculator.rebuildDefault(getConfiguration());
     }
 
     /** Rebuilds the data structure. */
     void rebuild() {
-      EntryRecorder recorder(memt::Arena::getArena(), size());
+      MATHIC_PROFILE("KDTree::rebuild");
+      ++_fullRebuildCount;
+      EntryRecorder recorder(_scratchArena, size());
       _tree.forAll(recorder);
       _divMaskCalculator.rebuild
         (recorder.begin(), recorder.end(), getConfiguration());
@@ -250,13 +468,42 @@ namespace mathic {
       resetNumberOfChangesTillRebuild();
     }
 
+    /** Makes every interval'th call to findDivisor record the work it
+        does, which then shows up in analyze(). Queries answered by the
+        divisor cache are not counted. An interval of 0 turns this off,
+        which is the default. Sampled queries are a little slower than
+        others. Also discards the statistics recorded so far. */
+    void setQuerySampling(size_t interval) {
+      _sampleInterval = interval;
+      _queriesTillSample = interval;
+      _queryStats = KDTreeQueryStats();
+    }
+
+    /** Returns the shape of the tree along with the statistics of the
+        sampled queries. This takes time linear in the number of nodes. */
+    KDTreeAnalysis analyze() const {
+      KDTreeAnalysis analysis;
+      _tree.analyze(analysis);
+      analysis.queries = _queryStats;
+      analysis.fullRebuilds = _fullRebuildCount;
+      return analysis;
+    }
+
+    typedef KDTreeTuner<C> Tuner;
+
+    /** Returns the state of the automatic tuning of the leaf size and
+        rebuild ratio. The tuner does nothing if UseAutoTuning is false. */
+    const Tuner& getTuner() const {return _tuner;}
+
 	/** Returns the number of bytes allocated by this object. Does not
 		include sizeof(*this), does not include any additional memory
 		that the configuration may have allocated and does not include
 		any memory that an Entry may point to. Does include
 		sizeof(Entry) as well as unused memory that is being kept to
 		avoid frequent allocations. */
-    size_t getMemoryUse() const {return _tree.getMemoryUse();}
+    size_t getMemoryUse() const {
+      return _tree.getMemoryUse() + _index.getMemoryUse();
+    }
 
   private:
     KDTree(const KDTree<C>&); // unavailable
@@ -304,7 +551,20 @@ namespace mathic {
     // All DivMasks calculated using this.
     typename Tree::DivMaskCalculator _divMaskCalculator;
     Tree _tree;
+    Tuner _tuner;
+    typedef HashIndex<C> Index;
+    Index _index;
     size_t _size;
+    size_t _fullRebuildCount; /// number of calls to rebuild()
+
+    size_t _sampleInterval; /// 0 if not sampling queries
+    size_t _queriesTillSample;
+    KDTreeQueryStats _queryStats;
+
+    /// For temporary copies of the entries. This is not the process wide
+    /// arena of memtailor, so that trees on different threads do not
+    /// share any memory.
+    memt::Arena _scratchArena;
   };
 
   template<class C>
@@ -317,11 +577,19 @@ namespace mathic {
       out << " autob:" << conf.getRebuildRatio()
           << '/' << conf.getRebuildMin();
     }
+    if (ConfigFlags<C>::UseAutoTuning)
+      out << " autotune";
     out << (C::UseDivMask && !C::UseTreeDivMask ? " dmask" : "")
         << (C::UseTreeDivMask ? " tree-dmask" : "")
         << (conf.getSortOnInsert() ? " sort" : "")
         << (conf.getUseDivisorCache() ? " cache" : "")
-        << (C::AllowRemovals ? "" : " no-removals");
+        << (C::AllowRemovals ? "" : " no-removals")
+        << (ConfigFlags<C>::UsePartialRebuilds ? " partial" : "")
+        << (ConfigFlags<C>::UseScoreBounds ? " score-bounds" : "")
+        << (ConfigFlags<C>::UseHashIndex ? " hash" : "")
+        << (ConfigFlags<C>::UseTombstones ? " tombstones" : "");
+    if (ConfigFlags<C>::CompactExponentBits != 0)
+      out << " compact" << ConfigFlags<C>::CompactExponentBits;
     return out.str();
   }
 
@@ -332,18 +600,29 @@ namespace mathic {
       _divisorCache = 0;
     if (!conf.getDoAutomaticRebuilds())
       return;
-    MATHIC_ASSERT(conf.getRebuildRatio() > 0);
+    const double ratio = ConfigFlags<C>::UseAutoTuning ?
+      _tuner.getRebuildRatio() : conf.getRebuildRatio();
+    MATHIC_ASSERT(ratio > 0);
     _changesTillRebuild = std::max
-      (static_cast<size_t>(size() * conf.getRebuildRatio()),
-       conf.getRebuildMin());
+      (static_cast<size_t>(size() * ratio), conf.getRebuildMin());
   }
 
   template<class C>
   void KDTree<C>::reportChanges(size_t additions, size_t removals) {
     if (getConfiguration().getUseDivisorCache() && (additions | removals) != 0)
       _divisorCache = 0;
-    if (reportChangesRebuild(additions, removals))
+    if (reportChangesRebuild(additions, removals) ||
+      (ConfigFlags<C>::UseTombstones && _tree.getDeadCount() > size()))
       rebuild();
+    else if (_tuner.wantsChange(size())) {
+      const size_t leafSize = _tuner.getLeafSize();
+      _tuner.change(size());
+      if (_tuner.getLeafSize() != leafSize) {
+        _tree.setLeafSize(_tuner.getLeafSize());
+        rebuild();
+      } else
+        resetNumberOfChangesTillRebuild();
+    }
   }
 
   template<class C>
@@ -354,7 +633,13 @@ namespace mathic {
     _size = (size() + additions) - removals;
     if (!getConfiguration().getDoAutomaticRebuilds())
       return false;
-    const size_t changesMadeCount = additions + removals;
+    // partial rebuilds keep the tree balanced under insertions and
+    // dead entries trigger their own rebuilds.
+    const size_t changesMadeCount =
+      (ConfigFlags<C>::UsePartialRebuilds ? 0 : additions) +
+      (ConfigFlags<C>::UseTombstones ? 0 : removals);
+    if (changesMadeCount == 0)
+      return false;
     if (_changesTillRebuild > changesMadeCount) {
       _changesTillRebuild -= changesMadeCount;
       return false;
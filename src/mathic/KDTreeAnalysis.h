@@ -0,0 +1,124 @@
+#ifndef MATHIC_K_D_TREE_ANALYSIS_GUARD
+#define MATHIC_K_D_TREE_ANALYSIS_GUARD
+
+#include "stdinc.h"
+#include <vector>
+#include <ostream>
+
+namespace mathic {
+  /** Counts of the work done by the divisor queries that KDTree has
+      sampled. See KDTree::setQuerySampling. */
+  struct KDTreeQueryStats {
+    KDTreeQueryStats():
+      queries(0),
+      nodesVisited(0),
+      leavesScanned(0),
+      divisibilityTests(0),
+      maskRejections(0) {}
+
+    unsigned long long queries;
+    unsigned long long nodesVisited; /// nodes taken off the search stack
+    unsigned long long leavesScanned; /// entry arrays looked into
+    /// entries compared to the monomial beyond their div mask
+    unsigned long long divisibilityTests;
+    /// entries and sub trees ruled out by their div mask alone
+    unsigned long long maskRejections;
+  };
+
+  /** A report on the shape of a KD tree and on the cost of the queries
+      sampled on it. See KDTree::analyze.
+
+      A leaf here is an array of entries. In a binary tree those are the
+      leaves. In a packed tree every node holds an array of entries, so
+      every node counts as a leaf. */
+  struct KDTreeAnalysis {
+    KDTreeAnalysis():
+      nodeCount(0), leafCount(0), entryCount(0), deadCount(0),
+      fullRebuilds(0), partialRebuilds(0) {}
+
+    size_t nodeCount;
+    size_t leafCount;
+    size_t entryCount; /// entries in leaves, including dead ones
+    size_t deadCount; /// entries removed but still taking up space
+    size_t fullRebuilds; /// rebuilds of the whole tree so far
+    /// rebuilds of a single sub tree so far. See UsePartialRebuilds.
+    size_t partialRebuilds;
+
+    /// leavesAtDepth[d] is the number of leaves at depth d. The root is
+    /// at depth 0.
+    std::vector<size_t> leavesAtDepth;
+
+    /// leavesWithSize[s] is the number of leaves with s entries,
+    /// including dead ones.
+    std::vector<size_t> leavesWithSize;
+
+    /// splitsOnVar[var] is the number of nodes that split on var.
+    std::vector<size_t> splitsOnVar;
+
+    KDTreeQueryStats queries;
+
+    /** Records a leaf with size entries at depth. */
+    void addLeaf(size_t depth, size_t size) {
+      ++leafCount;
+      entryCount += size;
+      increment(leavesAtDepth, depth);
+      increment(leavesWithSize, size);
+    }
+
+    /** Records a node that splits on var. */
+    void addSplit(size_t var) {
+      increment(splitsOnVar, var);
+    }
+
+    /** Returns the mean depth of the leaves. */
+    double getMeanLeafDepth() const;
+
+    void print(std::ostream& out) const;
+
+  private:
+    static void increment(std::vector<size_t>& counts, size_t index) {
+      if (index >= counts.size())
+        counts.resize(index + 1);
+      ++counts[index];
+    }
+  };
+
+  inline double KDTreeAnalysis::getMeanLeafDepth() const {
+    if (leafCount == 0)
+      return 0;
+    double sum = 0;
+    for (size_t depth = 0; depth < leavesAtDepth.size(); ++depth)
+      sum += static_cast<double>(depth) * leavesAtDepth[depth];
+    return sum / leafCount;
+  }
+
+  inline void KDTreeAnalysis::print(std::ostream& out) const {
+    out << "nodes:" << nodeCount << " leaves:" << leafCount
+      << " entries:" << entryCount << " dead:" << deadCount
+      << " mean leaf depth:" << getMeanLeafDepth() << '\n';
+    out << "full rebuilds:" << fullRebuilds
+      << " partial rebuilds:" << partialRebuilds << '\n';
+    out << "leaves at depth:";
+    for (size_t depth = 0; depth < leavesAtDepth.size(); ++depth)
+      if (leavesAtDepth[depth] != 0)
+        out << ' ' << depth << ':' << leavesAtDepth[depth];
+    out << "\nleaves with size:";
+    for (size_t size = 0; size < leavesWithSize.size(); ++size)
+      if (leavesWithSize[size] != 0)
+        out << ' ' << size << ':' << leavesWithSize[size];
+    out << "\nsplits on var:";
+    for (size_t var = 0; var < splitsOnVar.size(); ++var)
+      out << ' ' << var << ':' << splitsOnVar[var];
+    out << '\n';
+    if (queries.queries == 0)
+      return;
+    const double count = static_cast<double>(queries.queries);
+    out << "sampled queries:" << queries.queries
+      << " per query: nodes " << queries.nodesVisited / count
+      << ", leaves " << queries.leavesScanned / count
+      << ", divisibility tests " << queries.divisibilityTests / count
+      << ", mask rejections " << queries.maskRejections / count << '\n';
+  }
+}
+
+#endif
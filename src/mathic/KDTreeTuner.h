@@ -0,0 +1,259 @@
+#ifndef MATHIC_K_D_TREE_TUNER_GUARD
+#define MATHIC_K_D_TREE_TUNER_GUARD
+
+#include "stdinc.h"
+#include "ConfigFlags.h"
+#include "Timer.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <ostream>
+
+namespace mathic {
+  /** The measured cost of one setting tried by KDTreeTuner. */
+  struct KDTreeTuningTrial {
+    size_t leafSize;
+    double rebuildRatio;
+    size_t samples; /// number of timed operations
+    double nanosPerOperation; /// mean time of the timed operations
+    /// mean of the time of each timed operation divided by the base 2
+    /// logarithm of the number of entries in the tree at the time
+    double nanosPerLogSize;
+  };
+
+  /** Picks the leaf size and rebuild ratio of a KDTree at run time. It
+      is included into KDTree at compile time based on the template
+      parameter UseAutoTuning. The class offers the same methods either
+      way, but they are replaced by do-nothing versions if UseAutoTuning
+      is false.
+
+      Each candidate setting is tried in turn on the live tree for a
+      window of operations, timing every SampleInterval'th operation.
+      Once all candidates have been tried, the one with the lowest mean
+      time per operation is kept.
+
+      The tree usually grows while the candidates are tried, so later
+      candidates run on a larger tree than earlier ones. To not hold that
+      against them, each timing is divided by the base 2 logarithm of the
+      number of entries before it is compared, which is about how the
+      depth of the tree and so the cost of an operation grows.
+
+      The candidates are C::LeafSize halved
+      repeatedly down to 1, combined with half, once and twice the rebuild
+      ratio of the configuration if automatic rebuilds are on. The tuner
+      starts when the tree has MinTuningSize entries and starts over when
+      the tree has grown by a factor of RegrowthFactor since the last
+      decision. A trial must be timed with its own leaf size, so KDTree
+      rebuilds itself right away when the leaf size changes. A change of
+      only the rebuild ratio just resets the count of changes until the
+      next automatic rebuild.
+
+      Timings are only comparable if the mix of operations is about the
+      same in each window, so tuning suits workloads that are steady over
+      a few thousand operations. */
+  template<class C, bool UseAutoTuning = ConfigFlags<C>::UseAutoTuning>
+  class KDTreeTuner;
+
+  template<class C>
+  class KDTreeTuner<C, true> {
+  public:
+    static const size_t SampleInterval = 8;
+    static const size_t WindowSamples = 256;
+    static const size_t MinTuningSize = 128;
+    static const size_t RegrowthFactor = 4;
+
+    KDTreeTuner(const C& conf);
+
+    /** Times an operation on the tree if it is one of the sampled ones.
+        entryCount is the number of entries in the tree when the operation
+        starts. A sample is discarded if the setting changes before it
+        ends. */
+    class Operation {
+    public:
+      Operation(KDTreeTuner<C, true>& tuner, size_t entryCount):
+        _tuner(tuner), _trial(tuner._current), _entryCount(entryCount),
+        _start(tuner.startOperation()) {}
+      ~Operation() {
+        if (_start >= 0 && _trial == _tuner._current)
+          _tuner.endOperation(_start, _entryCount);
+      }
+    private:
+      KDTreeTuner<C, true>& _tuner;
+      const size_t _trial;
+      const size_t _entryCount;
+      const double _start;
+    };
+
+    /** Returns true if the setting should be changed now. entryCount is
+        the number of entries in the tree. */
+    bool wantsChange(size_t entryCount) const {
+      if (_settled)
+        return entryCount >= RegrowthFactor * _settledSize &&
+          entryCount >= MinTuningSize;
+      if (_current == NotStarted)
+        return entryCount >= MinTuningSize;
+      return _trials[_current].samples >= WindowSamples;
+    }
+
+    /** Moves on to the next setting. KDTree must then apply
+        getLeafSize() by rebuilding if it changed, and getRebuildRatio()
+        from the next count of changes until an automatic rebuild. */
+    void change(size_t entryCount);
+
+    size_t getLeafSize() const {return setting().leafSize;}
+    double getRebuildRatio() const {return setting().rebuildRatio;}
+
+    /** Returns true if the current setting is a decision and not a trial. */
+    bool isSettled() const {return _settled;}
+
+    /** Returns the number of times that all candidates have been tried. */
+    size_t getRoundCount() const {return _roundCount;}
+
+    /** Returns the candidates with the timings of the most recent round. */
+    const std::vector<KDTreeTuningTrial>& getTrials() const {return _trials;}
+
+    void print(std::ostream& out) const;
+
+  private:
+    friend class Operation;
+    static const size_t NotStarted = static_cast<size_t>(-1);
+
+    const KDTreeTuningTrial& setting() const {
+      return _trials[_current == NotStarted ? _best : _current];
+    }
+
+    double startOperation() {
+      if (_current == NotStarted || _settled ||
+        ++_operationCount % SampleInterval != 0)
+        return -1;
+      return static_cast<double>(WallTimer::getNanos());
+    }
+
+    void endOperation(double start, size_t entryCount) {
+      KDTreeTuningTrial& trial = _trials[_current];
+      const double nanos = static_cast<double>(WallTimer::getNanos()) - start;
+      // the logarithm is at least 1 so that tiny trees are not favored.
+      const double logSize =
+        std::log(static_cast<double>(std::max<size_t>(entryCount, 2))) /
+        std::log(2.0);
+      ++trial.samples;
+      trial.nanosPerOperation +=
+        (nanos - trial.nanosPerOperation) / trial.samples;
+      trial.nanosPerLogSize +=
+        (nanos / logSize - trial.nanosPerLogSize) / trial.samples;
+    }
+
+    std::vector<KDTreeTuningTrial> _trials;
+    size_t _current; /// index into _trials of the setting in use
+    size_t _best; /// index into _trials of the setting used when settled
+    bool _settled;
+    size_t _settledSize; /// number of entries at the last decision
+    size_t _roundCount;
+    size_t _operationCount;
+  };
+
+  template<class C>
+  const size_t KDTreeTuner<C, true>::SampleInterval;
+  template<class C>
+  const size_t KDTreeTuner<C, true>::WindowSamples;
+  template<class C>
+  const size_t KDTreeTuner<C, true>::MinTuningSize;
+  template<class C>
+  const size_t KDTreeTuner<C, true>::RegrowthFactor;
+
+  template<class C>
+  KDTreeTuner<C, true>::KDTreeTuner(const C& conf):
+    _current(NotStarted),
+    _best(0),
+    _settled(false),
+    _settledSize(0),
+    _roundCount(0),
+    _operationCount(0) {
+    std::vector<double> ratios;
+    ratios.push_back(conf.getRebuildRatio());
+    if (conf.getDoAutomaticRebuilds()) {
+      ratios.push_back(conf.getRebuildRatio() / 2);
+      ratios.push_back(conf.getRebuildRatio() * 2);
+    }
+    for (size_t leafSize = C::LeafSize; leafSize > 0; leafSize /= 2) {
+      for (size_t i = 0; i < ratios.size(); ++i) {
+        KDTreeTuningTrial trial;
+        trial.leafSize = leafSize;
+        trial.rebuildRatio = ratios[i];
+        trial.samples = 0;
+        trial.nanosPerOperation = 0;
+        trial.nanosPerLogSize = 0;
+        _trials.push_back(trial);
+      }
+    }
+  }
+
+  template<class C>
+  void KDTreeTuner<C, true>::change(size_t entryCount) {
+    MATHIC_ASSERT(wantsChange(entryCount));
+    if (_settled || _current == NotStarted) {
+      for (size_t i = 0; i < _trials.size(); ++i) {
+        _trials[i].samples = 0;
+        _trials[i].nanosPerOperation = 0;
+        _trials[i].nanosPerLogSize = 0;
+      }
+      _settled = false;
+      _current = 0;
+    } else if (_current + 1 < _trials.size())
+      ++_current;
+    else {
+      _best = 0;
+      for (size_t i = 1; i < _trials.size(); ++i)
+        if (_trials[i].nanosPerLogSize < _trials[_best].nanosPerLogSize)
+          _best = i;
+      _current = _best;
+      _settled = true;
+      _settledSize = entryCount;
+      ++_roundCount;
+    }
+  }
+
+  template<class C>
+  void KDTreeTuner<C, true>::print(std::ostream& out) const {
+    out << "leaf:" << getLeafSize() << " ratio:" << getRebuildRatio()
+      << (_settled ? " settled" : " tuning") << " rounds:" << _roundCount;
+    for (size_t i = 0; i < _trials.size(); ++i) {
+      const KDTreeTuningTrial& trial = _trials[i];
+      out << "\n  leaf:" << trial.leafSize << " ratio:" << trial.rebuildRatio
+        << " samples:" << trial.samples
+        << " ns/op:" << trial.nanosPerOperation
+        << " ns/op/log2(size):" << trial.nanosPerLogSize;
+      if (_settled && i == _best)
+        out << " *";
+    }
+    out << '\n';
+  }
+
+  template<class C>
+  class KDTreeTuner<C, false> {
+  public:
+    KDTreeTuner(const C& conf) {}
+
+    class Operation {
+    public:
+      Operation(KDTreeTuner<C, false>& tuner, size_t entryCount) {}
+    };
+
+    bool wantsChange(size_t entryCount) const {return false;}
+    void change(size_t entryCount) {MATHIC_ASSERT(false);}
+    size_t getLeafSize() const {return C::LeafSize;}
+    double getRebuildRatio() const {MATHIC_ASSERT(false); return 0;}
+    bool isSettled() const {return true;}
+    size_t getRoundCount() const {return 0;}
+    const std::vector<KDTreeTuningTrial>& getTrials() const {return _trials;}
+    void print(std::ostream& out) const {}
+
+  private:
+    static const std::vector<KDTreeTuningTrial> _trials; /// always empty
+  };
+
+  template<class C>
+  const std::vector<KDTreeTuningTrial> KDTreeTuner<C, false>::_trials;
+}
+
+#endif
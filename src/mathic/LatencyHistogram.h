@@ -0,0 +1,150 @@
+#ifndef MATHIC_LATENCY_HISTOGRAM_GUARD
+#define MATHIC_LATENCY_HISTOGRAM_GUARD
+
+#include "stdinc.h"
+#include "Timer.h"
+#include "ColumnPrinter.h"
+#include <vector>
+#include <ostream>
+
+namespace mathic {
+  /** Counts how many operations took how many nanoseconds, so that
+      percentiles such as the median and the 99th percentile of the
+      latency can be reported.
+
+      Latencies below 2^SubBucketBits nanoseconds are counted exactly.
+      Every larger power of two range is split into 2^SubBucketBits
+      buckets of equal width, so a reported latency is at most 1 /
+      2^SubBucketBits too high. The memory use is a few hundred counters
+      however large the latencies get. */
+  class LatencyHistogram {
+  public:
+    typedef unsigned long long Nanos;
+
+    static const size_t SubBucketBits = 3;
+
+    LatencyHistogram(): _count(0), _sum(0), _max(0) {}
+
+    /** Records an operation that took nanos nanoseconds. */
+    void add(Nanos nanos) {
+      const size_t bucket = getBucket(nanos);
+      if (bucket >= _buckets.size())
+        _buckets.resize(bucket + 1);
+      ++_buckets[bucket];
+      ++_count;
+      _sum += nanos;
+      if (_max < nanos)
+        _max = nanos;
+    }
+
+    /** Records the operations recorded in histogram. */
+    void merge(const LatencyHistogram& histogram);
+
+    void clear();
+
+    unsigned long long getCount() const {return _count;}
+    Nanos getMax() const {return _max;}
+    double getMean() const {
+      return _count == 0 ? 0 : static_cast<double>(_sum) / _count;
+    }
+
+    /** Returns a latency that is at least that of the given fraction of
+        the operations, for example 0.99 for the 99th percentile. Returns
+        0 if there are no operations. */
+    Nanos getPercentile(double fraction) const;
+
+    /** Prints the median, 99th and 99.9th percentile and the maximum. */
+    void print(std::ostream& out) const;
+
+    /** Times an operation from construction to destruction and records
+        it in a histogram, but only if asked to. This makes it simple to
+        time every so many operations of a loop. */
+    class Timing {
+    public:
+      Timing(LatencyHistogram& histogram, bool record):
+        _histogram(record ? &histogram : 0),
+        _start(record ? WallTimer::getNanos() : 0) {}
+      ~Timing() {
+        if (_histogram != 0)
+          _histogram->add(WallTimer::getNanos() - _start);
+      }
+
+    private:
+      LatencyHistogram* const _histogram;
+      const Nanos _start;
+    };
+
+  private:
+    static const size_t SubBucketCount = 1 << SubBucketBits;
+
+    static size_t getBucket(Nanos nanos) {
+      if (nanos < SubBucketCount)
+        return static_cast<size_t>(nanos);
+      size_t shift = 0;
+      while ((nanos >> shift) >= 2 * SubBucketCount)
+        ++shift;
+      return (shift + 1) * SubBucketCount +
+        static_cast<size_t>((nanos >> shift) - SubBucketCount);
+    }
+
+    /** Returns the greatest latency that goes into bucket. */
+    static Nanos getBucketMax(size_t bucket) {
+      if (bucket < SubBucketCount)
+        return bucket;
+      const size_t shift = bucket / SubBucketCount - 1;
+      const Nanos subBucket = bucket % SubBucketCount;
+      return ((SubBucketCount + subBucket + 1) << shift) - 1;
+    }
+
+    std::vector<unsigned long long> _buckets;
+    unsigned long long _count;
+    Nanos _sum;
+    Nanos _max;
+  };
+
+  inline void LatencyHistogram::merge(const LatencyHistogram& histogram) {
+    if (_buckets.size() < histogram._buckets.size())
+      _buckets.resize(histogram._buckets.size());
+    for (size_t bucket = 0; bucket < histogram._buckets.size(); ++bucket)
+      _buckets[bucket] += histogram._buckets[bucket];
+    _count += histogram._count;
+    _sum += histogram._sum;
+    if (_max < histogram._max)
+      _max = histogram._max;
+  }
+
+  inline void LatencyHistogram::clear() {
+    _buckets.clear();
+    _count = 0;
+    _sum = 0;
+    _max = 0;
+  }
+
+  inline LatencyHistogram::Nanos
+  LatencyHistogram::getPercentile(double fraction) const {
+    MATHIC_ASSERT(0 <= fraction && fraction <= 1);
+    if (_count == 0)
+      return 0;
+    // the number of operations that must be at or below the answer.
+    unsigned long long needed =
+      static_cast<unsigned long long>(fraction * _count);
+    if (needed < fraction * _count || needed == 0)
+      ++needed;
+    unsigned long long seen = 0;
+    for (size_t bucket = 0; bucket < _buckets.size(); ++bucket) {
+      seen += _buckets[bucket];
+      if (seen >= needed)
+        return getBucketMax(bucket) < _max ? getBucketMax(bucket) : _max;
+    }
+    return _max;
+  }
+
+  inline void LatencyHistogram::print(std::ostream& out) const {
+    out << "p50:" << ColumnPrinter::nanosInUnit(getPercentile(0.5))
+      << " p99:" << ColumnPrinter::nanosInUnit(getPercentile(0.99))
+      << " p999:" << ColumnPrinter::nanosInUnit(getPercentile(0.999))
+      << " max:" << ColumnPrinter::nanosInUnit(getMax());
+  }
+}
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef MATHIC_MINIMIZE_GUARD
+#define MATHIC_MINIMIZE_GUARD
+
+#include "stdinc.h"
+#include "ThreadScaling.h"
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+namespace mathic {
+  /** Reorders the entries in [begin, end) so that [begin, mid) contains
+      the minimal generators of the monomial ideal generated by
+      [begin, end), and returns mid. The minimal generators keep their
+      relative order. Of several equal entries only the first one is kept.
+
+      Iter must be a random access iterator. Finder is the divisor query
+      data structure to use, such as KDTree
+      or DivList, and conf is its Configuration. The Configuration must
+      accept an Entry wherever it accepts a Monomial. Finder needs to
+      support insert and findDivisor but not removals. The Exponent type
+      must support operator+ for computing total degrees.
+
+      The entries are sorted by total degree, so an entry can only be
+      divided by entries that come before it, and no multiples ever have
+      to be removed. The sorted entries are split into chunkCount chunks
+      that are minimized independently of each other, each on a thread
+      of its own with its own copy of conf. A sequential merge step then
+      removes the entries that are divisible by an entry of an earlier
+      chunk. If chunkCount is zero, one chunk per processor is used. See
+      runInParallel for what happens if threads are not available. */
+  template<class Finder, class Iter>
+  Iter minimize(
+    Iter begin,
+    Iter end,
+    const typename Finder::Configuration& conf,
+    size_t chunkCount = 0);
+
+  namespace MinimizeHelper {
+    // sorts pairs of (degree, index) by degree, then by index.
+    template<class Exponent>
+    struct DegreeOrder {
+      bool operator()(const std::pair<Exponent, size_t>& a,
+        const std::pair<Exponent, size_t>& b) const {
+        if (a.first < b.first)
+          return true;
+        if (b.first < a.first)
+          return false;
+        return a.second < b.second;
+      }
+    };
+
+    /** Minimizes each chunk of the entries in order of degree and marks
+        the entries that are minimal within their chunk in keep. */
+    template<class Finder, class Iter, class DegreeIndex>
+    class ChunkWork : public ParallelWork {
+    public:
+      typedef typename Finder::Configuration C;
+
+      ChunkWork(Iter begin, const std::vector<DegreeIndex>& order,
+        std::vector<char>& keep, const C& conf):
+        _begin(begin), _order(order), _keep(keep), _conf(conf) {}
+
+      virtual void run(size_t chunk, size_t chunkCount) {
+        const size_t size = _order.size();
+        const size_t chunkBegin = (size * chunk) / chunkCount;
+        const size_t chunkEnd = (size * (chunk + 1)) / chunkCount;
+        Finder finder(_conf);
+        for (size_t i = chunkBegin; i < chunkEnd; ++i) {
+          const size_t index = _order[i].second;
+          if (finder.findDivisor(_begin[index]) == 0) {
+            finder.insert(_begin[index]);
+            _keep[index] = true;
+          }
+        }
+      }
+
+    private:
+      const Iter _begin;
+      const std::vector<DegreeIndex>& _order;
+      std::vector<char>& _keep; /// each chunk writes its own entries
+      const C& _conf;
+    };
+  }
+
+  template<class Finder, class Iter>
+  Iter minimize(
+    Iter begin,
+    Iter end,
+    const typename Finder::Configuration& conf,
+    size_t chunkCount
+  ) {
+    typedef typename Finder::Configuration C;
+    typedef typename C::Exponent Exponent;
+    typedef std::pair<Exponent, size_t> DegreeIndex;
+
+    const size_t size = std::distance(begin, end);
+    if (size == 0)
+      return end;
+    if (chunkCount == 0)
+      chunkCount = getProcessorCount();
+    chunkCount = std::max<size_t>(1, std::min(chunkCount, size));
+
+    // sort by total degree
+    const size_t varCount = conf.getVarCount();
+    std::vector<DegreeIndex> order(size);
+    for (size_t i = 0; i < size; ++i) {
+      const typename std::iterator_traits<Iter>::reference entry = begin[i];
+      Exponent degree = conf.getExponent(entry, 0);
+      for (size_t var = 1; var < varCount; ++var)
+        degree = degree + conf.getExponent(entry, var);
+      order[i] = DegreeIndex(degree, i);
+    }
+    std::sort(order.begin(), order.end(),
+      MinimizeHelper::DegreeOrder<Exponent>());
+
+    // minimize each chunk independently
+    std::vector<char> keep(size, false);
+    MinimizeHelper::ChunkWork<Finder, Iter, DegreeIndex>
+      work(begin, order, keep, conf);
+    if (chunkCount == 1)
+      work.run(0, 1);
+    else
+      runInParallel(work, chunkCount);
+
+    // merge the chunks in order of degree
+    if (chunkCount > 1) {
+      Finder finder(conf);
+      for (size_t i = 0; i < size; ++i) {
+        const size_t index = order[i].second;
+        if (!keep[index])
+          continue;
+        if (finder.findDivisor(begin[index]) == 0)
+          finder.insert(begin[index]);
+        else
+          keep[index] = false;
+      }
+    }
+
+    // move the minimal generators to the front, keeping their order.
+    Iter newEnd = begin;
+    for (size_t i = 0; i < size; ++i) {
+      if (!keep[i])
+        continue;
+      const Iter it = begin + i;
+      if (it != newEnd)
+        std::iter_swap(newEnd, it);
+      ++newEnd;
+    }
+    return newEnd;
+  }
+}
+
+#endif
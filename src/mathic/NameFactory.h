@@ -90,6 +90,16 @@ namespace mathic {
   std::string uniqueNameWithPrefix
   (const NameFactory<AbstractProduct>& factory, const std::string& prefix);
 
+  /** Appends to names the unique product name for each prefix in the
+   comma separated list prefixes, in the order they are listed.
+   Exceptions thrown are as for uniqueNameWithPrefix(). */
+  template<class AbstractProduct>
+  void uniqueNamesWithPrefixes(
+    const NameFactory<AbstractProduct>& factory,
+    const std::string& prefixes,
+    std::vector<std::string>& names
+  );
+
 
   // **************************************************************
   // These implementations have to be included here due
@@ -196,6 +206,23 @@ namespace mathic {
     MATHIC_ASSERT(names.size() == 1);
     return names.back();
   }
+
+  template<class AbstractProduct>
+  void uniqueNamesWithPrefixes(
+    const NameFactory<AbstractProduct>& factory,
+    const std::string& prefixes,
+    std::vector<std::string>& names
+  ) {
+    size_t begin = 0;
+    while (true) {
+      const size_t end = prefixes.find(',', begin);
+      names.push_back(uniqueNameWithPrefix
+        (factory, prefixes.substr(begin, end - begin)));
+      if (end == std::string::npos)
+        break;
+      begin = end + 1;
+    }
+  }
 }
 
 #endif
@@ -2,8 +2,13 @@
 #define MATHIC_PACKED_K_D_TREE_GUARD
 
 #include "stdinc.h"
+#include "ConfigFlags.h"
 #include "DivMask.h"
+#include "CompactExponents.h"
 #include "KDEntryArray.h"
+#include "KDTreeAnalysis.h"
+#include "ScoreBound.h"
+#include "ThreadScaling.h"
 #include <memtailor.h>
 #include <ostream>
 
@@ -14,9 +19,12 @@ namespace mathic {
     typedef typename C::Monomial Monomial;
     typedef typename C::Entry Entry;
     typedef typename C::Exponent Exponent;
-    typedef typename DivMask::Extender<Entry, C::UseDivMask> ExtEntry;
-    typedef typename DivMask::Extender<const Monomial&,C::UseDivMask> ExtMonoRef;
+    typedef typename WithCompactExponents
+      <C, DivMask::Extender<Entry, C::UseDivMask> >::Type ExtEntry;
+    typedef typename WithCompactExponents
+      <C, DivMask::Extender<const Monomial&, C::UseDivMask> >::Type ExtMonoRef;
     typedef typename DivMask::Calculator<C> DivMaskCalculator;
+    typedef HasScoreBound<C> ScoreBound;
 
     struct ExpOrder {
     ExpOrder(size_t var, const C& conf): _var(var), _conf(conf) {}
@@ -46,11 +54,13 @@ namespace mathic {
           Node(begin, end, arena, conf, childCount);
       }
 
+      /** Constructs the node in memory, which must have room for
+          sizeOf(childCount) bytes. */
       template<class Iter>
-      static Node* makeNode(Iter begin, Iter end, memt::Arena& arena,
-        const DivMaskCalculator& calc, const C& conf, size_t childCount) {
-        return new (arena.alloc(sizeOf(childCount)))
-          Node(begin, end, arena, calc, conf, childCount);
+      static Node* makeNode(Iter begin, Iter end, void* memory,
+        memt::Arena& arena, const DivMaskCalculator& calc, const C& conf,
+        size_t childCount) {
+        return new (memory) Node(begin, end, arena, calc, conf, childCount);
       }
 
       static size_t sizeOf(size_t childCount) {
@@ -59,7 +69,11 @@ namespace mathic {
         return sizeof(Node) + childCount * sizeof(Child);
       }
 
-      struct Child : public mathic::DivMask::HasDivMask<C::UseTreeDivMask> {
+      // The tree div mask is a lower bound on the child's sub tree, on the
+      // later children and on the entries of the node. The score bound only
+      // covers the child's sub tree.
+      struct Child : public mathic::DivMask::HasDivMask<C::UseTreeDivMask>,
+        public ScoreBound {
         size_t var;
         Exponent exponent;
         Node* node;
@@ -72,6 +86,13 @@ namespace mathic {
       const_iterator childEnd() const {return _childrenEnd;}
 
       bool hasChildren() const {return childBegin() != childEnd();}
+      size_t childCount() const {return childEnd() - childBegin();}
+
+      /** The epoch of the tree that made this node. See _epoch in
+          PackedKDTree. */
+      size_t getEpoch() const {return _epoch;}
+      void setEpoch(size_t epoch) {_epoch = epoch;}
+
       template<class ME> // ME is MonomialOrEntry
       bool inChild(const_iterator child, const ME me, const C& conf) const {
         return child->exponent < conf.getExponent(me, child->var);
@@ -107,6 +128,7 @@ namespace mathic {
       class SplitEqualOrLess;
 
       KDEntryArray<C, ExtEntry> _entries;
+      size_t _epoch;
       // Array has size 1 to appease compiler since size 0 produces warnings
       // or errors. Actual size can be greater if more memory has been
       // allocated for the node than sizeof(Node).
@@ -123,13 +145,24 @@ namespace mathic {
 
     bool removeElement(const Monomial& monomial);
 
-    void insert(const ExtEntry& entry);
+    /** calc must be the calculator used for the div masks of the entries
+        already in the tree. It is used if a partial rebuild occurs. */
+    void insert(const ExtEntry& entry, const DivMaskCalculator& calc);
 
     template<class Iter>
     void reset(Iter begin, Iter end, const DivMaskCalculator& calc);
 
     inline Entry* findDivisor(const ExtMonoRef& monomial);
 
+    /** As findDivisor, but records the work done in stats. */
+    Entry* findDivisor(const ExtMonoRef& monomial, KDTreeQueryStats& stats);
+
+    inline Entry* findBestDivisor(const ExtMonoRef& monomial);
+
+    template<class S>
+    inline Entry* findDivisorWithScoreBelow
+      (const ExtMonoRef& monomial, const S& bound);
+
     template<class DivisorOutput>
     inline void findAllDivisors
       (const ExtMonoRef& monomial, DivisorOutput& out);
@@ -141,10 +174,46 @@ namespace mathic {
     template<class EntryOutput>
     void forAll(EntryOutput& out);
 
+    /** A resumable traversal of the entries that divide a monomial if
+        Divisors is true or of the entries that the monomial divides if
+        Divisors is false. See KDTree::divisorRange. */
+    template<bool Divisors>
+    class Range;
+
     void clear();
 
+    /** Makes this tree contain the same entries as tree in constant time
+        by sharing the nodes of tree. This tree must be empty. Afterwards
+        neither tree modifies a shared node. A tree that needs to modify
+        a shared node copies it first, along with its shared ancestors.
+        The memory of shared nodes is released once no tree uses them.
+        Once the other trees are gone, the next change to a tree makes
+        its nodes its own again, so it stops copying them. Sharing and
+        releasing nodes updates reference counts that are shared between
+        the trees without synchronization, and changes read them. */
+    void share(PackedKDTree<C>& tree);
+
+    /** Returns the number of removed entries that are still taking up
+        space. Always 0 unless UseTombstones is true. */
+    size_t getDeadCount() const {return _deadCount;}
+
+    /** Returns the maximal number of entries in a leaf. It starts out as
+        C::LeafSize. */
+    size_t getLeafSize() const {return _leafSize;}
+
+    /** Sets the maximal number of entries in a leaf for splits and
+        rebuilds from now on. Leaves that are already larger stay so
+        until the next rebuild. leafSize must be in [1, C::LeafSize]. */
+    void setLeafSize(size_t leafSize) {
+      MATHIC_ASSERT(0 < leafSize && leafSize <= C::LeafSize);
+      _leafSize = leafSize;
+    }
+
     size_t getMemoryUse() const;
 
+    /** Adds the shape of the tree to analysis. */
+    void analyze(KDTreeAnalysis& analysis) const;
+
     void print(std::ostream& out) const;
 
     C& getConfiguration() {return _conf;}
@@ -166,15 +235,154 @@ namespace mathic {
       typename Node::Child* fromParent;
     };
 
-    memt::Arena _arena; // Everything permanent allocated from here.
+    /** Builds a balanced subtree containing the entries in [begin, end)
+        and returns its root. var is the split variable of the parent or
+        -1 for the root of the tree. */
+    template<class Iter>
+    Node* build(Iter begin, Iter end, const DivMaskCalculator& calc,
+      size_t var);
+
+    /** Rebuilds the deepest subtree along _path that is too deep for
+        the number of entries in it. Call after an insertion has made the
+        height of the tree exceed maxBalancedDepth(_entryCount). */
+    void partialRebuild(const DivMaskCalculator& calc);
+
+    /** Returns how deep a tree with entryCount entries may get before
+        a partial rebuild is triggered. */
+    size_t maxBalancedDepth(size_t entryCount) const;
+
+    /** Returns the number of entries in the subtree rooted at node. */
+    size_t subtreeSize(Node* node) const;
+
+    /** Returns memory for a node with childCount children, reusing the
+        memory of a node discarded by a partial rebuild if possible. */
+    void* allocNode(size_t childCount);
+
+    /** Returns true if node may be shared with another tree. */
+    bool isShared(const Node* node) const {return node->getEpoch() != _epoch;}
+
+    /** Returns true if this tree may share nodes with another tree. If
+        every other tree that this tree shared nodes with is gone, this
+        makes all the nodes of this tree its own by giving them the
+        current epoch and returns false. Those nodes stay in the frozen
+        arenas, which this tree then keeps until clear() or rebuild(). */
+    bool mayShare();
+
+    /** Returns node if it is not shared. Otherwise replaces node by a copy
+        that is not shared and returns the copy. fromParent must be the
+        link to node, or null if node is the root, and it must not be in a
+        shared node. */
+    Node* unshare(Node* node, typename Node::Child* fromParent);
+
+    /** A node visited by removeMultiplesShared. */
+    struct Visit {
+      Visit(Node* node, size_t parent, size_t child):
+        node(node), parent(parent), child(child) {}
+      Node* node;
+      size_t parent; /// index of the visit of the parent, or -1 for the root
+      size_t child; /// index of node among the children of its parent
+    };
+
+    /** As removeMultiples, but copies shared nodes that have multiples in
+        them, along with their ancestors, before removing the multiples. */
+    template<class MultipleOutput>
+    size_t removeMultiplesShared
+      (const ExtMonoRef& monomial, MultipleOutput& out);
+
+    /** Unshares the node of visits[index] and its ancestors. Returns the
+        unshared node. */
+    Node* unshare(std::vector<Visit>& visits, size_t index);
+
+    /** The arenas that nodes are allocated from form a chain. The first
+        arena in the chain belongs to one tree and is where that tree
+        allocates new nodes. The later arenas are frozen and hold nodes
+        that may be shared between trees. A frozen arena records the root
+        and epoch of the tree at the time it was frozen. Its nodes of that
+        epoch are reachable from that root through nodes of that epoch, so
+        their entries can be destroyed when the last reference to the
+        arena goes away.
+
+        Trees that share an arena can be on different threads, so
+        refCount is only read and changed through addReference,
+        removeReference and getReferenceCount, which are atomic. */
+    struct ArenaLink {
+      ArenaLink(ArenaLink* previous):
+        previous(previous), refCount(1), root(0), epoch(0), frozen(false) {}
+      memt::Arena arena;
+      ArenaLink* previous; /// Counts as a reference. Can be null.
+      size_t refCount;
+      Node* root;
+      size_t epoch;
+      bool frozen;
+#ifndef __GNUC__
+      Mutex refCountMutex; /// There are no atomic builtins to use.
+#endif
+    };
+
+    static void addReference(ArenaLink* link) {
+#ifdef __GNUC__
+      __sync_add_and_fetch(&link->refCount, 1);
+#else
+      Mutex::Lock lock(link->refCountMutex);
+      ++link->refCount;
+#endif
+    }
+
+    /** Returns the number of references that are left. */
+    static size_t removeReference(ArenaLink* link) {
+#ifdef __GNUC__
+      return __sync_sub_and_fetch(&link->refCount, 1);
+#else
+      Mutex::Lock lock(link->refCountMutex);
+      return --link->refCount;
+#endif
+    }
+
+    static size_t getReferenceCount(ArenaLink* link) {
+#ifdef __GNUC__
+      return __sync_add_and_fetch(&link->refCount, 0);
+#else
+      Mutex::Lock lock(link->refCountMutex);
+      return link->refCount;
+#endif
+    }
+
+    /** Removes a reference to link and deletes it if that was the last
+        reference, which then removes a reference to its previous link. */
+    static void release(ArenaLink* link);
+
+    ArenaLink* _arenas; // Everything permanent allocated from here.
+    bool _mayShare; // False if no other tree can use the nodes of this one.
+
+    // Incremented on sharing. A node made by this tree has the epoch of
+    // the tree at the time. A node of an earlier epoch may be shared.
+    size_t _epoch;
+
     C _conf; // User supplied configuration.
     mutable std::vector<Node*> _tmp; // For navigating the tree.
+    // For findBestDivisor, which checks the score bound of each child
+    // again when it gets to it, since the best score may be lower then.
+    mutable std::vector<typename Node::const_iterator> _childTmp;
     Node* _root; // Root of the tree. Can be null!
+    size_t _entryCount; // Only kept up to date if UsePartialRebuilds.
+    size_t _deadCount; // Only non-zero if UseTombstones.
+    size_t _leafSize; // At most C::LeafSize.
+    size_t _partialRebuildCount; // Number of calls to partialRebuild.
+
+    // The links followed by the most recent insertion. _path[i] points to
+    // the node at depth i + 1. Only used if UsePartialRebuilds.
+    std::vector<typename Node::Child*> _path;
+
+    // _freeNodes[c] holds discarded nodes with room for c children.
+    std::vector<std::vector<Node*> > _freeNodes;
   };
 
   template<class C>
   PackedKDTree<C>::PackedKDTree(const C& configuration):
-  _conf(configuration), _root(0) {
+  _arenas(new ArenaLink(0)), _mayShare(false), _epoch(0),
+  _conf(configuration), _root(0),
+  _entryCount(0), _deadCount(0), _leafSize(C::LeafSize),
+  _partialRebuildCount(0) {
     MATHIC_ASSERT(C::LeafSize > 0);
     MATHIC_ASSERT(debugIsValid());
   }
@@ -182,11 +390,12 @@ namespace mathic {
   template<class C>
   PackedKDTree<C>::~PackedKDTree() {
     clear();
+    release(_arenas);
   }
 
   template<class C>
   PackedKDTree<C>::Node::Node(memt::Arena& arena, const C& conf):
-  _entries(arena, conf) {
+  _entries(arena, conf), _epoch(0) {
     _childrenEnd = childBegin();
   }
 
@@ -198,7 +407,7 @@ namespace mathic {
     memt::Arena& arena,
     const C& conf,
     size_t childCount):
-    _entries(begin, end, arena, conf) {
+    _entries(begin, end, arena, conf), _epoch(0) {
     _childrenEnd = childBegin() + childCount;
   }
 
@@ -211,7 +420,7 @@ namespace mathic {
     const DivMaskCalculator& calc,
     const C& conf,
     size_t childCount):
-    _entries(begin, end, arena, calc, conf) {
+    _entries(begin, end, arena, calc, conf), _epoch(0) {
     _childrenEnd = childBegin() + childCount;
   }
 
@@ -225,23 +434,69 @@ namespace mathic {
     if (_root == 0)
       return 0;
     size_t removedCount = 0;
-    Node* node = _root;
-    while (true) {
+    if (mayShare())
+      removedCount = removeMultiplesShared(extMonomial, out);
+    else {
+      Node* node = _root;
+      while (true) {
+        for (typename Node::const_iterator it = node->childBegin();
+          it != node->childEnd(); ++it) {
+          _tmp.push_back(it->node);
+          if (node->inChild(it, extMonomial.get(), _conf))
+            goto stopped;
+        }
+        removedCount +=
+          node->entries().removeMultiples(extMonomial, out, _conf);
+  stopped:;
+        if (_tmp.empty())
+          break;
+        node = _tmp.back();
+        _tmp.pop_back();
+      }
+    }
+    MATHIC_ASSERT(_tmp.empty());
+    MATHIC_ASSERT(debugIsValid());
+    if (ConfigFlags<C>::UsePartialRebuilds)
+      _entryCount -= removedCount;
+    if (ConfigFlags<C>::UseTombstones)
+      _deadCount += removedCount;
+    return removedCount;
+  }
+
+  template<class C>
+  template<class MO>
+  size_t PackedKDTree<C>::removeMultiplesShared(
+    const ExtMonoRef& extMonomial,
+    MO& out
+  ) {
+    // The visits are recorded so that the path to a node can be unshared
+    // once it turns out that the node has multiples in it.
+    std::vector<Visit> visits;
+    std::vector<size_t> todo;
+    visits.push_back(Visit(_root, static_cast<size_t>(-1), 0));
+    todo.push_back(0);
+    size_t removedCount = 0;
+    while (!todo.empty()) {
+      const size_t index = todo.back();
+      todo.pop_back();
+      Node* node = visits[index].node;
       for (typename Node::const_iterator it = node->childBegin();
         it != node->childEnd(); ++it) {
-        _tmp.push_back(it->node);
+        todo.push_back(visits.size());
+        visits.push_back(Visit(it->node, index, it - node->childBegin()));
         if (node->inChild(it, extMonomial.get(), _conf))
           goto stopped;
       }
+      {
+        KDEntryArray<C, ExtEntry>& entries = node->entries();
+        if (entries.findNextMultiple(extMonomial, entries.begin(), _conf) ==
+          entries.end())
+          continue;
+      }
+      node = unshare(visits, index);
       removedCount += node->entries().removeMultiples(extMonomial, out, _conf);
 stopped:;
-      if (_tmp.empty())
-        break;
-      node = _tmp.back();
-      _tmp.pop_back();
     }
-    MATHIC_ASSERT(_tmp.empty());
-    MATHIC_ASSERT(debugIsValid());
     return removedCount;
   }
 
@@ -250,51 +505,82 @@ stopped:;
     MATHIC_ASSERT(_tmp.empty());
     if (_root == 0)
       return false;
-    Node* node = _root;
+    Node* node = unshare(_root, 0);
  
     typename Node::iterator child = node->childBegin();
     while (child != node->childEnd()) {
       if (node->inChild(child, monomial, _conf)) {
-        node = child->node;
+        node = unshare(child->node, child);
         child = node->childBegin();
       } else
         ++child;
     }
     const bool value = node->entries().removeElement(monomial, _conf);
     MATHIC_ASSERT(debugIsValid());
+    if (ConfigFlags<C>::UsePartialRebuilds && value)
+      --_entryCount;
+    if (ConfigFlags<C>::UseTombstones && value)
+      ++_deadCount;
     return value;
   }
 
   template<class C>
-  void PackedKDTree<C>::insert(const ExtEntry& extEntry) {
+  void PackedKDTree<C>::insert(
+    const ExtEntry& extEntry,
+    const DivMaskCalculator& calc
+  ) {
     MATHIC_ASSERT(debugIsValid());
     // find node in which to insert extEntry
     typename Node::Child* parentChild = 0;
-    if (_root == 0)
-      _root = Node::makeNode(_arena, _conf);
-    Node* node = _root;
+    if (_root == 0) {
+      _root = Node::makeNode(_arenas->arena, _conf);
+      _root->setEpoch(_epoch);
+    }
+    if (ConfigFlags<C>::UsePartialRebuilds)
+      _path.clear();
+    bool deeper = false;
+    const typename ScoreBound::Score score =
+      ScoreBound::getScore(extEntry.get(), _conf);
+    Node* node = unshare(_root, 0);
     typename Node::iterator child = node->childBegin();
     while (true) {
       if (child == node->childEnd()) {
+        if (ConfigFlags<C>::UseTombstones)
+          _deadCount -= node->entries().compact();
         MATHIC_ASSERT(node->entries().size() <= C::LeafSize);
-        if (node->entries().size() < C::LeafSize)
+        if (node->entries().size() < _leafSize)
           node->entries().insert(extEntry, _conf);
         else { // split full node
-          node = node->splitInsert(extEntry, parentChild, _arena, _conf);
+          node = node->splitInsert
+            (extEntry, parentChild, _arenas->arena, _conf);
+          node->setEpoch(_epoch);
           if (parentChild == 0)
             _root = node;
+          if (ConfigFlags<C>::UsePartialRebuilds) {
+            _path.push_back(&*(node->childEnd() - 1));
+            deeper = true;
+          }
         }
         break;
       }
       if (C::UseTreeDivMask)
         child->updateToLowerBound(extEntry);
       if (node->inChild(child, extEntry.get(), _conf)) {
+        child->updateScoreBound(score);
         parentChild = &*child;
-        node = child->node;
+        if (ConfigFlags<C>::UsePartialRebuilds)
+          _path.push_back(parentChild);
+        node = unshare(child->node, parentChild);
         child = node->childBegin();
       } else
         ++child;
     }
+    if (ConfigFlags<C>::UsePartialRebuilds) {
+      ++_entryCount;
+      // only a split can make the tree deeper
+      if (deeper && _path.size() > maxBalancedDepth(_entryCount))
+        partialRebuild(calc);
+    }
     MATHIC_ASSERT(debugIsValid());
   }
 
@@ -304,7 +590,20 @@ stopped:;
     clear();
     if (insertBegin == insertEnd)
       return;
+    _entryCount = std::distance(insertBegin, insertEnd);
+    _root = build(insertBegin, insertEnd, calc, static_cast<size_t>(-1));
+    MATHIC_ASSERT(debugIsValid());
+  }
 
+  template<class C>
+  template<class Iter>
+  typename PackedKDTree<C>::Node* PackedKDTree<C>::build(
+    Iter insertBegin,
+    Iter insertEnd,
+    const DivMaskCalculator& calc,
+    size_t initialVar
+  ) {
+    MATHIC_ASSERT(insertBegin != insertEnd);
     typedef InsertTodo<Iter> Task;
     typedef std::vector<Task> TaskCont;
     TaskCont todo;
@@ -314,10 +613,11 @@ stopped:;
       Task initialTask;
       initialTask.begin = insertBegin;
       initialTask.end = insertEnd;
-      initialTask.var = static_cast<size_t>(-1);
+      initialTask.var = initialVar;
       initialTask.fromParent = 0;
       todo.push_back(initialTask);
     }
+    Node* top = 0;
     while (!todo.empty()) {
       Iter begin = todo.back().begin;
       Iter end = todo.back().end;
@@ -330,7 +630,7 @@ stopped:;
       todo.pop_back();
 
       // split off children until reaching few enough entries
-      while (C::LeafSize < static_cast<size_t>(std::distance(begin, end))) {
+      while (_leafSize < static_cast<size_t>(std::distance(begin, end))) {
         Task child;
         Iter middle = KDEntryArray<C, ExtEntry>::
           split(begin, end, var, child.exp, _conf);
@@ -343,10 +643,11 @@ stopped:;
         // now operate on the equal-or-less part of the range
         end = middle;
       }
-      Node* node = Node::makeNode
-        (begin, end, _arena, calc, _conf, children.size());
-      if (_root == 0)
-        _root = node;
+      Node* node = Node::makeNode(begin, end, allocNode(children.size()),
+        _arenas->arena, calc, _conf, children.size());
+      node->setEpoch(_epoch);
+      if (top == 0)
+        top = node;
       if (fromParent != 0)
         fromParent->node = node;
       for (size_t child = 0; child < children.size(); ++child) {
@@ -355,13 +656,13 @@ stopped:;
       }
       children.clear();
     }
-    MATHIC_ASSERT(_root != 0);
+    MATHIC_ASSERT(top != 0);
 
-    if (C::UseTreeDivMask) {
+    if (C::UseTreeDivMask || ConfigFlags<C>::UseScoreBounds) {
       // record nodes in tree using breadth first search
       typedef std::vector<Node*> NodeCont;
       NodeCont nodes;
-      nodes.push_back(_root);
+      nodes.push_back(top);
       for (size_t i = 0; i < nodes.size(); ++i) {
         Node* node = nodes[i];
         for (typename Node::iterator child = node->childBegin();
@@ -377,6 +678,17 @@ stopped:;
         riter rbegin = riter(node->childEnd());
         riter rend = riter(node->childBegin());
         for (riter child = rbegin; child != rend; ++child) {
+          if (ConfigFlags<C>::UseScoreBounds) {
+            Node* childNode = child->node;
+            child->resetScoreBound();
+            child->updateScoreBound(childNode->entries().begin(),
+              childNode->entries().end(), _conf);
+            for (typename Node::iterator it = childNode->childBegin();
+              it != childNode->childEnd(); ++it)
+              child->updateScoreBound(*it);
+          }
+          if (!C::UseTreeDivMask)
+            continue;
           child->resetDivMask();
           if (child == rbegin)
             child->updateToLowerBound(node->entries());
@@ -393,7 +705,250 @@ stopped:;
         MATHIC_ASSERT(node->debugIsValid());
       }
     }
-    MATHIC_ASSERT(debugIsValid());
+    return top;
+  }
+
+  template<class C>
+  void PackedKDTree<C>::partialRebuild(const DivMaskCalculator& calc) {
+    MATHIC_ASSERT(ConfigFlags<C>::UsePartialRebuilds);
+    MATHIC_ASSERT(_tmp.empty());
+    ++_partialRebuildCount;
+    // Walk up the insertion path, accumulating the size of the subtree
+    // below each node, until finding a node whose subtree is too deep
+    // for its size. The root always qualifies as the whole tree is too
+    // deep. The work done here is proportional to the size of the subtree
+    // that gets rebuilt, which makes the cost amortized logarithmic.
+    const size_t height = _path.size();
+    size_t depth = height;
+    size_t size = subtreeSize(_path.back()->node);
+    while (depth > 0 && height - depth <= maxBalancedDepth(size)) {
+      --depth;
+      Node* node = depth == 0 ? _root : _path[depth - 1]->node;
+      size += node->entries().liveSize();
+      for (typename Node::iterator it = node->childBegin();
+        it != node->childEnd(); ++it)
+        if (&*it != _path[depth])
+          size += subtreeSize(it->node);
+    }
+
+    // Move the entries out of the subtree and recycle its nodes.
+    typename Node::Child* fromParent = depth == 0 ? 0 : _path[depth - 1];
+    Node* top = fromParent == 0 ? _root : fromParent->node;
+    std::vector<Entry> entries;
+    entries.reserve(size);
+    _tmp.push_back(top);
+    while (!_tmp.empty()) {
+      Node* node = _tmp.back();
+      _tmp.pop_back();
+      for (typename Node::iterator it = node->childBegin();
+        it != node->childEnd(); ++it)
+        _tmp.push_back(it->node);
+      for (typename KDEntryArray<C, ExtEntry>::iterator it =
+        node->entries().begin(); it != node->entries().end(); ++it)
+        if (!node->entries().isDead(it))
+          entries.push_back(it->get());
+      _deadCount -= node->entries().deadCount();
+      if (isShared(node))
+        continue; // it is still in use by another tree
+      const size_t childCount = node->childCount();
+      node->entries().clear(); // calls destructors
+      if (_freeNodes.size() <= childCount)
+        _freeNodes.resize(childCount + 1);
+      _freeNodes[childCount].push_back(node);
+    }
+    MATHIC_ASSERT(entries.size() == size);
+
+    // The div masks of the entries are unchanged as calc is the calculator
+    // that they were computed with. The tree div mask on fromParent stays
+    // valid as the set of entries below it is the same.
+    const size_t var =
+      fromParent == 0 ? static_cast<size_t>(-1) : fromParent->var;
+    top = build(entries.begin(), entries.end(), calc, var);
+    if (fromParent == 0)
+      _root = top;
+    else
+      fromParent->node = top;
+    _path.clear();
+  }
+
+  template<class C>
+  size_t PackedKDTree<C>::maxBalancedDepth(size_t entryCount) const {
+    // Allow twice the depth of a perfectly balanced tree plus some slack
+    // for small trees.
+    size_t depth = 2;
+    for (size_t leaves = entryCount / _leafSize; leaves > 0; leaves /= 2)
+      depth += 2;
+    return depth;
+  }
+
+  template<class C>
+  size_t PackedKDTree<C>::subtreeSize(Node* node) const {
+    MATHIC_ASSERT(_tmp.empty());
+    size_t size = 0;
+    _tmp.push_back(node);
+    while (!_tmp.empty()) {
+      node = _tmp.back();
+      _tmp.pop_back();
+      size += node->entries().liveSize();
+      for (typename Node::iterator it = node->childBegin();
+        it != node->childEnd(); ++it)
+        _tmp.push_back(it->node);
+    }
+    return size;
+  }
+
+  template<class C>
+  void* PackedKDTree<C>::allocNode(size_t childCount) {
+    if (childCount < _freeNodes.size() && !_freeNodes[childCount].empty()) {
+      Node* node = _freeNodes[childCount].back();
+      _freeNodes[childCount].pop_back();
+      return node;
+    }
+    return _arenas->arena.alloc(Node::sizeOf(childCount));
+  }
+
+  template<class C>
+  typename PackedKDTree<C>::Node* PackedKDTree<C>::unshare
+    (Node* node, typename Node::Child* fromParent) {
+    MATHIC_ASSERT((fromParent == 0 ? _root : fromParent->node) == node);
+    if (!isShared(node) || !mayShare())
+      return node;
+    MATHIC_ASSERT(_arenas->previous != 0);
+    KDEntryArray<C, ExtEntry>& entries = node->entries();
+    Node* copy;
+    if (ConfigFlags<C>::UseTombstones && entries.deadCount() > 0) {
+      // leave the dead entries behind
+      std::vector<ExtEntry> live;
+      for (typename KDEntryArray<C, ExtEntry>::iterator it = entries.begin();
+        it != entries.end(); ++it)
+        if (!entries.isDead(it))
+          live.push_back(*it);
+      _deadCount -= entries.deadCount();
+      copy = Node::makeNode(live.begin(), live.end(), _arenas->arena, _conf,
+        node->childCount());
+    } else {
+      copy = Node::makeNode(entries.begin(), entries.end(), _arenas->arena,
+        _conf, node->childCount());
+    }
+    std::copy(node->childBegin(), node->childEnd(), copy->childBegin());
+    copy->setEpoch(_epoch);
+    if (fromParent == 0)
+      _root = copy;
+    else
+      fromParent->node = copy;
+    return copy;
+  }
+
+  template<class C>
+  typename PackedKDTree<C>::Node* PackedKDTree<C>::unshare
+    (std::vector<Visit>& visits, size_t index) {
+    // Go up to the first ancestor that is not shared. The ancestors of a
+    // node that is not shared are not shared either.
+    std::vector<size_t> path;
+    for (size_t i = index; i != static_cast<size_t>(-1); i = visits[i].parent) {
+      if (!isShared(visits[i].node))
+        break;
+      path.push_back(i);
+    }
+    // Unshare the path from the top down.
+    for (size_t i = path.size(); i > 0; --i) {
+      Visit& visit = visits[path[i - 1]];
+      typename Node::Child* fromParent = 0;
+      if (visit.parent != static_cast<size_t>(-1))
+        fromParent = visits[visit.parent].node->childBegin() + visit.child;
+      visit.node = unshare(visit.node, fromParent);
+    }
+    return visits[index].node;
+  }
+
+  template<class C>
+  bool PackedKDTree<C>::mayShare() {
+    if (!_mayShare)
+      return false;
+    // Another tree that uses a frozen arena of this tree refers to it
+    // either directly or through a frozen arena of its own that is not
+    // in the chain of this tree. Either way that adds a reference to the
+    // first arena of the chain of this tree that the other tree uses.
+    // This tree holds a reference to every link in its chain, so none
+    // of them is deleted while this runs, even if another tree that
+    // shares them is deleted on another thread.
+    for (ArenaLink* link = _arenas->previous; link != 0;
+      link = link->previous)
+      if (getReferenceCount(link) > 1)
+        return true;
+
+    // The nodes of the frozen epochs that are not reachable from _root
+    // keep their epoch, so release still destroys their entries, and
+    // their ancestors are not reachable from _root either.
+    MATHIC_ASSERT(_tmp.empty());
+    if (_root != 0)
+      _tmp.push_back(_root);
+    while (!_tmp.empty()) {
+      Node* node = _tmp.back();
+      _tmp.pop_back();
+      node->setEpoch(_epoch);
+      // a copy made by this tree can have shared children.
+      for (typename Node::iterator it = node->childBegin();
+        it != node->childEnd(); ++it)
+        _tmp.push_back(it->node);
+    }
+    _mayShare = false;
+    return false;
+  }
+
+  template<class C>
+  void PackedKDTree<C>::release(ArenaLink* link) {
+    while (link != 0 && removeReference(link) == 0) {
+      if (link->frozen && link->root != 0) {
+        // destroy the entries of the nodes made in the frozen epoch
+        std::vector<Node*> todo;
+        if (link->root->getEpoch() == link->epoch)
+          todo.push_back(link->root);
+        while (!todo.empty()) {
+          Node* node = todo.back();
+          todo.pop_back();
+          node->entries().clear(); // calls destructors
+          for (typename Node::iterator it = node->childBegin();
+            it != node->childEnd(); ++it)
+            if (it->node->getEpoch() == link->epoch)
+              todo.push_back(it->node);
+        }
+      }
+      ArenaLink* previous = link->previous;
+      delete link;
+      link = previous;
+    }
+  }
+
+  template<class C>
+  void PackedKDTree<C>::share(PackedKDTree<C>& tree) {
+    MATHIC_ASSERT(_root == 0);
+    MATHIC_ASSERT(&tree != this);
+    clear();
+
+    // Freeze the arena of tree and give each tree a new arena after it.
+    ArenaLink* frozen = tree._arenas;
+    MATHIC_ASSERT(!frozen->frozen);
+    frozen->frozen = true;
+    frozen->root = tree._root;
+    frozen->epoch = tree._epoch;
+    tree._arenas = new ArenaLink(frozen); // takes over the reference
+    addReference(frozen);
+    release(_arenas);
+    _arenas = new ArenaLink(frozen);
+
+    // Neither tree may now modify the nodes of the frozen epoch.
+    ++tree._epoch;
+    _epoch = tree._epoch;
+    tree._mayShare = true;
+    _mayShare = true;
+    tree._freeNodes.clear();
+    tree._path.clear();
+
+    _root = tree._root;
+    _entryCount = tree._entryCount;
+    _deadCount = tree._deadCount;
+    _leafSize = tree._leafSize;
   }
 
   template<class C>
@@ -436,6 +991,92 @@ next:
     return 0;
   }
 
+  template<class C>
+  typename PackedKDTree<C>::Entry* PackedKDTree<C>::findBestDivisor
+    (const ExtMonoRef& extMonomial) {
+    MATHIC_ASSERT(_childTmp.empty());
+    if (_root == 0)
+      return 0;
+    Entry* best = 0;
+    typename C::Score bestScore = typename C::Score();
+    Node* node = _root;
+    while (true) {
+      // a child whose div mask rules out divisibility also rules out
+      // the later children and the entries of the node.
+      typename Node::const_iterator stop = node->childEnd();
+      if (C::UseTreeDivMask) {
+        for (typename Node::const_iterator it = node->childBegin();
+          it != stop; ++it) {
+          if (!it->getDivMask().canDivide(extMonomial.getDivMask())) {
+            stop = it;
+            break;
+          }
+        }
+      }
+      // look at the entries first so that bestScore is as low as possible
+      // when deciding which children to visit.
+      if (stop == node->childEnd())
+        node->entries().findBestDivisor(extMonomial, best, bestScore, _conf);
+      for (typename Node::const_iterator it = node->childBegin();
+        it != stop; ++it) {
+        if (node->inChild(it, extMonomial.get(), _conf) &&
+          (best == 0 || it->canBeat(bestScore)))
+          _childTmp.push_back(it);
+      }
+
+      // skip children that could beat the best score when they were
+      // pushed but can no longer beat it.
+      while (!_childTmp.empty() &&
+        best != 0 && !_childTmp.back()->canBeat(bestScore))
+        _childTmp.pop_back();
+      if (_childTmp.empty())
+        break;
+      node = _childTmp.back()->node;
+      _childTmp.pop_back();
+    }
+    MATHIC_ASSERT(_childTmp.empty());
+    MATHIC_ASSERT(best == 0 || _conf.divides(*best, extMonomial.get()));
+    return best;
+  }
+
+  template<class C>
+  template<class S>
+  typename PackedKDTree<C>::Entry* PackedKDTree<C>::findDivisorWithScoreBelow
+    (const ExtMonoRef& extMonomial, const S& bound) {
+    MATHIC_ASSERT(_tmp.empty());
+    if (_root == 0)
+      return 0;
+    Node* node = _root;
+    while (true) {
+      for (typename Node::const_iterator it = node->childBegin();
+        it != node->childEnd(); ++it) {
+        if (C::UseTreeDivMask &&
+          !it->getDivMask().canDivide(extMonomial.getDivMask()))
+          goto next;
+        if (node->inChild(it, extMonomial.get(), _conf) && it->canBeat(bound))
+          _tmp.push_back(it->node);
+      }
+
+      {
+        typename KDEntryArray<C, ExtEntry>::iterator it =
+          node->entries().findDivisorWithScoreBelow(extMonomial, bound, _conf);
+        if (it != node->entries().end()) {
+          MATHIC_ASSERT(_conf.divides(it->get(), extMonomial.get()));
+          _tmp.clear();
+          return &it->get();
+        }
+      }
+
+next:
+      if (_tmp.empty())
+        break;
+      node = _tmp.back();
+      _tmp.pop_back();
+    }
+    MATHIC_ASSERT(_tmp.empty());
+    return 0;
+  }
+
   template<class C>
   template<class DO>
   void PackedKDTree<C>::findAllDivisors(
@@ -498,6 +1139,84 @@ next:
     MATHIC_ASSERT(_tmp.empty());
   }
 
+  template<class C>
+  template<bool Divisors>
+  class PackedKDTree<C>::Range {
+  public:
+    Range(PackedKDTree<C>& tree, const ExtMonoRef& extMonomial):
+      _conf(tree._conf), _monomial(extMonomial), _node(0), _entry(0) {
+      if (tree._root != 0)
+        _todo.push_back(tree._root);
+      settle();
+    }
+
+    bool empty() const {return _node == 0;}
+
+    Entry& front() const {
+      MATHIC_ASSERT(!empty());
+      return _entry->get();
+    }
+
+    void popFront() {
+      MATHIC_ASSERT(!empty());
+      ++_entry;
+      settle();
+    }
+
+  private:
+    typedef typename KDEntryArray<C, ExtEntry>::iterator EntryIter;
+
+    /** Pushes the children of node that can contain a match. Returns
+        false if the entries of node cannot contain a match. */
+    bool enter(Node* node) {
+      for (typename Node::const_iterator it = node->childBegin();
+        it != node->childEnd(); ++it) {
+        if (Divisors) {
+          if (C::UseTreeDivMask &&
+            !it->getDivMask().canDivide(_monomial.getDivMask()))
+            return false; // div mask rules out the rest of node
+          if (node->inChild(it, _monomial.get(), _conf))
+            _todo.push_back(it->node);
+        } else {
+          _todo.push_back(it->node);
+          if (node->inChild(it, _monomial.get(), _conf))
+            return false;
+        }
+      }
+      return true;
+    }
+
+    /** Moves _entry forward to the next match, or sets _node to null if
+        there are no more matches. */
+    void settle() {
+      while (true) {
+        if (_node != 0) {
+          KDEntryArray<C, ExtEntry>& entries = _node->entries();
+          _entry = Divisors ?
+            entries.findNextDivisor(_monomial, _entry, _conf) :
+            entries.findNextMultiple(_monomial, _entry, _conf);
+          if (_entry != entries.end())
+            return;
+        }
+        do {
+          if (_todo.empty()) {
+            _node = 0;
+            return;
+          }
+          _node = _todo.back();
+          _todo.pop_back();
+        } while (!enter(_node));
+        _entry = _node->entries().begin();
+      }
+    }
+
+    const C& _conf;
+    ExtMonoRef _monomial;
+    std::vector<Node*> _todo; // nodes not yet entered
+    Node* _node; // the node whose entries are being scanned
+    EntryIter _entry; // the current match in _node
+  };
+
   template<class C>
   template<class EO>
   void PackedKDTree<C>::forAll(EO& output) {
@@ -524,8 +1243,10 @@ next:
   template<class C>
   void PackedKDTree<C>::clear() {
     MATHIC_ASSERT(_tmp.empty());
-    // Call Entry destructors
-    if (_root != 0)
+    // Call Entry destructors. The entries of shared nodes are destroyed
+    // when the last reference to their arena goes away. The descendants
+    // of a shared node are shared too.
+    if (_root != 0 && !isShared(_root))
       _tmp.push_back(_root);
     while (!_tmp.empty()) {
       Node* node = _tmp.back();
@@ -533,20 +1254,97 @@ next:
       node->entries().clear(); // calls destructors
       for (typename Node::iterator it = node->childBegin();
         it != node->childEnd(); ++it)
-        _tmp.push_back(it->node);
+        if (!isShared(it->node))
+          _tmp.push_back(it->node);
+    }
+    if (_arenas->previous == 0)
+      _arenas->arena.freeAllAllocs();
+    else {
+      release(_arenas);
+      _arenas = new ArenaLink(0);
     }
-    _arena.freeAllAllocs();
+    _mayShare = false;
     _root = 0;
+    _entryCount = 0;
+    _deadCount = 0;
+    _freeNodes.clear();
   }
 
   template<class C>
   size_t PackedKDTree<C>::getMemoryUse() const {
     // todo: not accurate
-	size_t sum = _arena.getMemoryUse();
+	size_t sum = 0;
+	for (const ArenaLink* link = _arenas; link != 0; link = link->previous)
+	  sum += link->arena.getMemoryUse();
 	sum += _tmp.capacity() * sizeof(_tmp.front());
+	sum += _childTmp.capacity() * sizeof(_childTmp.front());
+	sum += _path.capacity() * sizeof(_path.front());
 	return sum;
   }
 
+  template<class C>
+  typename PackedKDTree<C>::Entry* PackedKDTree<C>::findDivisor
+    (const ExtMonoRef& extMonomial, KDTreeQueryStats& stats) {
+    // keep this in sync with the findDivisor that does no counting.
+    MATHIC_ASSERT(_tmp.empty());
+    ++stats.queries;
+    if (_root == 0)
+      return 0;
+    Node* node = _root;
+    while (true) {
+      ++stats.nodesVisited;
+      for (typename Node::const_iterator it = node->childBegin();
+        it != node->childEnd(); ++it) {
+        if (C::UseTreeDivMask &&
+          !it->getDivMask().canDivide(extMonomial.getDivMask())) {
+          ++stats.maskRejections;
+          goto next;
+        }
+        if (node->inChild(it, extMonomial.get(), _conf))
+          _tmp.push_back(it->node);
+      }
+
+      {
+        typename KDEntryArray<C, ExtEntry>::iterator it =
+          node->entries().findDivisor(extMonomial, _conf, stats);
+        if (it != node->entries().end()) {
+          _tmp.clear();
+          return &it->get();
+        }
+      }
+
+next:
+      if (_tmp.empty())
+        break;
+      node = _tmp.back();
+      _tmp.pop_back();
+    }
+    MATHIC_ASSERT(_tmp.empty());
+    return 0;
+  }
+
+  template<class C>
+  void PackedKDTree<C>::analyze(KDTreeAnalysis& analysis) const {
+    analysis.deadCount += _deadCount;
+    analysis.partialRebuilds += _partialRebuildCount;
+    if (_root == 0)
+      return;
+    std::vector<std::pair<const Node*, size_t> > todo;
+    todo.push_back(std::make_pair(_root, 0));
+    while (!todo.empty()) {
+      const Node* node = todo.back().first;
+      const size_t depth = todo.back().second;
+      todo.pop_back();
+      ++analysis.nodeCount;
+      analysis.addLeaf(depth, node->entries().size());
+      for (typename Node::const_iterator it = node->childBegin();
+        it != node->childEnd(); ++it) {
+        analysis.addSplit(it->var);
+        todo.push_back(std::make_pair(it->node, depth + 1));
+      }
+    }
+  }
+
   template<class C>
   void PackedKDTree<C>::print(std::ostream& out) const {
     out << "<<<<<<<< PackedKDTree >>>>>>>>\n";
@@ -624,6 +1422,8 @@ next:
             allStrictlyGreaterThan(var, exp, _conf));
           MATHIC_ASSERT(!C::UseTreeDivMask ||
             ancestorIt->canDivide(node->entries()));
+          MATHIC_ASSERT(ancestorIt->isScoreBoundOf
+            (node->entries().begin(), node->entries().end(), _conf));
         }
         // check less than or equal to sub tree.
         MATHIC_ASSERT(ancestor->entries().
@@ -728,6 +1528,10 @@ next:
       entries().insert(extEntry, conf);
     else
       copied->entries().insert(extEntry, conf);
+    if (ConfigFlags<C>::UseScoreBounds) {
+      newChild.resetScoreBound();
+      newChild.updateScoreBound(entries().begin(), entries().end(), conf);
+    }
 
     MATHIC_ASSERT(debugIsValid());
     MATHIC_ASSERT(copied->debugIsValid());
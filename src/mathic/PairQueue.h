@@ -2,6 +2,7 @@
 #define MATHIC_PAIR_QUEUE_GUARD
 
 #include "stdinc.h"
+#include "Profiler.h"
 
 #include "TourTree.h"
 
@@ -415,6 +416,7 @@ namespace mathic {
   template<class Iter>
   void PairQueue<C>::addColumnDescending
   (Iter const sortedRowsBegin, Iter const sortedRowsEnd) {
+	MATHIC_PROFILE("PairQueue::addColumnDescending");
 	if (mColumnCount >= std::numeric_limits<Index>::max())
 	  throw std::overflow_error("Too large column index in PairQueue.");
 	Index const newColumnIndex = static_cast<Index>(mColumnCount);
@@ -437,6 +439,7 @@ namespace mathic {
 
   template<class C>
   void PairQueue<C>::pop() {
+	MATHIC_PROFILE("PairQueue::pop");
 	MATHIC_ASSERT(!empty());
 
 	Column* const topColumn = mColumnQueue.top();
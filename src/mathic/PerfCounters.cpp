@@ -0,0 +1,148 @@
+#include "PerfCounters.h"
+
+#include "ColumnPrinter.h"
+
+#ifdef __linux__
+#define MATHIC_USE_PERF_EVENTS
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+namespace mathic {
+  PerfCounts::PerfCounts() {
+    for (size_t i = 0; i < CounterCount; ++i) {
+      available[i] = false;
+      values[i] = 0;
+    }
+  }
+
+  bool PerfCounts::anyAvailable() const {
+    for (size_t i = 0; i < CounterCount; ++i)
+      if (available[i])
+        return true;
+    return false;
+  }
+
+  const char* PerfCounts::getName(Counter counter) {
+    switch (counter) {
+    case Cycles: return "cycles";
+    case Instructions: return "instructions";
+    case L1DataMisses: return "L1d-misses";
+    case LastLevelMisses: return "LLC-misses";
+    case BranchMisses: return "branch-misses";
+    default:
+      MATHIC_ASSERT(false);
+      return "";
+    }
+  }
+
+  void PerfCounts::print
+  (std::ostream& out, unsigned long long operations) const {
+    const char* separator = "";
+    for (size_t i = 0; i < CounterCount; ++i) {
+      if (!available[i])
+        continue;
+      out << separator << getName(static_cast<Counter>(i)) << ':'
+        << ColumnPrinter::commafy(values[i]);
+      if (operations > 0)
+        out << " (" << ColumnPrinter::ratio(values[i], operations) << "/op)";
+      separator = " ";
+    }
+  }
+
+#ifdef MATHIC_USE_PERF_EVENTS
+  namespace {
+    int openCounter(unsigned int type, unsigned long long config) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = type;
+      attr.config = config;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      // measure the calling thread on any cpu.
+      return static_cast<int>
+        (syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+  }
+
+  PerfCounters::PerfCounters() {
+    const unsigned long long l1ReadMiss = PERF_COUNT_HW_CACHE_L1D |
+      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    _fds[PerfCounts::Cycles] =
+      openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    _fds[PerfCounts::Instructions] =
+      openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    _fds[PerfCounts::L1DataMisses] =
+      openCounter(PERF_TYPE_HW_CACHE, l1ReadMiss);
+    _fds[PerfCounts::LastLevelMisses] =
+      openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    _fds[PerfCounts::BranchMisses] =
+      openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+  }
+
+  PerfCounters::~PerfCounters() {
+    for (size_t i = 0; i < PerfCounts::CounterCount; ++i)
+      if (_fds[i] != -1)
+        close(_fds[i]);
+  }
+
+  void PerfCounters::start() {
+    for (size_t i = 0; i < PerfCounts::CounterCount; ++i) {
+      if (_fds[i] != -1) {
+        ioctl(_fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+      }
+    }
+  }
+
+  PerfCounts PerfCounters::stop() {
+    for (size_t i = 0; i < PerfCounts::CounterCount; ++i)
+      if (_fds[i] != -1)
+        ioctl(_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    PerfCounts counts;
+    for (size_t i = 0; i < PerfCounts::CounterCount; ++i) {
+      if (_fds[i] == -1)
+        continue;
+      // the value, the time enabled and the time running.
+      unsigned long long data[3];
+      if (read(_fds[i], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+        continue;
+      double value = static_cast<double>(data[0]);
+      if (data[2] < data[1])
+        value *= static_cast<double>(data[1]) / data[2];
+      counts.available[i] = true;
+      counts.values[i] = static_cast<unsigned long long>(value);
+    }
+    return counts;
+  }
+#else
+  PerfCounters::PerfCounters() {
+    for (size_t i = 0; i < PerfCounts::CounterCount; ++i)
+      _fds[i] = -1;
+  }
+
+  PerfCounters::~PerfCounters() {}
+
+  void PerfCounters::start() {}
+
+  PerfCounts PerfCounters::stop() {
+    return PerfCounts();
+  }
+#endif
+
+  bool PerfCounters::anyAvailable() const {
+    for (size_t i = 0; i < PerfCounts::CounterCount; ++i)
+      if (_fds[i] != -1)
+        return true;
+    return false;
+  }
+}
@@ -0,0 +1,71 @@
+#ifndef MATHIC_PERF_COUNTERS_GUARD
+#define MATHIC_PERF_COUNTERS_GUARD
+
+#include "stdinc.h"
+#include <ostream>
+
+namespace mathic {
+  /** The values of the hardware performance counters over a span of
+      time as measured by PerfCounters. A counter is unavailable if the
+      hardware, the operating system or its permissions do not allow it
+      to be measured. */
+  struct PerfCounts {
+    enum Counter {
+      Cycles,
+      Instructions,
+      L1DataMisses, /// level 1 data cache read misses
+      LastLevelMisses, /// last level cache misses
+      BranchMisses,
+      CounterCount
+    };
+
+    /** Makes every counter unavailable. */
+    PerfCounts();
+
+    bool available[CounterCount];
+    unsigned long long values[CounterCount];
+
+    /** Returns true if any counter is available. */
+    bool anyAvailable() const;
+
+    /** Returns a short name of counter such as "cycles". */
+    static const char* getName(Counter counter);
+
+    /** Prints the available counters in total and per operation. */
+    void print(std::ostream& out, unsigned long long operations) const;
+  };
+
+  /** Measures the hardware events of PerfCounts::Counter done by the
+      calling thread between calls to start() and stop(). Only events in
+      user space are counted, which needs fewer permissions than
+      counting kernel events too.
+
+      This uses perf_event_open on Linux. Elsewhere, and if the kernel
+      does not allow a counter to be opened, that counter is simply
+      unavailable, so code using this class works the same everywhere
+      but has fewer numbers to report. If the kernel has to share the
+      hardware between more counters than it has, the counts are scaled
+      up from the time that each counter was actually running. */
+  class PerfCounters {
+  public:
+    PerfCounters();
+    ~PerfCounters();
+
+    /** Returns true if any counter could be opened. */
+    bool anyAvailable() const;
+
+    /** Resets the counters to zero and starts counting. */
+    void start();
+
+    /** Stops counting and returns the counts since start(). */
+    PerfCounts stop();
+
+  private:
+    PerfCounters(const PerfCounters&); // unavailable
+    void operator=(const PerfCounters&); // unavailable
+
+    int _fds[PerfCounts::CounterCount]; /// -1 for unavailable counters
+  };
+}
+
+#endif
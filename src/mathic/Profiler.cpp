@@ -0,0 +1,319 @@
+#include "Profiler.h"
+
+#include "ColumnPrinter.h"
+#include "ThreadScaling.h"
+#include "Timer.h"
+#include <algorithm>
+#include <ctime>
+#include <map>
+
+#if defined(__GNUC__)
+#define MATHIC_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define MATHIC_THREAD_LOCAL __declspec(thread)
+#else
+/// no thread local storage, so all threads share one tree.
+#define MATHIC_THREAD_LOCAL
+#endif
+
+namespace mathic {
+  /** A region as entered from the region of its parent on one thread. */
+  class ProfileNode {
+  public:
+    ProfileNode(const char* name, ProfileNode* parent):
+      name(name), parent(parent), calls(0), wallNanos(0), cpuNanos(0),
+      wallStart(0), cpuStart(0) {}
+
+    ~ProfileNode() {
+      for (size_t i = 0; i < children.size(); ++i)
+        delete children[i];
+    }
+
+    /** Returns the child called name, making it if there is none. The
+        number of children is small, so a linear search is fast. */
+    ProfileNode* getChild(const char* name) {
+      for (size_t i = 0; i < children.size(); ++i)
+        if (children[i]->name == name)
+          return children[i];
+      children.push_back(new ProfileNode(name, this));
+      return children.back();
+    }
+
+    const char* const name;
+    ProfileNode* const parent;
+    std::vector<ProfileNode*> children;
+    unsigned long long calls;
+    unsigned long long wallNanos;
+    unsigned long long cpuNanos;
+    unsigned long long wallStart; /// of the open call, if any
+    unsigned long long cpuStart; /// of the open call, if any
+
+  private:
+    ProfileNode(const ProfileNode&); // unavailable
+    void operator=(const ProfileNode&); // unavailable
+  };
+
+  namespace {
+    /** The profile of one thread. */
+    struct ThreadTree {
+      ThreadTree(): root("", 0), current(&root) {}
+
+      ProfileNode root;
+      ProfileNode* current; /// the innermost open region
+    };
+
+    MATHIC_THREAD_LOCAL ThreadTree* threadTree = 0;
+
+    /** Guards the list of trees, not the trees themselves. */
+    Mutex& getTreesMutex() {
+      static Mutex mutex;
+      return mutex;
+    }
+
+    /** Owns the trees of every thread that has profiled anything. They
+        are kept after their thread ends so that they show up in reports,
+        and are freed when the program exits. */
+    class ThreadTrees {
+    public:
+      ThreadTrees() {}
+      ~ThreadTrees() {
+        for (size_t i = 0; i < trees.size(); ++i)
+          delete trees[i];
+      }
+
+      std::vector<ThreadTree*> trees;
+
+    private:
+      ThreadTrees(const ThreadTrees&); // unavailable
+      void operator=(const ThreadTrees&); // unavailable
+    };
+
+    std::vector<ThreadTree*>& getTrees() {
+      static ThreadTrees trees;
+      return trees.trees;
+    }
+
+    ThreadTree& getThreadTree() {
+      if (threadTree == 0) {
+        Mutex::Lock lock(getTreesMutex());
+        std::vector<ThreadTree*>& trees = getTrees();
+        // reserve first so that push_back cannot throw and leak the tree.
+        trees.reserve(trees.size() + 1);
+        trees.push_back(new ThreadTree());
+        threadTree = trees.back();
+      }
+      return *threadTree;
+    }
+
+    unsigned long long getCpuNanos() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+      timespec time;
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time);
+      return static_cast<unsigned long long>(time.tv_sec) * 1000000000 +
+        time.tv_nsec;
+#else
+      return static_cast<unsigned long long>
+        (std::clock() * (1e9 / CLOCKS_PER_SEC));
+#endif
+    }
+
+    void reset(ProfileNode& node, unsigned long long wall,
+      unsigned long long cpu) {
+      node.calls = 0;
+      node.wallNanos = 0;
+      node.cpuNanos = 0;
+      node.wallStart = wall;
+      node.cpuStart = cpu;
+      for (size_t i = 0; i < node.children.size(); ++i)
+        reset(*node.children[i], wall, cpu);
+    }
+
+    void addTo(ProfileTotals& totals, const ProfileNode& node) {
+      totals.calls += node.calls;
+      totals.wallNanos += node.wallNanos;
+      totals.cpuNanos += node.cpuNanos;
+      for (size_t i = 0; i < node.children.size(); ++i) {
+        const ProfileNode& child = *node.children[i];
+        size_t j = 0;
+        while (j < totals.children.size() &&
+          totals.children[j].name != child.name)
+          ++j;
+        if (j == totals.children.size()) {
+          totals.children.push_back(ProfileTotals());
+          totals.children.back().name = child.name;
+        }
+        addTo(totals.children[j], child);
+      }
+    }
+
+    bool moreWall(const ProfileTotals& a, const ProfileTotals& b) {
+      return a.wallNanos > b.wallNanos;
+    }
+
+    void sortByWall(ProfileTotals& totals) {
+      std::sort(totals.children.begin(), totals.children.end(), moreWall);
+      for (size_t i = 0; i < totals.children.size(); ++i)
+        sortByWall(totals.children[i]);
+    }
+
+    void printTreeNode(ColumnPrinter& pr, const ProfileTotals& totals,
+      unsigned long long allNanos, size_t depth) {
+      pr[0] << std::string(2 * depth, ' ') << totals.name << '\n';
+      pr[1] << ColumnPrinter::commafy(totals.calls) << '\n';
+      pr[2] << ColumnPrinter::nanosInUnit(totals.wallNanos) << '\n';
+      pr[3] << ColumnPrinter::percent(totals.wallNanos, allNanos) << '\n';
+      pr[4] << ColumnPrinter::nanosInUnit(totals.getSelfWallNanos()) << '\n';
+      pr[5] << ColumnPrinter::nanosInUnit(totals.cpuNanos) << '\n';
+      for (size_t i = 0; i < totals.children.size(); ++i)
+        printTreeNode(pr, totals.children[i], allNanos, depth + 1);
+    }
+
+    struct FlatTotals {
+      FlatTotals(): calls(0), wallNanos(0), selfWallNanos(0), cpuNanos(0) {}
+
+      std::string name;
+      unsigned long long calls;
+      unsigned long long wallNanos;
+      unsigned long long selfWallNanos;
+      unsigned long long cpuNanos;
+
+      bool operator<(const FlatTotals& flat) const {
+        return selfWallNanos > flat.selfWallNanos;
+      }
+    };
+
+    typedef std::map<std::string, FlatTotals> FlatMap;
+
+    /** Adds totals and its children to flat. The path holds the names
+        of the regions that totals is inside. */
+    void addFlat(FlatMap& flat, const ProfileTotals& totals,
+      std::vector<std::string>& path) {
+      FlatTotals& f = flat[totals.name];
+      f.name = totals.name;
+      f.calls += totals.calls;
+      f.selfWallNanos += totals.getSelfWallNanos();
+      if (std::find(path.begin(), path.end(), totals.name) == path.end()) {
+        f.wallNanos += totals.wallNanos;
+        f.cpuNanos += totals.cpuNanos;
+      }
+      path.push_back(totals.name);
+      for (size_t i = 0; i < totals.children.size(); ++i)
+        addFlat(flat, totals.children[i], path);
+      path.pop_back();
+    }
+
+    void addHeader(ColumnPrinter& pr, const char* percentName) {
+      pr[0] << "region\n";
+      pr[1] << "calls\n";
+      pr[2] << "wall\n";
+      pr[3] << percentName << '\n';
+      pr[4] << "self\n";
+      pr[5] << "cpu\n";
+    }
+  }
+
+  const ProfileTotals* ProfileTotals::getChild
+  (const std::string& name) const {
+    for (size_t i = 0; i < children.size(); ++i)
+      if (children[i].name == name)
+        return &children[i];
+    return 0;
+  }
+
+  unsigned long long ProfileTotals::getSelfWallNanos() const {
+    unsigned long long childNanos = 0;
+    for (size_t i = 0; i < children.size(); ++i)
+      childNanos += children[i].wallNanos;
+    // the clocks are read at slightly different times, so the children
+    // can add up to a little more than their parent.
+    return childNanos > wallNanos ? 0 : wallNanos - childNanos;
+  }
+
+  ProfileNode* Profiler::enter(const char* name) {
+    ThreadTree& tree = getThreadTree();
+    ProfileNode* node = tree.current->getChild(name);
+    tree.current = node;
+    ++node->calls;
+    node->cpuStart = getCpuNanos();
+    node->wallStart = WallTimer::getNanos();
+    return node;
+  }
+
+  void Profiler::leave(ProfileNode* node) {
+    const unsigned long long wall = WallTimer::getNanos();
+    const unsigned long long cpu = getCpuNanos();
+    MATHIC_ASSERT(threadTree != 0);
+    MATHIC_ASSERT(node == threadTree->current);
+    node->wallNanos += wall - node->wallStart;
+    node->cpuNanos += cpu - node->cpuStart;
+    threadTree->current = node->parent;
+  }
+
+  ProfileTotals Profiler::getTotals() {
+    ProfileTotals totals;
+    Mutex::Lock lock(getTreesMutex());
+    const std::vector<ThreadTree*>& trees = getTrees();
+    for (size_t i = 0; i < trees.size(); ++i)
+      addTo(totals, trees[i]->root);
+    // the root is not a region, so it has the time of the regions in it.
+    for (size_t i = 0; i < totals.children.size(); ++i) {
+      totals.wallNanos += totals.children[i].wallNanos;
+      totals.cpuNanos += totals.children[i].cpuNanos;
+    }
+    return totals;
+  }
+
+  void Profiler::reset() {
+    const unsigned long long wall = WallTimer::getNanos();
+    const unsigned long long cpu = getCpuNanos();
+    Mutex::Lock lock(getTreesMutex());
+    const std::vector<ThreadTree*>& trees = getTrees();
+    for (size_t i = 0; i < trees.size(); ++i)
+      mathic::reset(trees[i]->root, wall, cpu);
+  }
+
+  void Profiler::printTree(std::ostream& out) {
+    ProfileTotals totals = getTotals();
+    sortByWall(totals);
+    ColumnPrinter pr;
+    pr.addColumn(true);
+    for (size_t col = 1; col < 6; ++col)
+      pr.addColumn(false, " ");
+    addHeader(pr, "% wall");
+    for (size_t i = 0; i < totals.children.size(); ++i)
+      printTreeNode(pr, totals.children[i], totals.wallNanos, 0);
+    out << "*** Profile tree (wall time includes children) ***\n";
+    pr.print(out);
+  }
+
+  void Profiler::printFlat(std::ostream& out) {
+    const ProfileTotals totals = getTotals();
+    FlatMap flatMap;
+    std::vector<std::string> path;
+    for (size_t i = 0; i < totals.children.size(); ++i)
+      addFlat(flatMap, totals.children[i], path);
+    std::vector<FlatTotals> flat;
+    for (FlatMap::const_iterator it = flatMap.begin();
+      it != flatMap.end(); ++it)
+      flat.push_back(it->second);
+    std::sort(flat.begin(), flat.end());
+
+    ColumnPrinter pr;
+    pr.addColumn(true);
+    for (size_t col = 1; col < 6; ++col)
+      pr.addColumn(false, " ");
+    addHeader(pr, "% self");
+    for (size_t i = 0; i < flat.size(); ++i) {
+      const FlatTotals& f = flat[i];
+      pr[0] << f.name << '\n';
+      pr[1] << ColumnPrinter::commafy(f.calls) << '\n';
+      pr[2] << ColumnPrinter::nanosInUnit(f.wallNanos) << '\n';
+      pr[3] << ColumnPrinter::percent(f.selfWallNanos, totals.wallNanos)
+        << '\n';
+      pr[4] << ColumnPrinter::nanosInUnit(f.selfWallNanos) << '\n';
+      pr[5] << ColumnPrinter::nanosInUnit(f.cpuNanos) << '\n';
+    }
+    out << "*** Flat profile (sorted by self time) ***\n";
+    pr.print(out);
+  }
+}
@@ -0,0 +1,124 @@
+#ifndef MATHIC_PROFILER_GUARD
+#define MATHIC_PROFILER_GUARD
+
+#include "stdinc.h"
+#include <vector>
+#include <string>
+#include <ostream>
+
+/** Profiles the rest of the enclosing scope as a region named NAME,
+    which must be a string literal. Regions nest, so a region entered
+    while another one is open is recorded as a child of it. This expands
+    to nothing unless MATHIC_PROFILING is defined, so it costs nothing in
+    a normal build and can be put into the hottest loops. See Profiler. */
+#ifdef MATHIC_PROFILING
+#define MATHIC_PROFILE(NAME) \
+  ::mathic::ProfileScope MATHIC_PROFILE_CONCAT(mathicProfile, __LINE__)(NAME)
+#define MATHIC_PROFILE_CONCAT(A, B) MATHIC_PROFILE_CONCAT2(A, B)
+#define MATHIC_PROFILE_CONCAT2(A, B) A##B
+#else
+#define MATHIC_PROFILE(NAME)
+#endif
+
+namespace mathic {
+  class ProfileNode;
+
+  /** The time and call count of a region of code, along with those of
+      the regions that were entered inside it. */
+  struct ProfileTotals {
+    ProfileTotals(): calls(0), wallNanos(0), cpuNanos(0) {}
+
+    std::string name;
+    unsigned long long calls;
+    unsigned long long wallNanos; /// including the time of children
+    unsigned long long cpuNanos; /// CPU time of the thread, ditto
+    std::vector<ProfileTotals> children;
+
+    /** Returns the child called name, or null if there is none. */
+    const ProfileTotals* getChild(const std::string& name) const;
+
+    /** Returns the wall time not spent in children. */
+    unsigned long long getSelfWallNanos() const;
+  };
+
+  /** Records how often and for how long each region of code marked with
+      MATHIC_PROFILE is run. Each thread records into a tree of its own,
+      so threads do not contend for anything while profiling. A node of
+      the tree is a region entered from the region of its parent, so the
+      same region shows up once for each place it is entered from. The
+      root stands for the whole thread.
+
+      Both the wall clock time and the CPU time of the thread are
+      recorded in nanoseconds. The CPU time does not include time where
+      the thread is waiting or descheduled. Where there is no CPU clock
+      for threads, the CPU time of the process is used instead.
+
+      Entering and leaving a region reads both clocks. The CPU clock of
+      a thread is a system call on some platforms, so a region can cost
+      several hundred nanoseconds. The CPU time of a region includes
+      that cost, which is why it can be more than the wall time. The
+      enclosing region pays for it too, so profile regions that take
+      much longer than that, or expect the parents of tiny regions to
+      look slower than they are.
+
+      The reports add up the trees of all threads that have profiled
+      anything, including threads that have since ended. Reading and
+      resetting the trees of other threads is not synchronized, so only
+      do it while no other thread is in a profiled region. */
+  class Profiler {
+  public:
+    /** Enters the region called name, which must stay allocated for as
+        long as the profile is used. Regions are told apart by the
+        address of their name, so use a string literal. Returns the node
+        of the region, which must be passed to leave. */
+    static ProfileNode* enter(const char* name);
+
+    /** Leaves the region of node, which must be the last region that
+        the calling thread entered and has not left. */
+    static void leave(ProfileNode* node);
+
+    /** Returns the regions of all threads added up, with regions of the
+        same name at the same place in the tree merged. */
+    static ProfileTotals getTotals();
+
+    /** Sets every time and call count to zero. Regions that are open
+        stay open and only count the time from now on. */
+    static void reset();
+
+    /** Prints each region with its children indented below it. */
+    static void printTree(std::ostream& out);
+
+    /** Prints each region once, however many places it is entered from,
+        sorted by the wall time spent in the region itself and not in its
+        children. The total time of a region that is entered inside
+        itself only counts the outermost call. */
+    static void printFlat(std::ostream& out);
+
+    /** Returns true if MATHIC_PROFILE does anything in code compiled
+        with the same settings as the caller. */
+    static bool enabled() {
+#ifdef MATHIC_PROFILING
+      return true;
+#else
+      return false;
+#endif
+    }
+  };
+
+  /** Profiles a region from construction to destruction. Use
+      MATHIC_PROFILE rather than this directly, so that the profiling
+      can be turned off. */
+  class ProfileScope {
+  public:
+    ProfileScope(const char* name): _node(Profiler::enter(name)) {}
+    ~ProfileScope() {Profiler::leave(_node);}
+
+  private:
+    ProfileScope(const ProfileScope&); // unavailable
+    void operator=(const ProfileScope&); // unavailable
+
+    ProfileNode* const _node;
+  };
+}
+
+#endif
@@ -0,0 +1,13 @@
+#include "QueueTrace.h"
+
+namespace mathic {
+  namespace {
+    const char Magic[] = {'M', 'P', 'Q', 'T', 1};
+  }
+
+  QueueTraceWriter::QueueTraceWriter(const std::string& fileName):
+    _file(fileName, Magic, sizeof(Magic)) {}
+
+  QueueTraceReader::QueueTraceReader(const std::string& fileName):
+    _file(fileName, Magic, sizeof(Magic), "priority queue trace") {}
+}
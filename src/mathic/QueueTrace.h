@@ -0,0 +1,198 @@
+#ifndef MATHIC_QUEUE_TRACE_GUARD
+#define MATHIC_QUEUE_TRACE_GUARD
+
+#include "stdinc.h"
+#include "TraceFile.h"
+#include <vector>
+#include <string>
+#include <functional>
+#include <algorithm>
+
+namespace mathic {
+  /** Writes a trace of the pushes and pops done on a priority queue, so
+      that the same traffic can be replayed later, for example by pqsim.
+
+      Entries are recorded as unsigned integer values that must have the
+      same order as the entries have in the queue, so that the greatest
+      value is the next one to be popped. A push of a span of entries is
+      recorded as one event, as is a pop.
+
+      The file starts with the 4 bytes "MPQT" and a version byte of 1.
+      Then follow the events. Every number is written in 7 bit groups,
+      least significant first, with the high bit of each byte set if
+      more groups follow. An event starts with a number n. If n is 0, the
+      event is a pop and the value that was popped follows. Otherwise
+      the event is a push of n values, which are stored in descending
+      order as the first value followed by the difference between each
+      value and the one after it. */
+  class QueueTraceWriter {
+  public:
+    typedef TraceFileWriter::Number Value;
+
+    /** Creates the file fileName, replacing any file of that name.
+        Reports an error if the file cannot be created. */
+    explicit QueueTraceWriter(const std::string& fileName);
+
+    /** Records a push of the values in [begin, end). */
+    template<class It>
+    void push(It begin, It end);
+
+    /** Records a pop that returned value. */
+    void pop(Value value);
+
+    /** Writes the buffered events to the file. Reports an error if that
+        fails. */
+    void flush() {_file.flush();}
+
+    unsigned long long getEventCount() const {return _file.getEventCount();}
+
+  private:
+    QueueTraceWriter(const QueueTraceWriter&); // unavailable
+    void operator=(const QueueTraceWriter&); // unavailable
+
+    TraceFileWriter _file;
+    std::vector<Value> _span; /// for sorting the values of a push
+  };
+
+  /** Reads a trace written by QueueTraceWriter one event at a time. */
+  class QueueTraceReader {
+  public:
+    typedef QueueTraceWriter::Value Value;
+
+    /** Opens the trace in fileName. Reports an error if the file cannot
+        be read or is not a trace. */
+    explicit QueueTraceReader(const std::string& fileName);
+
+    /** Reads the next event. Returns false if there are no more events.
+        Otherwise span is set to the values of a push in descending order
+        or made empty for a pop, in which case popValue is set to the
+        value that was popped. Reports an error if the trace is
+        truncated. */
+    template<class V>
+    bool next(std::vector<V>& span, V& popValue);
+
+    /** Makes the next event read be the first event of the trace. */
+    void rewind() {_file.rewind();}
+
+  private:
+    QueueTraceReader(const QueueTraceReader&); // unavailable
+    void operator=(const QueueTraceReader&); // unavailable
+
+    TraceFileReader _file;
+  };
+
+  /** A priority queue that passes everything on to a queue of type Queue
+      and records the pushes and pops in a trace. Queue can be any of the
+      mathic priority queues. The configuration of Queue must have the
+      method
+
+      * unsigned long long getTraceValue(const Entry& entry) const
+      Returns the value to record for entry. Values must have the same
+      order as the entries have in the queue.
+
+      The trace has no way to express clear(), so that is not offered. */
+  template<class Queue>
+  class TracingQueue {
+  public:
+    typedef typename Queue::Configuration Configuration;
+    typedef typename Queue::Entry Entry;
+
+    /** Does not take ownership of trace, which must stay alive while
+        this object is in use. */
+    TracingQueue(const Configuration& configuration, QueueTraceWriter& trace):
+      _queue(configuration), _trace(trace) {}
+
+    Configuration& getConfiguration() {return _queue.getConfiguration();}
+    const Configuration& getConfiguration() const {
+      return _queue.getConfiguration();
+    }
+
+    Queue& getQueue() {return _queue;}
+    const Queue& getQueue() const {return _queue;}
+
+    std::string getName() const {return "Tracing " + _queue.getName();}
+
+    void push(Entry entry) {
+      const QueueTraceWriter::Value value = getValue(entry);
+      _trace.push(&value, &value + 1);
+      _queue.push(entry);
+    }
+
+    template<class It>
+    void push(It begin, It end) {
+      _span.clear();
+      for (It it = begin; it != end; ++it)
+        _span.push_back(getValue(*it));
+      _trace.push(_span.begin(), _span.end());
+      _queue.push(begin, end);
+    }
+
+    Entry pop() {
+      Entry entry = _queue.pop();
+      _trace.pop(getValue(entry));
+      return entry;
+    }
+
+    /** Recorded as a pop of top() followed by a push of newEntry. */
+    void decreaseTop(Entry newEntry) {
+      _trace.pop(getValue(_queue.top()));
+      const QueueTraceWriter::Value value = getValue(newEntry);
+      _trace.push(&value, &value + 1);
+      _queue.decreaseTop(newEntry);
+    }
+
+    Entry top() const {return _queue.top();}
+    bool empty() const {return _queue.empty();}
+    size_t size() const {return _queue.size();}
+    size_t getMemoryUse() const {return _queue.getMemoryUse();}
+
+  private:
+    QueueTraceWriter::Value getValue(const Entry& entry) const {
+      return getConfiguration().getTraceValue(entry);
+    }
+
+    Queue _queue;
+    QueueTraceWriter& _trace;
+    std::vector<QueueTraceWriter::Value> _span;
+  };
+
+  template<class It>
+  void QueueTraceWriter::push(It begin, It end) {
+    if (begin == end)
+      return;
+    _span.assign(begin, end);
+    std::sort(_span.begin(), _span.end(), std::greater<Value>());
+    _file.writeNumber(_span.size());
+    _file.writeNumber(_span.front());
+    for (size_t i = 1; i < _span.size(); ++i)
+      _file.writeNumber(_span[i - 1] - _span[i]);
+    _file.eventWritten();
+  }
+
+  inline void QueueTraceWriter::pop(Value value) {
+    _file.writeNumber(0);
+    _file.writeNumber(value);
+    _file.eventWritten();
+  }
+
+  template<class V>
+  bool QueueTraceReader::next(std::vector<V>& span, V& popValue) {
+    span.clear();
+    if (_file.atEnd())
+      return false;
+    const Value size = _file.readNumber();
+    if (size == 0) {
+      popValue = static_cast<V>(_file.readNumber());
+      return true;
+    }
+    Value value = _file.readNumber();
+    span.push_back(static_cast<V>(value));
+    for (Value i = 1; i < size; ++i) {
+      value -= _file.readNumber();
+      span.push_back(static_cast<V>(value));
+    }
+    return true;
+  }
+}
+
+#endif
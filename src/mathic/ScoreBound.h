@@ -0,0 +1,96 @@
+#ifndef MATHIC_SCORE_BOUND_GUARD
+#define MATHIC_SCORE_BOUND_GUARD
+
+#include "stdinc.h"
+#include "ConfigFlags.h"
+
+namespace mathic {
+  /** Base class to include a lower bound on the scores of the entries in
+      a sub tree into a class at compile time based on the template
+      parameter UseScoreBounds. The class offers the same methods either
+      way, but they are replaced by do-nothing versions if UseScoreBounds
+      is false. Lower scores are better. Scores are given by the method
+      getScore(Entry) on the Configuration C. */
+  template<class C, bool UseScoreBounds = ConfigFlags<C>::UseScoreBounds>
+  class HasScoreBound;
+
+  template<class C>
+  class HasScoreBound<C, true> {
+  public:
+    typedef typename C::Score Score;
+
+    HasScoreBound() {resetScoreBound();}
+
+    template<class E>
+    static Score getScore(const E& entry, const C& conf) {
+      return conf.getScore(entry);
+    }
+
+    /** Makes the bound that of an empty sub tree. */
+    void resetScoreBound() {_empty = true;}
+
+    /** Lowers the bound to score if score is lower. */
+    void updateScoreBound(const Score& score) {
+      if (_empty || score < _bound) {
+        _bound = score;
+        _empty = false;
+      }
+    }
+
+    void updateScoreBound(const HasScoreBound<C, true>& bound) {
+      if (!bound._empty)
+        updateScoreBound(bound._bound);
+    }
+
+    /** Lowers the bound to the lowest score of the entries in the range
+        [begin, end) of extended entries. */
+    template<class Iter>
+    void updateScoreBound(Iter begin, Iter end, const C& conf) {
+      for (; begin != end; ++begin)
+        updateScoreBound(conf.getScore(begin->get()));
+    }
+
+    /** Returns true if an entry in the sub tree could have a score lower
+        than score. */
+    bool canBeat(const Score& score) const {
+      return !_empty && _bound < score;
+    }
+
+    /** Returns true if no entry in [begin, end) has a lower score than
+        the bound. */
+    template<class Iter>
+    bool isScoreBoundOf(Iter begin, Iter end, const C& conf) const {
+      for (; begin != end; ++begin)
+        if (_empty || conf.getScore(begin->get()) < _bound)
+          return false;
+      return true;
+    }
+
+  private:
+    Score _bound;
+    bool _empty;
+  };
+
+  template<class C>
+  class HasScoreBound<C, false> {
+  public:
+    typedef char Score;
+
+    template<class E>
+    static Score getScore(const E& entry, const C& conf) {return 0;}
+
+    void resetScoreBound() {}
+    void updateScoreBound(const Score& score) {}
+    void updateScoreBound(const HasScoreBound<C, false>& bound) {}
+    template<class Iter>
+    void updateScoreBound(Iter begin, Iter end, const C& conf) {}
+    template<class S>
+    bool canBeat(const S& score) const {return true;}
+    template<class Iter>
+    bool isScoreBoundOf(Iter begin, Iter end, const C& conf) const {
+      return true;
+    }
+  };
+}
+
+#endif
@@ -0,0 +1,543 @@
+#ifndef MATHIC_SHARDED_DIV_FINDER_GUARD
+#define MATHIC_SHARDED_DIV_FINDER_GUARD
+
+#include "stdinc.h"
+#include "KDTree.h"
+#include "DivFinderHelper.h"
+#include "ThreadScaling.h"
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <iterator>
+
+namespace mathic {
+  /** An object that supports queries for divisors of a monomial by
+      partitioning the entries among several independent KDTrees, called
+      shards. It has the same interface as KDTree, so it can be used in
+      its place. See DivFinder.h and KDTree.h for more documentation.
+
+      Each entry is owned by exactly one shard. Insertions and removals of
+      single elements only touch the owning shard. Queries ask each shard
+      that could have an answer in turn and stop at the first divisor
+      found. Each shard allocates its memory from its own arena. When the
+      shards are loaded in bulk, which happens on insertion of a range
+      into an empty object and on rebuild, each shard is built by a
+      thread of its own, see runInParallel. With the usual first-touch
+      page placement the memory of a shard is then local to the thread
+      that built it.
+
+      There are two ways to decide which shard owns an entry. If
+      ShardByHash is true, the hash value of the entry does. Otherwise
+      the shards split the range of exponents of the first variable into
+      consecutive intervals. A divisor of a monomial then cannot be in a
+      shard whose interval lies above the exponent of the monomial, and
+      a multiple cannot be in a shard whose interval lies below it, so
+      queries skip those shards. The split points are chosen so that the
+      shards get about the same number of entries. They are recomputed on
+      rebuild, on insertion of a range into an empty object and, if
+      getDoAutomaticRebuilds() is true, whenever the number of entries
+      has doubled since they were last computed. Until then all entries
+      go into the first shard.
+
+      Extra fields for Configuration in addition to those for KDTree:
+
+      * size_t getShardCount() const
+      Return the number of shards. Must be positive.
+
+      * static const bool ShardByHash
+      If true, entries are assigned to shards by getHash, which must then
+      be present. See KDTree.h for the requirements on getHash. If false,
+      entries are assigned to shards by the exponent of the first
+      variable.
+
+      The configuration is copied into each shard, so changes made through
+      getConfiguration() do not affect the shards. Calls to the
+      configuration of different shards can happen concurrently while
+      the shards are being loaded in bulk. */
+  template<class Configuration>
+  class ShardedDivFinder;
+
+  namespace ShardedDivFinderHelper {
+    // getHash is only required if ShardByHash is true, so it must not be
+    // referred to otherwise.
+    template<bool ShardByHash>
+    struct Hash {
+      template<class C, class M>
+      static size_t get(const C& conf, const M& monomial) {
+        return conf.getHash(monomial);
+      }
+    };
+    template<>
+    struct Hash<false> {
+      template<class C, class M>
+      static size_t get(const C& conf, const M& monomial) {
+        MATHIC_ASSERT(false);
+        return 0;
+      }
+    };
+
+    /** Inserts each part of the entries into the empty shard of the same
+        index. */
+    template<class Shard, class Entry>
+    class LoadWork : public ParallelWork {
+    public:
+      LoadWork(const std::vector<Shard*>& shards,
+        std::vector<std::vector<Entry> >& parts):
+        _shards(shards), _parts(parts) {}
+
+      virtual void run(size_t shard, size_t shardCount) {
+        MATHIC_ASSERT(shardCount == _shards.size());
+        _shards[shard]->insert(_parts[shard].begin(), _parts[shard].end());
+      }
+
+    private:
+      const std::vector<Shard*>& _shards;
+      std::vector<std::vector<Entry> >& _parts;
+    };
+  }
+
+  template<class C>
+  class ShardedDivFinder {
+  public:
+    typedef C Configuration;
+    typedef KDTree<C> Shard;
+    typedef typename C::Monomial Monomial;
+    typedef typename C::Entry Entry;
+    typedef typename C::Exponent Exponent;
+
+    ShardedDivFinder(const C& configuration);
+    ~ShardedDivFinder();
+
+    /** Returns whether there are any entries. */
+    bool empty() const {return size() == 0;}
+
+    /** Returns the number of entries. */
+    size_t size() const {return _size;}
+
+    /** Returns a string that describes the data structure. */
+    std::string getName() const;
+
+    /** Returns a reference to this object's configuration object. */
+    C& getConfiguration() {return _conf;}
+
+    /** Returns a reference to this object's configuration object. */
+    const C& getConfiguration() const {return _conf;}
+
+    /** Returns the number of shards. */
+    size_t getShardCount() const {return _shards.size();}
+
+    /** Returns the shard at the given index. */
+    const Shard& getShard(size_t index) const {
+      MATHIC_ASSERT(index < getShardCount());
+      return *_shards[index];
+    }
+
+    /** Removes all multiples of monomial. A duplicate counts
+        as a multiple. Returns true if any multiples were removed. */
+    bool removeMultiples(const Monomial& monomial) {
+      bool removed = false;
+      for (size_t i = firstMultipleShard(monomial); i < _shards.size(); ++i) {
+        const size_t before = _shards[i]->size();
+        if (_shards[i]->removeMultiples(monomial)) {
+          _size -= before - _shards[i]->size();
+          removed = true;
+        }
+      }
+      return removed;
+    }
+
+    /** Removes all multiples of monomial. A duplicate counts
+        as a multiple. Returns true if any multiples were removed.
+        Calls out.push_back(entry) for each entry that is removed. */
+    template<class MultipleOutput>
+    bool removeMultiples(const Monomial& monomial, MultipleOutput& out) {
+      bool removed = false;
+      for (size_t i = firstMultipleShard(monomial); i < _shards.size(); ++i) {
+        const size_t before = _shards[i]->size();
+        if (_shards[i]->removeMultiples(monomial, out)) {
+          _size -= before - _shards[i]->size();
+          removed = true;
+        }
+      }
+      return removed;
+    }
+
+    /** Calls out.proceed(entry) for each entry that monomial divides.
+        The method returns if proceed returns false, otherwise the
+        search for divisors proceeds. */
+    template<class Output>
+    void findAllMultiples(const Monomial& monomial, Output& out) {
+      DivFinderHelper::StopRecorder<Entry, Output> recorder(out);
+      for (size_t i = firstMultipleShard(monomial); i < _shards.size(); ++i) {
+        _shards[i]->findAllMultiples(monomial, recorder);
+        if (recorder.stopped())
+          return;
+      }
+    }
+
+    /** Calls out.proceed(entry) for each entry that monomial divides.
+        The method returns if proceed returns false, otherwise the
+        search for divisors proceeds. */
+    template<class Output>
+    void findAllMultiples(const Monomial& monomial, Output& out) const {
+      DivFinderHelper::StopRecorder<Entry, Output> recorder(out);
+      for (size_t i = firstMultipleShard(monomial); i < _shards.size(); ++i) {
+        const Shard& shard = *_shards[i];
+        shard.findAllMultiples(monomial, recorder);
+        if (recorder.stopped())
+          return;
+      }
+    }
+
+    /** Inserts entry into the data structure. Does NOT remove multiples
+        of entry and entry is inserted even if it is a multiple of another
+        entry. */
+    void insert(const Entry& entry) {
+      _shards[getShardIndex(entry)]->insert(entry);
+      ++_size;
+      if (!C::ShardByHash && _size >= _resplitSize &&
+        _conf.getDoAutomaticRebuilds())
+        rebuild();
+    }
+
+    /** Inserts the entries in the range [begin, end) into the data
+        structure. Does NOT remove multiples of entry and entry is inserted
+        even if it is a multiple of another entry.
+
+        The elements in the range [begin, end) may be rearranged by this
+        function, so the range must be mutable. If that is not acceptable,
+        call the one element insert method for each element. */
+    template<class Iter>
+    void insert(Iter begin, Iter end) {
+      if (!empty()) {
+        for (; begin != end; ++begin)
+          insert(*begin);
+        return;
+      }
+      std::vector<Entry> entries(begin, end);
+      load(entries);
+    }
+
+    /** Removes an element whose exponents are equal to monomial's. Returns
+      if there are no such monomials in the data structure. */
+    bool removeElement(const Monomial& monomial) {
+      if (!_shards[getShardIndex(monomial)]->removeElement(monomial))
+        return false;
+      --_size;
+      return true;
+    }
+
+    /** Returns true if there is an entry whose exponents are equal to
+        monomial's. */
+    bool contains(const Monomial& monomial) const {
+      return getShard(getShardIndex(monomial)).contains(monomial);
+    }
+
+    /** Returns a pointer to an entry that divides monomial. Returns null if no
+        entries divide monomial. */
+    Entry* findDivisor(const Monomial& monomial) {
+      const size_t end = divisorShardEnd(monomial);
+      for (size_t i = 0; i < end; ++i) {
+        Entry* divisor = _shards[i]->findDivisor(monomial);
+        if (divisor != 0)
+          return divisor;
+      }
+      return 0;
+    }
+
+    /** Returns the position of a divisor of monomial. Returns null if no
+        entries divide monomial. */
+    const Entry* findDivisor(const Monomial& monomial) const {
+      return const_cast<ShardedDivFinder<C>&>(*this).findDivisor(monomial);
+    }
+
+    /** Returns a pointer to an entry that divides monomial and that has
+        the lowest score among those entries. Returns null if no entries
+        divide monomial. */
+    Entry* findBestDivisor(const Monomial& monomial) {
+      Entry* best = 0;
+      const size_t end = divisorShardEnd(monomial);
+      for (size_t i = 0; i < end; ++i) {
+        Entry* divisor = _shards[i]->findBestDivisor(monomial);
+        if (divisor != 0 &&
+          (best == 0 || _conf.getScore(*divisor) < _conf.getScore(*best)))
+          best = divisor;
+      }
+      return best;
+    }
+
+    /** Returns a pointer to an entry that divides monomial and that has
+        the lowest score among those entries. Returns null if no entries
+        divide monomial. */
+    const Entry* findBestDivisor(const Monomial& monomial) const {
+      return const_cast<ShardedDivFinder<C>&>(*this).findBestDivisor(monomial);
+    }
+
+    /** Returns a pointer to an entry that divides monomial and that has
+        a score lower than bound. Returns null if there is no such entry. */
+    template<class Score>
+    Entry* findDivisorWithScoreBelow
+      (const Monomial& monomial, const Score& bound) {
+      const size_t end = divisorShardEnd(monomial);
+      for (size_t i = 0; i < end; ++i) {
+        Entry* divisor = _shards[i]->findDivisorWithScoreBelow(monomial, bound);
+        if (divisor != 0)
+          return divisor;
+      }
+      return 0;
+    }
+
+    /** Returns a pointer to an entry that divides monomial and that has
+        a score lower than bound. Returns null if there is no such entry. */
+    template<class Score>
+    const Entry* findDivisorWithScoreBelow
+      (const Monomial& monomial, const Score& bound) const {
+      return const_cast<ShardedDivFinder<C>&>(*this).
+        findDivisorWithScoreBelow(monomial, bound);
+    }
+
+    /** Calls out.proceed(entry) for each entry that divides monomial.
+        The method returns if proceed returns false, otherwise the
+        search for divisors proceeds. */
+    template<class DivisorOutput>
+    void findAllDivisors(const Monomial& monomial, DivisorOutput& out) {
+      DivFinderHelper::StopRecorder<Entry, DivisorOutput> recorder(out);
+      const size_t end = divisorShardEnd(monomial);
+      for (size_t i = 0; i < end; ++i) {
+        _shards[i]->findAllDivisors(monomial, recorder);
+        if (recorder.stopped())
+          return;
+      }
+    }
+
+    /** Calls output.proceed(entry) for each entry that divides monomial.
+        The method returns if proceed returns false, otherwise the
+        search for divisors proceeds. */
+    template<class DivisorOutput>
+    void findAllDivisors(const Monomial& monomial, DivisorOutput& out) const {
+      DivFinderHelper::StopRecorder<Entry, DivisorOutput> recorder(out);
+      const size_t end = divisorShardEnd(monomial);
+      for (size_t i = 0; i < end; ++i) {
+        const Shard& shard = *_shards[i];
+        shard.findAllDivisors(monomial, recorder);
+        if (recorder.stopped())
+          return;
+      }
+    }
+
+    /** Calls output.proceed(entry) for each entry.
+        The method returns if proceed returns false, otherwise the
+        search for divisors proceeds. */
+    template<class EntryOutput>
+    void forAll(EntryOutput& out) {
+      DivFinderHelper::StopRecorder<Entry, EntryOutput> recorder(out);
+      for (size_t i = 0; i < _shards.size(); ++i) {
+        _shards[i]->forAll(recorder);
+        if (recorder.stopped())
+          return;
+      }
+    }
+
+    /** Calls out.proceed(entry) for each entry.
+        The method returns if proceed returns false, otherwise the
+        search for divisors proceeds. */
+    template<class EntryOutput>
+    void forAll(EntryOutput& out) const {
+      DivFinderHelper::StopRecorder<Entry, EntryOutput> recorder(out);
+      for (size_t i = 0; i < _shards.size(); ++i) {
+        const Shard& shard = *_shards[i];
+        shard.forAll(recorder);
+        if (recorder.stopped())
+          return;
+      }
+    }
+
+    /** Removes all entries. Does not reset the configuration object. */
+    void clear() {
+      for (size_t i = 0; i < _shards.size(); ++i)
+        _shards[i]->clear();
+      _size = 0;
+      _splits.clear();
+      _resplitSize = _conf.getRebuildMin();
+    }
+
+    /** Rebuilds the data structure. If ShardByHash is false, this also
+        recomputes the split points and moves entries between shards
+        accordingly. */
+    void rebuild();
+
+	/** Returns the number of bytes allocated by this object. Does not
+		include sizeof(*this), does not include any additional memory
+		that the configuration may have allocated and does not include
+		any memory that an Entry may point to. Does include
+		sizeof(Entry) as well as unused memory that is being kept to
+		avoid frequent allocations. */
+    size_t getMemoryUse() const {
+      size_t sum = _splits.capacity() * sizeof(Exponent) +
+        _shards.capacity() * sizeof(Shard*);
+      for (size_t i = 0; i < _shards.size(); ++i)
+        sum += sizeof(Shard) + _shards[i]->getMemoryUse();
+      return sum;
+    }
+
+  private:
+    ShardedDivFinder(const ShardedDivFinder<C>&); // unavailable
+    void operator=(const ShardedDivFinder<C>&); // unavailable
+
+    /// For recording all entries using forAll.
+    class EntryRecorder {
+    public:
+      EntryRecorder(std::vector<Entry>& entries): _entries(entries) {}
+      bool proceed(const Entry& entry) {
+        _entries.push_back(entry);
+        return true;
+      }
+    private:
+      std::vector<Entry>& _entries;
+    };
+
+    /** Returns the index of the shard that owns entries with the
+        exponents of monomial. */
+    template<class M>
+    size_t getShardIndex(const M& monomial) const {
+      if (C::ShardByHash)
+        return ShardedDivFinderHelper::Hash<C::ShardByHash>::get
+          (_conf, monomial) % _shards.size();
+      return shardOfExponent(_conf.getExponent(monomial, 0));
+    }
+
+    size_t shardOfExponent(const Exponent& exponent) const {
+      return std::upper_bound(_splits.begin(), _splits.end(), exponent) -
+        _splits.begin();
+    }
+
+    /** Returns the index after the last shard that can contain a divisor
+        of monomial. */
+    size_t divisorShardEnd(const Monomial& monomial) const {
+      if (C::ShardByHash)
+        return _shards.size();
+      return shardOfExponent(_conf.getExponent(monomial, 0)) + 1;
+    }
+
+    /** Returns the index of the first shard that can contain a multiple
+        of monomial. */
+    size_t firstMultipleShard(const Monomial& monomial) const {
+      if (C::ShardByHash)
+        return 0;
+      return shardOfExponent(_conf.getExponent(monomial, 0));
+    }
+
+    /** Sets the split points so that each shard gets about the same
+        number of the entries in entries. */
+    void computeSplits(const std::vector<Entry>& entries);
+
+    /** Inserts entries into the shards, which must be empty. */
+    void load(std::vector<Entry>& entries);
+
+    C _conf;
+    std::vector<Shard*> _shards;
+
+    /** Shard i owns the entries whose first exponent e has
+        _splits[i - 1] <= e < _splits[i], where the conditions that refer
+        to splits that do not exist are taken to be true. Only used if
+        ShardByHash is false. */
+    std::vector<Exponent> _splits;
+    size_t _resplitSize; /// recompute the splits once size reaches this.
+    size_t _size;
+  };
+
+  template<class C>
+  ShardedDivFinder<C>::ShardedDivFinder(const C& configuration):
+    _conf(configuration),
+    _resplitSize(configuration.getRebuildMin()),
+    _size(0) {
+    MATHIC_ASSERT(_conf.getShardCount() > 0);
+    const size_t shardCount = std::max<size_t>(1, _conf.getShardCount());
+    _shards.reserve(shardCount);
+    try {
+      for (size_t i = 0; i < shardCount; ++i)
+        _shards.push_back(new Shard(_conf));
+    } catch (...) {
+      for (size_t i = 0; i < _shards.size(); ++i)
+        delete _shards[i];
+      throw;
+    }
+  }
+
+  template<class C>
+  ShardedDivFinder<C>::~ShardedDivFinder() {
+    for (size_t i = 0; i < _shards.size(); ++i)
+      delete _shards[i];
+  }
+
+  template<class C>
+  std::string ShardedDivFinder<C>::getName() const {
+    std::stringstream out;
+    out << "Sharded(" << _shards.size()
+        << (C::ShardByHash ? " by hash" : " by var") << ") "
+        << _shards.front()->getName();
+    return out.str();
+  }
+
+  template<class C>
+  void ShardedDivFinder<C>::rebuild() {
+    if (C::ShardByHash) {
+      for (size_t i = 0; i < _shards.size(); ++i)
+        _shards[i]->rebuild();
+      return;
+    }
+    std::vector<Entry> entries;
+    entries.reserve(size());
+    EntryRecorder recorder(entries);
+    forAll(recorder);
+    for (size_t i = 0; i < _shards.size(); ++i)
+      _shards[i]->clear();
+    _size = 0;
+    load(entries);
+  }
+
+  template<class C>
+  void ShardedDivFinder<C>::computeSplits(const std::vector<Entry>& entries) {
+    _splits.clear();
+    if (entries.empty())
+      return;
+    std::vector<Exponent> exponents;
+    exponents.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i)
+      exponents.push_back(_conf.getExponent(entries[i], 0));
+    std::sort(exponents.begin(), exponents.end());
+
+    // many equal exponents can make for fewer splits than shards.
+    const size_t shardCount = _shards.size();
+    for (size_t shard = 1; shard < shardCount; ++shard) {
+      const Exponent& split = exponents[(exponents.size() * shard) / shardCount];
+      if (exponents.front() < split &&
+        (_splits.empty() || _splits.back() < split))
+        _splits.push_back(split);
+    }
+  }
+
+  template<class C>
+  void ShardedDivFinder<C>::load(std::vector<Entry>& entries) {
+    MATHIC_ASSERT(empty());
+    if (!C::ShardByHash)
+      computeSplits(entries);
+    std::vector<std::vector<Entry> > parts(_shards.size());
+    for (size_t i = 0; i < entries.size(); ++i)
+      parts[getShardIndex(entries[i])].push_back(entries[i]);
+
+    // Range insertion into an empty KDTree does not use any memory shared
+    // between shards, so the shards can be loaded in parallel.
+    ShardedDivFinderHelper::LoadWork<Shard, Entry> work(_shards, parts);
+    if (_shards.size() == 1)
+      work.run(0, 1);
+    else
+      runInParallel(work, _shards.size());
+
+    _size = entries.size();
+    _resplitSize = std::max(2 * _size, _conf.getRebuildMin());
+  }
+}
+
+#endif
@@ -0,0 +1,348 @@
+#include "ThreadScaling.h"
+
+#include "BenchmarkReport.h"
+#include "ColumnPrinter.h"
+#include "Timer.h"
+#include "error.h"
+#include <exception>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MATHIC_USE_PTHREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace mathic {
+  namespace {
+    struct ParallelData {
+      ParallelWork* work;
+      size_t thread;
+      size_t threadCount;
+      std::string error; /// what was thrown, if anything
+    };
+
+    void runParallelPart(ParallelData& data) {
+      try {
+        data.work->run(data.thread, data.threadCount);
+      } catch (const std::exception& e) {
+        data.error = e.what();
+      } catch (...) {
+        data.error = "unknown exception";
+      }
+    }
+  }
+
+#ifdef MATHIC_USE_PTHREADS
+  struct Mutex::Data {
+    pthread_mutex_t mutex;
+  };
+
+  Mutex::Mutex(): _data(new Data()) {
+    pthread_mutex_init(&_data->mutex, 0);
+  }
+
+  Mutex::~Mutex() {
+    pthread_mutex_destroy(&_data->mutex);
+    delete _data;
+  }
+
+  void Mutex::lock() {
+    pthread_mutex_lock(&_data->mutex);
+  }
+
+  void Mutex::unlock() {
+    pthread_mutex_unlock(&_data->mutex);
+  }
+
+  bool ThreadScaling::threadsAvailable() {
+    return true;
+  }
+
+  namespace {
+    /** Holds the threads of a run back until all of them have been
+        started, so that they start working at the same time. */
+    class StartGate {
+    public:
+      StartGate(): _waiting(0), _open(false) {
+        pthread_mutex_init(&_mutex, 0);
+        pthread_cond_init(&_changed, 0);
+      }
+
+      ~StartGate() {
+        pthread_cond_destroy(&_changed);
+        pthread_mutex_destroy(&_mutex);
+      }
+
+      /** Called by each thread to wait for the gate to open. */
+      void wait() {
+        pthread_mutex_lock(&_mutex);
+        ++_waiting;
+        pthread_cond_broadcast(&_changed);
+        while (!_open)
+          pthread_cond_wait(&_changed, &_mutex);
+        pthread_mutex_unlock(&_mutex);
+      }
+
+      /** Returns when threadCount threads are waiting. */
+      void waitForThreads(size_t threadCount) {
+        pthread_mutex_lock(&_mutex);
+        while (_waiting < threadCount)
+          pthread_cond_wait(&_changed, &_mutex);
+        pthread_mutex_unlock(&_mutex);
+      }
+
+      /** Lets the waiting threads through. */
+      void open() {
+        pthread_mutex_lock(&_mutex);
+        _open = true;
+        pthread_cond_broadcast(&_changed);
+        pthread_mutex_unlock(&_mutex);
+      }
+
+    private:
+      pthread_mutex_t _mutex;
+      pthread_cond_t _changed;
+      size_t _waiting;
+      bool _open;
+    };
+
+    struct ThreadData {
+      ScalingWork* work;
+      StartGate* gate;
+      size_t thread;
+      size_t threadCount;
+      unsigned long long operations;
+      unsigned long long nanos;
+      std::string error; /// what was thrown, if anything
+    };
+
+    extern "C" void* runParallelThread(void* arg) {
+      runParallelPart(*static_cast<ParallelData*>(arg));
+      return 0;
+    }
+
+    extern "C" void* runThread(void* arg) {
+      ThreadData& data = *static_cast<ThreadData*>(arg);
+      data.gate->wait();
+      const unsigned long long start = WallTimer::getNanos();
+      try {
+        data.operations = data.work->run(data.thread, data.threadCount);
+      } catch (const std::exception& e) {
+        data.error = e.what();
+      } catch (...) {
+        data.error = "unknown exception";
+      }
+      data.nanos = WallTimer::getNanos() - start;
+      return 0;
+    }
+  }
+
+  void runInParallel(ParallelWork& work, size_t threadCount) {
+    MATHIC_ASSERT(threadCount > 0);
+    std::vector<ParallelData> data(threadCount);
+    for (size_t thread = 0; thread < threadCount; ++thread) {
+      data[thread].work = &work;
+      data[thread].thread = thread;
+      data[thread].threadCount = threadCount;
+    }
+    std::vector<pthread_t> threads(threadCount);
+    std::vector<char> started(threadCount, false);
+    for (size_t thread = 1; thread < threadCount; ++thread)
+      started[thread] = pthread_create
+        (&threads[thread], 0, runParallelThread, &data[thread]) == 0;
+    runParallelPart(data[0]);
+    for (size_t thread = 1; thread < threadCount; ++thread) {
+      if (started[thread])
+        pthread_join(threads[thread], 0);
+      else
+        runParallelPart(data[thread]);
+    }
+    for (size_t thread = 0; thread < threadCount; ++thread)
+      if (!data[thread].error.empty())
+        reportError("a thread of a parallel run failed: " +
+          data[thread].error);
+  }
+
+  size_t getProcessorCount() {
+#ifdef _SC_NPROCESSORS_ONLN
+    const long count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count > 0)
+      return static_cast<size_t>(count);
+#endif
+    return 1;
+  }
+
+  void ThreadScaling::run
+  (ScalingWork& work, const std::vector<size_t>& threadCounts) {
+    for (size_t i = 0; i < threadCounts.size(); ++i) {
+      const size_t threadCount = threadCounts[i];
+      MATHIC_ASSERT(threadCount > 0);
+      work.prepare(threadCount);
+
+      StartGate gate;
+      std::vector<ThreadData> data(threadCount);
+      std::vector<pthread_t> threads(threadCount);
+      size_t started = 0;
+      for (; started < threadCount; ++started) {
+        ThreadData& d = data[started];
+        d.work = &work;
+        d.gate = &gate;
+        d.thread = started;
+        d.threadCount = threadCount;
+        d.operations = 0;
+        d.nanos = 0;
+        if (pthread_create(&threads[started], 0, runThread, &d) != 0)
+          break;
+      }
+      gate.waitForThreads(started);
+      const unsigned long long start = WallTimer::getNanos();
+      gate.open();
+      for (size_t thread = 0; thread < started; ++thread)
+        pthread_join(threads[thread], 0);
+      const unsigned long long nanos = WallTimer::getNanos() - start;
+      work.finish();
+      if (started < threadCount) {
+        std::ostringstream msg;
+        msg << "could only start " << started << " of " << threadCount
+          << " threads.";
+        reportError(msg.str());
+      }
+
+      Result result;
+      result.name = work.getName();
+      result.threadCount = threadCount;
+      result.nanos = nanos;
+      result.operations = 0;
+      result.fastestThreadNanos = data.front().nanos;
+      result.slowestThreadNanos = data.front().nanos;
+      for (size_t thread = 0; thread < threadCount; ++thread) {
+        const ThreadData& d = data[thread];
+        if (!d.error.empty())
+          reportError("a thread of " + result.name + " failed: " + d.error);
+        result.operations += d.operations;
+        if (result.fastestThreadNanos > d.nanos)
+          result.fastestThreadNanos = d.nanos;
+        if (result.slowestThreadNanos < d.nanos)
+          result.slowestThreadNanos = d.nanos;
+      }
+      _results.push_back(result);
+    }
+  }
+#else
+  Mutex::Mutex(): _data(0) {}
+  Mutex::~Mutex() {}
+  void Mutex::lock() {}
+  void Mutex::unlock() {}
+
+  bool ThreadScaling::threadsAvailable() {
+    return false;
+  }
+
+  void runInParallel(ParallelWork& work, size_t threadCount) {
+    MATHIC_ASSERT(threadCount > 0);
+    ParallelData data;
+    data.work = &work;
+    data.threadCount = threadCount;
+    for (data.thread = 0; data.thread < threadCount; ++data.thread) {
+      runParallelPart(data);
+      if (!data.error.empty())
+        reportError("a thread of a parallel run failed: " + data.error);
+    }
+  }
+
+  size_t getProcessorCount() {
+    return 1;
+  }
+
+  void ThreadScaling::run
+  (ScalingWork& work, const std::vector<size_t>& threadCounts) {}
+#endif
+
+  void ThreadScalingOptions::parse(int& argc, const char**& args) {
+    if (argc < 3)
+      return;
+    const std::string option = args[1];
+    if (option != "threads" && option != "shared-threads")
+      return;
+    shared = option == "shared-threads";
+    const std::string list = args[2];
+    size_t begin = 0;
+    while (true) {
+      const size_t end = list.find(',', begin);
+      std::istringstream in(list.substr(begin, end - begin));
+      size_t threadCount = 0;
+      in >> threadCount;
+      if (!in || !in.eof() || threadCount == 0)
+        reportError("expected a comma separated list of thread counts "
+          "instead of \"" + list + "\".");
+      threadCounts.push_back(threadCount);
+      if (end == std::string::npos)
+        break;
+      begin = end + 1;
+    }
+    args[2] = args[0];
+    args += 2;
+    argc -= 2;
+  }
+
+  double ThreadScaling::Result::getOperationsPerNano() const {
+    return nanos == 0 ? 0 : static_cast<double>(operations) / nanos;
+  }
+
+  double ThreadScaling::getEfficiency(const Result& result) const {
+    const Result* base = 0;
+    for (size_t i = 0; i < _results.size(); ++i) {
+      const Result& r = _results[i];
+      if (r.name == result.name &&
+        (base == 0 || r.threadCount < base->threadCount))
+        base = &r;
+    }
+    MATHIC_ASSERT(base != 0);
+    const double basePerThread =
+      base->getOperationsPerNano() / base->threadCount;
+    if (basePerThread == 0)
+      return 0;
+    return result.getOperationsPerNano() /
+      (basePerThread * result.threadCount);
+  }
+
+  void ThreadScaling::print(std::ostream& out) const {
+    ColumnPrinter pr;
+    pr.addColumn(true);
+    pr.addColumn(false, " ", " threads");
+    pr.addColumn(false, " ");
+    pr.addColumn(false, " ", "op/s");
+    pr.addColumn(false, " ", " efficiency");
+    pr.addColumn(false, " thread times ");
+    pr.addColumn(false, " to ");
+    for (size_t i = 0; i < _results.size(); ++i) {
+      const Result& r = _results[i];
+      pr[0] << r.name << '\n';
+      pr[1] << r.threadCount << '\n';
+      pr[2] << ColumnPrinter::nanosInUnit(r.nanos) << '\n';
+      pr[3] << ColumnPrinter::commafy(static_cast<unsigned long long>
+        (r.getOperationsPerNano() * 1e9)) << '\n';
+      pr[4] << ColumnPrinter::percent(getEfficiency(r)) << '\n';
+      pr[5] << ColumnPrinter::nanosInUnit(r.fastestThreadNanos) << '\n';
+      pr[6] << ColumnPrinter::nanosInUnit(r.slowestThreadNanos) << '\n';
+    }
+    out << "*** Thread scaling ***\n";
+    pr.print(out);
+  }
+
+  void ThreadScaling::addToReport
+  (BenchmarkReport& report, const std::string& workload) const {
+    for (size_t i = 0; i < _results.size(); ++i) {
+      const Result& r = _results[i];
+      std::ostringstream model;
+      model << r.name << " on " << r.threadCount << " threads";
+      BenchmarkResult result;
+      result.workload = workload;
+      result.model = model.str();
+      result.setRunNanos(std::vector<unsigned long long>(1, r.nanos));
+      result.operations = r.operations;
+      report.add(result);
+    }
+  }
+}
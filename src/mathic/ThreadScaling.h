@@ -0,0 +1,156 @@
+#ifndef MATHIC_THREAD_SCALING_GUARD
+#define MATHIC_THREAD_SCALING_GUARD
+
+#include "stdinc.h"
+#include <vector>
+#include <string>
+#include <ostream>
+
+namespace mathic {
+  class BenchmarkReport;
+
+  /** A mutual exclusion lock for benchmarks where threads share a
+      container, since the containers of mathic are not thread safe. This
+      does nothing if ThreadScaling::threadsAvailable() is false. */
+  class Mutex {
+  public:
+    Mutex();
+    ~Mutex();
+
+    void lock();
+    void unlock();
+
+    /** Holds the lock of a mutex from construction to destruction. */
+    class Lock {
+    public:
+      Lock(Mutex& mutex): _mutex(mutex) {_mutex.lock();}
+      ~Lock() {_mutex.unlock();}
+
+    private:
+      Lock(const Lock&); // unavailable
+      void operator=(const Lock&); // unavailable
+
+      Mutex& _mutex;
+    };
+
+  private:
+    Mutex(const Mutex&); // unavailable
+    void operator=(const Mutex&); // unavailable
+
+    struct Data;
+    Data* _data;
+  };
+
+  /** Work that is split between a number of threads by runInParallel. */
+  class ParallelWork {
+  public:
+    virtual ~ParallelWork() {}
+
+    /** Does the part of the work of thread number thread out of
+        threadCount. Different threads must not write to the same
+        memory. */
+    virtual void run(size_t thread, size_t threadCount) = 0;
+  };
+
+  /** Runs work on threadCount threads at once and returns once all of
+      them are done. The calling thread does the part of thread 0. If a
+      thread cannot be started, or if ThreadScaling::threadsAvailable()
+      is false, the calling thread does its part afterwards, so the work
+      always gets done. Reports an error if work throws an exception on
+      any thread. */
+  void runInParallel(ParallelWork& work, size_t threadCount);
+
+  /** Returns the number of processors that are online, or 1 if that is
+      not known. */
+  size_t getProcessorCount();
+
+  /** The work that ThreadScaling runs on a number of threads at once. */
+  class ScalingWork {
+  public:
+    virtual ~ScalingWork() {}
+
+    /** Returns the name that the work is reported under. */
+    virtual std::string getName() const = 0;
+
+    /** Prepares for a run on threadCount threads. This is not timed. */
+    virtual void prepare(size_t threadCount) {}
+
+    /** Does the work of thread number thread out of threadCount and
+        returns the number of operations that it did. This is called on
+        every thread at the same time. */
+    virtual unsigned long long run(size_t thread, size_t threadCount) = 0;
+
+    /** Cleans up after a run. This is not timed. */
+    virtual void finish() {}
+  };
+
+  /** Measures how the throughput of some work scales with the number of
+      threads that do it at once. The scaling efficiency of a run is its
+      throughput divided by the throughput of the run with the fewest
+      threads, scaled to the same number of threads. Perfect scaling is
+      100%. Contention for locks, the memory allocator, memory bandwidth
+      or cache lines that are written by more than one thread, also known
+      as false sharing, makes it lower.
+
+      This uses POSIX threads. Elsewhere no threads are available and
+      run() does nothing. */
+  class ThreadScaling {
+  public:
+    /** Returns true if this platform has threads. */
+    static bool threadsAvailable();
+
+    /** Runs work on each number of threads in threadCounts. A run is
+        timed from when every thread is ready to start to when the last
+        one finishes, so starting the threads is not timed. Reports an
+        error if work throws an exception on any thread. */
+    void run(ScalingWork& work, const std::vector<size_t>& threadCounts);
+
+    /** Prints the time, throughput and scaling efficiency of each run. */
+    void print(std::ostream& out) const;
+
+    /** Adds each run to report as a model with the number of threads in
+        its name. */
+    void addToReport
+      (BenchmarkReport& report, const std::string& workload) const;
+
+    /** Returns true if nothing has been run. */
+    bool empty() const {return _results.empty();}
+
+  private:
+    struct Result {
+      std::string name;
+      size_t threadCount;
+      unsigned long long nanos;
+      unsigned long long operations;
+      /// the time of the fastest and slowest thread, to show imbalance.
+      unsigned long long fastestThreadNanos;
+      unsigned long long slowestThreadNanos;
+
+      double getOperationsPerNano() const;
+    };
+
+    /** Returns the scaling efficiency of result as a fraction. */
+    double getEfficiency(const Result& result) const;
+
+    std::vector<Result> _results;
+  };
+
+  /** The command line options of pqsim and divsim for measuring thread
+      scaling. */
+  struct ThreadScalingOptions {
+    ThreadScalingOptions(): shared(false) {}
+
+    std::vector<size_t> threadCounts; /// empty if not measuring scaling
+    bool shared; /// all threads share one container behind a Mutex
+
+    /** Removes the option "threads LIST" or "shared-threads LIST" from
+        the front of the arguments after args[0]. LIST is a comma
+        separated list of thread counts. Reports an error if LIST is
+        malformed. */
+    void parse(int& argc, const char**& args);
+
+    bool any() const {return !threadCounts.empty();}
+  };
+}
+
+#endif
@@ -39,6 +39,46 @@ namespace mathic {
     timer.print(out);
     return out;
   }
+
+  /** Measures spans of wall clock time in nanoseconds. Uses a monotonic
+      clock where there is one, so the time does not jump when the system
+      clock is set, and does not overflow for centuries. Elsewhere
+      std::clock is used, which has the resolution and overflow
+      limitations described for Timer. */
+  class WallTimer {
+  public:
+    WallTimer() {reset();}
+
+    /** Resets the amount of elapsed time to zero. */
+    void reset() {_nanosAtReset = getNanos();}
+
+    /** Returns the number of nanoseconds since the last reset. */
+    unsigned long long getNanoseconds() const {
+      return getNanos() - _nanosAtReset;
+    }
+
+    /** Returns the number of milliseconds since the last reset. */
+    unsigned long getMilliseconds() const {
+      return static_cast<unsigned long>(getNanoseconds() / 1000000);
+    }
+
+    /** Returns the current time in nanoseconds since some fixed point
+        in the past. */
+    static unsigned long long getNanos() {
+#ifdef CLOCK_MONOTONIC
+      timespec time;
+      clock_gettime(CLOCK_MONOTONIC, &time);
+      return static_cast<unsigned long long>(time.tv_sec) * 1000000000 +
+        time.tv_nsec;
+#else
+      return static_cast<unsigned long long>
+        (std::clock() * (1e9 / CLOCKS_PER_SEC));
+#endif
+    }
+
+  private:
+    unsigned long long _nanosAtReset;
+  };
 }
 
 #endif
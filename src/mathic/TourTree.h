@@ -2,6 +2,7 @@
 #define MATHIC_TOUR_TREE_GUARD
 
 #include "stdinc.h"
+#include "Profiler.h"
 #include "ComTree.h"
 #include <string>
 #include <vector>
@@ -164,6 +165,7 @@ namespace mathic {
 
   template<class C>
 	typename TourTree<C>::Entry TourTree<C>::pop() {
+	MATHIC_PROFILE("TourTree::pop");
 	MATHIC_ASSERT(!empty());
 	Entry top = _tree[Node()]->entry;
 	if (_tree.lastLeaf().isRoot()) {
@@ -0,0 +1,98 @@
+#include "TraceFile.h"
+
+#include "error.h"
+#include <cstring>
+
+#if (defined __unix__) || (defined __APPLE__)
+#define MATHIC_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace mathic {
+  TraceFileWriter::TraceFileWriter
+  (const std::string& fileName, const char* magic, size_t magicSize):
+    _file(std::fopen(fileName.c_str(), "wb")),
+    _fileName(fileName),
+    _eventCount(0) {
+    if (_file == 0)
+      reportError("could not create trace file " + fileName + '.');
+    _buffer.insert(_buffer.end(), magic, magic + magicSize);
+  }
+
+  TraceFileWriter::~TraceFileWriter() {
+    // do not throw from a destructor.
+    if (!_buffer.empty())
+      std::fwrite(&_buffer[0], 1, _buffer.size(), _file);
+    std::fclose(_file);
+  }
+
+  void TraceFileWriter::flush() {
+    if (!_buffer.empty() &&
+      std::fwrite(&_buffer[0], 1, _buffer.size(), _file) != _buffer.size())
+      reportError("could not write to trace file " + _fileName + '.');
+    _buffer.clear();
+    if (std::fflush(_file) != 0)
+      reportError("could not write to trace file " + _fileName + '.');
+  }
+
+  TraceFileReader::TraceFileReader(const std::string& fileName,
+    const char* magic, size_t magicSize, const std::string& kind):
+    _begin(0), _pos(0), _end(0), _mapping(0), _mappingSize(0),
+    _fileName(fileName) {
+#ifdef MATHIC_USE_MMAP
+    const int fd = open(fileName.c_str(), O_RDONLY);
+    if (fd == -1)
+      reportError("could not open trace file " + fileName + '.');
+    struct stat status;
+    if (fstat(fd, &status) == 0 && status.st_size > 0) {
+      _mappingSize = static_cast<size_t>(status.st_size);
+      void* mapping = mmap(0, _mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapping != MAP_FAILED) {
+        _mapping = mapping;
+        madvise(_mapping, _mappingSize, MADV_SEQUENTIAL);
+        _begin = static_cast<const unsigned char*>(_mapping);
+        _end = _begin + _mappingSize;
+      }
+    }
+    close(fd);
+#endif
+    if (_mapping == 0) {
+      std::FILE* file = std::fopen(fileName.c_str(), "rb");
+      if (file == 0)
+        reportError("could not open trace file " + fileName + '.');
+      unsigned char block[1 << 16];
+      size_t read;
+      while ((read = std::fread(block, 1, sizeof(block), file)) > 0)
+        _contents.insert(_contents.end(), block, block + read);
+      std::fclose(file);
+      _begin = _contents.empty() ? 0 : &_contents[0];
+      _end = _begin + _contents.size();
+    }
+
+    if (static_cast<size_t>(_end - _begin) < magicSize ||
+      std::memcmp(_begin, magic, magicSize) != 0) {
+      // the destructor does not run if the constructor throws.
+#ifdef MATHIC_USE_MMAP
+      if (_mapping != 0)
+        munmap(_mapping, _mappingSize);
+#endif
+      reportError(fileName + " is not a " + kind + '.');
+    }
+    _begin += magicSize;
+    _pos = _begin;
+  }
+
+  TraceFileReader::~TraceFileReader() {
+#ifdef MATHIC_USE_MMAP
+    if (_mapping != 0)
+      munmap(_mapping, _mappingSize);
+#endif
+  }
+
+  void TraceFileReader::reportTruncated() const {
+    reportError("the trace in " + _fileName + " is truncated.");
+  }
+}
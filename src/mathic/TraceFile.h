@@ -0,0 +1,115 @@
+#ifndef MATHIC_TRACE_FILE_GUARD
+#define MATHIC_TRACE_FILE_GUARD
+
+#include "stdinc.h"
+#include <vector>
+#include <string>
+#include <cstdio>
+
+namespace mathic {
+  /** Writes the file of a trace such as those of QueueTraceWriter and
+      DivTraceWriter. The file starts with a magic byte string that
+      identifies the kind of trace. The rest of the file is numbers
+      written in 7 bit groups, least significant first, with the high bit
+      of each byte set if more groups follow. Writes are buffered. */
+  class TraceFileWriter {
+  public:
+    typedef unsigned long long Number;
+
+    /** Creates the file fileName, replacing any file of that name, and
+        writes the magicSize bytes of magic to it. Reports an error if the
+        file cannot be created. */
+    TraceFileWriter
+      (const std::string& fileName, const char* magic, size_t magicSize);
+
+    /** Writes any buffered numbers and closes the file. */
+    ~TraceFileWriter();
+
+    void writeNumber(Number number) {
+      while (number >= 0x80) {
+        _buffer.push_back(static_cast<unsigned char>(number | 0x80));
+        number >>= 7;
+      }
+      _buffer.push_back(static_cast<unsigned char>(number));
+    }
+
+    /** Counts an event as written and flushes if the buffer is full. */
+    void eventWritten() {
+      ++_eventCount;
+      if (_buffer.size() >= BufferSize)
+        flush();
+    }
+
+    /** Writes the buffered numbers to the file. Reports an error if that
+        fails. */
+    void flush();
+
+    unsigned long long getEventCount() const {return _eventCount;}
+
+  private:
+    TraceFileWriter(const TraceFileWriter&); // unavailable
+    void operator=(const TraceFileWriter&); // unavailable
+
+    static const size_t BufferSize = 1 << 16;
+
+    std::FILE* _file;
+    std::string _fileName;
+    std::vector<unsigned char> _buffer;
+    unsigned long long _eventCount;
+  };
+
+  /** Reads the numbers of a file written by TraceFileWriter. The file is
+      memory mapped where that is supported, so a trace can be much larger
+      than the memory that the reader uses. */
+  class TraceFileReader {
+  public:
+    typedef TraceFileWriter::Number Number;
+
+    /** Opens fileName and checks that it starts with the magicSize bytes
+        of magic. Reports an error if the file cannot be read or does not
+        start with magic, in which case kind is used to say what the file
+        should have been. */
+    TraceFileReader(const std::string& fileName,
+      const char* magic, size_t magicSize, const std::string& kind);
+    ~TraceFileReader();
+
+    /** Returns true if all numbers have been read. */
+    bool atEnd() const {return _pos == _end;}
+
+    /** Reads the next number. Reports an error if the file is
+        truncated. */
+    Number readNumber() {
+      Number number = 0;
+      for (unsigned int shift = 0; ; shift += 7) {
+        if (_pos == _end)
+          reportTruncated();
+        const unsigned char byte = *_pos;
+        ++_pos;
+        number |= static_cast<Number>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+          return number;
+      }
+    }
+
+    /** Makes the next number read be the first one after the magic. */
+    void rewind() {_pos = _begin;}
+
+    const std::string& getFileName() const {return _fileName;}
+
+  private:
+    TraceFileReader(const TraceFileReader&); // unavailable
+    void operator=(const TraceFileReader&); // unavailable
+
+    void reportTruncated() const;
+
+    const unsigned char* _begin; /// the first number
+    const unsigned char* _pos; /// the next number
+    const unsigned char* _end;
+    void* _mapping; /// null if the file was read into _contents
+    size_t _mappingSize;
+    std::vector<unsigned char> _contents;
+    std::string _fileName;
+  };
+}
+
+#endif
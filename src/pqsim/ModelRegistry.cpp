@@ -0,0 +1,79 @@
+#include "stdinc.h"
+#include "ModelRegistry.h"
+
+#include "StlSetModel.h"
+#include "HeapModel.h"
+#include "GeobucketModel.h"
+#include "TourTreeModel.h"
+#include "Simulator.h"
+
+namespace {
+  template<class Model>
+  class Runner : public ModelRunner {
+  public:
+    virtual void run(Simulator& sim) {
+      Model model;
+      sim.run(model);
+    }
+
+    virtual void runThreads
+      (Simulator& sim, const mathic::ThreadScalingOptions& options) {
+      sim.runThreads<Model>(options);
+    }
+  };
+
+  /** GeobucketModel takes its base and minimum bucket size at run time,
+      so they are fixed here to make a model that can be default
+      constructed. */
+  template<bool Deduplicate, size_t GeoBase, size_t MinBucketSize>
+  class FixedGeobucketModel :
+    public GeobucketModel<0,0,0,Deduplicate,0,0,0> {
+  public:
+    FixedGeobucketModel():
+      GeobucketModel<0,0,0,Deduplicate,0,0,0>(GeoBase, MinBucketSize) {}
+  };
+}
+
+void registerModels(ModelRegistry& registry) {
+  using mathic::nameFactoryRegister;
+  nameFactoryRegister<Runner<TourTreeModel<1,0> > >(registry, "tourtree-spans");
+  nameFactoryRegister<Runner<TourTreeModel<0,0> > >(registry, "tourtree");
+  nameFactoryRegister<Runner<TourTreeModel<0,1> > >
+    (registry, "tourtree-fastindex");
+  nameFactoryRegister<Runner<FixedGeobucketModel<0,4,32> > >
+    (registry, "geobucket-4-32");
+  nameFactoryRegister<Runner<FixedGeobucketModel<0,2,32> > >
+    (registry, "geobucket-2-32");
+  nameFactoryRegister<Runner<FixedGeobucketModel<1,4,32> > >
+    (registry, "geobucket-4-32-dedup");
+  nameFactoryRegister<Runner<StlSetModel<1> > >(registry, "stlset-spans");
+  nameFactoryRegister<Runner<StlSetModel<0> > >(registry, "stlset");
+  nameFactoryRegister<Runner<HeapModel<0,0,0> > >(registry, "heap");
+  nameFactoryRegister<Runner<HeapModel<1,0,0> > >(registry, "heap-spans");
+  nameFactoryRegister<Runner<HeapModel<0,1,0> > >(registry, "heap-dedup");
+  nameFactoryRegister<Runner<HeapModel<1,1,0> > >
+    (registry, "heap-spans-dedup");
+  nameFactoryRegister<Runner<HeapModel<0,0,1> > >(registry, "heap-fastindex");
+}
+
+void pushBackDefaultModels(std::vector<std::string>& names) {
+#ifdef DEBUG
+  const char* const defaults[] = {"tourtree", "heap"};
+#else
+  const char* const defaults[] = {
+    "tourtree-spans", "tourtree", "geobucket-4-32", "geobucket-2-32",
+    "geobucket-4-32-dedup", "stlset-spans", "stlset", "heap", "heap-spans",
+    "heap-dedup", "heap-spans-dedup"
+  };
+#endif
+  names.insert(names.end(),
+    defaults, defaults + sizeof(defaults) / sizeof(*defaults));
+}
+
+void pushBackChosenModels(const ModelRegistry& registry,
+  const std::string& list, std::vector<std::string>& names) {
+  if (list == "all")
+    registry.namesWithPrefix("", names);
+  else
+    mathic::uniqueNamesWithPrefixes(registry, list, names);
+}
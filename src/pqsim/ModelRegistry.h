@@ -0,0 +1,40 @@
+#ifndef PQ_MODEL_REGISTRY_GUARD
+#define PQ_MODEL_REGISTRY_GUARD
+
+#include "mathic/NameFactory.h"
+#include <string>
+#include <vector>
+
+class Simulator;
+namespace mathic {
+  struct ThreadScalingOptions;
+}
+
+/** Runs one of the priority queue models that pqsim is compiled with.
+    Models are template instantiations, so a ModelRegistry has a runner
+    for each of them so that they can be chosen by name on the command
+    line. */
+class ModelRunner {
+public:
+  virtual ~ModelRunner() {}
+  virtual void run(Simulator& sim) = 0;
+  virtual void runThreads
+    (Simulator& sim, const mathic::ThreadScalingOptions& options) = 0;
+};
+
+typedef mathic::NameFactory<ModelRunner> ModelRegistry;
+
+/** Registers every model under a short name such as heap-dedup. */
+void registerModels(ModelRegistry& registry);
+
+/** Appends the names of the models that pqsim runs if none are chosen. */
+void pushBackDefaultModels(std::vector<std::string>& names);
+
+/** Appends the names of the models chosen by the comma separated list
+    of name prefixes, or every model if the list is "all". Throws
+    mathic::UnknownNameException or mathic::AmbiguousNameException if a
+    prefix does not choose exactly one model. */
+void pushBackChosenModels(const ModelRegistry& registry,
+  const std::string& list, std::vector<std::string>& names);
+
+#endif
@@ -2,10 +2,12 @@
 #include "Simulator.h"
 
 #include "mathic/ColumnPrinter.h"
+#include "mathic/error.h"
 #include <queue>
 #include <iterator>
 #include <algorithm>
 #include <set>
+#include <cmath>
 
 namespace {
   std::string commafy(unsigned long l) {
@@ -188,6 +190,10 @@ void Simulator::dupSpans
       sim.pop();
   }
   _description = makeDescription(sim, _repeats, "dup spans");
+  std::ostringstream type;
+  type << "dup spans " << pushSumGoal << ' ' << avgSpan << ' '
+    << avgLiveGoal << ' ' << dupPercentage;
+  _simType = type.str();
 }
 
 void Simulator::orderSpans
@@ -220,6 +226,9 @@ void Simulator::orderSpans
   }
 
   _description = makeDescription(sim, _repeats, "ordered spans");
+  std::ostringstream type;
+  type << "ordered spans " << spanCount << ' ' << spanSize << ' ' << avgSize;
+  _simType = type.str();
 }
 
 void Simulator::randomSpans(size_t spanCount, size_t spanSize, size_t initialSize) {
@@ -247,6 +256,286 @@ void Simulator::randomSpans(size_t spanCount, size_t spanSize, size_t initialSiz
     }
   }
   _description = makeDescription(sim, _repeats, "random spans");
+  std::ostringstream type;
+  type << "random spans " << spanCount << ' ' << spanSize << ' '
+    << initialSize;
+  _simType = type.str();
+}
+
+Simulator::PolyParams::PolyParams():
+  pushSumGoal(1000000),
+  varCount(8),
+  degree(20),
+  order(RevLex),
+  bitsPerVar(6),
+  reducerCount(100),
+  avgReducerSize(20),
+  spread(2),
+  skewedSizes(false) {}
+
+bool Simulator::PolyParams::setOrder(const std::string& name) {
+  if (name == "lex")
+    order = Lex;
+  else if (name == "deglex")
+    order = DegLex;
+  else if (name == "revlex")
+    order = RevLex;
+  else
+    return false;
+  return true;
+}
+
+std::string Simulator::PolyParams::getError() const {
+  const size_t fieldCount = varCount + (order == Lex ? 0 : 1);
+  if (varCount < 2)
+    return "there must be at least 2 variables.";
+  if (bitsPerVar == 0 ||
+    fieldCount * bitsPerVar > sizeof(Value) * mathic::BitsPerByte)
+    return "the exponents do not fit in a value.";
+  if (degree < 2 || degree >= static_cast<size_t>(1) << bitsPerVar)
+    return "the degree must be at least 2 and fit in bits-per-var bits.";
+  if (reducerCount == 0 || avgReducerSize == 0 || spread == 0)
+    return "the reducer count, size and spread must be positive.";
+  return "";
+}
+
+namespace {
+  typedef std::vector<size_t> Exponents;
+
+  /** Packs monomials into a Value so that comparing values compares
+      the monomials in a term order. Each exponent gets a field of
+      bitsPerVar bits. The graded orders put the total degree in front,
+      and revlex stores the complement of the exponents in reverse order
+      so that a smaller exponent in the last variable makes a larger
+      value. */
+  class MonomialPacker {
+  public:
+    typedef Simulator::PolyParams PolyParams;
+
+    MonomialPacker(const PolyParams& params):
+      _order(params.order),
+      _bits(params.bitsPerVar),
+      _max((static_cast<Value>(1) << params.bitsPerVar) - 1) {}
+
+    Value pack(const Exponents& e) const {
+      Value value = 0;
+      if (_order != PolyParams::Lex)
+        value = getDegree(e);
+      if (_order == PolyParams::RevLex)
+        for (size_t var = e.size(); var > 0; --var)
+          value = (value << _bits) | (_max - e[var - 1]);
+      else
+        for (size_t var = 0; var < e.size(); ++var)
+          value = (value << _bits) | e[var];
+      return value;
+    }
+
+    void unpack(Value value, Exponents& e) const {
+      if (_order == PolyParams::RevLex) {
+        for (size_t var = 0; var < e.size(); ++var, value >>= _bits)
+          e[var] = _max - (value & _max);
+      } else {
+        for (size_t var = e.size(); var > 0; --var, value >>= _bits)
+          e[var - 1] = value & _max;
+      }
+    }
+
+    static size_t getDegree(const Exponents& e) {
+      size_t degree = 0;
+      for (size_t var = 0; var < e.size(); ++var)
+        degree += e[var];
+      return degree;
+    }
+
+  private:
+    const PolyParams::Order _order;
+    const size_t _bits;
+    const Value _max;
+  };
+
+  /** A polynomial without coefficients. */
+  struct Reducer {
+    Exponents lead;
+    std::vector<Exponents> tail; /// each term is less than lead
+  };
+
+  void randomMonomial(size_t degree, Exponents& e) {
+    std::fill(e.begin(), e.end(), 0);
+    for (size_t i = 0; i < degree; ++i)
+      ++e[rand() % e.size()];
+  }
+
+  size_t randomReducerSize(const Simulator::PolyParams& params) {
+    if (!params.skewedSizes)
+      return 1 + rand() % (2 * params.avgReducerSize - 1);
+    // exponentially distributed with mean avgReducerSize.
+    const double uniform = (rand() + 1.0) / (RAND_MAX + 2.0);
+    const double size = -std::log(uniform) * params.avgReducerSize;
+    return size < 1 ? 1 : static_cast<size_t>(size);
+  }
+
+  /** Sets the tail of reducer to up to size distinct monomials that are
+      less than the lead term and have the same degree. */
+  void makeTail(Reducer& reducer, size_t size,
+    const Simulator::PolyParams& params, const MonomialPacker& packer) {
+    const Value lead = packer.pack(reducer.lead);
+    const size_t varCount = reducer.lead.size();
+    std::set<Value> tail;
+    Exponents term;
+    for (size_t tries = 0; tail.size() < size && tries < 10 * size + 100;
+      ++tries) {
+      term = reducer.lead;
+      for (size_t move = 0; move < params.spread; ++move) {
+        const size_t from = rand() % varCount;
+        const size_t to = rand() % varCount;
+        if (term[from] > 0) {
+          --term[from];
+          ++term[to];
+        }
+      }
+      const Value value = packer.pack(term);
+      if (value < lead && tail.insert(value).second)
+        reducer.tail.push_back(term);
+    }
+  }
+}
+
+void Simulator::polySpans(const PolyParams& params) {
+  ASSERT(params.getError().empty());
+  const MonomialPacker packer(params);
+  const size_t varCount = params.varCount;
+
+  std::vector<Reducer> reducers(params.reducerCount);
+  const size_t maxLeadDegree = params.degree / 2;
+  for (size_t i = 0; i < reducers.size(); ++i) {
+    Reducer& reducer = reducers[i];
+    reducer.lead.resize(varCount);
+    randomMonomial(1 + rand() % maxLeadDegree, reducer.lead);
+    makeTail(reducer, randomReducerSize(params), params, packer);
+  }
+
+  SimBuilder sim(true, _mem, _events);
+  size_t polynomialCount = 0;
+  size_t reductionCount = 0;
+  Exponents monomial(varCount);
+  Exponents product(varCount);
+  while (sim.getPushSum() < params.pushSumGoal || !sim.noLive()) {
+    if (sim.noLive()) {
+      // start reducing a new polynomial.
+      Reducer polynomial;
+      polynomial.lead.resize(varCount);
+      randomMonomial(params.degree, polynomial.lead);
+      makeTail(polynomial, randomReducerSize(params), params, packer);
+      sim.beginPush();
+      sim.addToPush(packer.pack(polynomial.lead));
+      for (size_t i = 0; i < polynomial.tail.size(); ++i)
+        sim.addToPush(packer.pack(polynomial.tail[i]));
+      sim.endPush();
+      ++polynomialCount;
+      continue;
+    }
+
+    packer.unpack(sim.pop(), monomial);
+    if (sim.getPushSum() >= params.pushSumGoal)
+      continue;
+    for (size_t i = 0; i < reducers.size(); ++i) {
+      const Reducer& reducer = reducers[i];
+      size_t var = 0;
+      while (var < varCount && reducer.lead[var] <= monomial[var])
+        ++var;
+      if (var < varCount)
+        continue; // the lead term does not divide monomial
+      if (reducer.tail.empty())
+        break;
+      sim.beginPush();
+      for (size_t term = 0; term < reducer.tail.size(); ++term) {
+        for (var = 0; var < varCount; ++var)
+          product[var] =
+            monomial[var] - reducer.lead[var] + reducer.tail[term][var];
+        sim.addToPush(packer.pack(product));
+      }
+      sim.endPush();
+      ++reductionCount;
+      break;
+    }
+  }
+
+  const char* const orderNames[] = {"lex", "deglex", "revlex"};
+  std::ostringstream name;
+  name << "polynomial reduction of " << polynomialCount
+    << " polynomials with " << reductionCount << " steps";
+  _description = makeDescription(sim, _repeats, name.str());
+  std::ostringstream type;
+  type << "poly " << params.pushSumGoal << ' ' << varCount << ' '
+    << params.degree << ' ' << orderNames[params.order] << ' '
+    << params.bitsPerVar << ' ' << params.reducerCount << ' '
+    << params.avgReducerSize << ' ' << params.spread << ' '
+    << (params.skewedSizes ? "exp" : "uniform");
+  _simType = type.str();
+}
+
+void Simulator::trace(const std::string& fileName) {
+  delete _trace;
+  _trace = 0;
+  _trace = new mathic::QueueTraceReader(fileName);
+  _traceFileName = fileName;
+  _events.clear();
+  _mem.clear();
+
+  // Replay the trace on a multiset to check that every pop can be done.
+  // A pop removes every copy of the greatest value, like the models do.
+  size_t pushCount = 0;
+  size_t pushSum = 0;
+  size_t popCount = 0;
+  std::multiset<Value> live;
+  std::vector<Value> span;
+  Value popValue;
+  while (_trace->next(span, popValue)) {
+    if (span.empty()) {
+      ++popCount;
+      std::ostringstream msg;
+      if (live.empty())
+        msg << "pop number " << popCount << " of trace " << fileName
+          << " is done on an empty queue.";
+      else if (*live.rbegin() != popValue)
+        msg << "pop number " << popCount << " of trace " << fileName
+          << " gives " << popValue << " while the greatest value in the "
+          "queue is " << *live.rbegin() << '.';
+      if (!msg.str().empty())
+        mathic::reportError(msg.str());
+      live.erase(popValue);
+    } else {
+      ++pushCount;
+      pushSum += span.size();
+      live.insert(span.begin(), span.end());
+    }
+  }
+  _trace->rewind();
+  std::ostringstream out;
+  out << "*** Simulation \"trace " << fileName << "\"\n ";
+  out << pushCount << " spans\n ";
+  out << (pushCount == 0 ? 0 : pushSum / pushCount)
+    << " per span on average\n ";
+  out << pushSum << " entries pushed in total.\n ";
+  out << popCount << " pops.\n ";
+  if (!live.empty())
+    out << live.size() << " entries left in the queue, which are popped "
+      "untimed after each repeat.\n ";
+  out << _repeats << " repeats.\n";
+  _description = out.str();
+  _simType = "trace " + fileName;
+}
+
+void Simulator::saveTrace(const std::string& fileName) const {
+  mathic::QueueTraceWriter writer(fileName);
+  for (size_t i = 0; i < _events.size(); ++i) {
+    const Event& e = _events[i];
+    if (e.size == 0)
+      writer.pop(e.popValue);
+    else
+      writer.push(_mem.begin() + e.begin, _mem.begin() + e.begin + e.size);
+  }
+  writer.flush();
 }
 
 void Simulator::printEventSummary(std::ostream& out) const {
@@ -272,7 +561,29 @@ void Simulator::print(const Event& e, std::ostream& out) const {
   }
 }
 
+const size_t Simulator::LatencySampleInterval;
+
+void Simulator::addToReport(mathic::BenchmarkReport& report) const {
+  for (std::vector<SimData>::const_iterator it = _data.begin();
+    it != _data.end(); ++it) {
+    mathic::BenchmarkResult result;
+    result.workload = _simType;
+    result.model = it->name;
+    result.setRunNanos(it->turnNanos);
+    result.comparisons = it->comparisons;
+    result.memoryUse = it->memoryUse;
+    result.operations = it->operations;
+    result.perf = it->perf;
+    report.add(result);
+  }
+  _scaling.addToReport(report, _simType);
+}
+
 void Simulator::printData(std::ostream& out) const {
+  if (!_scaling.empty())
+    _scaling.print(out);
+  if (_data.empty())
+    return;
   std::vector<SimData> sorted(_data);
   sort(sorted.begin(), sorted.end());
   out << "*** Simulation outcome ***" << std::endl;
@@ -281,12 +592,41 @@ void Simulator::printData(std::ostream& out) const {
   pr.addColumn(false, " ", "ms");
   pr.addColumn(false, " ", "cmps");
   pr.addColumn(false, " ", "kb");
+  pr.addColumn(false, " ", "op/s");
+  pr.addColumn(false, " ", "cmps/op");
+  std::vector<size_t> counters; // the perf counters that have a column
+  for (size_t i = 0; i < mathic::PerfCounts::CounterCount; ++i) {
+    for (size_t sim = 0; sim < sorted.size(); ++sim) {
+      if (sorted[sim].perf.available[i]) {
+        counters.push_back(i);
+        pr.addColumn(false, " ", std::string(mathic::PerfCounts::getName
+          (static_cast<mathic::PerfCounts::Counter>(i))) + "/op");
+        break;
+      }
+    }
+  }
+  pr.addColumn(true, " push ");
+  pr.addColumn(true, " pop ");
   for (std::vector<SimData>::const_iterator it = sorted.begin();
     it != sorted.end(); ++it) {
     pr[0] << it->name << '\n';
     pr[1] << commafy(it->mseconds) << '\n';
     pr[2] << commafy(it->comparisons) << '\n';
     pr[3] << commafy(it->memoryUse / 1024) << '\n';
+    pr[4] << mic::ColumnPrinter::commafy(it->getOperationsPerSecond()) << '\n';
+    pr[5] << mic::ColumnPrinter::ratio(it->comparisons, it->operations)
+      << '\n';
+    size_t column = 6;
+    for (size_t i = 0; i < counters.size(); ++i, ++column) {
+      if (it->perf.available[counters[i]])
+        pr[column] << mic::ColumnPrinter::ratio
+          (it->perf.values[counters[i]], it->operations);
+      pr[column] << '\n';
+    }
+    it->pushLatency.print(pr[column]);
+    pr[column] << '\n';
+    it->popLatency.print(pr[column + 1]);
+    pr[column + 1] << '\n';
   }
   pr.print(out);
 }
@@ -318,7 +658,24 @@ void Simulator::SimData::print(std::ostream& out) {
     << " " << commafy(mseconds) << " ms"
     << " " << commafy(comparisons) << " cmps"
     << " " << commafy(memoryUse / 1024) << " kb"
-    << '\n';
+    << " " << mic::ColumnPrinter::commafy(getOperationsPerSecond()) << " op/s"
+    << " " << mic::ColumnPrinter::ratio(comparisons, operations)
+    << " cmps/op"
+    << "\n  push ";
+  pushLatency.print(out);
+  out << "\n  pop ";
+  popLatency.print(out);
+  if (perf.anyAvailable()) {
+    out << "\n  ";
+    perf.print(out, operations);
+  }
+  out << '\n';
+}
+
+unsigned long long Simulator::SimData::getOperationsPerSecond() const {
+  if (nseconds == 0)
+    return 0;
+  return static_cast<unsigned long long>(operations * 1e9 / nseconds);
 }
 
 bool Simulator::SimData::operator<(const SimData& sd) const {
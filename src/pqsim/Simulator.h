@@ -2,30 +2,124 @@
 #define SIMULATOR_GUARD
 
 #include "Item.h"
+#include "mathic/QueueTrace.h"
+#include "mathic/LatencyHistogram.h"
+#include "mathic/Timer.h"
+#include "mathic/PerfCounters.h"
+#include "mathic/BenchmarkReport.h"
+#include "mathic/ThreadScaling.h"
+#include <memtailor.h>
 #include <queue>
 #include <vector>
-#include <ctime>
 #include <algorithm>
 #include <sstream>
 #include <iostream>
 #include <string>
+#include <memory>
 
 class Simulator {
 public:
-  Simulator(size_t repeats): _repeats(repeats), _simType("none") {}
+  Simulator(size_t repeats): _repeats(repeats), _simType("none"), _trace(0) {}
+  ~Simulator() {delete _trace;}
 
   void dupSpans(size_t pushSumGoal, size_t avgSpan, size_t avgLiveGoal,
     size_t dupPercentage);
   void orderSpans(size_t spanCount, size_t spanSize, size_t avgSize);
   void randomSpans(size_t spanCount, size_t spanSize, size_t initialSize);
 
+  /** The parameters of polySpans. */
+  struct PolyParams {
+    /** The term orders that monomials can be packed into a Value by. */
+    enum Order {Lex, DegLex, RevLex};
+
+    PolyParams();
+
+    /** Sets order from its name lex, deglex or revlex. Returns false if
+        there is no order of that name. */
+    bool setOrder(const std::string& name);
+
+    /** Returns the problem with these parameters, or the empty string if
+        there is none. */
+    std::string getError() const;
+
+    size_t pushSumGoal; /// stop reducing once this many values are pushed
+    size_t varCount;
+    size_t degree; /// of the polynomials that are reduced
+    Order order;
+    size_t bitsPerVar; /// bits of each exponent in a Value
+    size_t reducerCount;
+    /// the average number of terms of a reducer besides its lead term,
+    /// which is the average number of values in a pushed span.
+    size_t avgReducerSize;
+    /// the number of times that a unit of exponent is moved from one
+    /// variable to another to get a tail term from the lead term.
+    /// Reducers are denser, and their multiples overlap more, when this
+    /// is lower.
+    size_t spread;
+    /// the reducer sizes are exponentially distributed, so most reducers
+    /// are small and a few are large, instead of uniformly distributed.
+    bool skewedSizes;
+  };
+
+  /** Generates the pushes and pops of the queue of a polynomial
+      reduction, as done by a Groebner basis computation. The values are
+      monomials packed into a Value so that comparing values compares
+      the monomials in the term order of params.
+
+      A number of homogeneous polynomials of degree params.degree are
+      reduced by a fixed set of homogeneous reducers with lead terms of
+      degree at most half of that. The terms of a polynomial are pushed
+      to start its reduction. Then the largest term is popped, merging
+      equal terms like a real reduction adds their coefficients. If the
+      lead term of a reducer divides the popped term, then the tail of
+      the reducer times the quotient is pushed. Such products of similar
+      monomials and the same reducer are monotone spans of close values
+      that overlap with the spans pushed before them. This goes on with
+      new polynomials until params.pushSumGoal values have been pushed,
+      and then the queue is popped until it is empty. */
+  void polySpans(const PolyParams& params);
+
+  /** Replays the trace in fileName instead of generated events. The
+      trace is streamed from the file on each repeat. Queues on spans
+      point into the pushed spans, so the values pushed during one
+      repeat are kept in memory until the repeat is over. Entries that
+      are left in the queue at the end of the trace, as in a partial
+      capture, are popped untimed after each repeat. Reports an error if
+      the trace pops an empty queue or pops a value that is not the
+      greatest one in the queue. See mathic/QueueTrace.h. */
+  void trace(const std::string& fileName);
+
+  /** Writes the generated events as a trace to fileName. */
+  void saveTrace(const std::string& fileName) const;
+
+  /** Runs the events on pq. The wall clock time of every
+      LatencySampleInterval'th push and pop is recorded in a latency
+      histogram. Hardware performance counters are recorded for the
+      whole run where they are available. */
   template<class PQueue>
   void run(PQueue& pq, bool printData = true, bool printStates = false);
 
+  static const size_t LatencySampleInterval = 16;
+
+  /** Runs the events on each number of threads in options at once to
+      see how PQueue scales. Each thread runs all the events on its own
+      PQueue that it constructs itself, copying the pushed spans into its
+      own memt::Arena, unless options.shared is true. Then the threads
+      split the generated events between them and run them on a single
+      PQueue behind a mutex. A shared queue does not see the events in
+      order, so its pops are not checked and pops on an empty queue are
+      skipped. A trace cannot be shared. */
+  template<class PQueue>
+  void runThreads(const mathic::ThreadScalingOptions& options);
+
   void printEventSummary(std::ostream& out) const;
   void printEvents(std::ostream& out) const;
   void printData(std::ostream& out) const;
 
+  /** Adds the outcome of each run to report. Each repeat of the events
+      is a timed run of the report. */
+  void addToReport(mathic::BenchmarkReport& report) const;
+
   struct Event {
     Event(): size(0) {}
     size_t begin;
@@ -34,11 +128,52 @@ public:
   };
 
 private:
+  Simulator(const Simulator&); // unavailable
+  void operator=(const Simulator&); // unavailable
+
+  template<class PQueue>
+  class ScalingWork;
+
+  /** Runs every event on pqueue _repeats times. Returns the number of
+      operations. */
+  template<class PQueue>
+  unsigned long long runThread(PQueue& pqueue) const;
+
+  /** Runs the events of number thread out of threadCount on a queue
+      shared by all the threads. Returns the number of operations. */
+  template<class PQueue>
+  unsigned long long runSharedThread(PQueue& pqueue, mathic::Mutex& mutex,
+    size_t thread, size_t threadCount) const;
+
+  /** Pushes a copy of the size values from span if size > 0. Otherwise
+      pops and checks that the value is popValue. */
+  /** Pops pqueue until it is empty. A trace can end with entries left in
+      the queue, and those point into spans that are freed before the
+      next repeat. */
+  template<class PQueue>
+  static void drain(PQueue& pqueue) {
+    while (!pqueue.empty())
+      pqueue.pop();
+  }
+
+  template<class PQueue>
+  void runThreadEvent(PQueue& pqueue, memt::Arena& arena,
+    const Value* span, size_t size, Value popValue) const;
+
   struct SimData {
+    SimData(): operations(0) {}
+
     std::string name;
     unsigned long comparisons;
     unsigned long mseconds;
+    unsigned long long nseconds;
+    unsigned long long operations; /// pushes and pops
     size_t memoryUse;
+    mathic::LatencyHistogram pushLatency;
+    mathic::LatencyHistogram popLatency;
+    mathic::PerfCounts perf;
+    std::vector<unsigned long long> turnNanos; /// time of each repeat
+    unsigned long long getOperationsPerSecond() const;
     bool operator<(const SimData& sd) const;
     void print(std::ostream& out);
   };
@@ -55,13 +190,167 @@ private:
   size_t _repeats;
   std::string _simType;
   std::string _description;
+  mathic::QueueTraceReader* _trace; /// null if not replaying a trace
+  std::string _traceFileName; /// empty if not replaying a trace
+  mathic::PerfCounters _perf;
+  mathic::ThreadScaling _scaling;
 };
 
 template<class PQueue>
-void Simulator::run(PQueue& pqueue, bool printData, bool printStates) {
-  clock_t timeBegin = clock();
-  std::vector<Event>::const_iterator end = _events.end();
+class Simulator::ScalingWork : public mathic::ScalingWork {
+public:
+  ScalingWork(const Simulator& sim, bool shared):
+    _sim(sim), _shared(shared), _queue(0) {}
+  ~ScalingWork() {delete _queue;}
+
+  virtual std::string getName() const {
+    PQueue queue;
+    return queue.getName() + (_shared ? " shared" : "");
+  }
+
+  virtual void prepare(size_t threadCount) {
+    if (_shared)
+      _queue = new PQueue();
+  }
+
+  virtual unsigned long long run(size_t thread, size_t threadCount) {
+    if (_shared)
+      return _sim.runSharedThread(*_queue, _mutex, thread, threadCount);
+    PQueue queue;
+    return _sim.runThread(queue);
+  }
+
+  virtual void finish() {
+    delete _queue;
+    _queue = 0;
+  }
+
+private:
+  const Simulator& _sim;
+  const bool _shared;
+  PQueue* _queue; /// the shared queue
+  mathic::Mutex _mutex;
+};
+
+template<class PQueue>
+void Simulator::runThreads(const mathic::ThreadScalingOptions& options) {
+  if (options.shared && _trace != 0) {
+    std::cerr << "ERROR: the threads cannot share a queue for a trace."
+      << std::endl;
+    exit(1);
+  }
+  ScalingWork<PQueue> work(*this, options.shared);
+  _scaling.run(work, options.threadCounts);
+}
+
+template<class PQueue>
+unsigned long long Simulator::runThread(PQueue& pqueue) const {
+  unsigned long long operations = 0;
+  memt::Arena spanArena;
+  std::vector<Value> span;
+  Value popValue;
+  std::auto_ptr<mathic::QueueTraceReader> trace;
+  if (!_traceFileName.empty())
+    trace.reset(new mathic::QueueTraceReader(_traceFileName));
   for (size_t turn = 0; turn < _repeats; ++turn) {
+    spanArena.freeAllAllocs();
+    if (trace.get() != 0) {
+      trace->rewind();
+      while (trace->next(span, popValue)) {
+        ++operations;
+        runThreadEvent(pqueue, spanArena,
+          span.empty() ? 0 : &span.front(), span.size(), popValue);
+      }
+      drain(pqueue);
+    } else {
+      typedef std::vector<Event>::const_iterator CIterator;
+      CIterator end = _events.end();
+      for (CIterator it = _events.begin(); it != end; ++it) {
+        ++operations;
+        runThreadEvent(pqueue, spanArena,
+          it->size == 0 ? 0 : &_mem[it->begin], it->size, it->popValue);
+      }
+    }
+  }
+  return operations;
+}
+
+template<class PQueue>
+void Simulator::runThreadEvent(PQueue& pqueue, memt::Arena& arena,
+  const Value* span, size_t size, Value popValue) const {
+  if (size == 0) {
+    const Value item = pqueue.pop();
+    if (!(item == popValue)) {
+      std::cerr << "ERROR: queue " << pqueue.getName()
+        << " gave incorrect value " << item << std::endl;
+      exit(1);
+    }
+  } else {
+    std::pair<Value*, Value*> mem = arena.allocArrayNoCon<Value>(size);
+    std::copy(span, span + size, mem.first);
+    pqueue.push(mem.first, mem.second);
+  }
+}
+
+template<class PQueue>
+unsigned long long Simulator::runSharedThread(PQueue& pqueue,
+  mathic::Mutex& mutex, size_t thread, size_t threadCount) const {
+  unsigned long long operations = 0;
+  for (size_t turn = 0; turn < _repeats; ++turn) {
+    for (size_t i = thread; i < _events.size(); i += threadCount) {
+      const Event& e = _events[i];
+      ++operations;
+      mathic::Mutex::Lock lock(mutex);
+      if (e.size == 0) {
+        if (!pqueue.empty())
+          pqueue.pop();
+      } else {
+        const Value* begin = &_mem[e.begin];
+        pqueue.push(begin, begin + e.size);
+      }
+    }
+  }
+  return operations;
+}
+
+template<class PQueue>
+void Simulator::run(PQueue& pqueue, bool printData, bool printStates) {
+  SimData data;
+  mathic::WallTimer timer;
+  std::vector<Value> span;
+  Value popValue;
+  memt::Arena spanArena;
+  _perf.start();
+  for (size_t turn = 0; _trace != 0 && turn < _repeats; ++turn) {
+    const unsigned long long turnStart = timer.getNanoseconds();
+    _trace->rewind();
+    spanArena.freeAllAllocs();
+    while (_trace->next(span, popValue)) {
+      const bool sample = ++data.operations % LatencySampleInterval == 0;
+      if (span.empty()) {
+        Value item;
+        {
+          mathic::LatencyHistogram::Timing timing(data.popLatency, sample);
+          item = pqueue.pop();
+        }
+        if (!(item == popValue)) {
+          std::cerr << "ERROR: queue " << pqueue.getName()
+            << " gave incorrect value " << item << std::endl;
+          exit(1);
+        }
+      } else {
+        std::pair<Value*, Value*> mem =
+          spanArena.allocArrayNoCon<Value>(span.size());
+        std::copy(span.begin(), span.end(), mem.first);
+        mathic::LatencyHistogram::Timing timing(data.pushLatency, sample);
+        pqueue.push(mem.first, mem.second);
+      }
+    }
+    data.turnNanos.push_back(timer.getNanoseconds() - turnStart);
+    drain(pqueue);
+  }
+  for (size_t turn = 0; _trace == 0 && turn < _repeats; ++turn) {
+    const unsigned long long turnStart = timer.getNanoseconds();
     typedef std::vector<Event>::const_iterator CIterator;
     CIterator end = _events.end();
     for (CIterator it = _events.begin(); it != end; ++it) {
@@ -74,8 +363,13 @@ void Simulator::run(PQueue& pqueue, bool printData, bool printStates) {
         pqueue.print(std::cerr);
         std::cerr << '\n';
       }
+      const bool sample = ++data.operations % LatencySampleInterval == 0;
       if (e.size == 0) {
-        Value item = pqueue.pop();
+        Value item;
+        {
+          mathic::LatencyHistogram::Timing timing(data.popLatency, sample);
+          item = pqueue.pop();
+        }
         if (!(item == e.popValue)) {
           std::cerr << "ERROR: queue " << pqueue.getName()
             << " gave incorrect value " << item << std::endl;
@@ -83,18 +377,19 @@ void Simulator::run(PQueue& pqueue, bool printData, bool printStates) {
         }
       } else {
         const Value* begin = &_mem[e.begin];
+        mathic::LatencyHistogram::Timing timing(data.pushLatency, sample);
         pqueue.push(begin, begin + e.size);
       }
     }
+    data.turnNanos.push_back(timer.getNanoseconds() - turnStart);
   }
-  clock_t timeEnd = clock();
+  data.nseconds = timer.getNanoseconds();
+  data.perf = _perf.stop();
 
-  SimData data;
   data.name = pqueue.getName();
   data.memoryUse = pqueue.getMemoryUse();
   data.comparisons = pqueue.getComparisons();
-  data.mseconds = (unsigned long)
-    ((double(timeEnd) - timeBegin) * 1000) / CLOCKS_PER_SEC;
+  data.mseconds = static_cast<unsigned long>(data.nseconds / 1000000);
   _data.push_back(data);
   if (printData)
     data.print(std::cerr);
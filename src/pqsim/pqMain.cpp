@@ -1,10 +1,9 @@
 #include "stdinc.h"
 
-#include "StlSetModel.h"
-#include "HeapModel.h"
-#include "GeobucketModel.h"
-#include "TourTreeModel.h"
+#include "ModelRegistry.h"
 #include "Simulator.h"
+#include "mathic/BenchmarkReport.h"
+#include "mathic/Profiler.h"
 #include <iostream>
 #include <ctime>
 
@@ -20,46 +19,151 @@ namespace {
 int main(int argc, const char** args) {
   srand(static_cast<unsigned int>(time(0)));
   srand(0);
-  if (argc < 4) {
-	std::cerr << "usage: elements span-length target-avg-size\n";
-	return 0;
+  mathic::BenchmarkReportOptions reportOptions;
+  reportOptions.parse(argc, args);
+  // "threads list" runs each model on each number of threads in the
+  // comma separated list at once, each with its own queue, to measure
+  // scaling. "shared-threads list" does the same on one shared queue.
+  mathic::ThreadScalingOptions threadOptions;
+  threadOptions.parse(argc, args);
+  if (threadOptions.any() && !mathic::ThreadScaling::threadsAvailable()) {
+    std::cerr << "Threads are not available on this platform.\n";
+    return 1;
+  }
+
+  // "models list" chooses the models to run from a comma separated list
+  // of name prefixes.
+  ModelRegistry registry("model");
+  registerModels(registry);
+  std::vector<std::string> models;
+  if (argc >= 3 && std::string(args[1]) == "models") {
+    try {
+      pushBackChosenModels(registry, args[2], models);
+    } catch (const mathic::MathicException& e) {
+      std::cerr << e.what();
+      return 1;
+    }
+    args += 2;
+    argc -= 2;
+  } else
+    pushBackDefaultModels(models);
+
+  // "trace file" replays a trace and "save file ..." saves the
+  // generated events as a trace before running them.
+  std::string mode = argc >= 3 ? args[1] : "";
+  const char* traceFile = 0;
+  if (mode == "trace" || mode == "save") {
+    traceFile = args[2];
+    if (mode == "save") {
+      args += 2;
+      argc -= 2;
+      mode = argc >= 2 ? args[1] : "";
+    }
+  }
+
+  // "poly elements ..." generates the queue traffic of polynomial
+  // reduction. See Simulator::polySpans.
+  Simulator::PolyParams poly;
+  std::string polyError;
+  if (mode == "poly") {
+    if (argc < 9 || argc > 11)
+      polyError = "wrong number of arguments for poly.";
+    else {
+      poly.pushSumGoal = toInt(args[2]);
+      poly.varCount = toInt(args[3]);
+      poly.degree = toInt(args[4]);
+      if (!poly.setOrder(args[5]))
+        polyError = "unknown term order " + std::string(args[5]) + '.';
+      poly.bitsPerVar = toInt(args[6]);
+      poly.reducerCount = toInt(args[7]);
+      poly.avgReducerSize = toInt(args[8]);
+      if (argc >= 10)
+        poly.spread = toInt(args[9]);
+      if (argc == 11) {
+        const std::string sizes = args[10];
+        if (sizes != "uniform" && sizes != "exp")
+          polyError = "expected uniform or exp instead of " + sizes + '.';
+        poly.skewedSizes = sizes == "exp";
+      }
+      if (polyError.empty())
+        polyError = poly.getError();
+    }
+    if (!polyError.empty())
+      std::cerr << "ERROR: " << polyError << '\n';
+  }
+
+  if ((mode != "trace" && mode != "poly" && argc < 4) ||
+    !polyError.empty()) {
+	std::cerr << "usage: [report options] [thread options] [models LIST] "
+      "[save trace-file]\n"
+      "         elements span-length target-avg-size [dup-percentage]\n"
+      "       [report options] [thread options] [models LIST] "
+      "[save trace-file]\n"
+      "         poly elements var-count degree lex|deglex|revlex "
+      "bits-per-var\n"
+      "         reducers avg-reducer-size [spread [uniform|exp]]\n"
+      "       [report options] [thread options] [models LIST] "
+      "trace trace-file\n"
+      "report options: json FILE, csv FILE and compare BASELINE-CSV-FILE\n"
+      "thread options: threads COUNTS and shared-threads COUNTS where "
+      "COUNTS is like 1,2,4\n"
+      "LIST is all or a comma separated list of prefixes of these models:\n";
+    std::vector<std::string> names;
+    registry.namesWithPrefix("", names);
+    for (size_t i = 0; i < names.size(); ++i)
+      std::cerr << "  " << names[i] << '\n';
+	return polyError.empty() ? 0 : 1;
   }
-  size_t elements = toInt(args[1]);
-  size_t spanSize = toInt(args[2]);
-  size_t avgOrInitialSize = toInt(args[3]);
-  size_t dups = 30;
-  if (argc >= 5)
-    dups = toInt(args[4]);
 
   size_t repeats = 500;
   IF_DEBUG(repeats = 2;);
 
-  std::cerr << "Generating simulation..." << std::endl;
   Simulator sim(repeats);
-  //sim.orderSpans(elements / spanSize, spanSize, avgOrInitialSize);
-  //sim.randomSpans(elements / spanSize, spanSize, avgOrInitialSize);
-  sim.dupSpans(elements, spanSize, avgOrInitialSize, dups);
+  if (mode == "trace") {
+    std::cerr << "Reading trace..." << std::endl;
+    try {
+      sim.trace(traceFile);
+    } catch (const mathic::MathicException& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  } else if (mode == "poly") {
+    std::cerr << "Generating polynomial reduction..." << std::endl;
+    sim.polySpans(poly);
+    if (traceFile != 0)
+      sim.saveTrace(traceFile);
+  } else {
+    size_t elements = toInt(args[1]);
+    size_t spanSize = toInt(args[2]);
+    size_t avgOrInitialSize = toInt(args[3]);
+    size_t dups = 30;
+    if (argc >= 5)
+      dups = toInt(args[4]);
+
+    std::cerr << "Generating simulation..." << std::endl;
+    //sim.orderSpans(elements / spanSize, spanSize, avgOrInitialSize);
+    //sim.randomSpans(elements / spanSize, spanSize, avgOrInitialSize);
+    sim.dupSpans(elements, spanSize, avgOrInitialSize, dups);
+    if (traceFile != 0)
+      sim.saveTrace(traceFile);
+  }
   sim.printEventSummary(std::cerr);
   //sim.printEvents(std::cerr);
   std::cerr << '\n' << std::endl;
 
-#ifdef DEBUG
-  {TourTreeModel<0,0> x; sim.run(x);}
-  {HeapModel<0,0,0> x; sim.run(x);}
-#else
-  {TourTreeModel<1,0> x; sim.run(x);}
-  {TourTreeModel<0,0> x; sim.run(x);}
-  {GeobucketModel<0,0,0,0,0,0,0> x(4, 32); sim.run(x);}
-  {GeobucketModel<0,0,0,0,0,0,0> x(2, 32); sim.run(x);}
-  {GeobucketModel<0,0,0,1,0,0,0> x(4, 32); sim.run(x);}
-  {StlSetModel<1> x; sim.run(x);}
-  {StlSetModel<0> x; sim.run(x);}
-  {HeapModel<0,0,0> x; sim.run(x);}
-  {HeapModel<1,0,0> x; sim.run(x);}
-  {HeapModel<0,1,0> x; sim.run(x);}
-  {HeapModel<1,1,0> x; sim.run(x);}
-#endif
+  for (size_t i = 0; i < models.size(); ++i) {
+    if (threadOptions.any())
+      registry.create(models[i])->runThreads(sim, threadOptions);
+    else
+      registry.create(models[i])->run(sim);
+  }
 
   sim.printData(std::cout);
-  return 0;
+  if (mathic::Profiler::enabled()) {
+    mathic::Profiler::printFlat(std::cerr);
+    mathic::Profiler::printTree(std::cerr);
+  }
+  mathic::BenchmarkReport report;
+  sim.addToReport(report);
+  return reportOptions.process(report, std::cout) ? 0 : 1;
 }
@@ -0,0 +1,106 @@
+#include "mathic/BenchmarkReport.h"
+#include "mathic/error.h"
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+namespace {
+  const char* const ReportFile = "BenchmarkReport.test.csv";
+
+  mathic::BenchmarkResult makeResult
+    (const char* model, unsigned long long firstRunNanos) {
+    mathic::BenchmarkResult result;
+    result.workload = "test, with comma";
+    result.model = model;
+    std::vector<unsigned long long> nanos;
+    for (unsigned long long run = 0; run < 5; ++run)
+      nanos.push_back(firstRunNanos + run * 1000);
+    result.setRunNanos(nanos);
+    result.comparisons = 100;
+    result.memoryUse = 2000;
+    result.operations = 300;
+    return result;
+  }
+}
+
+TEST(BenchmarkReport, Statistics) {
+  mathic::BenchmarkResult result = makeResult("model", 100000);
+  ASSERT_EQ(5u, result.runs);
+  ASSERT_DOUBLE_EQ(102000, result.meanNanos);
+  // the sample standard deviation of 0, 1000, ..., 4000.
+  ASSERT_NEAR(1581.14, result.stddevNanos, 0.01);
+  // t for 4 degrees of freedom is 2.776.
+  ASSERT_NEAR(2.776 * 1581.14 / std::sqrt(5.0),
+    result.getConfidence95(), 1);
+
+  mathic::BenchmarkResult single;
+  single.setRunNanos(std::vector<unsigned long long>(1, 5));
+  ASSERT_EQ(0, single.getConfidence95());
+}
+
+TEST(BenchmarkReport, CsvRoundTrip) {
+  mathic::BenchmarkReport report;
+  report.add(makeResult("a", 100000));
+  mathic::BenchmarkResult withPerf = makeResult("b \"quoted\"", 200000);
+  withPerf.perf.available[mathic::PerfCounts::Cycles] = true;
+  withPerf.perf.values[mathic::PerfCounts::Cycles] = 123456;
+  report.add(withPerf);
+  {
+    std::ofstream out(ReportFile);
+    report.writeCsv(out);
+  }
+
+  mathic::BenchmarkReport read;
+  read.readCsv(ReportFile);
+  std::remove(ReportFile);
+  ASSERT_EQ(2u, read.getResults().size());
+  for (size_t i = 0; i < 2; ++i) {
+    const mathic::BenchmarkResult& a = report.getResults()[i];
+    const mathic::BenchmarkResult& b = read.getResults()[i];
+    ASSERT_EQ(a.workload, b.workload);
+    ASSERT_EQ(a.model, b.model);
+    ASSERT_EQ(a.runs, b.runs);
+    ASSERT_NEAR(a.meanNanos, b.meanNanos, 1);
+    ASSERT_NEAR(a.stddevNanos, b.stddevNanos, 1);
+    ASSERT_EQ(a.comparisons, b.comparisons);
+    ASSERT_EQ(a.memoryUse, b.memoryUse);
+    ASSERT_EQ(a.operations, b.operations);
+    for (size_t c = 0; c < mathic::PerfCounts::CounterCount; ++c) {
+      ASSERT_EQ(a.perf.available[c], b.perf.available[c]);
+      ASSERT_EQ(a.perf.values[c], b.perf.values[c]);
+    }
+  }
+
+  std::ostringstream json;
+  report.writeJson(json);
+  ASSERT_NE(std::string::npos, json.str().find("\"b \\\"quoted\\\"\""));
+}
+
+TEST(BenchmarkReport, Compare) {
+  mathic::BenchmarkReport baseline;
+  baseline.add(makeResult("same", 100000));
+  baseline.add(makeResult("slower", 100000));
+  baseline.add(makeResult("faster", 100000));
+
+  mathic::BenchmarkReport current;
+  current.add(makeResult("same", 100500));
+  current.add(makeResult("slower", 150000));
+  current.add(makeResult("faster", 50000));
+  current.add(makeResult("new", 50000));
+
+  std::ostringstream out;
+  ASSERT_EQ(1u, current.compare(baseline, out));
+  ASSERT_NE(std::string::npos, out.str().find("REGRESSION"));
+  ASSERT_NE(std::string::npos, out.str().find("not in baseline"));
+
+  // the slowdown of 50% is significant but below a threshold of 60%.
+  ASSERT_EQ(0u, current.compare(baseline, out, 0.6));
+
+  std::ofstream(ReportFile) << "not,a,report\n";
+  mathic::BenchmarkReport bad;
+  ASSERT_THROW(bad.readCsv(ReportFile), mathic::MathicException);
+  std::remove(ReportFile);
+}
@@ -1,10 +1,1276 @@
-#include "divsim/stdinc.h"
-#include "mathic/KDTree.h"
-#include <gtest/gtest.h>
-
-#include "mathic/DivList.h"
-#include "divsim/KDTreeModel.h"
-
-TEST(DivFinder, NoOp) {
-  KDTreeModel<1,1,1,1,1> model(1, 1, 0, 0, 1.0, 1000);
-};
+#include "divsim/stdinc.h"
+#include "mathic/KDTree.h"
+#include <gtest/gtest.h>
+
+#include "mathic/DivList.h"
+#include "mathic/Minimize.h"
+#include "mathic/ShardedDivFinder.h"
+#include "mathic/ComponentDivFinder.h"
+#include "mathic/ThreadScaling.h"
+#include "divsim/KDTreeModel.h"
+#include "divsim/DivListModel.h"
+#include <algorithm>
+
+namespace {
+  /** A linear congruential generator. Unlike rand() it gives the same
+      numbers everywhere, so every platform runs the tests on the same
+      input. */
+  class Random {
+  public:
+    Random(unsigned int seed): _state(seed) {}
+
+    /** Returns a number in [0, limit). */
+    int next(int limit) {
+      _state = _state * 1103515245 + 12345;
+      return static_cast<int>((_state >> 16) % limit);
+    }
+
+    /** Sets every exponent to next(limit). */
+    void fill(std::vector<int>& exponents, int limit) {
+      for (size_t var = 0; var < exponents.size(); ++var)
+        exponents[var] = next(limit);
+    }
+
+  private:
+    unsigned int _state;
+  };
+
+  /** Returns count distinct vectors of varCount exponents in
+      [0, limit). KD trees do not support duplicates, so most tests need
+      them distinct. There must be at least count such vectors. */
+  std::vector<std::vector<int> > randomDistinctExponents
+  (size_t count, size_t varCount, unsigned int seed, int limit = 10) {
+    Random random(seed);
+    std::vector<std::vector<int> > exponents;
+    std::vector<int> e(varCount);
+    while (exponents.size() < count) {
+      random.fill(e, limit);
+      if (std::find(exponents.begin(), exponents.end(), e) == exponents.end())
+        exponents.push_back(e);
+    }
+    return exponents;
+  }
+}
+
+TEST(DivFinder, NoOp) {
+  KDTreeModel<1,1,1,1,1> model(1, 1, 0, 0, 1.0, 1000);
+};
+
+namespace {
+  template<class Model>
+  void testStaircase(Model& model) {
+    // inserting a staircase in order makes a plain KD tree degenerate.
+    const int count = 300;
+    std::vector<std::vector<int> > exponents(count, std::vector<int>(2));
+    for (int i = 0; i < count; ++i) {
+      exponents[i][0] = i;
+      exponents[i][1] = count - i;
+      model.insert(Monomial(exponents[i]));
+    }
+    ASSERT_EQ(static_cast<size_t>(count), model.size());
+    std::vector<int> query(2);
+    for (int i = 0; i < count; ++i) {
+      query[0] = i;
+      query[1] = count - i;
+      ASSERT_TRUE(model.findDivisor(Monomial(query)) != 0);
+      query[1] = count - i - 1;
+      ASSERT_TRUE(model.findDivisor(Monomial(query)) == 0);
+    }
+  }
+}
+
+namespace {
+  /** Returns the depth of the deepest leaf of tree. */
+  template<class Tree>
+  size_t maxLeafDepth(const Tree& tree) {
+    const mathic::KDTreeAnalysis analysis = tree.analyze();
+    return analysis.leavesAtDepth.empty() ?
+      0 : analysis.leavesAtDepth.size() - 1;
+  }
+
+  /** Returns about twice the depth of a balanced tree with leafCount
+      leaves, plus some slack for small trees. */
+  size_t depthBound(size_t leafCount) {
+    size_t depth = 2;
+    for (; leafCount > 0; leafCount /= 2)
+      depth += 2;
+    return depth;
+  }
+
+  /** Inserts a staircase into a tree with partial rebuilds and into
+      one without, where Conf and PlainConf only differ in that. */
+  template<class Conf, class PlainConf>
+  void testPartialRebuildDepth() {
+    // automatic rebuilds are on, but insertions do not count towards
+    // them with partial rebuilds, so only partial rebuilds happen.
+    mathic::KDTree<Conf> tree(Conf(2, false, false, 0.5, 0));
+    mathic::KDTree<PlainConf> plain(PlainConf(2, false, false, 0.0, 0));
+    const size_t count = 300;
+    std::vector<std::vector<int> > exponents(count, std::vector<int>(2));
+    for (size_t i = 0; i < count; ++i) {
+      exponents[i][0] = static_cast<int>(i);
+      exponents[i][1] = static_cast<int>(count - i);
+      tree.insert(Monomial(exponents[i]));
+      plain.insert(Monomial(exponents[i]));
+      ASSERT_LE(maxLeafDepth(tree), depthBound(tree.size() / Conf::LeafSize));
+    }
+    const mathic::KDTreeAnalysis analysis = tree.analyze();
+    ASSERT_EQ(0u, analysis.fullRebuilds);
+    ASSERT_LT(0u, analysis.partialRebuilds);
+
+    // without partial rebuilds the staircase makes the tree too deep.
+    ASSERT_GT(maxLeafDepth(plain), depthBound(count / PlainConf::LeafSize));
+    ASSERT_EQ(0u, plain.analyze().partialRebuilds);
+  }
+}
+
+TEST(DivFinder, PartialRebuild) {
+  KDTreeModel<1,1,1,1,1,1> packed(2, 0, 0, 0, 0.0, 0);
+  testStaircase(packed);
+  KDTreeModel<1,1,0,1,1,1> binary(2, 0, 0, 0, 0.0, 0);
+  testStaircase(binary);
+
+  testPartialRebuildDepth<KDTreeModelConfiguration<1,1,1,1,1,1>,
+    KDTreeModelConfiguration<1,1,1,1,1,0> >();
+  testPartialRebuildDepth<KDTreeModelConfiguration<1,1,0,1,1,1>,
+    KDTreeModelConfiguration<1,1,0,1,1,0> >();
+}
+
+namespace {
+  template<class Model>
+  void testFindBestDivisor(Model& model) {
+    const size_t varCount = 3;
+    const size_t count = 200;
+    std::vector<std::vector<int> > exponents =
+      randomDistinctExponents(count, varCount, 1);
+    for (size_t i = 0; i < count; ++i)
+      model.insert(Monomial(exponents[i]));
+
+    std::vector<int> query(varCount);
+    for (int a = 0; a < 10; ++a) {
+      for (int b = 0; b < 10; ++b) {
+        query[0] = a;
+        query[1] = b;
+        query[2] = (a * b) % 10;
+        // find the lowest total degree of a divisor by brute force
+        int bestDegree = -1;
+        for (size_t i = 0; i < count; ++i) {
+          bool divides = true;
+          int degree = 0;
+          for (size_t var = 0; var < varCount; ++var) {
+            divides = divides && exponents[i][var] <= query[var];
+            degree += exponents[i][var];
+          }
+          if (divides && (bestDegree == -1 || degree < bestDegree))
+            bestDegree = degree;
+        }
+        const Monomial* best = model.findBestDivisor(Monomial(query));
+        if (bestDegree == -1) {
+          ASSERT_TRUE(best == 0);
+          continue;
+        }
+        ASSERT_TRUE(best != 0);
+        int degree = 0;
+        for (size_t var = 0; var < varCount; ++var) {
+          ASSERT_LE((*best)[var], query[var]);
+          degree += (*best)[var];
+        }
+        ASSERT_EQ(bestDegree, degree);
+      }
+    }
+  }
+}
+
+TEST(DivFinder, FindBestDivisor) {
+  KDTreeModel<1,1,1,2,1,0,1> packed(3, 0, 0, 0, 0.0, 0);
+  testFindBestDivisor(packed);
+  KDTreeModel<1,1,0,2,1,0,1> binary(3, 0, 1, 0, 0.0, 0);
+  testFindBestDivisor(binary);
+  KDTreeModel<0,0,1,1,1> noBounds(3, 0, 0, 0, 0.0, 0);
+  testFindBestDivisor(noBounds);
+  DivListModel<0,1> list(3, 0, 0, 0, 0.0, 0);
+  testFindBestDivisor(list);
+}
+
+namespace {
+  template<class Finder>
+  void testMinimize(const typename Finder::Configuration& conf) {
+    const size_t varCount = 3;
+    const size_t count = 300;
+    std::vector<std::vector<int> > exponents
+      (count, std::vector<int>(varCount));
+    Random random(1);
+    for (size_t i = 0; i < count; ++i)
+      random.fill(exponents[i], 8);
+
+    // an entry is a minimal generator if no other entry strictly divides
+    // it and no earlier entry is equal to it.
+    std::vector<Monomial> expected;
+    for (size_t i = 0; i < count; ++i) {
+      bool minimal = true;
+      for (size_t j = 0; j < count && minimal; ++j) {
+        const Monomial a(exponents[j]);
+        const Monomial b(exponents[i]);
+        if (i == j || !conf.divides(a, b))
+          continue;
+        if (j < i || exponents[i] != exponents[j])
+          minimal = false;
+      }
+      if (minimal)
+        expected.push_back(Monomial(exponents[i]));
+    }
+
+    // 0 chunks is one per processor.
+    const size_t chunkCounts[] = {1, 3, 8, 0};
+    for (size_t c = 0; c < sizeof(chunkCounts) / sizeof(*chunkCounts); ++c) {
+      const size_t chunkCount = chunkCounts[c];
+      std::vector<Monomial> entries;
+      for (size_t i = 0; i < count; ++i)
+        entries.push_back(Monomial(exponents[i]));
+      std::vector<Monomial>::iterator newEnd = mathic::minimize<Finder>
+        (entries.begin(), entries.end(), conf, chunkCount);
+      entries.erase(newEnd, entries.end());
+      // Monomial only has operator== in debug builds, but equal entries
+      // point to the same exponents.
+      ASSERT_EQ(expected.size(), entries.size());
+      for (size_t i = 0; i < entries.size(); ++i)
+        ASSERT_EQ(expected[i].getPointer(), entries[i].getPointer());
+    }
+  }
+}
+
+TEST(DivFinder, Minimize) {
+  typedef KDTreeModelConfiguration<1,1,1,2,0> PackedConf;
+  testMinimize<mathic::KDTree<PackedConf> >(PackedConf(3, 0, 0, 0.0, 0));
+  typedef KDTreeModelConfiguration<0,0,0,1,0> BinaryConf;
+  testMinimize<mathic::KDTree<BinaryConf> >(BinaryConf(3, 0, 0, 0.0, 0));
+  typedef DivListModelConfiguration<0,1> ListConf;
+  testMinimize<mathic::DivList<ListConf> >(ListConf(3, 0, 0.0, 0));
+}
+
+namespace {
+  template<class Model>
+  void testCompactExponents(Model& model) {
+    // exponents around 255 make some entries overflow 8 bits, so both
+    // the compact path and the fallback path get used.
+    const size_t varCount = 3;
+    const size_t count = 200;
+    std::vector<std::vector<int> > exponents =
+      randomDistinctExponents(count, varCount, 1);
+    for (size_t i = 0; i < count; ++i) {
+      for (size_t var = 0; var < varCount; ++var)
+        exponents[i][var] += 250;
+      model.insert(Monomial(exponents[i]));
+    }
+
+    std::vector<int> query(varCount);
+    Random random(2);
+    for (size_t i = 0; i < 300; ++i) {
+      for (size_t var = 0; var < varCount; ++var)
+        query[var] = 250 + random.next(12);
+      bool hasDivisor = false;
+      for (size_t j = 0; j < count && !hasDivisor; ++j) {
+        hasDivisor = true;
+        for (size_t var = 0; var < varCount; ++var)
+          if (query[var] < exponents[j][var])
+            hasDivisor = false;
+      }
+      ASSERT_EQ(hasDivisor, model.findDivisor(Monomial(query)) != 0);
+    }
+  }
+}
+
+TEST(DivFinder, CompactExponents) {
+  KDTreeModel<1,1,1,4,1,0,0,8> packed8(3, 1, 0, 0, 0.0, 0);
+  testCompactExponents(packed8);
+  KDTreeModel<0,0,0,4,1,0,0,16> binary16(3, 1, 0, 0, 0.0, 0);
+  testCompactExponents(binary16);
+}
+
+namespace {
+  template<class Model>
+  void testContains(Model& model, bool duplicates) {
+    const size_t varCount = 3;
+    const size_t count = 100;
+    std::vector<std::vector<int> > exponents
+      (count, std::vector<int>(varCount));
+    for (size_t i = 0; i < count; ++i) {
+      exponents[i][0] = static_cast<int>(i % 7);
+      exponents[i][1] = static_cast<int>(i % 11);
+      exponents[i][2] = static_cast<int>(i / 50);
+      model.insert(Monomial(exponents[i]));
+      if (duplicates)
+        model.insert(Monomial(exponents[i]));
+    }
+
+    std::vector<int> absent(varCount, 100);
+    ASSERT_FALSE(model.contains(Monomial(absent)));
+    ASSERT_FALSE(model.removeElement(Monomial(absent)));
+    for (size_t i = 0; i < count; ++i) {
+      ASSERT_TRUE(model.contains(Monomial(exponents[i])));
+      ASSERT_TRUE(model.removeElement(Monomial(exponents[i])));
+      ASSERT_EQ(duplicates, model.contains(Monomial(exponents[i])));
+      if (duplicates) {
+        ASSERT_TRUE(model.removeElement(Monomial(exponents[i])));
+      }
+      ASSERT_FALSE(model.removeElement(Monomial(exponents[i])));
+    }
+    ASSERT_EQ(0u, model.size());
+  }
+}
+
+TEST(DivFinder, Contains) {
+  KDTreeModel<1,1,1,4,1,0,0,0,1> packedHash(3, 0, 0, 0, 0.0, 0);
+  testContains(packedHash, false);
+  KDTreeModel<1,1,0,1,1,0,0,0,1> binaryHash(3, 0, 0, 0, 0.0, 0);
+  testContains(binaryHash, false);
+  KDTreeModel<1,1,1,4,1> packed(3, 0, 0, 0, 0.0, 0);
+  testContains(packed, false);
+  DivListModel<0,1,1> listHash(3, 0, 0, 0, 0.0, 0);
+  testContains(listHash, true);
+  DivListModel<1,0,1> linkedHash(3, 0, 0, 0, 0.0, 0);
+  testContains(linkedHash, true);
+  DivListModel<0,1> list(3, 0, 0, 0, 0.0, 0);
+  testContains(list, true);
+}
+
+namespace {
+  class DegreeRecorder {
+  public:
+    DegreeRecorder(size_t varCount): _varCount(varCount) {}
+    bool proceed(const Monomial& m) {
+      int degree = 0;
+      for (size_t var = 0; var < _varCount; ++var)
+        degree += m[var];
+      degrees.push_back(degree);
+      return true;
+    }
+    std::vector<int> degrees;
+  private:
+    size_t _varCount;
+  };
+
+  template<class Model>
+  void testDegreeBuckets(Model& model) {
+    const size_t varCount = 3;
+    const size_t count = 200;
+    std::vector<std::vector<int> > exponents =
+      randomDistinctExponents(count, varCount, 1);
+    for (size_t i = 0; i < count; ++i)
+      model.insert(Monomial(exponents[i]));
+
+    std::vector<int> query(varCount);
+    Random random(2);
+    for (size_t i = 0; i < 300; ++i) {
+      random.fill(query, 10);
+      bool hasDivisor = false;
+      for (size_t j = 0; j < count && !hasDivisor; ++j) {
+        hasDivisor = true;
+        for (size_t var = 0; var < varCount; ++var)
+          if (query[var] < exponents[j][var])
+            hasDivisor = false;
+      }
+      ASSERT_EQ(hasDivisor, model.findDivisor(Monomial(query)) != 0);
+    }
+
+    // moving divisors to the front must keep the buckets in order.
+    DegreeRecorder recorder(varCount);
+    model.forAll(recorder);
+    ASSERT_EQ(model.size(), recorder.degrees.size());
+    for (size_t i = 1; i < recorder.degrees.size(); ++i)
+      ASSERT_LE(recorder.degrees[i - 1], recorder.degrees[i]);
+  }
+}
+
+TEST(DivFinder, DegreeBuckets) {
+  DivListModel<0,1,0,1> array(3, 1, 1, 0, 0.0, 0);
+  testDegreeBuckets(array);
+  DivListModel<1,0,0,1> linked(3, 1, 1, 0, 0.0, 0);
+  testDegreeBuckets(linked);
+  DivListModel<1,1,1,1> linkedHash(3, 0, 1, 0, 0.0, 0);
+  testDegreeBuckets(linkedHash);
+
+  // degree buckets keep their own order, so they cannot also be sorted.
+  typedef DivListModelConfiguration<0,1,0,1> Conf;
+  ASSERT_THROW(mathic::DivList<Conf> sorted(Conf(3, true, 0.0, 0)),
+    mathic::MathicException);
+}
+
+TEST(DivFinder, MaskArray) {
+  DivListModel<0,1,0,0,1> array(3, 1, 0, 0, 0.0, 0);
+  testCompactExponents(array);
+  DivListModel<0,1,0,1,1> degree(3, 1, 1, 0, 0.0, 0);
+  testDegreeBuckets(degree);
+  DivListModel<0,1,1,0,1> hash(3, 0, 1, 0, 0.0, 0);
+  testContains(hash, true);
+}
+
+namespace {
+  template<class Finder>
+  void testShardedLoad(const typename Finder::Configuration& conf) {
+    const size_t varCount = 3;
+    const size_t count = 300;
+    std::vector<std::vector<int> > exponents =
+      randomDistinctExponents(count, varCount, 1);
+    std::vector<Monomial> entries;
+    for (size_t i = 0; i < exponents.size(); ++i)
+      entries.push_back(Monomial(exponents[i]));
+    std::vector<Monomial> copy(entries);
+
+    Finder finder(conf);
+    finder.insert(copy.begin(), copy.end());
+    ASSERT_EQ(entries.size(), finder.size());
+    for (size_t shard = 0; shard < finder.getShardCount(); ++shard)
+      ASSERT_FALSE(finder.getShard(shard).empty());
+
+    std::vector<int> query(varCount);
+    Random random(2);
+    for (size_t i = 0; i < 1000; ++i) {
+      random.fill(query, 10);
+      const Monomial monomial(query);
+      bool hasDivisor = false;
+      for (size_t j = 0; j < entries.size() && !hasDivisor; ++j)
+        hasDivisor = conf.divides(entries[j], monomial);
+      ASSERT_EQ(hasDivisor, finder.findDivisor(monomial) != 0);
+    }
+
+    finder.removeMultiples(entries.front());
+    finder.rebuild();
+    for (size_t i = 0; i < entries.size(); ++i)
+      ASSERT_EQ(!conf.divides(entries.front(), entries[i]),
+        finder.contains(entries[i]));
+  }
+}
+
+TEST(DivFinder, Sharded) {
+  KDTreeModel<1,1,1,1,1,1,0,0,0,3> packed(2, 0, 0, 0, 1.0, 10);
+  testStaircase(packed);
+  KDTreeModel<1,1,0,1,1,1,0,0,0,3,1> binaryHash(2, 0, 0, 0, 0.0, 0);
+  testStaircase(binaryHash);
+
+  KDTreeModel<1,1,1,2,1,0,1,0,0,4> bounds(3, 0, 0, 0, 0.0, 0);
+  testFindBestDivisor(bounds);
+  KDTreeModel<1,1,1,4,1,0,0,0,1,3,1> hash(3, 0, 0, 0, 0.0, 0);
+  testContains(hash, false);
+
+  typedef KDTreeModelConfiguration<1,1,1,2,0,0,0,0,0,3> ByVarConf;
+  testMinimize<mathic::ShardedDivFinder<ByVarConf> >
+    (ByVarConf(3, 0, 0, 0.0, 0));
+
+  typedef KDTreeModelConfiguration<1,1,1,4,1,0,0,0,0,4> LoadConf;
+  testShardedLoad<mathic::ShardedDivFinder<LoadConf> >
+    (LoadConf(3, 0, 0, 1.0, 1000));
+  typedef KDTreeModelConfiguration<1,1,0,4,1,0,0,0,1,4,1> LoadHashConf;
+  testShardedLoad<mathic::ShardedDivFinder<LoadHashConf> >
+    (LoadHashConf(3, 0, 0, 1.0, 1000));
+}
+
+namespace {
+  template<class Model>
+  void testChurn(Model& model) {
+    // model must remove multiples on insertion.
+    const size_t varCount = 3;
+    const size_t count = 1000;
+    std::vector<std::vector<int> > exponents
+      (count, std::vector<int>(varCount));
+    Random random(1);
+    for (size_t i = 0; i < count; ++i) {
+      random.fill(exponents[i], 12);
+      model.insert(Monomial(exponents[i]));
+    }
+
+    std::sort(exponents.begin(), exponents.end());
+    exponents.erase(std::unique(exponents.begin(), exponents.end()),
+      exponents.end());
+    size_t minimalCount = 0;
+    for (size_t i = 0; i < exponents.size(); ++i) {
+      const Monomial monomial(exponents[i]);
+      ASSERT_TRUE(model.findDivisor(monomial) != 0);
+      bool minimal = true;
+      for (size_t j = 0; j < exponents.size() && minimal; ++j) {
+        if (i == j)
+          continue;
+        minimal = false;
+        for (size_t var = 0; var < varCount; ++var)
+          if (exponents[i][var] < exponents[j][var])
+            minimal = true;
+      }
+      if (minimal)
+        ++minimalCount;
+      ASSERT_EQ(minimal, model.contains(monomial));
+    }
+    ASSERT_EQ(minimalCount, model.size());
+  }
+}
+
+TEST(DivFinder, Tombstones) {
+  KDTreeModel<1,1,1,8,1,0,0,0,0,1,0,1> packed(3, 1, 0, 0, 1.0, 100);
+  testChurn(packed);
+  KDTreeModel<1,1,0,4,1,1,1,0,0,1,0,1> binary(3, 1, 0, 0, 0.0, 0);
+  testChurn(binary);
+  KDTreeModel<1,1,1,1,1,0,0,0,1,1,0,1> leafOne(3, 1, 0, 0, 0.0, 0);
+  testChurn(leafOne);
+  KDTreeModel<1,1,1,4,1,0,0,0,1,1,0,1> hash(3, 0, 0, 0, 0.0, 0);
+  testContains(hash, false);
+  KDTreeModel<1,1,0,2,1,0,1,0,0,1,0,1> bounds(3, 0, 0, 0, 0.0, 0);
+  testFindBestDivisor(bounds);
+}
+
+namespace {
+  class EntryRecorder {
+  public:
+    bool proceed(const Monomial& m) {
+      entries.push_back(&m[0]);
+      return true;
+    }
+    std::vector<const int*> entries;
+  };
+
+  template<class Range>
+  std::vector<const int*> drain(Range range, size_t limit) {
+    std::vector<const int*> entries;
+    for (; !range.empty() && entries.size() < limit; range.popFront())
+      entries.push_back(&range.front()[0]);
+    return entries;
+  }
+
+  template<class Finder>
+  void testRanges(Finder& finder) {
+    const size_t varCount = 3;
+    const size_t count = 200;
+    std::vector<std::vector<int> > exponents =
+      randomDistinctExponents(count, varCount, 7, 8);
+    for (size_t i = 0; i < count; ++i)
+      finder.insert(Monomial(exponents[i]));
+
+    std::vector<int> query(varCount);
+    Random random(8);
+    for (size_t i = 0; i < 100; ++i) {
+      random.fill(query, 8);
+      const Monomial monomial(query);
+      EntryRecorder divisors;
+      finder.findAllDivisors(monomial, divisors);
+      ASSERT_EQ(divisors.entries, drain
+        (finder.divisorRange(monomial), static_cast<size_t>(-1)));
+      EntryRecorder multiples;
+      finder.findAllMultiples(monomial, multiples);
+      ASSERT_EQ(multiples.entries, drain
+        (finder.multipleRange(monomial), static_cast<size_t>(-1)));
+
+      // stopping early gives a prefix of the full range.
+      std::vector<const int*> firstTwo =
+        drain(finder.multipleRange(monomial), 2);
+      ASSERT_EQ(std::min<size_t>(2, multiples.entries.size()), firstTwo.size());
+      ASSERT_TRUE(std::equal
+        (firstTwo.begin(), firstTwo.end(), multiples.entries.begin()));
+    }
+  }
+}
+
+TEST(DivFinder, Ranges) {
+  typedef KDTreeModelConfiguration<1,1,1,4,1> PackedConf;
+  mathic::KDTree<PackedConf> packed(PackedConf(3, 0, 0, 0.0, 0));
+  testRanges(packed);
+  typedef KDTreeModelConfiguration<1,1,0,2,1,0,0,0,0,1,0,1> BinaryConf;
+  mathic::KDTree<BinaryConf> binary(BinaryConf(3, 0, 0, 0.0, 0));
+  testRanges(binary);
+  typedef DivListModelConfiguration<0,1,0,1> ListConf;
+  mathic::DivList<ListConf> list(ListConf(3, 0, 0.0, 0));
+  testRanges(list);
+  typedef DivListModelConfiguration<1,0> LinkedConf;
+  mathic::DivList<LinkedConf> sorted(LinkedConf(3, 1, 0.0, 0));
+  testRanges(sorted);
+}
+
+namespace {
+  /** The last exponent of a monomial is its component. */
+  class ModuleConfiguration : public KDTreeModelConfiguration<1,1,1,4,1> {
+  public:
+    ModuleConfiguration(size_t varCount):
+      KDTreeModelConfiguration<1,1,1,4,1>(varCount, 0, 0, 0.0, 0) {}
+    size_t getComponent(const Monomial& monomial) const {
+      return monomial[getVarCount()];
+    }
+  };
+
+  class Counter {
+  public:
+    Counter(): count(0) {}
+    bool proceed(const Monomial&) {++count; return true;}
+    size_t count;
+  };
+}
+
+TEST(DivFinder, Components) {
+  const size_t varCount = 2;
+  const size_t count = 120;
+  // the last exponent is the component. Spreading distinct exponents
+  // over the components keeps the entries distinct.
+  std::vector<std::vector<int> > exponents =
+    randomDistinctExponents(count, varCount, 3, 12);
+  for (size_t i = 0; i < count; ++i)
+    exponents[i].push_back(static_cast<int>(i % 3));
+  std::vector<Monomial> entries;
+  for (size_t i = 0; i < exponents.size(); ++i)
+    entries.push_back(Monomial(exponents[i]));
+
+  mathic::ComponentDivFinder<ModuleConfiguration>
+    finder((ModuleConfiguration(varCount)));
+  finder.insert(entries.begin(), entries.begin() + entries.size() / 2);
+  for (size_t i = entries.size() / 2; i < entries.size(); ++i)
+    finder.insert(entries[i]);
+  ASSERT_EQ(exponents.size(), finder.size());
+  ASSERT_EQ(3u, finder.getComponentCount());
+
+  std::vector<int> query(varCount + 1);
+  Random random(4);
+  for (size_t i = 0; i < 200; ++i) {
+    for (size_t var = 0; var <= varCount; ++var)
+      query[var] = random.next(var == varCount ? 4 : 12);
+    size_t divisorCount = 0;
+    for (size_t j = 0; j < exponents.size(); ++j) {
+      bool divides = exponents[j][varCount] == query[varCount];
+      for (size_t var = 0; var < varCount; ++var)
+        if (query[var] < exponents[j][var])
+          divides = false;
+      divisorCount += divides;
+    }
+    const Monomial monomial(query);
+    Counter counter;
+    finder.findAllDivisors(monomial, counter);
+    ASSERT_EQ(divisorCount, counter.count);
+    ASSERT_EQ(divisorCount > 0, finder.findDivisor(monomial) != 0);
+  }
+
+  // removing multiples of a monomial leaves the other components alone.
+  std::vector<int> one(varCount + 1);
+  one[varCount] = 1;
+  size_t inOne = 0;
+  for (size_t j = 0; j < exponents.size(); ++j)
+    inOne += exponents[j][varCount] == 1;
+  ASSERT_TRUE(finder.removeMultiples(Monomial(one)));
+  ASSERT_EQ(exponents.size() - inOne, finder.size());
+  Counter all;
+  finder.forAll(all);
+  ASSERT_EQ(finder.size(), all.count);
+  ASSERT_TRUE(finder.findDivisor(Monomial(exponents.front())) != 0 ||
+    exponents.front()[varCount] == 1);
+}
+
+namespace {
+  template<class Finder>
+  void testScoreBelow(Finder& finder) {
+    const size_t varCount = 3;
+    const size_t count = 200;
+    std::vector<std::vector<int> > exponents =
+      randomDistinctExponents(count, varCount, 5);
+    for (size_t i = 0; i < count; ++i)
+      finder.insert(Monomial(exponents[i]));
+
+    std::vector<int> query(varCount);
+    Random random(6);
+    for (size_t i = 0; i < 200; ++i) {
+      random.fill(query, 10);
+      // the score is the total degree.
+      const int bound = static_cast<int>(i % 20);
+      bool exists = false;
+      for (size_t j = 0; j < count && !exists; ++j) {
+        int degree = 0;
+        bool divides = true;
+        for (size_t var = 0; var < varCount; ++var) {
+          divides = divides && exponents[j][var] <= query[var];
+          degree += exponents[j][var];
+        }
+        exists = divides && degree < bound;
+      }
+      const Monomial* divisor =
+        finder.findDivisorWithScoreBelow(Monomial(query), bound);
+      ASSERT_EQ(exists, divisor != 0);
+      if (divisor != 0) {
+        int degree = 0;
+        for (size_t var = 0; var < varCount; ++var) {
+          ASSERT_LE((*divisor)[var], query[var]);
+          degree += (*divisor)[var];
+        }
+        ASSERT_LT(degree, bound);
+      }
+    }
+  }
+}
+
+TEST(DivFinder, ScoreBelow) {
+  typedef KDTreeModelConfiguration<1,1,1,4,1,0,1> PackedConf;
+  mathic::KDTree<PackedConf> packed(PackedConf(3, 0, 0, 0.0, 0));
+  testScoreBelow(packed);
+  typedef KDTreeModelConfiguration<1,1,0,2,1,0,1> BinaryConf;
+  mathic::KDTree<BinaryConf> binary(BinaryConf(3, 1, 0, 0.0, 0));
+  testScoreBelow(binary);
+  typedef KDTreeModelConfiguration<0,0,1,1,1> NoBoundsConf;
+  mathic::KDTree<NoBoundsConf> noBounds(NoBoundsConf(3, 0, 0, 0.0, 0));
+  testScoreBelow(noBounds);
+  typedef DivListModelConfiguration<0,1> ListConf;
+  mathic::DivList<ListConf> list(ListConf(3, 0, 0.0, 0));
+  testScoreBelow(list);
+}
+
+namespace {
+  template<class Finder>
+  std::vector<const int*> contents(const Finder& finder) {
+    EntryRecorder recorder;
+    finder.forAll(recorder);
+    std::sort(recorder.entries.begin(), recorder.entries.end());
+    return recorder.entries;
+  }
+
+  /** Removes the entries that monomial divides from entries. */
+  void removeMultiplesFrom
+    (std::vector<const int*>& entries, const int* monomial, size_t varCount) {
+    std::vector<const int*> kept;
+    for (size_t i = 0; i < entries.size(); ++i) {
+      bool divides = true;
+      for (size_t var = 0; var < varCount; ++var)
+        if (entries[i][var] < monomial[var])
+          divides = false;
+      if (!divides)
+        kept.push_back(entries[i]);
+    }
+    entries.swap(kept);
+  }
+
+  template<class Conf>
+  void testSnapshots(const Conf& conf) {
+    typedef mathic::KDTree<Conf> Tree;
+    const size_t varCount = 3;
+    std::vector<std::vector<int> > exponents =
+      randomDistinctExponents(600, varCount, 11, 16);
+    size_t next = 0;
+
+    Tree tree(conf);
+    std::vector<const int*> expected;
+    for (; next < 200; ++next) {
+      tree.insert(Monomial(exponents[next]));
+      expected.push_back(&exponents[next][0]);
+    }
+    std::sort(expected.begin(), expected.end());
+
+    std::vector<Tree*> snapshots;
+    std::vector<std::vector<const int*> > snapshotContents;
+    for (size_t round = 0; round < 6; ++round) {
+      snapshots.push_back(tree.snapshot());
+      snapshotContents.push_back(expected);
+
+      // change the original
+      for (size_t i = 0; i < 40; ++i, ++next) {
+        tree.insert(Monomial(exponents[next]));
+        expected.push_back(&exponents[next][0]);
+      }
+      std::sort(expected.begin(), expected.end());
+      for (size_t i = 0; i < 5; ++i) {
+        const int* victim = expected[(i * 37 + round) % expected.size()];
+        std::vector<int> copy(victim, victim + varCount);
+        ASSERT_TRUE(tree.removeElement(Monomial(copy)));
+        expected.erase(std::find(expected.begin(), expected.end(), victim));
+      }
+      std::vector<int> cut(varCount, 10);
+      cut[round % varCount] = 6;
+      tree.removeMultiples(Monomial(cut));
+      removeMultiplesFrom(expected, &cut[0], varCount);
+      if (round == 3)
+        tree.rebuild();
+
+      // change a snapshot too
+      if (round % 2 == 1) {
+        Tree& snapshot = *snapshots[round - 1];
+        std::vector<const int*>& snapshotExpected = snapshotContents[round - 1];
+        snapshot.insert(Monomial(exponents[next]));
+        snapshotExpected.push_back(&exponents[next][0]);
+        ++next;
+        std::sort(snapshotExpected.begin(), snapshotExpected.end());
+        snapshot.removeMultiples(Monomial(cut));
+        removeMultiplesFrom(snapshotExpected, &cut[0], varCount);
+      }
+
+      ASSERT_EQ(expected, contents(tree));
+      ASSERT_EQ(expected.size(), tree.size());
+      for (size_t i = 0; i < snapshots.size(); ++i) {
+        ASSERT_EQ(snapshotContents[i], contents(*snapshots[i]));
+        ASSERT_EQ(snapshotContents[i].size(), snapshots[i]->size());
+        for (size_t j = 0; j < snapshotContents[i].size(); ++j) {
+          std::vector<int> query
+            (snapshotContents[i][j], snapshotContents[i][j] + varCount);
+          ASSERT_TRUE(snapshots[i]->findDivisor(Monomial(query)) != 0);
+        }
+      }
+    }
+
+    // deleting the snapshots leaves the original intact.
+    for (size_t i = 0; i < snapshots.size(); i += 2)
+      delete snapshots[i];
+    tree.insert(Monomial(exponents[next]));
+    expected.push_back(&exponents[next][0]);
+    std::sort(expected.begin(), expected.end());
+    for (size_t i = 1; i < snapshots.size(); i += 2)
+      delete snapshots[i];
+    ASSERT_EQ(expected, contents(tree));
+
+    // with the snapshots gone the tree owns its nodes again, so changes
+    // do not copy any nodes.
+    const size_t memoryUse = tree.getMemoryUse();
+    for (size_t i = 0; i < exponents.size(); i += 20) {
+      if (!tree.removeElement(Monomial(exponents[i])))
+        continue;
+      tree.insert(Monomial(exponents[i]));
+    }
+    ASSERT_EQ(memoryUse, tree.getMemoryUse());
+    ASSERT_EQ(expected, contents(tree));
+  }
+}
+
+TEST(DivFinder, Snapshots) {
+  typedef KDTreeModelConfiguration<1,1,1,4,1> Conf;
+  testSnapshots(Conf(3, 0, 0, 0.0, 0));
+  typedef KDTreeModelConfiguration<1,1,1,1,1,1,1> PartialConf;
+  testSnapshots(PartialConf(3, 1, 0, 0.0, 0));
+  typedef KDTreeModelConfiguration<1,1,1,8,1,0,0,0,1,1,0,1> TombConf;
+  testSnapshots(TombConf(3, 0, 0, 1.0, 50));
+}
+
+namespace {
+  /** Thread 0 inserts into the original tree while the other threads
+      each query some of the snapshots and then delete them. */
+  template<class Tree>
+  class SnapshotWork : public mathic::ParallelWork {
+  public:
+    SnapshotWork(Tree& tree, std::vector<Tree*>& snapshots,
+      std::vector<std::vector<int> >& exponents, size_t insertBegin):
+      _tree(tree), _snapshots(snapshots), _exponents(exponents),
+      _insertBegin(insertBegin), found(snapshots.size(), 0) {}
+
+    virtual void run(size_t thread, size_t threadCount) {
+      if (thread == 0) {
+        for (size_t i = _insertBegin; i < _exponents.size(); ++i)
+          _tree.insert(Monomial(_exponents[i]));
+        return;
+      }
+      for (size_t i = thread - 1; i < _snapshots.size();
+        i += threadCount - 1) {
+        std::vector<const int*> entries = contents(*_snapshots[i]);
+        for (size_t j = 0; j < entries.size(); ++j) {
+          std::vector<int> query(entries[j], entries[j] + 3);
+          if (_snapshots[i]->findDivisor(Monomial(query)) != 0)
+            ++found[i];
+        }
+        delete _snapshots[i];
+        _snapshots[i] = 0;
+      }
+    }
+
+  private:
+    Tree& _tree;
+    std::vector<Tree*>& _snapshots;
+    std::vector<std::vector<int> >& _exponents;
+    const size_t _insertBegin;
+
+  public:
+    std::vector<size_t> found; /// found[i] divisors found in snapshot i
+  };
+
+  template<class Conf>
+  void testSnapshotsOnThreads(const Conf& conf) {
+    typedef mathic::KDTree<Conf> Tree;
+    const size_t varCount = 3;
+    std::vector<std::vector<int> > exponents =
+      randomDistinctExponents(1000, varCount, 13, 16);
+
+    Tree tree(conf);
+    std::vector<Tree*> snapshots;
+    std::vector<size_t> snapshotSizes;
+    for (size_t i = 0; i < 600; ++i) {
+      tree.insert(Monomial(exponents[i]));
+      if (i % 100 == 99) {
+        snapshots.push_back(tree.snapshot());
+        snapshotSizes.push_back(tree.size());
+      }
+    }
+
+    SnapshotWork<Tree> work(tree, snapshots, exponents, 600);
+    mathic::runInParallel(work, 3);
+    for (size_t i = 0; i < snapshots.size(); ++i) {
+      ASSERT_TRUE(snapshots[i] == 0);
+      ASSERT_EQ(snapshotSizes[i], work.found[i]);
+    }
+
+    std::vector<const int*> expected;
+    for (size_t i = 0; i < exponents.size(); ++i)
+      expected.push_back(&exponents[i][0]);
+    std::sort(expected.begin(), expected.end());
+    ASSERT_EQ(expected, contents(tree));
+    for (size_t i = 0; i < exponents.size(); ++i)
+      ASSERT_TRUE(tree.findDivisor(Monomial(exponents[i])) != 0);
+
+    // the snapshots are gone, so the tree takes its nodes back.
+    const size_t memoryUse = tree.getMemoryUse();
+    for (size_t i = 0; i < exponents.size(); i += 20) {
+      ASSERT_TRUE(tree.removeElement(Monomial(exponents[i])));
+      tree.insert(Monomial(exponents[i]));
+    }
+    ASSERT_EQ(memoryUse, tree.getMemoryUse());
+    ASSERT_EQ(expected, contents(tree));
+  }
+}
+
+TEST(DivFinder, SnapshotsOnThreads) {
+  typedef KDTreeModelConfiguration<1,1,1,4,1> Conf;
+  for (size_t round = 0; round < 5; ++round)
+    testSnapshotsOnThreads(Conf(3, 0, 0, 0.0, 0));
+  typedef KDTreeModelConfiguration<1,1,1,1,1,1,1> PartialConf;
+  testSnapshotsOnThreads(PartialConf(3, 1, 0, 0.0, 0));
+}
+
+namespace {
+  /** Inserts entries, moves divisors to the front unless the list is
+      sorted and removes entries. These update the mask array one mask
+      at a time, so check that it still matches the list. */
+  template<class Conf>
+  void testMaskArrayChanges(const Conf& conf) {
+    const size_t varCount = 3;
+    const size_t count = 200;
+    std::vector<std::vector<int> > exponents =
+      randomDistinctExponents(count, varCount, 9);
+    mathic::DivList<Conf> list(conf);
+    for (size_t i = 0; i < count; ++i) {
+      list.insert(Monomial(exponents[i]));
+#ifdef MATHIC_DEBUG
+      ASSERT_TRUE(list.debugIsValid());
+#endif
+    }
+    std::vector<const int*> expected;
+    for (size_t i = 0; i < count; ++i)
+      expected.push_back(&exponents[i][0]);
+    std::sort(expected.begin(), expected.end());
+
+    std::vector<int> query(varCount);
+    Random random(10);
+    for (size_t i = 0; i < 400; ++i) {
+      random.fill(query, 10);
+      bool hasDivisor = false;
+      for (size_t j = 0; j < expected.size() && !hasDivisor; ++j)
+        hasDivisor = expected[j][0] <= query[0] &&
+          expected[j][1] <= query[1] && expected[j][2] <= query[2];
+      typename mathic::DivList<Conf>::iterator it =
+        list.findDivisorIterator(Monomial(query));
+      ASSERT_EQ(hasDivisor, it != list.end());
+      if (it != list.end() && !conf.getSortOnInsert())
+        list.moveToFront(it);
+#ifdef MATHIC_DEBUG
+      ASSERT_TRUE(list.debugIsValid());
+#endif
+
+      if (i % 20 == 19) {
+        std::vector<int> cut(varCount, 8);
+        cut[i % varCount] = 6;
+        list.removeMultiples(Monomial(cut));
+        removeMultiplesFrom(expected, &cut[0], varCount);
+      } else if (i % 10 == 9 && !expected.empty()) {
+        const int* victim = expected[i % expected.size()];
+        std::vector<int> copy(victim, victim + varCount);
+        ASSERT_TRUE(list.removeElement(Monomial(copy)));
+        expected.erase(std::find(expected.begin(), expected.end(), victim));
+      }
+#ifdef MATHIC_DEBUG
+      ASSERT_TRUE(list.debugIsValid());
+#endif
+      ASSERT_EQ(expected, contents(list));
+    }
+  }
+}
+
+TEST(DivFinder, MaskArrayChanges) {
+  typedef DivListModelConfiguration<0,1,0,0,1> ArrayConf;
+  testMaskArrayChanges(ArrayConf(3, false, 0.0, 0));
+  testMaskArrayChanges(ArrayConf(3, true, 0.0, 0));
+  typedef DivListModelConfiguration<0,1,0,1,1> DegreeConf;
+  testMaskArrayChanges(DegreeConf(3, false, 0.0, 0));
+}
+
+namespace {
+  template<class Conf>
+  void testAutoTuning(const Conf& conf, size_t expectedTrialCount) {
+    typedef mathic::KDTree<Conf> Tree;
+    typedef typename Tree::Tuner Tuner;
+    const size_t varCount = 3;
+    std::vector<std::vector<int> > exponents =
+      randomDistinctExponents(300, varCount, 7, 16);
+    std::vector<const int*> expected;
+    Tree tree(conf);
+    for (size_t i = 0; i < exponents.size(); ++i) {
+      tree.insert(Monomial(exponents[i]));
+      expected.push_back(&exponents[i][0]);
+    }
+    std::sort(expected.begin(), expected.end());
+    ASSERT_EQ(expectedTrialCount, tree.getTuner().getTrials().size());
+    ASSERT_FALSE(tree.getTuner().isSettled());
+
+    // queries are timed and changes give the tree a chance to switch
+    // to the next setting.
+    std::vector<int> query(varCount);
+    Random random(8);
+    for (size_t round = 0; !tree.getTuner().isSettled(); ++round) {
+      ASSERT_LT(round, 200u);
+      for (size_t i = 0; i < 400; ++i) {
+        random.fill(query, 20);
+        bool hasDivisor = false;
+        for (size_t j = 0; j < expected.size(); ++j)
+          if (expected[j][0] <= query[0] && expected[j][1] <= query[1] &&
+            expected[j][2] <= query[2])
+            hasDivisor = true;
+        ASSERT_EQ(hasDivisor, tree.findDivisor(Monomial(query)) != 0);
+      }
+      std::vector<int>& e = exponents[round % exponents.size()];
+      ASSERT_TRUE(tree.removeElement(Monomial(e)));
+      tree.insert(Monomial(e));
+      ASSERT_EQ(expected, contents(tree));
+    }
+
+    const Tuner& tuner = tree.getTuner();
+    ASSERT_EQ(1u, tuner.getRoundCount());
+    const std::vector<mathic::KDTreeTuningTrial>& trials = tuner.getTrials();
+    size_t best = 0;
+    for (size_t i = 0; i < trials.size(); ++i) {
+      ASSERT_GE(trials[i].samples, Tuner::WindowSamples);
+      if (trials[i].nanosPerLogSize < trials[best].nanosPerLogSize)
+        best = i;
+    }
+    ASSERT_EQ(trials[best].leafSize, tuner.getLeafSize());
+    ASSERT_EQ(trials[best].rebuildRatio, tuner.getRebuildRatio());
+    for (size_t i = 0; i < exponents.size(); ++i)
+      ASSERT_TRUE(tree.findDivisor(Monomial(exponents[i])) != 0);
+  }
+}
+
+TEST(DivFinder, AutoTuning) {
+  // leaf sizes 8, 4, 2 and 1 without automatic rebuilds.
+  typedef KDTreeModelConfiguration<1,1,1,8,1,0,0,0,0,1,0,0,1> PackedConf;
+  testAutoTuning(PackedConf(3, 0, 0, 0.0, 0), 4);
+  // leaf sizes 4, 2 and 1 times 3 rebuild ratios.
+  typedef KDTreeModelConfiguration<1,1,0,4,1,0,0,0,0,1,0,0,1> BinaryConf;
+  testAutoTuning(BinaryConf(3, 1, 0, 1.0, 50), 9);
+}
+
+namespace {
+  template<class Tree>
+  void testAnalyze(Tree& tree, bool packed) {
+    const size_t varCount = 3;
+    std::vector<std::vector<int> > exponents =
+      randomDistinctExponents(200, varCount, 5, 16);
+    for (size_t i = 0; i < exponents.size(); ++i)
+      tree.insert(Monomial(exponents[i]));
+
+    mathic::KDTreeAnalysis analysis = tree.analyze();
+    ASSERT_EQ(tree.size(), analysis.entryCount);
+    ASSERT_EQ(0u, analysis.queries.queries);
+    size_t leaves = 0;
+    for (size_t d = 0; d < analysis.leavesAtDepth.size(); ++d)
+      leaves += analysis.leavesAtDepth[d];
+    ASSERT_EQ(analysis.leafCount, leaves);
+    size_t entries = 0;
+    leaves = 0;
+    for (size_t s = 0; s < analysis.leavesWithSize.size(); ++s) {
+      entries += s * analysis.leavesWithSize[s];
+      leaves += analysis.leavesWithSize[s];
+    }
+    ASSERT_EQ(analysis.entryCount, entries);
+    ASSERT_EQ(analysis.leafCount, leaves);
+    ASSERT_LE(analysis.splitsOnVar.size(), varCount);
+    size_t splits = 0;
+    for (size_t var = 0; var < analysis.splitsOnVar.size(); ++var)
+      splits += analysis.splitsOnVar[var];
+    // each split adds one node in a packed tree and two in a binary tree.
+    if (packed)
+      ASSERT_EQ(analysis.nodeCount, splits + 1);
+    else
+      ASSERT_EQ(analysis.nodeCount, 2 * splits + 1);
+
+    // sampled queries find the same divisors as other queries.
+    std::vector<int> query(varCount);
+    std::vector<const void*> divisors;
+    for (size_t i = 0; i < 100; ++i) {
+      for (size_t var = 0; var < varCount; ++var)
+        query[var] = (i * (var + 3)) % 18;
+      divisors.push_back(tree.findDivisor(Monomial(query)));
+    }
+    tree.setQuerySampling(2);
+    size_t found = 0;
+    for (size_t i = 0; i < 100; ++i) {
+      for (size_t var = 0; var < varCount; ++var)
+        query[var] = (i * (var + 3)) % 18;
+      ASSERT_EQ(divisors[i], tree.findDivisor(Monomial(query)));
+      if (i % 2 == 1 && divisors[i] != 0)
+        ++found;
+    }
+    analysis = tree.analyze();
+    ASSERT_EQ(50u, analysis.queries.queries);
+    ASSERT_GE(analysis.queries.nodesVisited, analysis.queries.queries);
+    ASSERT_GE(analysis.queries.nodesVisited, analysis.queries.leavesScanned);
+    ASSERT_GE(analysis.queries.divisibilityTests, found);
+    tree.setQuerySampling(0);
+    ASSERT_EQ(0u, tree.analyze().queries.queries);
+  }
+}
+
+TEST(DivFinder, Analyze) {
+  typedef KDTreeModelConfiguration<1,1,1,4,1> PackedConf;
+  mathic::KDTree<PackedConf> packed(PackedConf(3, 0, 0, 0.0, 0));
+  testAnalyze(packed, true);
+  typedef KDTreeModelConfiguration<1,0,0,2,1> BinaryConf;
+  mathic::KDTree<BinaryConf> binary(BinaryConf(3, 1, 0, 0.0, 0));
+  testAnalyze(binary, false);
+  typedef KDTreeModelConfiguration<0,0,0,1,1> NoMaskConf;
+  mathic::KDTree<NoMaskConf> noMask(NoMaskConf(3, 0, 0, 0.0, 0));
+  testAnalyze(noMask, false);
+}
+
+namespace {
+  /** A Configuration with only the fields that KDTree and DivList needed
+      before the optional flags of ConfigFlags.h were added. */
+  template<bool PT>
+  class PlainConfiguration {
+  public:
+    typedef int Exponent;
+    typedef ::Monomial Monomial;
+    typedef Monomial Entry;
+
+    PlainConfiguration(size_t varCount): _varCount(varCount) {}
+
+    size_t getVarCount() const {return _varCount;}
+    bool getSortOnInsert() const {return false;}
+    Exponent getExponent(const Monomial& monomial, size_t var) const {
+      return monomial[var];
+    }
+    bool divides(const Monomial& a, const Monomial& b) const {
+      for (size_t var = 0; var < getVarCount(); ++var)
+        if (b[var] < a[var])
+          return false;
+      return true;
+    }
+    bool isLessThan(const Monomial& a, const Monomial& b) const {
+      for (size_t var = 0; var < getVarCount(); ++var)
+        if (a[var] != b[var])
+          return a[var] < b[var];
+      return false;
+    }
+    size_t getLeafSize() const {return LeafSize;}
+    bool getUseDivisorCache() const {return false;}
+    bool getDoAutomaticRebuilds() const {return true;}
+    double getRebuildRatio() const {return 0.5;}
+    size_t getRebuildMin() const {return 10;}
+
+    static const bool UseDivMask = true;
+    static const bool UseTreeDivMask = true;
+    static const bool UseLinkedList = false;
+    static const bool PackedTree = PT;
+    static const size_t LeafSize = 4;
+    static const bool AllowRemovals = true;
+
+  private:
+    size_t _varCount;
+  };
+
+  template<class Finder>
+  void testPlainConfiguration(Finder& finder) {
+    // a Monomial points to its exponents, so they must stay alive.
+    std::vector<std::vector<int> > exponents(20, std::vector<int>(2));
+    for (int i = 0; i < 20; ++i) {
+      exponents[i][0] = i;
+      exponents[i][1] = 20 - i;
+      finder.insert(Monomial(exponents[i]));
+    }
+    ASSERT_EQ(20u, finder.size());
+    std::vector<int> query(2);
+    query[0] = 5;
+    query[1] = 16;
+    ASSERT_TRUE(finder.findDivisor(Monomial(query)) != 0);
+    query[1] = 14;
+    ASSERT_TRUE(finder.findDivisor(Monomial(query)) == 0);
+    query[0] = 3;
+    query[1] = 17;
+    ASSERT_TRUE(finder.removeElement(Monomial(query)));
+    ASSERT_EQ(19u, finder.size());
+  }
+}
+
+TEST(DivFinder, OptionalFlags) {
+  typedef PlainConfiguration<true> Plain;
+  ASSERT_TRUE(!mathic::ConfigFlags<Plain>::UsePartialRebuilds);
+  ASSERT_TRUE(!mathic::ConfigFlags<Plain>::UseTombstones);
+  ASSERT_TRUE(!mathic::ConfigFlags<Plain>::UseDegreeBuckets);
+  ASSERT_TRUE(mathic::ConfigFlags<Plain>::CompactExponentBits == 0);
+  typedef KDTreeModelConfiguration<1,1,1,4,1,1,1,8,1,1,0,1> Full;
+  ASSERT_TRUE(mathic::ConfigFlags<Full>::UsePartialRebuilds &&
+    mathic::ConfigFlags<Full>::UseTombstones);
+  ASSERT_TRUE(mathic::ConfigFlags<Full>::CompactExponentBits == 8);
+
+  mathic::KDTree<Plain> packed((Plain(2)));
+  testPlainConfiguration(packed);
+  mathic::KDTree<PlainConfiguration<false> > binary
+    ((PlainConfiguration<false>(2)));
+  testPlainConfiguration(binary);
+  mathic::DivList<Plain> list((Plain(2)));
+  testPlainConfiguration(list);
+}
+
+namespace {
+  /** Builds a finder of its own on each thread and rebuilds it often, so
+      that the threads rebuild at the same time. */
+  template<class Finder>
+  class RebuildWork : public mathic::ScalingWork {
+  public:
+    RebuildWork(const typename Finder::Configuration& conf): _conf(conf) {}
+
+    virtual std::string getName() const {return "rebuild";}
+    virtual void prepare(size_t threadCount) {
+      found.assign(threadCount, 0);
+    }
+    virtual unsigned long long run(size_t thread, size_t threadCount) {
+      const int count = 200;
+      std::vector<std::vector<int> > exponents(count, std::vector<int>(2));
+      Finder finder(_conf);
+      for (int i = 0; i < count; ++i) {
+        exponents[i][0] = i;
+        exponents[i][1] = count - i;
+        finder.insert(Monomial(exponents[i]));
+        if (i % 10 == 0)
+          finder.rebuild();
+      }
+      for (int i = 0; i < count; ++i)
+        if (finder.findDivisor(Monomial(exponents[i])) != 0)
+          ++found[thread];
+      return count;
+    }
+
+    std::vector<size_t> found;
+
+  private:
+    const typename Finder::Configuration _conf;
+  };
+
+  template<class Finder>
+  void testRebuildOnThreads(const typename Finder::Configuration& conf) {
+    RebuildWork<Finder> work(conf);
+    mathic::ThreadScaling scaling;
+    scaling.run(work, std::vector<size_t>(1, 4));
+    ASSERT_EQ(4u, work.found.size());
+    for (size_t thread = 0; thread < work.found.size(); ++thread)
+      ASSERT_EQ(200u, work.found[thread]);
+  }
+}
+
+TEST(DivFinder, RebuildOnThreads) {
+  if (!mathic::ThreadScaling::threadsAvailable())
+    return;
+  typedef KDTreeModelConfiguration<1,1,1,4,1> TreeConf;
+  testRebuildOnThreads<mathic::KDTree<TreeConf> >
+    (TreeConf(2, 0, 0, 0.0, 0));
+  typedef DivListModelConfiguration<0,1> ListConf;
+  testRebuildOnThreads<mathic::DivList<ListConf> >(ListConf(2, 0, 0.0, 0));
+}
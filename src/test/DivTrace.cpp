@@ -0,0 +1,145 @@
+#include "divsim/stdinc.h"
+#include "mathic/DivTrace.h"
+#include "mathic/KDTree.h"
+#include "mathic/DivList.h"
+#include "mathic/error.h"
+#include "divsim/KDTreeModel.h"
+#include "divsim/DivListModel.h"
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+namespace {
+  const char* const TraceFile = "DivTrace.test.trace";
+
+  /** Returns count distinct vectors of varCount exponents in [0, limit)
+      from a linear congruential generator, so that every platform sees
+      the same trace. There must be at least count such vectors. */
+  std::vector<std::vector<int> > randomDistinctExponents
+  (size_t count, size_t varCount, unsigned int seed, int limit) {
+    unsigned int state = seed;
+    std::vector<std::vector<int> > exponents;
+    std::vector<int> e(varCount);
+    while (exponents.size() < count) {
+      for (size_t var = 0; var < varCount; ++var) {
+        state = state * 1103515245 + 12345;
+        e[var] = static_cast<int>((state >> 16) % limit);
+      }
+      if (std::find(exponents.begin(), exponents.end(), e) == exponents.end())
+        exponents.push_back(e);
+    }
+    return exponents;
+  }
+}
+
+TEST(DivTrace, RecordAndReplay) {
+  typedef KDTreeModelConfiguration<1,1,1,2,1> TreeConf;
+  const size_t varCount = 3;
+  const size_t count = 100;
+  std::vector<std::vector<int> > exponents =
+    randomDistinctExponents(count, varCount, 1, 20);
+  std::vector<mathic::DivTraceEvent::Type> types;
+  std::vector<size_t> removedCounts;
+  size_t passedOnCount = 0;
+  {
+    mathic::DivTraceWriter writer(TraceFile, varCount);
+    mathic::TracingDivFinder<mathic::KDTree<TreeConf> >
+      finder(TreeConf(varCount, false, false, 1.0, 1000), writer);
+    for (size_t i = 0; i < count; ++i) {
+      Monomial monomial(exponents[i]);
+      if (i % 20 == 9) {
+        types.push_back(mathic::DivTraceEvent::RemoveMultiples);
+        finder.removeMultiples(monomial);
+      } else if (i % 10 == 9) {
+        // the removed entries are passed on as well as counted.
+        types.push_back(mathic::DivTraceEvent::RemoveMultiples);
+        const size_t sizeBefore = finder.size();
+        std::vector<Monomial> removed;
+        const bool anyRemoved = finder.removeMultiples(monomial, removed);
+        ASSERT_EQ(anyRemoved, !removed.empty());
+        ASSERT_EQ(sizeBefore - removed.size(), finder.size());
+        passedOnCount += removed.size();
+        for (size_t j = 0; j < removed.size(); ++j)
+          ASSERT_TRUE
+            (finder.getConfiguration().divides(monomial, removed[j]));
+      } else if (i % 10 == 8) {
+        types.push_back(mathic::DivTraceEvent::RemoveElement);
+        finder.removeElement(Monomial(exponents[i - 1]));
+      } else if (i % 2 == 0) {
+        const bool found = finder.findDivisor(monomial) != 0;
+        types.push_back(found ? mathic::DivTraceEvent::QueryHasDivisor :
+          mathic::DivTraceEvent::QueryNoDivisor);
+      } else {
+        types.push_back(mathic::DivTraceEvent::Insert);
+        finder.insert(monomial);
+      }
+    }
+    ASSERT_EQ(count, writer.getEventCount());
+    ASSERT_LT(0u, passedOnCount);
+  }
+
+  // replay on a div list and check that it gives the same answers.
+  typedef DivListModelConfiguration<0,1> ListConf;
+  mathic::DivList<ListConf> list(ListConf(varCount, false, 0.0, 0));
+  mathic::DivTraceReader reader(TraceFile);
+  ASSERT_EQ(varCount, reader.getVarCount());
+  mathic::DivTraceEvent event;
+  std::vector<std::vector<int> > replayed(count);
+  for (size_t i = 0; i < count; ++i) {
+    ASSERT_TRUE(reader.next(event));
+    ASSERT_EQ(types[i], event.type);
+    replayed[i].assign(event.exponents.begin(), event.exponents.end());
+    ASSERT_EQ(exponents[i == 0 || i % 10 != 8 ? i : i - 1], replayed[i]);
+    Monomial monomial(replayed[i]);
+    if (event.type == mathic::DivTraceEvent::Insert)
+      list.insert(monomial);
+    else if (event.type == mathic::DivTraceEvent::RemoveElement)
+      ASSERT_EQ(event.removedCount != 0, list.removeElement(monomial));
+    else if (event.type == mathic::DivTraceEvent::RemoveMultiples) {
+      const size_t sizeBefore = list.size();
+      list.removeMultiples(monomial);
+      ASSERT_EQ(sizeBefore - event.removedCount, list.size());
+    } else {
+      ASSERT_EQ(event.type == mathic::DivTraceEvent::QueryHasDivisor,
+        list.findDivisor(monomial) != 0);
+    }
+  }
+  ASSERT_FALSE(reader.next(event));
+
+  reader.rewind();
+  ASSERT_TRUE(reader.next(event));
+  ASSERT_EQ(replayed[0], std::vector<int>
+    (event.exponents.begin(), event.exponents.end()));
+}
+
+TEST(DivTrace, BadFiles) {
+  {
+    std::ofstream out(TraceFile);
+    out << "not a trace";
+  }
+  ASSERT_THROW(mathic::DivTraceReader reader(TraceFile),
+    mathic::MathicException);
+
+  {
+    mathic::DivTraceWriter writer(TraceFile, 2);
+    std::vector<long long> exponents(2);
+    exponents[0] = 1000;
+    writer.write(mathic::DivTraceEvent::Insert, exponents);
+  }
+  {
+    // cut off the last exponent.
+    std::ifstream in(TraceFile, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)),
+      std::istreambuf_iterator<char>());
+    in.close();
+    std::ofstream out(TraceFile, std::ios::binary);
+    out << contents.substr(0, contents.size() - 1);
+  }
+  mathic::DivTraceReader reader(TraceFile);
+  mathic::DivTraceEvent event;
+  ASSERT_THROW(reader.next(event), mathic::MathicException);
+  std::remove(TraceFile);
+}
@@ -0,0 +1,44 @@
+#include "mathic/LatencyHistogram.h"
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+TEST(LatencyHistogram, Percentiles) {
+  mathic::LatencyHistogram histogram;
+  ASSERT_EQ(0u, histogram.getPercentile(0.5));
+
+  // 1 to 1000 nanoseconds once each.
+  for (unsigned long long nanos = 1; nanos <= 1000; ++nanos)
+    histogram.add(nanos);
+  ASSERT_EQ(1000u, histogram.getCount());
+  ASSERT_EQ(1000u, histogram.getMax());
+  ASSERT_DOUBLE_EQ(500.5, histogram.getMean());
+  ASSERT_EQ(1u, histogram.getPercentile(0));
+  ASSERT_EQ(1000u, histogram.getPercentile(1));
+
+  // a reported percentile is never low and at most 1/8 high.
+  const double fractions[] = {0.1, 0.5, 0.9, 0.99, 0.999};
+  for (size_t i = 0; i < sizeof(fractions) / sizeof(*fractions); ++i) {
+    const double exact = fractions[i] * 1000;
+    const double reported = static_cast<double>
+      (histogram.getPercentile(fractions[i]));
+    ASSERT_LE(exact, reported);
+    ASSERT_LE(reported, exact * 1.125);
+  }
+
+  // small latencies are exact.
+  mathic::LatencyHistogram small;
+  for (unsigned long long nanos = 0; nanos < 8; ++nanos)
+    small.add(nanos);
+  ASSERT_EQ(3u, small.getPercentile(0.5));
+
+  small.merge(histogram);
+  ASSERT_EQ(1008u, small.getCount());
+  ASSERT_EQ(1000u, small.getMax());
+  small.clear();
+  ASSERT_EQ(0u, small.getCount());
+
+  std::ostringstream out;
+  histogram.print(out);
+  ASSERT_EQ("p50:511ns p99:1.0us p999:1.0us max:1.0us", out.str());
+}
@@ -0,0 +1,23 @@
+#include "mathic/PerfCounters.h"
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+TEST(PerfCounters, StartStop) {
+  // counters may be unavailable here, in which case nothing is counted.
+  mathic::PerfCounters counters;
+  counters.start();
+  volatile unsigned long long sum = 0;
+  for (unsigned long long i = 0; i < 100000; ++i)
+    sum += i;
+  const mathic::PerfCounts counts = counters.stop();
+  ASSERT_EQ(counters.anyAvailable() && counts.anyAvailable(),
+    counts.anyAvailable());
+  if (counts.available[mathic::PerfCounts::Instructions]) {
+    ASSERT_LT(100000u, counts.values[mathic::PerfCounts::Instructions]);
+  }
+
+  std::ostringstream out;
+  mathic::PerfCounts().print(out, 10);
+  ASSERT_EQ("", out.str());
+}
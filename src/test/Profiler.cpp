@@ -0,0 +1,90 @@
+#define MATHIC_PROFILING
+#include "mathic/Profiler.h"
+#include "mathic/ThreadScaling.h"
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+namespace {
+  void inner() {
+    MATHIC_PROFILE("test inner");
+  }
+
+  void outer(size_t innerCalls) {
+    MATHIC_PROFILE("test outer");
+    for (size_t i = 0; i < innerCalls; ++i)
+      inner();
+  }
+
+  void recursive(size_t depth) {
+    MATHIC_PROFILE("test recursive");
+    if (depth > 0)
+      recursive(depth - 1);
+  }
+
+  class ProfilingWork : public mathic::ScalingWork {
+  public:
+    virtual std::string getName() const {return "profiling";}
+    virtual unsigned long long run(size_t thread, size_t threadCount) {
+      outer(1);
+      return 1;
+    }
+  };
+}
+
+TEST(Profiler, Nesting) {
+  ASSERT_TRUE(mathic::Profiler::enabled());
+  mathic::Profiler::reset();
+  outer(3);
+  outer(2);
+  inner();
+
+  const mathic::ProfileTotals totals = mathic::Profiler::getTotals();
+  const mathic::ProfileTotals* out = totals.getChild("test outer");
+  ASSERT_TRUE(out != 0);
+  ASSERT_EQ(2u, out->calls);
+  ASSERT_EQ(1u, out->children.size());
+  ASSERT_EQ(5u, out->getChild("test inner")->calls);
+  ASSERT_EQ(1u, totals.getChild("test inner")->calls);
+  ASSERT_TRUE(out->wallNanos >= out->getChild("test inner")->wallNanos);
+  ASSERT_TRUE(out->wallNanos >= out->getSelfWallNanos());
+
+  mathic::Profiler::reset();
+  const mathic::ProfileTotals zero = mathic::Profiler::getTotals();
+  ASSERT_EQ(0u, zero.getChild("test outer")->calls);
+  ASSERT_EQ(0u, zero.getChild("test outer")->wallNanos);
+}
+
+TEST(Profiler, Threads) {
+  if (!mathic::ThreadScaling::threadsAvailable())
+    return;
+  mathic::Profiler::reset();
+  ProfilingWork work;
+  mathic::ThreadScaling scaling;
+  scaling.run(work, std::vector<size_t>(1, 3));
+
+  // every thread records into its own tree and the totals add them up.
+  const mathic::ProfileTotals totals = mathic::Profiler::getTotals();
+  const mathic::ProfileTotals* out = totals.getChild("test outer");
+  ASSERT_TRUE(out != 0);
+  ASSERT_EQ(3u, out->calls);
+  ASSERT_EQ(3u, out->getChild("test inner")->calls);
+}
+
+TEST(Profiler, Print) {
+  mathic::Profiler::reset();
+  outer(1);
+  recursive(2);
+
+  std::ostringstream tree;
+  mathic::Profiler::printTree(tree);
+  ASSERT_NE(std::string::npos, tree.str().find("\n  test outer"));
+  ASSERT_NE(std::string::npos, tree.str().find("\n    test inner"));
+  ASSERT_NE(std::string::npos, tree.str().find("\n      test recursive"));
+
+  std::ostringstream flat;
+  mathic::Profiler::printFlat(flat);
+  ASSERT_NE(std::string::npos, flat.str().find("\n  test inner"));
+  ASSERT_EQ(std::string::npos, flat.str().find("\n    test inner"));
+  ASSERT_NE(std::string::npos, flat.str().find("test recursive"));
+}
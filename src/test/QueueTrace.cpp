@@ -0,0 +1,100 @@
+#include "mathic/QueueTrace.h"
+#include "mathic/Heap.h"
+#include "mathic/error.h"
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+namespace {
+  class HeapConf {
+  public:
+    typedef unsigned int Entry;
+    typedef bool CompareResult;
+    CompareResult compare(Entry a, Entry b) const {return a < b;}
+    bool cmpLessThan(CompareResult r) const {return r;}
+    bool cmpEqual(CompareResult r) const {return false;}
+    static const bool supportDeduplication = false;
+    static const bool fastIndex = false;
+    Entry deduplicate(Entry a, Entry b) const {return a;}
+
+    unsigned long long getTraceValue(Entry e) const {return e;}
+  };
+
+  const char* const TraceFile = "QueueTrace.test.trace";
+}
+
+TEST(QueueTrace, RecordAndReplay) {
+  std::vector<unsigned int> popped;
+  {
+    mathic::QueueTraceWriter writer(TraceFile);
+    mathic::TracingQueue<mathic::Heap<HeapConf> > queue(HeapConf(), writer);
+    unsigned int span[] = {5, 300, 17, 100000};
+    queue.push(span, span + 4);
+    queue.push(42);
+    popped.push_back(queue.pop());
+    queue.decreaseTop(3);
+    popped.push_back(queue.pop());
+    while (!queue.empty())
+      popped.push_back(queue.pop());
+    ASSERT_EQ(9u, writer.getEventCount());
+  }
+
+  mathic::QueueTraceReader reader(TraceFile);
+  for (size_t round = 0; round < 2; ++round) {
+    std::vector<unsigned int> span;
+    unsigned int popValue;
+    ASSERT_TRUE(reader.next(span, popValue));
+    ASSERT_EQ(4u, span.size());
+    ASSERT_EQ(100000u, span[0]);
+    ASSERT_EQ(300u, span[1]);
+    ASSERT_EQ(17u, span[2]);
+    ASSERT_EQ(5u, span[3]);
+
+    // replaying into a heap gives the recorded pops.
+    mathic::Heap<HeapConf> heap((HeapConf()));
+    heap.push(span.begin(), span.end());
+    std::vector<unsigned int> replayed;
+    while (reader.next(span, popValue)) {
+      if (span.empty()) {
+        ASSERT_EQ(popValue, heap.pop());
+        replayed.push_back(popValue);
+      } else
+        heap.push(span.begin(), span.end());
+    }
+    ASSERT_TRUE(heap.empty());
+    // decreaseTop is recorded as a pop, so it shows up among the pops.
+    ASSERT_EQ(popped.size() + 1, replayed.size());
+    reader.rewind();
+  }
+}
+
+TEST(QueueTrace, BadFiles) {
+  {
+    std::ofstream out(TraceFile);
+    out << "not a trace";
+  }
+  ASSERT_THROW(mathic::QueueTraceReader reader(TraceFile),
+    mathic::MathicException);
+
+  {
+    mathic::QueueTraceWriter writer(TraceFile);
+    writer.pop(1000);
+  }
+  {
+    // cut off the last byte of the pop value.
+    std::ifstream in(TraceFile, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)),
+      std::istreambuf_iterator<char>());
+    in.close();
+    std::ofstream out(TraceFile, std::ios::binary);
+    out << contents.substr(0, contents.size() - 1);
+  }
+  mathic::QueueTraceReader reader(TraceFile);
+  std::vector<unsigned int> span;
+  unsigned int popValue;
+  ASSERT_THROW(reader.next(span, popValue), mathic::MathicException);
+  std::remove(TraceFile);
+}
@@ -0,0 +1,136 @@
+#include "mathic/ThreadScaling.h"
+#include "mathic/BenchmarkReport.h"
+#include "mathic/error.h"
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+namespace {
+  const size_t Count = 10000;
+
+  /** Counts to a number on every thread, both in a counter of its own
+      and in a counter shared by all threads. */
+  class CountingWork : public mathic::ScalingWork {
+  public:
+    CountingWork(): shared(0), prepared(0), finished(0) {}
+
+    virtual std::string getName() const {return "counting";}
+    virtual void prepare(size_t threadCount) {
+      ++prepared;
+      shared = 0;
+      perThread.assign(threadCount, 0);
+    }
+    virtual unsigned long long run(size_t thread, size_t threadCount) {
+      for (size_t i = 0; i < Count; ++i) {
+        ++perThread[thread];
+        mathic::Mutex::Lock lock(mutex);
+        ++shared;
+      }
+      return Count;
+    }
+    virtual void finish() {++finished;}
+
+    mathic::Mutex mutex;
+    size_t shared;
+    std::vector<size_t> perThread;
+    size_t prepared;
+    size_t finished;
+  };
+
+  class ThrowingWork : public mathic::ScalingWork {
+  public:
+    virtual std::string getName() const {return "throwing";}
+    virtual unsigned long long run(size_t thread, size_t threadCount) {
+      if (thread == 1)
+        mathic::reportError("thread 1 failed");
+      return 0;
+    }
+  };
+}
+
+TEST(ThreadScaling, Run) {
+  if (!mathic::ThreadScaling::threadsAvailable())
+    return;
+  mathic::ThreadScaling scaling;
+  ASSERT_TRUE(scaling.empty());
+  CountingWork work;
+  std::vector<size_t> threadCounts;
+  threadCounts.push_back(1);
+  threadCounts.push_back(4);
+  scaling.run(work, threadCounts);
+  ASSERT_FALSE(scaling.empty());
+  ASSERT_EQ(2u, work.prepared);
+  ASSERT_EQ(2u, work.finished);
+  ASSERT_EQ(4 * Count, work.shared);
+  for (size_t thread = 0; thread < 4; ++thread)
+    ASSERT_EQ(Count, work.perThread[thread]);
+
+  std::ostringstream out;
+  scaling.print(out);
+  ASSERT_NE(std::string::npos, out.str().find("counting"));
+  ASSERT_NE(std::string::npos, out.str().find("efficiency"));
+
+  mathic::BenchmarkReport report;
+  scaling.addToReport(report, "count");
+  ASSERT_EQ(2u, report.getResults().size());
+  ASSERT_EQ("counting on 4 threads", report.getResults()[1].model);
+  ASSERT_EQ(4 * Count, report.getResults()[1].operations);
+
+  ThrowingWork throwing;
+  ASSERT_THROW(scaling.run(throwing, threadCounts), mathic::MathicException);
+}
+
+namespace {
+  /** Records which parts of the work were done. */
+  class PartsWork : public mathic::ParallelWork {
+  public:
+    PartsWork(size_t threadCount): done(threadCount, 0) {}
+
+    virtual void run(size_t thread, size_t threadCount) {
+      if (threadCount == done.size())
+        ++done[thread];
+    }
+
+    std::vector<size_t> done;
+  };
+
+  class ThrowingPartsWork : public mathic::ParallelWork {
+  public:
+    virtual void run(size_t thread, size_t threadCount) {
+      if (thread == 2)
+        mathic::reportError("part 2 failed");
+    }
+  };
+}
+
+TEST(ThreadScaling, RunInParallel) {
+  ASSERT_GE(mathic::getProcessorCount(), 1u);
+  for (size_t threadCount = 1; threadCount <= 5; threadCount += 2) {
+    PartsWork work(threadCount);
+    mathic::runInParallel(work, threadCount);
+    for (size_t thread = 0; thread < threadCount; ++thread)
+      ASSERT_EQ(1u, work.done[thread]);
+  }
+  ThrowingPartsWork throwing;
+  ASSERT_THROW(mathic::runInParallel(throwing, 3), mathic::MathicException);
+}
+
+TEST(ThreadScaling, ParseOptions) {
+  const char* argsArray[] = {"sim", "shared-threads", "1,2,8", "100"};
+  const char** args = argsArray;
+  int argc = 4;
+  mathic::ThreadScalingOptions options;
+  options.parse(argc, args);
+  ASSERT_EQ(2, argc);
+  ASSERT_EQ(std::string("sim"), args[0]);
+  ASSERT_EQ(std::string("100"), args[1]);
+  ASSERT_TRUE(options.shared);
+  ASSERT_EQ(3u, options.threadCounts.size());
+  ASSERT_EQ(8u, options.threadCounts[2]);
+
+  const char* badArray[] = {"sim", "threads", "1,x"};
+  args = badArray;
+  argc = 3;
+  mathic::ThreadScalingOptions bad;
+  ASSERT_THROW(bad.parse(argc, args), mathic::MathicException);
+}